@@ -0,0 +1,141 @@
+#include "alias_table.h"
+
+// the free list a table with room for capacity columns goes to: the largest
+// class it has room for
+static int get_capacity_class(int capacity)
+{
+    int table_class = 0;
+    while (table_class + 1 < ALIAS_TABLE_CLASSES
+           && (2u << table_class) <= (unsigned int) capacity)
+        table_class++;
+    return table_class;
+}
+
+// takes a table with room for size columns off the free lists, NULL if
+// there is none. the first tables of size's own class are looked at (a
+// table replaced by one of the same size is found there), then the next
+// class, where they all fit. a small table doesn't eat up a bigger one
+static AliasTable* take_free_table(AliasTable **free_tables, int size)
+{
+    int table_class = get_capacity_class(size);
+    AliasTable **link = &free_tables[table_class];
+    for (int i = 0; *link != NULL && i < FREE_TABLE_SCAN; ++i)
+    {
+        AliasTable *alias_table = *link;
+        if (alias_table->capacity >= size)
+        {
+            *link = alias_table->next_free;
+            return alias_table;
+        }
+        link = &alias_table->next_free;
+    }
+    if (table_class + 1 < ALIAS_TABLE_CLASSES && free_tables[table_class + 1] != NULL)
+    {
+        AliasTable *alias_table = free_tables[table_class + 1];
+        free_tables[table_class + 1] = alias_table->next_free;
+        return alias_table;
+    }
+    return NULL;
+}
+
+AliasTable* create_alias_table(Arena *arena, AliasTable **free_tables,
+                               const unsigned int *successors,
+                               const unsigned int *frequencies, int size)
+{
+    long long total_frequency = 0;
+    for (int i = 0; i < size; ++i)
+        total_frequency += frequencies[i];
+
+    // scaled weights and the small/large work lists of Vose's algorithm
+    long long *scaled = malloc(size * sizeof(long long));
+    int *work = malloc(size * sizeof(int));
+    if (scaled == NULL || work == NULL)
+    {
+        free(scaled);
+        free(work);
+        return NULL;
+    }
+    // one block for the struct and its arrays
+    AliasTable *alias_table = free_tables != NULL ? take_free_table(free_tables, size)
+                                                  : NULL;
+    if (alias_table == NULL)
+    {
+        alias_table = arena_alloc(arena, sizeof(AliasTable)
+                                         + 2 * size * sizeof(unsigned int)
+                                         + size * sizeof(int),
+                                  sizeof(void*));
+        if (alias_table == NULL)
+        {
+            free(scaled);
+            free(work);
+            return NULL;
+        }
+        alias_table->capacity = size;
+    }
+    alias_table->size = size;
+    alias_table->total_frequency = (int) total_frequency;
+    alias_table->outcomes = (unsigned int*) (alias_table + 1);
+    alias_table->aliases = alias_table->outcomes + alias_table->capacity;
+    alias_table->thresholds = (int*) (alias_table->aliases + alias_table->capacity);
+
+    // scale every frequency by size, so the average column weighs exactly
+    // total_frequency. small columns fill the front of work, large the back
+    int small_count = 0;
+    int large_start = size;
+    for (int i = 0; i < size; ++i)
+    {
+        alias_table->outcomes[i] = successors[i];
+        alias_table->aliases[i] = successors[i];
+        scaled[i] = (long long) frequencies[i] * size;
+        if (scaled[i] < total_frequency)
+            work[small_count++] = i;
+        else
+            work[--large_start] = i;
+    }
+
+    // every small column is topped up by a large one, which shrinks by
+    // the same amount and may become small itself
+    while (small_count > 0 && large_start < size)
+    {
+        int small = work[--small_count];
+        int large = work[large_start];
+        alias_table->thresholds[small] = (int) scaled[small];
+        alias_table->aliases[small] = alias_table->outcomes[large];
+        scaled[large] -= total_frequency - scaled[small];
+        if (scaled[large] < total_frequency)
+        {
+            // the large column moves to the small list (small_count never
+            // passes large_start, so the slot it is written to is free)
+            large_start++;
+            work[small_count++] = large;
+        }
+    }
+
+    // the weights are integers, so what is left weighs exactly
+    // total_frequency and never uses its alias
+    for (int i = large_start; i < size; ++i)
+        alias_table->thresholds[work[i]] = (int) total_frequency;
+
+    free(scaled);
+    free(work);
+    return alias_table;
+}
+
+void recycle_alias_table(AliasTable **free_tables, AliasTable *alias_table)
+{
+    int table_class = get_capacity_class(alias_table->capacity);
+    alias_table->next_free = free_tables[table_class];
+    free_tables[table_class] = alias_table;
+}
+
+unsigned int sample_alias_table(const AliasTable *alias_table,
+                               RandomState *random_state)
+{
+    int column = get_random_number(random_state, alias_table->size);
+    if (get_random_number(random_state, alias_table->total_frequency)
+        < alias_table->thresholds[column])
+    {
+        return alias_table->outcomes[column];
+    }
+    return alias_table->aliases[column];
+}
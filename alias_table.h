@@ -0,0 +1,64 @@
+#ifndef _ALIAS_TABLE_H_
+#define _ALIAS_TABLE_H_
+
+#include "markov_chain.h"
+
+// how many tables of a free list create_alias_table looks at for one that
+// is big enough
+#define FREE_TABLE_SCAN 16
+
+/**
+ * Walker/Vose alias table over the successors of a MarkovNode.
+ * Column i returns the word id outcomes[i] when a number drawn from
+ * [0, total_frequency) is below thresholds[i], and aliases[i] otherwise.
+ * All the arithmetic is done on integers so the sampled distribution is
+ * exactly the one of the frequencies.
+ */
+typedef struct AliasTable {
+    int size;
+    int total_frequency;
+    // how many columns the arrays have room for (more than size for a table
+    // that was recycled)
+    int capacity;
+    union {
+        unsigned int *outcomes;
+        // the next table of a free list, while the table is on one
+        struct AliasTable *next_free;
+    };
+    unsigned int *aliases;
+    int *thresholds;
+} AliasTable;
+
+/**
+ * Build an alias table over a (non empty) set of successors.
+ * @param arena the arena to allocate the table from
+ * @param free_tables ALIAS_TABLE_CLASSES free lists to take the table from
+ * before allocating it from the arena (see recycle_alias_table), NULL to
+ * always allocate
+ * @param successors the ids of the words to sample
+ * @param frequencies how many times each of them occurred
+ * @param size number of successors
+ * @return the new table, NULL in case of allocation error.
+ */
+AliasTable* create_alias_table(Arena *arena, AliasTable **free_tables,
+                               const unsigned int *successors,
+                               const unsigned int *frequencies, int size);
+
+/**
+ * Hand a table nothing samples from any more to free lists, for
+ * create_alias_table to build another table in its memory.
+ * @param free_tables the ALIAS_TABLE_CLASSES free lists
+ * @param alias_table the table, which must not be used afterwards
+ */
+void recycle_alias_table(AliasTable **free_tables, AliasTable *alias_table);
+
+/**
+ * Sample a word from the table in O(1).
+ * @param alias_table the table to sample from
+ * @param random_state the generator to draw from
+ * @return the id of the sampled word
+ */
+unsigned int sample_alias_table(const AliasTable *alias_table,
+                               RandomState *random_state);
+
+#endif //_ALIAS_TABLE_H_
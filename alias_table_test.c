@@ -0,0 +1,141 @@
+#include "alias_table.h"
+#include <math.h>
+#include <string.h>
+
+// Checks that sample_alias_table draws every outcome as often as its
+// frequency says: DRAWS draws out of a table, then a chi-square test of the
+// counts against the frequencies. The seed is fixed, so the run is the same
+// every time, and the bound is the 0.1% critical value, so a table that is
+// right passes by a wide margin while one that is off by a percent fails.
+//   alias_table_test
+// prints the statistic of every case, returns EXIT_FAILURE if one fails
+
+#define DRAWS 2000000
+#define SEED 20261017
+// the z score of the 0.1% upper tail of a normal distribution
+#define CRITICAL_Z 3.0902
+#define MAX_OUTCOMES 1000
+
+// the chi-square critical value for degrees_of_freedom at CRITICAL_Z, by
+// the Wilson-Hilferty approximation
+static double get_critical_value(int degrees_of_freedom)
+{
+    double k = degrees_of_freedom;
+    double term = 1 - 2 / (9 * k) + CRITICAL_Z * sqrt(2 / (9 * k));
+    return k * term * term * term;
+}
+
+// draws DRAWS times out of the table and tests the counts, returns 1 if
+// they are off (or the table is wrong)
+static int check_table(const char *name, const AliasTable *alias_table,
+                       const unsigned int *frequencies, int size)
+{
+    static long long counts[MAX_OUTCOMES];
+    memset(counts, 0, sizeof(counts));
+    RandomState random_state;
+    seed_random_state(&random_state, SEED);
+    for (int i = 0; i < DRAWS; ++i)
+    {
+        unsigned int outcome = sample_alias_table(alias_table, &random_state);
+        if (outcome >= (unsigned int) size)
+        {
+            printf("%s: drew %u, out of range\n", name, outcome);
+            return 1;
+        }
+        counts[outcome]++;
+    }
+
+    long long total_frequency = 0;
+    for (int i = 0; i < size; ++i)
+        total_frequency += frequencies[i];
+    double chi_square = 0;
+    int possible_outcomes = 0;
+    for (int i = 0; i < size; ++i)
+    {
+        double expected = (double) DRAWS * frequencies[i] / total_frequency;
+        // an outcome that can't happen must never be drawn
+        if (frequencies[i] == 0)
+        {
+            if (counts[i] > 0)
+            {
+                printf("%s: drew outcome %d, which has frequency 0\n", name, i);
+                return 1;
+            }
+            continue;
+        }
+        chi_square += (counts[i] - expected) * (counts[i] - expected) / expected;
+        possible_outcomes++;
+    }
+    int degrees_of_freedom = possible_outcomes > 1 ? possible_outcomes - 1 : 1;
+    double critical_value = get_critical_value(degrees_of_freedom);
+    int failed = chi_square > critical_value;
+    printf("%s: chi2 = %.2f, df = %d, bound %.2f %s\n", name, chi_square,
+           degrees_of_freedom, critical_value, failed ? "FAILED" : "ok");
+    return failed;
+}
+
+// builds a table over outcomes 0 to size - 1 and checks it
+static int check_frequencies(const char *name, Arena *arena,
+                             AliasTable **free_tables,
+                             const unsigned int *frequencies, int size)
+{
+    unsigned int outcomes[MAX_OUTCOMES];
+    for (int i = 0; i < size; ++i)
+        outcomes[i] = (unsigned int) i;
+    AliasTable *alias_table = create_alias_table(arena, free_tables, outcomes,
+                                                 frequencies, size);
+    if (alias_table == NULL)
+    {
+        printf("%s: could not build the table\n", name);
+        return 1;
+    }
+    return check_table(name, alias_table, frequencies, size);
+}
+
+int main(void)
+{
+    Arena arena;
+    init_arena(&arena, STRING_ARENA_BLOCK_SIZE);
+    int failed = 0;
+
+    static const unsigned int small[] = {1, 7, 3, 50, 2};
+    failed |= check_frequencies("small", &arena, NULL, small, 5);
+    static const unsigned int single[] = {9};
+    failed |= check_frequencies("single", &arena, NULL, single, 1);
+    static const unsigned int with_zero[] = {4, 0, 4, 1};
+    failed |= check_frequencies("with zero", &arena, NULL, with_zero, 4);
+
+    // a Zipf-like tail, like the successors of a common word
+    static unsigned int zipf[MAX_OUTCOMES];
+    for (int i = 0; i < MAX_OUTCOMES; ++i)
+        zipf[i] = 100000 / (i + 1);
+    failed |= check_frequencies("zipf", &arena, NULL, zipf, MAX_OUTCOMES);
+
+    // a table built in the memory of a bigger recycled one, the way the
+    // online chain reuses the tables it replaced. 24 columns are in the
+    // class above the one of 10, where create_alias_table takes any table
+    AliasTable *free_tables[ALIAS_TABLE_CLASSES] = {NULL};
+    unsigned int outcomes[MAX_OUTCOMES];
+    for (int i = 0; i < MAX_OUTCOMES; ++i)
+        outcomes[i] = (unsigned int) i;
+    AliasTable *big = create_alias_table(&arena, NULL, outcomes, zipf, 24);
+    if (big == NULL)
+        failed = 1;
+    else
+    {
+        recycle_alias_table(free_tables, big);
+        static const unsigned int recycled[] = {5, 1, 1, 20, 3, 8, 2, 13, 1, 40};
+        AliasTable *reused = create_alias_table(&arena, free_tables, outcomes,
+                                                recycled, 10);
+        if (reused != big)
+        {
+            printf("recycled: the table was not built in the recycled one\n");
+            failed = 1;
+        }
+        else
+            failed |= check_table("recycled", reused, recycled, 10);
+    }
+
+    free_arena(&arena);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,99 @@
+#include "arena.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// every object in a slab pool is aligned like this (enough for the structs
+// of the chain, which only hold pointers and ints)
+#define SLAB_OBJECT_ALIGNMENT sizeof(void*)
+
+void init_arena(Arena *arena, size_t block_size)
+{
+    arena->current = NULL;
+    arena->block_size = block_size;
+    arena->bytes_reserved = 0;
+}
+
+// allocates a new block big enough for size bytes at the given alignment
+static ArenaBlock* add_arena_block(Arena *arena, size_t size, size_t alignment)
+{
+    size_t capacity = arena->block_size;
+    if (size + alignment > capacity)
+        capacity = size + alignment; // oversized requests get their own block
+    ArenaBlock *block = malloc(sizeof(ArenaBlock) + capacity);
+    if (block == NULL)
+        return NULL;
+    block->previous = arena->current;
+    block->used = 0;
+    block->capacity = capacity;
+    arena->current = block;
+    arena->bytes_reserved += capacity;
+    return block;
+}
+
+void* arena_alloc(Arena *arena, size_t size, size_t alignment)
+{
+    ArenaBlock *block = arena->current;
+    if (block != NULL)
+    {
+        uintptr_t start = (uintptr_t) (block + 1);
+        uintptr_t aligned = (start + block->used + alignment - 1)
+                            & ~(uintptr_t) (alignment - 1);
+        if (aligned + size <= start + block->capacity)
+        {
+            block->used = aligned + size - start;
+            return (void*) aligned;
+        }
+    }
+
+    // the current block is full (or there is none yet)
+    block = add_arena_block(arena, size, alignment);
+    if (block == NULL)
+        return NULL;
+    uintptr_t start = (uintptr_t) (block + 1);
+    uintptr_t aligned = (start + alignment - 1) & ~(uintptr_t) (alignment - 1);
+    block->used = aligned + size - start;
+    return (void*) aligned;
+}
+
+char* arena_copy_string(Arena *arena, const char *string, size_t length)
+{
+    // strings are only read byte by byte, so they are packed with no padding
+    char *copy = arena_alloc(arena, length + 1, 1);
+    if (copy == NULL)
+        return NULL;
+    memcpy(copy, string, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+void free_arena(Arena *arena)
+{
+    ArenaBlock *block = arena->current;
+    while (block != NULL)
+    {
+        ArenaBlock *previous = block->previous;
+        free(block);
+        block = previous;
+    }
+    arena->current = NULL;
+    arena->bytes_reserved = 0;
+}
+
+void init_slab_pool(SlabPool *pool, size_t object_size, size_t objects_per_slab)
+{
+    // round the size up so every object in a slab stays aligned
+    pool->object_size = (object_size + SLAB_OBJECT_ALIGNMENT - 1)
+                        & ~(SLAB_OBJECT_ALIGNMENT - 1);
+    init_arena(&pool->arena, pool->object_size * objects_per_slab);
+}
+
+void* slab_pool_alloc(SlabPool *pool)
+{
+    return arena_alloc(&pool->arena, pool->object_size, SLAB_OBJECT_ALIGNMENT);
+}
+
+void free_slab_pool(SlabPool *pool)
+{
+    free_arena(&pool->arena);
+}
@@ -0,0 +1,92 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h> // For size_t
+
+// default sizes for the chain's allocators
+#define STRING_ARENA_BLOCK_SIZE (1 << 20)
+#define SLAB_OBJECTS_PER_SLAB 4096
+
+/**
+ * One big malloc'd block that an arena hands out memory from. The memory
+ * handed out follows this header.
+ */
+typedef struct ArenaBlock {
+    struct ArenaBlock *previous;
+    size_t used;
+    size_t capacity;
+} ArenaBlock;
+
+/**
+ * Bump allocator: memory is carved out of big blocks one after the other and
+ * is only ever released all at once, by free_arena.
+ */
+typedef struct Arena {
+    ArenaBlock *current;
+    size_t block_size;
+    size_t bytes_reserved;
+} Arena;
+
+/**
+ * Pool of fixed size objects of one type, kept contiguous in big slabs.
+ * Like the arena, objects are never freed one by one.
+ */
+typedef struct SlabPool {
+    Arena arena;
+    size_t object_size;
+} SlabPool;
+
+/**
+ * Initialize an empty arena (no memory is allocated until the first use).
+ * @param arena the arena to initialize
+ * @param block_size the size of every block the arena allocates
+ */
+void init_arena(Arena *arena, size_t block_size);
+
+/**
+ * Allocate memory from the arena.
+ * @param arena the arena to allocate from
+ * @param size number of bytes to allocate
+ * @param alignment required alignment (a power of 2)
+ * @return pointer to the memory, NULL in case of allocation error.
+ */
+void* arena_alloc(Arena *arena, size_t size, size_t alignment);
+
+/**
+ * Copy a string into the arena (and null terminate it).
+ * @param arena the arena to copy into
+ * @param string the string to copy (does not need to be null terminated)
+ * @param length number of characters to copy
+ * @return the copy, NULL in case of allocation error.
+ */
+char* arena_copy_string(Arena *arena, const char *string, size_t length);
+
+/**
+ * Release all the memory of the arena in one go.
+ * @param arena the arena to free
+ */
+void free_arena(Arena *arena);
+
+/**
+ * Initialize an empty pool.
+ * @param pool the pool to initialize
+ * @param object_size size of the objects of the pool (sizeof the type)
+ * @param objects_per_slab how many objects every slab holds
+ */
+void init_slab_pool(SlabPool *pool, size_t object_size, size_t objects_per_slab);
+
+/**
+ * Allocate one object from the pool.
+ * @param pool the pool to allocate from
+ * @return pointer to the (uninitialized) object, NULL in case of allocation
+ * error.
+ */
+void* slab_pool_alloc(SlabPool *pool);
+
+/**
+ * Release all the slabs of the pool in one go.
+ * @param pool the pool to free
+ */
+void free_slab_pool(SlabPool *pool);
+
+#endif //_ARENA_H_
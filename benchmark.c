@@ -0,0 +1,462 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "markov_chain.h"
+#include "compressed_chain.h"
+#include "tokenizer.h"
+
+// Benchmarks building a chain and generating out of it, on Zipf distributed
+// synthetic corpora and on text files. Every case runs in its own process
+// (so the peak RSS is the case's own) and prints one JSON object, all of
+// them in one JSON array:
+//   markov_benchmark [--tokens n]... [--corpus path]... [--seed s]
+//                    [--tweets n] [--vocabulary n] [--exponent s]
+//                    [--count-bits b]
+// with no --tokens and no --corpus, runs 10K, 100K, 1M and 10M tokens.
+// the corpora and the tweets only depend on the seed (1 by default).
+// every case also compresses the frozen chain (see compressed_chain.h, with
+// counts quantized to b bits, exact by default, and the same start table)
+// and generates the same number of tweets out of that, for the memory and
+// speed of both layouts
+
+#define TOKENS_OPTION "--tokens"
+#define CORPUS_OPTION "--corpus"
+#define SEED_OPTION "--seed"
+#define TWEETS_OPTION "--tweets"
+#define VOCABULARY_OPTION "--vocabulary"
+#define EXPONENT_OPTION "--exponent"
+#define COUNT_BITS_OPTION "--count-bits"
+#define MAX_CASES 32
+
+#define DEFAULT_SEED 1
+#define DEFAULT_TWEETS 100000
+#define DEFAULT_VOCABULARY 100000
+#define DEFAULT_EXPONENT 1.0
+#define MAX_TWEET_LEN 20
+
+// synthetic sentences are this many words long (uniformly), and lines hold
+// up to this many sentences
+#define MIN_SENTENCE_WORDS 4
+#define MAX_SENTENCE_WORDS 24
+#define MAX_LINE_SENTENCES 3
+
+// one corpus to benchmark: a file, or a synthetic corpus of tokens tokens
+typedef struct BenchmarkCase {
+    const char* path;
+    long long tokens;
+} BenchmarkCase;
+
+typedef struct BenchmarkSettings {
+    BenchmarkCase cases[MAX_CASES];
+    int num_of_cases;
+    uint64_t seed;
+    int num_of_tweets;
+    int vocabulary;
+    double exponent;
+    int count_bits;
+} BenchmarkSettings;
+
+static double seconds_since(const struct timespec* start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) (now.tv_sec - start->tv_sec)
+           + (double) (now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+static long long nanoseconds_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// uniform double in [0, 1)
+static double random_fraction(RandomState* random_state)
+{
+    return (double) (next_random(random_state) >> 11) * 0x1.0p-53;
+}
+
+/**
+ * Write a synthetic corpus: words w0, w1... drawn from a Zipf distribution
+ * (word i has weight 1 / (i + 1)^exponent), in sentences that end with '.'
+ * and lines of a few sentences.
+ * @param out where to write the corpus
+ * @param tokens how many words to write
+ * @param settings the vocabulary size, the exponent and the seed
+ * @return 0 on success, 1 on failure
+ */
+static int write_zipf_corpus(FILE* out, long long tokens,
+                             const BenchmarkSettings* settings)
+{
+    int vocabulary = settings->vocabulary;
+    double* cumulative = malloc(vocabulary * sizeof(double));
+    if (cumulative == NULL)
+        return 1;
+    double total = 0;
+    for (int i = 0; i < vocabulary; ++i)
+    {
+        total += 1.0 / pow(i + 1, settings->exponent);
+        cumulative[i] = total;
+    }
+
+    RandomState random_state;
+    seed_random_state(&random_state, settings->seed);
+    int sentence_left = 0;
+    int line_sentences = 0;
+    for (long long i = 0; i < tokens; ++i)
+    {
+        if (sentence_left == 0)
+            sentence_left = MIN_SENTENCE_WORDS
+                            + get_random_number(&random_state,
+                                                MAX_SENTENCE_WORDS
+                                                - MIN_SENTENCE_WORDS + 1);
+        // the first word whose running weight passes the draw
+        double draw = random_fraction(&random_state) * total;
+        int low = 0;
+        int high = vocabulary - 1;
+        while (low < high)
+        {
+            int middle = low + (high - low) / 2;
+            if (cumulative[middle] <= draw)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        sentence_left--;
+        const char* separator = " ";
+        if (sentence_left == 0 || i == tokens - 1)
+        {
+            line_sentences++;
+            separator = ". ";
+            if (line_sentences == MAX_LINE_SENTENCES
+                || get_random_number(&random_state, 2) == 0)
+            {
+                separator = ".\n";
+                line_sentences = 0;
+            }
+        }
+        if (fprintf(out, "w%d%s", low, separator) < 0)
+        {
+            free(cumulative);
+            return 1;
+        }
+    }
+    free(cumulative);
+    return fflush(out) != 0;
+}
+
+static long long count_tokens(FILE* file)
+{
+    Tokenizer tokenizer;
+    if (init_file_tokenizer(&tokenizer, file) == 1)
+        return -1;
+    long long tokens = 0;
+    Token token;
+    while (next_token(&tokenizer, &token))
+        tokens++;
+    int failed = tokenizer.failed;
+    free_tokenizer(&tokenizer);
+    return failed ? -1 : tokens;
+}
+
+static int compare_latencies(const void* first, const void* second)
+{
+    long long a = *(const long long*) first;
+    long long b = *(const long long*) second;
+    return (a > b) - (a < b);
+}
+
+// how fast tweets were generated, and the latency percentiles of one tweet
+typedef struct GenerationTimes {
+    double tweets_per_second;
+    long long latency_p50_ns;
+    long long latency_p99_ns;
+} GenerationTimes;
+
+// sorts the latencies of num_of_tweets tweets into their percentiles
+static GenerationTimes summarize_latencies(long long* latencies, int num_of_tweets,
+                                           double seconds)
+{
+    qsort(latencies, num_of_tweets, sizeof(long long), compare_latencies);
+    GenerationTimes times = {seconds > 0 ? num_of_tweets / seconds : 0,
+                             num_of_tweets > 0 ? latencies[num_of_tweets / 2] : 0,
+                             num_of_tweets > 0 ? latencies[num_of_tweets * 99 / 100] : 0};
+    return times;
+}
+
+/**
+ * Compress a frozen chain, generate tweets out of the compressed form (each
+ * one timed, like out of the chain) and measure it.
+ * @param markov_chain the frozen chain
+ * @param latencies room for the latency of every tweet
+ * @param settings the number of tweets, the seed and the count bits
+ * @param compressed_bytes where to store the bytes of the compressed form
+ * @param compress_seconds where to store how long compressing took
+ * @param max_error where to store get_compressed_chain_error
+ * @param times where to store how fast generating was
+ * @return 0 on success, 1 on failure
+ */
+static int run_compressed(const MarkovChain* markov_chain, long long* latencies,
+                          const BenchmarkSettings* settings, size_t* compressed_bytes,
+                          double* compress_seconds, double* max_error,
+                          GenerationTimes* times)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    CompressedChain compressed_chain;
+    if (compress_markov_chain(&compressed_chain, markov_chain, settings->count_bits) == 1)
+        return 1;
+    *compress_seconds = seconds_since(&start);
+    *compressed_bytes = get_compressed_chain_memory(&compressed_chain);
+    *max_error = get_compressed_chain_error(&compressed_chain, markov_chain);
+
+    TweetBatch batch;
+    int result = *max_error < 0 || init_tweet_batch(&batch) == 1;
+    if (result == 0)
+    {
+        RandomState random_state;
+        seed_random_state(&random_state, settings->seed);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < settings->num_of_tweets && result == 0; ++i)
+        {
+            if (batch.num_of_tweets == 4096)
+                clear_tweet_batch(&batch);
+            long long before = nanoseconds_now();
+            result = generate_compressed_tweets(&compressed_chain, 1, MAX_TWEET_LEN,
+                                                &batch, &random_state);
+            latencies[i] = nanoseconds_now() - before;
+        }
+        *times = summarize_latencies(latencies, settings->num_of_tweets,
+                                     seconds_since(&start));
+        free_tweet_batch(&batch);
+    }
+    free_compressed_chain(&compressed_chain);
+    return result;
+}
+
+/**
+ * Build a chain out of a corpus file, generate tweets out of it and print
+ * the JSON object of the case.
+ * @param file the corpus
+ * @param name what to call the corpus in the output
+ * @param tokens how many words the corpus has
+ * @param settings the number of tweets and the seed
+ * @return 0 on success, 1 on failure
+ */
+static int run_case(FILE* file, const char* name, long long tokens,
+                    const BenchmarkSettings* settings)
+{
+    MarkovChain* markov_chain = create_markov_chain();
+    Tokenizer tokenizer;
+    if (markov_chain == NULL || init_file_tokenizer(&tokenizer, file) == 1)
+        return 1;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int result = fill_database_from_tokenizer(&tokenizer, INT_MAX, markov_chain);
+    double ingest_seconds = seconds_since(&start);
+    free_tokenizer(&tokenizer);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    // (an empty corpus, or one where every word ends a sentence, has
+    // nothing to generate from)
+    if (result == 0)
+        result = markov_chain->num_of_startable_words == 0
+                 || freeze_markov_chain(markov_chain);
+    double freeze_seconds = seconds_since(&start);
+
+    // every tweet is timed on its own, for the latency percentiles
+    long long* latencies = malloc((settings->num_of_tweets + 1)
+                                  * sizeof(long long));
+    TweetBatch batch;
+    if (result == 0 && (latencies == NULL || init_tweet_batch(&batch) == 1))
+        result = 1;
+    GenerationTimes times = {0, 0, 0};
+    if (result == 0)
+    {
+        RandomState random_state;
+        seed_random_state(&random_state, settings->seed);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < settings->num_of_tweets && result == 0; ++i)
+        {
+            // the batch is emptied every so often so it doesn't grow forever
+            if (batch.num_of_tweets == 4096)
+                clear_tweet_batch(&batch);
+            long long before = nanoseconds_now();
+            MarkovNode* first_node = get_first_random_node(markov_chain,
+                                                           &random_state);
+            result = write_tweet(markov_chain, first_node, MAX_TWEET_LEN,
+                                 &batch, &random_state);
+            latencies[i] = nanoseconds_now() - before;
+        }
+        times = summarize_latencies(latencies, settings->num_of_tweets,
+                                    seconds_since(&start));
+        free_tweet_batch(&batch);
+    }
+
+    size_t compressed_bytes = 0;
+    double compress_seconds = 0;
+    double max_error = 0;
+    GenerationTimes compressed_times = {0, 0, 0};
+    if (result == 0 && markov_chain->database->size > 0)
+        result = run_compressed(markov_chain, latencies, settings, &compressed_bytes,
+                                &compress_seconds, &max_error, &compressed_times);
+
+    if (result == 0)
+    {
+        size_t edges = 0;
+        for (Node* node = markov_chain->database->first; node != NULL;
+             node = node->next)
+            edges += node->data->num_of_successors;
+        size_t chain_bytes = get_markov_chain_memory(markov_chain);
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        printf("  {\"corpus\": \"%s\", \"seed\": %llu, \"tokens\": %lld, "
+               "\"vocabulary\": %d, \"edges\": %zu, "
+               "\"ingest_seconds\": %.6f, \"ingest_tokens_per_second\": %.0f, "
+               "\"freeze_seconds\": %.6f, \"chain_bytes\": %zu, "
+               "\"peak_rss_kb\": %ld, \"tweets\": %d, "
+               "\"tweets_per_second\": %.0f, \"tweet_latency_p50_ns\": %lld, "
+               "\"tweet_latency_p99_ns\": %lld, \"count_bits\": %d, "
+               "\"compress_seconds\": %.6f, \"compressed_bytes\": %zu, "
+               "\"compression_ratio\": %.2f, \"compressed_max_tv_distance\": %.6f, "
+               "\"compressed_tweets_per_second\": %.0f, "
+               "\"compressed_tweet_latency_p50_ns\": %lld, "
+               "\"compressed_tweet_latency_p99_ns\": %lld}",
+               name, (unsigned long long) settings->seed, tokens,
+               markov_chain->database->size, edges, ingest_seconds,
+               ingest_seconds > 0 ? tokens / ingest_seconds : 0,
+               freeze_seconds, chain_bytes, usage.ru_maxrss, settings->num_of_tweets,
+               times.tweets_per_second, times.latency_p50_ns, times.latency_p99_ns,
+               settings->count_bits, compress_seconds, compressed_bytes,
+               compressed_bytes > 0 ? (double) chain_bytes / compressed_bytes : 0,
+               max_error, compressed_times.tweets_per_second,
+               compressed_times.latency_p50_ns, compressed_times.latency_p99_ns);
+    }
+    free(latencies);
+    free_database(&markov_chain);
+    return result;
+}
+
+// body of the process of one case
+static int run_benchmark_case(const BenchmarkCase* benchmark_case,
+                              const BenchmarkSettings* settings)
+{
+    if (benchmark_case->path != NULL)
+    {
+        FILE* file = fopen(benchmark_case->path, "r");
+        if (file == NULL)
+            return 1;
+        long long tokens = count_tokens(file);
+        int result = tokens < 0 || fseek(file, 0, SEEK_SET) != 0
+                     || run_case(file, benchmark_case->path, tokens, settings);
+        fclose(file);
+        return result;
+    }
+
+    // the corpus goes through a temporary file, so it's read the same way
+    // a real one is and doesn't have to fit in memory
+    FILE* file = tmpfile();
+    if (file == NULL)
+        return 1;
+    int result = write_zipf_corpus(file, benchmark_case->tokens, settings)
+                 || fseek(file, 0, SEEK_SET) != 0
+                 || run_case(file, "zipf", benchmark_case->tokens, settings);
+    fclose(file);
+    return result;
+}
+
+static int parse_benchmark_arguments(int argc, char* argv[],
+                                     BenchmarkSettings* settings)
+{
+    settings->num_of_cases = 0;
+    settings->seed = DEFAULT_SEED;
+    settings->num_of_tweets = DEFAULT_TWEETS;
+    settings->vocabulary = DEFAULT_VOCABULARY;
+    settings->exponent = DEFAULT_EXPONENT;
+    settings->count_bits = 0;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if ((strcmp(argv[i], TOKENS_OPTION) == 0
+             || strcmp(argv[i], CORPUS_OPTION) == 0)
+            && settings->num_of_cases == MAX_CASES)
+            return 1;
+        if (strcmp(argv[i], TOKENS_OPTION) == 0)
+            settings->cases[settings->num_of_cases++]
+                = (BenchmarkCase) {NULL, strtoll(argv[i + 1], NULL, 10)};
+        else if (strcmp(argv[i], CORPUS_OPTION) == 0)
+            settings->cases[settings->num_of_cases++]
+                = (BenchmarkCase) {argv[i + 1], 0};
+        else if (strcmp(argv[i], SEED_OPTION) == 0)
+            settings->seed = strtoull(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], TWEETS_OPTION) == 0)
+            settings->num_of_tweets = (int) strtol(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], VOCABULARY_OPTION) == 0)
+            settings->vocabulary = (int) strtol(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], EXPONENT_OPTION) == 0)
+            settings->exponent = strtod(argv[i + 1], NULL);
+        else if (strcmp(argv[i], COUNT_BITS_OPTION) == 0)
+            settings->count_bits = (int) strtol(argv[i + 1], NULL, 10);
+        else
+            return 1;
+    }
+    if (argc % 2 == 0 || settings->num_of_tweets < 0
+        || settings->vocabulary < 1
+        || (settings->count_bits != 0 && (settings->count_bits < MIN_COUNT_BITS
+                                          || settings->count_bits > MAX_COUNT_BITS)))
+        return 1;
+
+    if (settings->num_of_cases == 0)
+    {
+        long long defaults[] = {10000, 100000, 1000000, 10000000};
+        for (int i = 0; i < 4; ++i)
+            settings->cases[settings->num_of_cases++]
+                = (BenchmarkCase) {NULL, defaults[i]};
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    BenchmarkSettings settings;
+    if (parse_benchmark_arguments(argc, argv, &settings) == 1)
+    {
+        fprintf(stderr, "Usage: markov_benchmark [--tokens n]... "
+                        "[--corpus path]... [--seed s] [--tweets n] "
+                        "[--vocabulary n] [--exponent s] [--count-bits b]\n");
+        return EXIT_FAILURE;
+    }
+
+    int result = EXIT_SUCCESS;
+    printf("[\n");
+    for (int i = 0; i < settings.num_of_cases; ++i)
+    {
+        // the child's output must not be printed twice
+        fflush(stdout);
+        pid_t child = fork();
+        if (child == 0)
+        {
+            int failed = run_benchmark_case(&settings.cases[i], &settings);
+            fflush(stdout);
+            _exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+        }
+        int status;
+        if (child == -1 || waitpid(child, &status, 0) == -1
+            || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+        {
+            fprintf(stderr, "Benchmark case %d failed\n", i + 1);
+            result = EXIT_FAILURE;
+            break;
+        }
+        printf(i == settings.num_of_cases - 1 ? "\n" : ",\n");
+    }
+    printf("]\n");
+    return result;
+}
@@ -0,0 +1,438 @@
+#include "byte_source.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#ifdef MARKOV_WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef MARKOV_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+// bytes read to tell the compression: gzip starts with 1f 8b, zstd with
+// 28 b5 2f fd
+#define MAGIC_SIZE 4
+
+// the file under a source, with the bytes that were read to tell its
+// compression put back in front
+typedef struct FileInput {
+    FILE *file;
+    unsigned char prefix[MAGIC_SIZE];
+    size_t prefix_length;
+    size_t prefix_position;
+} FileInput;
+
+// the queue of a threaded source: the blocks read ahead of the tokenizer,
+// from head on
+typedef struct ThreadedSource {
+    ByteSource inner;
+    char *blocks;
+    size_t lengths[BYTE_SOURCE_QUEUE_LENGTH];
+    int head;
+    int num_of_ready;
+    // how much of the head block was read already
+    size_t position;
+    // the inner source reached its end (or failed), close asked to stop
+    int finished;
+    int stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t block_ready;
+    pthread_cond_t block_free;
+    pthread_t thread;
+} ThreadedSource;
+
+static size_t read_input(FileInput *input, void *buffer, size_t size)
+{
+    size_t from_prefix = input->prefix_length - input->prefix_position;
+    if (from_prefix == 0)
+    {
+        return fread(buffer, 1, size, input->file);
+    }
+    from_prefix = from_prefix < size ? from_prefix : size;
+    memcpy(buffer, input->prefix + input->prefix_position, from_prefix);
+    input->prefix_position += from_prefix;
+    return from_prefix;
+}
+
+static size_t read_plain(ByteSource *source, char *buffer, size_t size)
+{
+    FileInput *input = source->state;
+    size_t length = read_input(input, buffer, size);
+    source->failed = length == 0 && ferror(input->file);
+    return length;
+}
+
+static void close_plain(ByteSource *source)
+{
+    free(source->state);
+}
+
+static int open_plain_source(ByteSource *source, const FileInput *input)
+{
+    FileInput *state = malloc(sizeof(FileInput));
+    if (state == NULL)
+    {
+        return 1;
+    }
+    *state = *input;
+    source->read = read_plain;
+    source->close = close_plain;
+    source->state = state;
+    return 0;
+}
+
+#ifdef MARKOV_WITH_ZLIB
+typedef struct GzipState {
+    FileInput input;
+    z_stream stream;
+    // a member was started and didn't end yet
+    int in_member;
+    unsigned char buffer[BYTE_SOURCE_BLOCK_SIZE];
+} GzipState;
+
+static size_t read_gzip(ByteSource *source, char *buffer, size_t size)
+{
+    GzipState *state = source->state;
+    z_stream *stream = &state->stream;
+    uInt out_size = size < BYTE_SOURCE_BLOCK_SIZE ? (uInt) size : BYTE_SOURCE_BLOCK_SIZE;
+    stream->next_out = (unsigned char *) buffer;
+    stream->avail_out = out_size;
+    while (stream->avail_out == out_size)
+    {
+        if (stream->avail_in == 0)
+        {
+            size_t length = read_input(&state->input, state->buffer, BYTE_SOURCE_BLOCK_SIZE);
+            if (length == 0)
+            {
+                // a file cut in the middle of a member is not valid
+                source->failed = ferror(state->input.file) || state->in_member;
+                break;
+            }
+            stream->next_in = state->buffer;
+            stream->avail_in = (uInt) length;
+        }
+        state->in_member = 1;
+        int result = inflate(stream, Z_NO_FLUSH);
+        if (result == Z_STREAM_END)
+        {
+            // a gzip file can be several members back to back
+            state->in_member = 0;
+            if (inflateReset(stream) != Z_OK)
+            {
+                source->failed = 1;
+                break;
+            }
+        }
+        else if (result != Z_OK && result != Z_BUF_ERROR)
+        {
+            source->failed = 1;
+            break;
+        }
+    }
+    return out_size - stream->avail_out;
+}
+
+static void close_gzip(ByteSource *source)
+{
+    GzipState *state = source->state;
+    inflateEnd(&state->stream);
+    free(state);
+}
+
+static int open_gzip_source(ByteSource *source, const FileInput *input)
+{
+    GzipState *state = calloc(1, sizeof(GzipState));
+    if (state == NULL)
+    {
+        return 1;
+    }
+    state->input = *input;
+    // 16 + the biggest window: gzip headers only
+    if (inflateInit2(&state->stream, 16 + MAX_WBITS) != Z_OK)
+    {
+        free(state);
+        return 1;
+    }
+    source->read = read_gzip;
+    source->close = close_gzip;
+    source->state = state;
+    return 0;
+}
+#endif
+
+#ifdef MARKOV_WITH_ZSTD
+typedef struct ZstdState {
+    FileInput input;
+    ZSTD_DStream *stream;
+    ZSTD_inBuffer in;
+    // a frame was started and didn't end yet
+    int in_frame;
+    unsigned char buffer[BYTE_SOURCE_BLOCK_SIZE];
+} ZstdState;
+
+static size_t read_zstd(ByteSource *source, char *buffer, size_t size)
+{
+    ZstdState *state = source->state;
+    ZSTD_outBuffer out = {buffer, size, 0};
+    for (;;)
+    {
+        // called before reading more, to hand out what the decoder still holds
+        size_t in_position = state->in.pos;
+        size_t result = ZSTD_decompressStream(state->stream, &out, &state->in);
+        if (ZSTD_isError(result))
+        {
+            source->failed = 1;
+            break;
+        }
+        // 0 means a frame just ended (a zstd file can be several of them)
+        if (result == 0)
+        {
+            state->in_frame = 0;
+        }
+        else if (state->in.pos > in_position || out.pos > 0)
+        {
+            state->in_frame = 1;
+        }
+        if (out.pos > 0)
+        {
+            break;
+        }
+        // nothing came out of what is left of the input yet (a header, say)
+        if (state->in.pos < state->in.size)
+        {
+            continue;
+        }
+        size_t length = read_input(&state->input, state->buffer, BYTE_SOURCE_BLOCK_SIZE);
+        if (length == 0)
+        {
+            // a file cut in the middle of a frame is not valid
+            source->failed = ferror(state->input.file) || state->in_frame;
+            break;
+        }
+        state->in = (ZSTD_inBuffer) {state->buffer, length, 0};
+    }
+    return out.pos;
+}
+
+static void close_zstd(ByteSource *source)
+{
+    ZstdState *state = source->state;
+    ZSTD_freeDStream(state->stream);
+    free(state);
+}
+
+static int open_zstd_source(ByteSource *source, const FileInput *input)
+{
+    ZstdState *state = calloc(1, sizeof(ZstdState));
+    if (state == NULL)
+    {
+        return 1;
+    }
+    state->input = *input;
+    state->stream = ZSTD_createDStream();
+    if (state->stream == NULL || ZSTD_isError(ZSTD_initDStream(state->stream)))
+    {
+        ZSTD_freeDStream(state->stream);
+        free(state);
+        return 1;
+    }
+    state->in = (ZSTD_inBuffer) {state->buffer, 0, 0};
+    source->read = read_zstd;
+    source->close = close_zstd;
+    source->state = state;
+    return 0;
+}
+#endif
+
+int open_compressed_source(ByteSource *source, FILE *file)
+{
+    static const unsigned char gzip_magic[] = {0x1F, 0x8B};
+    static const unsigned char zstd_magic[] = {0x28, 0xB5, 0x2F, 0xFD};
+    FileInput input = {file, {0}, 0, 0};
+    input.prefix_length = fread(input.prefix, 1, MAGIC_SIZE, file);
+    if (input.prefix_length < MAGIC_SIZE && ferror(file))
+    {
+        return 1;
+    }
+    source->close = NULL;
+    source->state = NULL;
+    source->failed = 0;
+    source->compression = BYTE_SOURCE_PLAIN;
+    if (input.prefix_length >= sizeof(gzip_magic)
+        && memcmp(input.prefix, gzip_magic, sizeof(gzip_magic)) == 0)
+    {
+        source->compression = BYTE_SOURCE_GZIP;
+    }
+    else if (input.prefix_length >= sizeof(zstd_magic)
+             && memcmp(input.prefix, zstd_magic, sizeof(zstd_magic)) == 0)
+    {
+        source->compression = BYTE_SOURCE_ZSTD;
+    }
+
+    switch (source->compression)
+    {
+        case BYTE_SOURCE_GZIP:
+#ifdef MARKOV_WITH_ZLIB
+            return open_gzip_source(source, &input);
+#else
+            return 2;
+#endif
+        case BYTE_SOURCE_ZSTD:
+#ifdef MARKOV_WITH_ZSTD
+            return open_zstd_source(source, &input);
+#else
+            return 2;
+#endif
+        default:
+            return open_plain_source(source, &input);
+    }
+}
+
+// thread body: fills the free blocks of the queue until the inner source
+// ends or the source is closed
+static void *read_ahead(void *arg)
+{
+    ThreadedSource *threaded = (ThreadedSource *) arg;
+    pthread_mutex_lock(&threaded->lock);
+    for (;;)
+    {
+        while (threaded->num_of_ready == BYTE_SOURCE_QUEUE_LENGTH && !threaded->stopping)
+        {
+            pthread_cond_wait(&threaded->block_free, &threaded->lock);
+        }
+        if (threaded->stopping)
+        {
+            break;
+        }
+        int slot = (threaded->head + threaded->num_of_ready) % BYTE_SOURCE_QUEUE_LENGTH;
+        pthread_mutex_unlock(&threaded->lock);
+
+        // the block is this thread's alone until it's counted as ready
+        char *block = threaded->blocks + (size_t) slot * BYTE_SOURCE_BLOCK_SIZE;
+        size_t length = 0;
+        size_t read = 1;
+        while (length < BYTE_SOURCE_BLOCK_SIZE && read > 0)
+        {
+            read = read_byte_source(&threaded->inner, block + length,
+                                    BYTE_SOURCE_BLOCK_SIZE - length);
+            length += read;
+        }
+
+        pthread_mutex_lock(&threaded->lock);
+        if (length > 0)
+        {
+            threaded->lengths[slot] = length;
+            threaded->num_of_ready++;
+            pthread_cond_signal(&threaded->block_ready);
+        }
+        if (read == 0)
+        {
+            threaded->finished = 1;
+            pthread_cond_signal(&threaded->block_ready);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&threaded->lock);
+    return NULL;
+}
+
+static size_t read_threaded(ByteSource *source, char *buffer, size_t size)
+{
+    ThreadedSource *threaded = source->state;
+    pthread_mutex_lock(&threaded->lock);
+    while (threaded->num_of_ready == 0 && !threaded->finished)
+    {
+        pthread_cond_wait(&threaded->block_ready, &threaded->lock);
+    }
+    if (threaded->num_of_ready == 0)
+    {
+        source->failed = threaded->inner.failed;
+        pthread_mutex_unlock(&threaded->lock);
+        return 0;
+    }
+    pthread_mutex_unlock(&threaded->lock);
+
+    // the head block is the reader's alone while it's ready
+    int head = threaded->head;
+    size_t length = threaded->lengths[head] - threaded->position;
+    length = length < size ? length : size;
+    memcpy(buffer, threaded->blocks + (size_t) head * BYTE_SOURCE_BLOCK_SIZE
+                   + threaded->position, length);
+    threaded->position += length;
+    if (threaded->position == threaded->lengths[head])
+    {
+        pthread_mutex_lock(&threaded->lock);
+        threaded->head = (head + 1) % BYTE_SOURCE_QUEUE_LENGTH;
+        threaded->num_of_ready--;
+        threaded->position = 0;
+        pthread_cond_signal(&threaded->block_free);
+        pthread_mutex_unlock(&threaded->lock);
+    }
+    return length;
+}
+
+static void free_threaded_source(ThreadedSource *threaded)
+{
+    pthread_mutex_destroy(&threaded->lock);
+    pthread_cond_destroy(&threaded->block_ready);
+    pthread_cond_destroy(&threaded->block_free);
+    free(threaded->blocks);
+    free(threaded);
+}
+
+static void close_threaded(ByteSource *source)
+{
+    ThreadedSource *threaded = source->state;
+    // the thread may be waiting for a free block, or in the middle of one
+    pthread_mutex_lock(&threaded->lock);
+    threaded->stopping = 1;
+    pthread_cond_signal(&threaded->block_free);
+    pthread_mutex_unlock(&threaded->lock);
+    pthread_join(threaded->thread, NULL);
+    close_byte_source(&threaded->inner);
+    free_threaded_source(threaded);
+}
+
+int open_threaded_source(ByteSource *source, ByteSource *inner)
+{
+    ThreadedSource *threaded = calloc(1, sizeof(ThreadedSource));
+    if (threaded == NULL)
+    {
+        return 1;
+    }
+    threaded->inner = *inner;
+    threaded->blocks = malloc((size_t) BYTE_SOURCE_QUEUE_LENGTH * BYTE_SOURCE_BLOCK_SIZE);
+    pthread_mutex_init(&threaded->lock, NULL);
+    pthread_cond_init(&threaded->block_ready, NULL);
+    pthread_cond_init(&threaded->block_free, NULL);
+    if (threaded->blocks == NULL
+        || pthread_create(&threaded->thread, NULL, read_ahead, threaded) != 0)
+    {
+        free_threaded_source(threaded);
+        return 1;
+    }
+    source->read = read_threaded;
+    source->close = close_threaded;
+    source->state = threaded;
+    source->compression = inner->compression;
+    source->failed = 0;
+    return 0;
+}
+
+size_t read_byte_source(ByteSource *source, char *buffer, size_t size)
+{
+    if (source->failed)
+    {
+        return 0;
+    }
+    return source->read(source, buffer, size);
+}
+
+void close_byte_source(ByteSource *source)
+{
+    if (source->close != NULL)
+    {
+        source->close(source);
+    }
+    source->state = NULL;
+}
@@ -0,0 +1,77 @@
+#ifndef _BYTE_SOURCE_H_
+#define _BYTE_SOURCE_H_
+
+#include <stdio.h>  // For FILE
+#include <stddef.h> // For size_t
+
+// what open_compressed_source found at the start of the file
+#define BYTE_SOURCE_PLAIN 0
+#define BYTE_SOURCE_GZIP 1
+#define BYTE_SOURCE_ZSTD 2
+
+// the size of the blocks a threaded source hands over, and how many of them
+// can wait in its queue
+#define BYTE_SOURCE_BLOCK_SIZE (1 << 16)
+#define BYTE_SOURCE_QUEUE_LENGTH 8
+
+// Where a tokenizer reads a corpus from, when it's not a plain FILE or a
+// text in memory: a compressed file (gzip needs a build with zlib,
+// MARKOV_WITH_ZLIB, and zstd one with libzstd, MARKOV_WITH_ZSTD), and the
+// same read on a thread of its own so decompressing overlaps with building
+// the chain. Sources never close the FILE they read.
+
+typedef struct ByteSource ByteSource;
+
+// reads up to size bytes into buffer, returns how many (0 only at the end
+// of the input or when reading failed, which sets source->failed)
+typedef size_t (*ReadBytes)(ByteSource *source, char *buffer, size_t size);
+
+struct ByteSource {
+    ReadBytes read;
+    // frees what state holds
+    void (*close)(ByteSource *source);
+    void *state;
+    // BYTE_SOURCE_PLAIN, BYTE_SOURCE_GZIP or BYTE_SOURCE_ZSTD
+    int compression;
+    // reading failed (the file could not be read, or was not valid)
+    int failed;
+};
+
+/**
+ * Open a file that may be compressed, telling by its first bytes.
+ * @param source the source to open
+ * @param file the file, read from its current position
+ * @return 0 on success, 1 in case of allocation error or if reading the
+ * first bytes failed, 2 if the file is compressed in a way this build can't
+ * read (source->compression says which).
+ */
+int open_compressed_source(ByteSource *source, FILE *file);
+
+/**
+ * Read another source on a thread of its own, BYTE_SOURCE_BLOCK_SIZE bytes
+ * at a time, with up to BYTE_SOURCE_QUEUE_LENGTH blocks waiting.
+ * @param source the source to open
+ * @param inner the source to read, taken over by this one (only the struct
+ * itself is left to the caller)
+ * @return 0 on success, 1 in case of allocation error or if the thread
+ * could not be started (then inner is left as it was).
+ */
+int open_threaded_source(ByteSource *source, ByteSource *inner);
+
+/**
+ * Read up to size bytes.
+ * @param source the source to read from
+ * @param buffer where to store them
+ * @param size how many bytes fit in buffer
+ * @return how many bytes were read, 0 at the end of the input or on failure
+ * (in which case source->failed is set).
+ */
+size_t read_byte_source(ByteSource *source, char *buffer, size_t size);
+
+/**
+ * Free the source (the file itself is left alone).
+ * @param source the source to close
+ */
+void close_byte_source(ByteSource *source);
+
+#endif //_BYTE_SOURCE_H_
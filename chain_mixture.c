@@ -0,0 +1,326 @@
+#include "chain_mixture.h"
+#include "alias_table.h"
+#include <string.h>
+
+// checks the weights and turns them into the running sums the first word
+// is drawn with
+static int set_first_word_weights(ChainMixture *mixture, const double *weights)
+{
+    double total_weight = 0;
+    for (int c = 0; c < mixture->num_of_components; ++c)
+    {
+        if (!(weights[c] >= 0))
+        {
+            return 1;
+        }
+        // a chain with no word to start a tweet with has no first word to give
+        if (mixture->components[c].chain->num_of_startable_words > 0)
+        {
+            total_weight += weights[c];
+        }
+    }
+    if (total_weight <= 0)
+    {
+        return 1;
+    }
+    unsigned int accumulated_weight = 0;
+    for (int c = 0; c < mixture->num_of_components; ++c)
+    {
+        mixture->components[c].weight = weights[c];
+        if (mixture->components[c].chain->num_of_startable_words > 0)
+        {
+            accumulated_weight += (unsigned int) (weights[c] / total_weight
+                                                  * MIXTURE_RESOLUTION + 0.5);
+        }
+        mixture->first_word_weights[c] = accumulated_weight;
+    }
+    return 0;
+}
+
+int init_chain_mixture(ChainMixture *mixture, MarkovChain **chains,
+                       const double *weights, int num_of_components)
+{
+    mixture->num_of_components = num_of_components;
+    mixture->components = calloc(num_of_components, sizeof(MixtureComponent));
+    mixture->first_word_weights = malloc(num_of_components * sizeof(unsigned int));
+    mixture->component_ids = NULL;
+    mixture->mixed_tables = NULL;
+    mixture->mix_positions = NULL;
+    init_arena(&mixture->tables, STRING_ARENA_BLOCK_SIZE);
+    pthread_mutex_init(&mixture->tables_lock, NULL);
+    if (init_word_table(&mixture->words) == 1)
+    {
+        free(mixture->components);
+        free(mixture->first_word_weights);
+        pthread_mutex_destroy(&mixture->tables_lock);
+        return 1;
+    }
+    if (num_of_components < 1 || mixture->components == NULL
+        || mixture->first_word_weights == NULL)
+    {
+        free_chain_mixture(mixture);
+        return 1;
+    }
+    for (int c = 0; c < num_of_components; ++c)
+    {
+        mixture->components[c].chain = chains[c];
+    }
+    if (set_first_word_weights(mixture, weights) == 1)
+    {
+        free_chain_mixture(mixture);
+        return 1;
+    }
+
+    // every word of every chain gets a shared id
+    for (int c = 0; c < num_of_components; ++c)
+    {
+        const MarkovChain *markov_chain = chains[c];
+        MixtureComponent *component = &mixture->components[c];
+        component->shared_ids = malloc((markov_chain->database->size + 1)
+                                       * sizeof(unsigned int));
+        if (component->shared_ids == NULL)
+        {
+            free_chain_mixture(mixture);
+            return 1;
+        }
+        for (int i = 0; i < markov_chain->database->size; ++i)
+        {
+            if (intern_word(&mixture->words, markov_chain->words.words[i],
+                            markov_chain->words.lengths[i],
+                            &component->shared_ids[i]) == 1)
+            {
+                free_chain_mixture(mixture);
+                return 1;
+            }
+        }
+    }
+
+    int num_of_words = mixture->words.size;
+    mixture->component_ids = malloc(((size_t) num_of_words * num_of_components + 1)
+                                    * sizeof(int));
+    mixture->mixed_tables = calloc(num_of_words + 1, sizeof(*mixture->mixed_tables));
+    mixture->mix_positions = malloc((num_of_words + 1) * sizeof(int));
+    if (mixture->component_ids == NULL || mixture->mixed_tables == NULL
+        || mixture->mix_positions == NULL)
+    {
+        free_chain_mixture(mixture);
+        return 1;
+    }
+    memset(mixture->component_ids, -1,
+           (size_t) num_of_words * num_of_components * sizeof(int));
+    memset(mixture->mix_positions, -1, num_of_words * sizeof(int));
+    for (int c = 0; c < num_of_components; ++c)
+    {
+        const MixtureComponent *component = &mixture->components[c];
+        for (int i = 0; i < chains[c]->database->size; ++i)
+        {
+            mixture->component_ids[(size_t) component->shared_ids[i] * num_of_components
+                                   + c] = i;
+        }
+    }
+    return 0;
+}
+
+int set_mixture_weights(ChainMixture *mixture, const double *weights)
+{
+    if (set_first_word_weights(mixture, weights) == 1)
+    {
+        return 1;
+    }
+    // the cached tables were mixed with the old weights
+    for (int i = 0; i < mixture->words.size; ++i)
+    {
+        atomic_store_explicit(&mixture->mixed_tables[i], NULL, memory_order_relaxed);
+    }
+    size_t block_size = mixture->tables.block_size;
+    free_arena(&mixture->tables);
+    init_arena(&mixture->tables, block_size);
+    return 0;
+}
+
+unsigned int get_first_mixture_word(const ChainMixture *mixture,
+                                    RandomState *random_state)
+{
+    int num_of_components = mixture->num_of_components;
+    unsigned int random_number = (unsigned int) get_random_number(
+            random_state, (int) mixture->first_word_weights[num_of_components - 1]);
+    int c = 0;
+    while (mixture->first_word_weights[c] <= random_number)
+    {
+        c++;
+    }
+    const MixtureComponent *component = &mixture->components[c];
+    MarkovNode *first_node = get_first_random_node(component->chain, random_state);
+    return component->shared_ids[first_node->id];
+}
+
+// mixes the successors of a word in all the chains into a new table (left
+// NULL when no chain with any weight has a successor for the word), returns
+// 1 in case of allocation error. the caller holds tables_lock
+static int build_mixed_table(ChainMixture *mixture, unsigned int word_id,
+                             AliasTable **alias_table)
+{
+    *alias_table = NULL;
+    int num_of_components = mixture->num_of_components;
+    const int *component_ids = mixture->component_ids + (size_t) word_id * num_of_components;
+
+    // only the chains that have somewhere to go from the word share the weight
+    double total_weight = 0;
+    int num_of_candidates = 0;
+    for (int c = 0; c < num_of_components; ++c)
+    {
+        if (component_ids[c] == -1)
+        {
+            continue;
+        }
+        const MarkovNode *markov_node = get_node_by_id(mixture->components[c].chain,
+                                                       (unsigned int) component_ids[c]);
+        if (markov_node->num_of_successors > 0)
+        {
+            total_weight += mixture->components[c].weight;
+            num_of_candidates += markov_node->num_of_successors;
+        }
+    }
+    if (num_of_candidates == 0 || total_weight <= 0)
+    {
+        return 0;
+    }
+
+    unsigned int *successors = malloc(num_of_candidates * sizeof(unsigned int));
+    double *weights = malloc(num_of_candidates * sizeof(double));
+    unsigned int *frequencies = malloc(num_of_candidates * sizeof(unsigned int));
+    if (successors == NULL || weights == NULL || frequencies == NULL)
+    {
+        free(successors);
+        free(weights);
+        free(frequencies);
+        return 1;
+    }
+    int num_of_successors = 0;
+    for (int c = 0; c < num_of_components; ++c)
+    {
+        const MixtureComponent *component = &mixture->components[c];
+        if (component_ids[c] == -1 || component->weight <= 0)
+        {
+            continue;
+        }
+        const MarkovNode *markov_node = get_node_by_id(component->chain,
+                                                       (unsigned int) component_ids[c]);
+        double total_frequency = 0;
+        for (int i = 0; i < markov_node->num_of_successors; ++i)
+        {
+            total_frequency += markov_node->frequencies[i];
+        }
+        // the same successor in several chains adds up
+        double scale = component->weight / total_weight / total_frequency;
+        for (int i = 0; i < markov_node->num_of_successors; ++i)
+        {
+            unsigned int successor = component->shared_ids[markov_node->successors[i]];
+            int position = mixture->mix_positions[successor];
+            if (position == -1)
+            {
+                position = num_of_successors++;
+                mixture->mix_positions[successor] = position;
+                successors[position] = successor;
+                weights[position] = 0;
+            }
+            weights[position] += markov_node->frequencies[i] * scale;
+        }
+    }
+    for (int i = 0; i < num_of_successors; ++i)
+    {
+        mixture->mix_positions[successors[i]] = -1;
+        long long frequency = (long long) (weights[i] * MIXTURE_RESOLUTION + 0.5);
+        frequencies[i] = frequency > 0 ? (unsigned int) frequency : 1;
+    }
+    *alias_table = create_alias_table(&mixture->tables, NULL, successors, frequencies,
+                                      num_of_successors);
+    free(successors);
+    free(weights);
+    free(frequencies);
+    return *alias_table == NULL;
+}
+
+int get_next_mixture_word(ChainMixture *mixture, unsigned int word_id,
+                          unsigned int *next_id, RandomState *random_state)
+{
+    AliasTable *alias_table = atomic_load_explicit(&mixture->mixed_tables[word_id],
+                                                   memory_order_acquire);
+    if (alias_table == NULL)
+    {
+        // whoever gets the lock first builds the table, the others find it
+        pthread_mutex_lock(&mixture->tables_lock);
+        alias_table = atomic_load_explicit(&mixture->mixed_tables[word_id],
+                                           memory_order_relaxed);
+        int failed = 0;
+        if (alias_table == NULL)
+        {
+            failed = build_mixed_table(mixture, word_id, &alias_table);
+            atomic_store_explicit(&mixture->mixed_tables[word_id], alias_table,
+                                  memory_order_release);
+        }
+        pthread_mutex_unlock(&mixture->tables_lock);
+        if (alias_table == NULL)
+        {
+            // a word with nowhere to go is looked at again every time, but
+            // that's only at the end of a tweet
+            return failed ? -1 : 1;
+        }
+    }
+    *next_id = sample_alias_table(alias_table, random_state);
+    return 0;
+}
+
+int generate_mixture_tweets(ChainMixture *mixture, int num_of_tweets, int max_length,
+                            TweetBatch *batch, RandomState *random_state)
+{
+    const WordTable *words = &mixture->words;
+    for (int t = 0; t < num_of_tweets; ++t)
+    {
+        unsigned int current_word = get_first_mixture_word(mixture, random_state);
+        for (int i = 1; i < max_length && !word_ends_sentence(words, current_word); ++i)
+        {
+            unsigned int next_word;
+            // a word that only ever ended a line has nowhere to go either
+            int result = get_next_mixture_word(mixture, current_word, &next_word,
+                                               random_state);
+            if (result == -1)
+            {
+                return 1;
+            }
+            if (result == 1)
+            {
+                break;
+            }
+            if (append_word_to_tweet(batch, words->words[current_word],
+                                     words->lengths[current_word]) == 1)
+            {
+                return 1;
+            }
+            current_word = next_word;
+        }
+        if (append_word_to_tweet(batch, words->words[current_word],
+                                 words->lengths[current_word]) == 1
+            || end_tweet(batch) == 1)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void free_chain_mixture(ChainMixture *mixture)
+{
+    for (int c = 0; c < mixture->num_of_components && mixture->components != NULL; ++c)
+    {
+        free(mixture->components[c].shared_ids);
+    }
+    free(mixture->components);
+    free(mixture->first_word_weights);
+    free(mixture->component_ids);
+    free(mixture->mixed_tables);
+    free(mixture->mix_positions);
+    free_arena(&mixture->tables);
+    free_word_table(&mixture->words);
+    pthread_mutex_destroy(&mixture->tables_lock);
+}
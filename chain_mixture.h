@@ -0,0 +1,119 @@
+#ifndef _CHAIN_MIXTURE_H_
+#define _CHAIN_MIXTURE_H_
+
+#include "markov_chain.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+// the mixed weights of a word's successors are integers out of about this
+// many (a successor with any weight at all gets at least 1)
+#define MIXTURE_RESOLUTION (1 << 24)
+
+// Blends several chains (one per campaign or time window, say) at
+// generation time instead of merging them: the next word after w is drawn
+// from the sum over the chains that have successors for w of
+//   weight of the chain * frequency of the successor / frequency of all of
+//   w's successors in that chain
+// with the weights of those chains scaled to sum to 1. The first word comes
+// from get_first_random_node of a chain drawn by weight.
+//
+// The words of all the chains get ids in one shared WordTable. The mixed
+// distribution of a word is built the first time the word is generated
+// from, as an alias table, and cached until the weights change, so hot
+// words cost the same as in a frozen chain.
+
+typedef struct MixtureComponent {
+    MarkovChain *chain;
+    double weight;
+    // the shared id of every word of the chain, by its id in the chain
+    unsigned int *shared_ids;
+} MixtureComponent;
+
+typedef struct ChainMixture {
+    MixtureComponent *components;
+    int num_of_components;
+    // every word of every chain
+    WordTable words;
+    // the id in component c of shared word w is at
+    // component_ids[w * num_of_components + c], -1 when c doesn't have it
+    int *component_ids;
+    // the mixed table of every shared word, NULL until it's first needed
+    // (and for words no chain has a successor for)
+    _Atomic(struct AliasTable *) *mixed_tables;
+    // the tables and what builds them, one builder at a time
+    Arena tables;
+    pthread_mutex_t tables_lock;
+    // where every successor is among the ones being mixed, -1 for none
+    // (only used while holding tables_lock)
+    int *mix_positions;
+    // running sums of the weights of the chains, out of MIXTURE_RESOLUTION,
+    // to draw the chain of the first word
+    unsigned int *first_word_weights;
+} ChainMixture;
+
+/**
+ * Initialize a mixture of chains, which must not change while it's used.
+ * @param mixture the mixture to initialize
+ * @param chains the chains (at least one)
+ * @param weights the weight of every chain (not negative, not all 0, they
+ * don't need to sum to 1)
+ * @param num_of_components number of chains
+ * @return 0 on success, 1 if the weights are invalid or in case of
+ * allocation error.
+ */
+int init_chain_mixture(ChainMixture *mixture, MarkovChain **chains,
+                       const double *weights, int num_of_components);
+
+/**
+ * Change the weights of the chains, dropping the cached tables. Must not be
+ * called while generating from the mixture.
+ * @param mixture the mixture
+ * @param weights the new weight of every chain (same rules as
+ * init_chain_mixture)
+ * @return 0 on success, 1 if the weights are invalid.
+ */
+int set_mixture_weights(ChainMixture *mixture, const double *weights);
+
+/**
+ * Draw the first word of a tweet: a chain by weight, then one of its words
+ * like get_first_random_node.
+ * @param mixture the mixture
+ * @param random_state the generator to draw from
+ * @return the shared id of the word
+ */
+unsigned int get_first_mixture_word(const ChainMixture *mixture,
+                                    RandomState *random_state);
+
+/**
+ * Choose randomly the next word out of the mixed distribution of a word.
+ * Safe to call from several threads at once.
+ * @param mixture the mixture
+ * @param word_id shared id of the current word
+ * @param next_id where to store the shared id of the next word
+ * @param random_state the generator to draw from
+ * @return 0 on success, 1 if no chain has a successor for the word, -1 in
+ * case of allocation error.
+ */
+int get_next_mixture_word(ChainMixture *mixture, unsigned int word_id,
+                          unsigned int *next_id, RandomState *random_state);
+
+/**
+ * Generate num_of_tweets tweets out of the mixture into the batch, by the
+ * same rules as generate_tweets. Safe to call from several threads at once.
+ * @param mixture the mixture
+ * @param num_of_tweets how many tweets to generate
+ * @param max_length maximum length of every tweet
+ * @param batch the batch to add the tweets to
+ * @param random_state the generator to draw from
+ * @return 0 on success, 1 in case of allocation error.
+ */
+int generate_mixture_tweets(ChainMixture *mixture, int num_of_tweets, int max_length,
+                            TweetBatch *batch, RandomState *random_state);
+
+/**
+ * Free the mixture (not its chains).
+ * @param mixture the mixture to free
+ */
+void free_chain_mixture(ChainMixture *mixture);
+
+#endif //_CHAIN_MIXTURE_H_
@@ -0,0 +1,496 @@
+#include "compressed_chain.h"
+#include "alias_table.h"
+#include <string.h>
+
+#define INITIAL_EDGES_CAPACITY 4096
+// bytes of a skip entry: byte offset, count and id before the block
+#define SKIP_ENTRY_SIZE (3 * sizeof(uint32_t))
+#define MAX_VARINT_SIZE 5
+
+// a successor while its node is being compressed
+typedef struct CompressedEdge {
+    uint32_t id;
+    uint32_t count;
+} CompressedEdge;
+
+// the bytes being written, growing as needed
+typedef struct ByteWriter {
+    unsigned char *bytes;
+    size_t size;
+    size_t capacity;
+} ByteWriter;
+
+static int compare_edges(const void *first, const void *second)
+{
+    uint32_t a = ((const CompressedEdge *) first)->id;
+    uint32_t b = ((const CompressedEdge *) second)->id;
+    return (a > b) - (a < b);
+}
+
+// makes room for needed more bytes
+static int reserve_writer(ByteWriter *writer, size_t needed)
+{
+    if (writer->size + needed <= writer->capacity)
+    {
+        return 0;
+    }
+    size_t capacity = writer->capacity == 0 ? INITIAL_EDGES_CAPACITY : writer->capacity;
+    while (capacity < writer->size + needed)
+    {
+        capacity *= 2;
+    }
+    unsigned char *bytes = realloc(writer->bytes, capacity);
+    if (bytes == NULL)
+    {
+        return 1;
+    }
+    writer->bytes = bytes;
+    writer->capacity = capacity;
+    return 0;
+}
+
+// writes a varint (there must be room for MAX_VARINT_SIZE bytes)
+static void write_varint(ByteWriter *writer, uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        writer->bytes[writer->size++] = (unsigned char) (value | 0x80);
+        value >>= 7;
+    }
+    writer->bytes[writer->size++] = (unsigned char) value;
+}
+
+static const unsigned char *read_varint(const unsigned char *bytes, uint32_t *value)
+{
+    uint32_t result = *bytes & 0x7F;
+    for (int shift = 7; *bytes++ & 0x80; shift += 7)
+    {
+        result |= (uint32_t) (*bytes & 0x7F) << shift;
+    }
+    *value = result;
+    return bytes;
+}
+
+// the code of a count in count_bits bits (the count itself for 0)
+static uint32_t encode_count(uint32_t count, int count_bits)
+{
+    int mantissa_bits = count_bits - COUNT_EXPONENT_BITS;
+    if (count_bits == 0 || count < (1u << mantissa_bits))
+    {
+        return count;
+    }
+    // keep the top mantissa_bits + 1 bits, rounded to nearest
+    int shift = 0;
+    while ((count >> shift) >= (2u << mantissa_bits))
+    {
+        shift++;
+    }
+    uint64_t rounded = ((uint64_t) count + (shift > 0 ? 1u << (shift - 1) : 0)) >> shift;
+    if (rounded == (2u << mantissa_bits))
+    {
+        rounded >>= 1;
+        shift++;
+    }
+    return (uint32_t) (shift + 1) << mantissa_bits | ((uint32_t) rounded - (1u << mantissa_bits));
+}
+
+// the count a code stands for
+static uint32_t decode_count(uint32_t code, int count_bits)
+{
+    int mantissa_bits = count_bits - COUNT_EXPONENT_BITS;
+    if (count_bits == 0 || code < (1u << mantissa_bits))
+    {
+        return code;
+    }
+    uint32_t exponent = code >> mantissa_bits;
+    uint32_t mantissa = code & ((1u << mantissa_bits) - 1);
+    return (mantissa | 1u << mantissa_bits) << (exponent - 1);
+}
+
+// writes the successors of one node, sorted by id, with their counts
+// already encoded
+static int write_node(ByteWriter *writer, const CompressedEdge *edges, int num_of_edges,
+                      int count_bits)
+{
+    uint32_t total_count = 0;
+    for (int i = 0; i < num_of_edges; ++i)
+    {
+        total_count += decode_count(edges[i].count, count_bits);
+    }
+    int num_of_skips = num_of_edges > COMPRESSED_BLOCK_SIZE
+                       ? (num_of_edges - 1) / COMPRESSED_BLOCK_SIZE : 0;
+    if (reserve_writer(writer, 2 * MAX_VARINT_SIZE + num_of_skips * SKIP_ENTRY_SIZE
+                               + (size_t) num_of_edges * 2 * MAX_VARINT_SIZE) == 1)
+    {
+        return 1;
+    }
+    write_varint(writer, (uint32_t) num_of_edges);
+    write_varint(writer, total_count);
+    // the skip entries are filled in as their blocks are written
+    size_t skips = writer->size;
+    writer->size += num_of_skips * SKIP_ENTRY_SIZE;
+    size_t data = writer->size;
+
+    uint32_t previous_id = 0;
+    uint32_t count_before = 0;
+    for (int i = 0; i < num_of_edges; ++i)
+    {
+        if (i > 0 && i % COMPRESSED_BLOCK_SIZE == 0 && num_of_skips > 0)
+        {
+            uint32_t skip[3] = {(uint32_t) (writer->size - data), count_before, previous_id};
+            memcpy(writer->bytes + skips + (i / COMPRESSED_BLOCK_SIZE - 1) * SKIP_ENTRY_SIZE,
+                   skip, SKIP_ENTRY_SIZE);
+        }
+        write_varint(writer, edges[i].id - previous_id);
+        write_varint(writer, edges[i].count);
+        previous_id = edges[i].id;
+        count_before += decode_count(edges[i].count, count_bits);
+    }
+    return 0;
+}
+
+// copies the words of the chain, back to back
+static int copy_words(CompressedChain *compressed_chain, const MarkovChain *markov_chain)
+{
+    const WordTable *words = &markov_chain->words;
+    size_t strings_size = 0;
+    for (int i = 0; i < words->size; ++i)
+    {
+        strings_size += words->lengths[i] + 1;
+    }
+    compressed_chain->strings = malloc(strings_size + 1);
+    if (compressed_chain->strings == NULL || strings_size > UINT32_MAX)
+    {
+        return 1;
+    }
+    uint32_t offset = 0;
+    for (int i = 0; i < words->size; ++i)
+    {
+        compressed_chain->word_offsets[i] = offset;
+        memcpy(compressed_chain->strings + offset, words->words[i], words->lengths[i] + 1);
+        offset += words->lengths[i] + 1;
+    }
+    compressed_chain->word_offsets[words->size] = offset;
+
+    // (at least one entry, so a chain with none doesn't allocate 0 bytes)
+    int num_of_startable_words = markov_chain->num_of_startable_words;
+    compressed_chain->startable_words = malloc((num_of_startable_words + 1)
+                                               * sizeof(uint32_t));
+    if (compressed_chain->startable_words == NULL)
+    {
+        return 1;
+    }
+    for (int i = 0; i < num_of_startable_words; ++i)
+    {
+        compressed_chain->startable_words[i] = get_startable_word(markov_chain, i);
+    }
+    compressed_chain->num_of_startable_words = (uint32_t) num_of_startable_words;
+    return 0;
+}
+
+// builds the start table out of the start counts of the chain, the way
+// freeze_markov_chain does (there is none with uniform_first_words, or when
+// no sentence started with a word that doesn't end one)
+static int build_compressed_start_table(CompressedChain *compressed_chain,
+                                        const MarkovChain *markov_chain)
+{
+    int word_count = (int) compressed_chain->word_count;
+    int num_of_starts = 0;
+    for (int i = 0; i < word_count && !markov_chain->uniform_first_words; ++i)
+    {
+        num_of_starts += get_node_by_id(markov_chain, (unsigned int) i)->start_count > 0;
+    }
+    if (num_of_starts == 0)
+    {
+        return 0;
+    }
+    unsigned int *words = malloc(num_of_starts * sizeof(unsigned int));
+    unsigned int *counts = malloc(num_of_starts * sizeof(unsigned int));
+    if (words != NULL && counts != NULL)
+    {
+        int j = 0;
+        for (int i = 0; i < word_count; ++i)
+        {
+            unsigned int start_count = get_node_by_id(markov_chain, (unsigned int) i)
+                    ->start_count;
+            if (start_count > 0)
+            {
+                words[j] = (unsigned int) i;
+                counts[j++] = start_count;
+            }
+        }
+        compressed_chain->start_table = create_alias_table(&compressed_chain->start_arena,
+                                                           NULL, words, counts,
+                                                           num_of_starts);
+    }
+    free(words);
+    free(counts);
+    return compressed_chain->start_table == NULL;
+}
+
+int compress_markov_chain(CompressedChain *compressed_chain,
+                          const MarkovChain *markov_chain, int count_bits)
+{
+    memset(compressed_chain, 0, sizeof(CompressedChain));
+    if (count_bits != 0 && (count_bits < MIN_COUNT_BITS || count_bits > MAX_COUNT_BITS))
+    {
+        return 1;
+    }
+    int word_count = markov_chain->database->size;
+    compressed_chain->word_count = (uint32_t) word_count;
+    compressed_chain->count_bits = count_bits;
+    // the table is allocated once, its block is just as big
+    init_arena(&compressed_chain->start_arena, 0);
+    compressed_chain->word_offsets = malloc((word_count + 1) * sizeof(uint32_t));
+    compressed_chain->edge_offsets = malloc((word_count + 1) * sizeof(uint32_t));
+    int max_successors = 0;
+    for (int i = 0; i < word_count; ++i)
+    {
+        int num_of_successors = get_node_by_id(markov_chain, (unsigned int) i)
+                ->num_of_successors;
+        max_successors = num_of_successors > max_successors ? num_of_successors
+                                                            : max_successors;
+    }
+    CompressedEdge *edges = malloc((max_successors + 1) * sizeof(CompressedEdge));
+    if (compressed_chain->word_offsets == NULL || compressed_chain->edge_offsets == NULL
+        || edges == NULL || copy_words(compressed_chain, markov_chain) == 1
+        || build_compressed_start_table(compressed_chain, markov_chain) == 1)
+    {
+        free(edges);
+        free_compressed_chain(compressed_chain);
+        return 1;
+    }
+
+    ByteWriter writer = {NULL, 0, 0};
+    int failed = 0;
+    for (int i = 0; i < word_count && !failed; ++i)
+    {
+        const MarkovNode *markov_node = get_node_by_id(markov_chain, (unsigned int) i);
+        for (int j = 0; j < markov_node->num_of_successors; ++j)
+        {
+            edges[j].id = markov_node->successors[j];
+            edges[j].count = encode_count(markov_node->frequencies[j], count_bits);
+        }
+        qsort(edges, markov_node->num_of_successors, sizeof(CompressedEdge), compare_edges);
+        compressed_chain->edge_offsets[i] = (uint32_t) writer.size;
+        failed = writer.size > UINT32_MAX
+                 || write_node(&writer, edges, markov_node->num_of_successors, count_bits);
+    }
+    compressed_chain->edge_offsets[word_count] = (uint32_t) writer.size;
+    free(edges);
+    failed |= writer.size > UINT32_MAX;
+
+    // the stream was grown by doubling, it's kept exactly as big as it is
+    unsigned char *fitted = failed ? NULL : realloc(writer.bytes, writer.size + 1);
+    if (fitted == NULL)
+    {
+        free(writer.bytes);
+        free_compressed_chain(compressed_chain);
+        return 1;
+    }
+    compressed_chain->edges = fitted;
+    compressed_chain->edges_size = writer.size;
+    return 0;
+}
+
+size_t get_compressed_chain_memory(const CompressedChain *compressed_chain)
+{
+    uint32_t word_count = compressed_chain->word_count;
+    return sizeof(CompressedChain) + 2 * ((size_t) word_count + 1) * sizeof(uint32_t)
+           + compressed_chain->word_offsets[word_count] + compressed_chain->edges_size
+           + compressed_chain->start_arena.bytes_reserved
+           + compressed_chain->num_of_startable_words * sizeof(uint32_t);
+}
+
+double get_compressed_chain_error(const CompressedChain *compressed_chain,
+                                  const MarkovChain *markov_chain)
+{
+    // the compressed count of every successor of the node being compared,
+    // by id (put back to 0 after every node)
+    uint32_t *counts = calloc(compressed_chain->word_count + 1, sizeof(uint32_t));
+    if (counts == NULL)
+    {
+        return -1;
+    }
+    double max_error = 0;
+    for (uint32_t i = 0; i < compressed_chain->word_count; ++i)
+    {
+        const unsigned char *bytes = compressed_chain->edges + compressed_chain->edge_offsets[i];
+        uint32_t num_of_successors;
+        uint32_t total_count;
+        bytes = read_varint(bytes, &num_of_successors);
+        bytes = read_varint(bytes, &total_count);
+        if (num_of_successors > COMPRESSED_BLOCK_SIZE)
+        {
+            bytes += (num_of_successors - 1) / COMPRESSED_BLOCK_SIZE * SKIP_ENTRY_SIZE;
+        }
+        uint32_t id = 0;
+        for (uint32_t j = 0; j < num_of_successors; ++j)
+        {
+            uint32_t delta;
+            bytes = read_varint(bytes, &delta);
+            id += delta;
+            uint32_t code;
+            bytes = read_varint(bytes, &code);
+            counts[id] = decode_count(code, compressed_chain->count_bits);
+        }
+
+        const MarkovNode *markov_node = get_node_by_id(markov_chain, i);
+        double exact_total = 0;
+        for (int j = 0; j < markov_node->num_of_successors; ++j)
+        {
+            exact_total += markov_node->frequencies[j];
+        }
+        double error = 0;
+        for (int j = 0; j < markov_node->num_of_successors; ++j)
+        {
+            unsigned int successor = markov_node->successors[j];
+            double difference = markov_node->frequencies[j] / exact_total
+                                - (double) counts[successor] / total_count;
+            error += difference < 0 ? -difference : difference;
+            counts[successor] = 0;
+        }
+        max_error = error / 2 > max_error ? error / 2 : max_error;
+    }
+    free(counts);
+    return max_error;
+}
+
+int get_next_compressed_word(const CompressedChain *compressed_chain, uint32_t word_index,
+                             uint32_t *next_index, RandomState *random_state)
+{
+    const unsigned char *bytes = compressed_chain->edges
+                                 + compressed_chain->edge_offsets[word_index];
+    uint32_t num_of_successors;
+    uint32_t total_count;
+    bytes = read_varint(bytes, &num_of_successors);
+    if (num_of_successors == 0)
+    {
+        return 1;
+    }
+    bytes = read_varint(bytes, &total_count);
+    uint32_t random_number = (uint32_t) get_random_number(random_state, (int) total_count);
+
+    // the last block that starts at or below the random number
+    uint32_t count_before = 0;
+    uint32_t id = 0;
+    const unsigned char *data = bytes;
+    if (num_of_successors > COMPRESSED_BLOCK_SIZE)
+    {
+        int num_of_skips = (int) (num_of_successors - 1) / COMPRESSED_BLOCK_SIZE;
+        data = bytes + num_of_skips * SKIP_ENTRY_SIZE;
+        int low = 0;
+        int high = num_of_skips;
+        while (low < high)
+        {
+            int middle = low + (high - low) / 2;
+            uint32_t skip_count;
+            memcpy(&skip_count, bytes + middle * SKIP_ENTRY_SIZE + sizeof(uint32_t),
+                   sizeof(uint32_t));
+            if (skip_count <= random_number)
+            {
+                low = middle + 1;
+            }
+            else
+            {
+                high = middle;
+            }
+        }
+        uint32_t skip[3] = {0, 0, 0};
+        if (low > 0)
+        {
+            memcpy(skip, bytes + (low - 1) * SKIP_ENTRY_SIZE, SKIP_ENTRY_SIZE);
+        }
+        data += skip[0];
+        count_before = skip[1];
+        id = skip[2];
+    }
+
+    // the first successor whose running count passes the random number
+    for (;;)
+    {
+        uint32_t delta;
+        uint32_t code;
+        data = read_varint(data, &delta);
+        data = read_varint(data, &code);
+        id += delta;
+        count_before += decode_count(code, compressed_chain->count_bits);
+        if (random_number < count_before)
+        {
+            *next_index = id;
+            return 0;
+        }
+    }
+}
+
+// whether a word ends with '.', like word_ends_sentence
+static int compressed_word_ends_sentence(const CompressedChain *compressed_chain,
+                                         uint32_t word_index)
+{
+    uint32_t end = compressed_chain->word_offsets[word_index + 1] - 1;
+    return end > compressed_chain->word_offsets[word_index]
+           && compressed_chain->strings[end - 1] == '.';
+}
+
+int generate_compressed_tweets(const CompressedChain *compressed_chain, int num_of_tweets,
+                               int max_length, TweetBatch *batch,
+                               RandomState *random_state)
+{
+    if (num_of_tweets > 0 && compressed_chain->num_of_startable_words == 0)
+    {
+        return 1;
+    }
+    for (int t = 0; t < num_of_tweets; ++t)
+    {
+        // same as get_first_random_node: a word that started sentences, or
+        // without a start table any word that doesn't end one
+        uint32_t current_word;
+        if (compressed_chain->start_table != NULL)
+        {
+            current_word = sample_alias_table(compressed_chain->start_table, random_state);
+        }
+        else
+        {
+            current_word = compressed_chain->startable_words[get_random_number(
+                    random_state, (int) compressed_chain->num_of_startable_words)];
+        }
+
+        for (int i = 1; i < max_length
+                        && !compressed_word_ends_sentence(compressed_chain, current_word); ++i)
+        {
+            uint32_t next_word;
+            // a word that only ever ended a line has nowhere to go either
+            if (get_next_compressed_word(compressed_chain, current_word, &next_word,
+                                         random_state) == 1)
+            {
+                break;
+            }
+            const uint32_t *offsets = compressed_chain->word_offsets + current_word;
+            if (append_word_to_tweet(batch, compressed_chain->strings + offsets[0],
+                                     offsets[1] - offsets[0] - 1) == 1)
+            {
+                return 1;
+            }
+            current_word = next_word;
+        }
+        const uint32_t *offsets = compressed_chain->word_offsets + current_word;
+        if (append_word_to_tweet(batch, compressed_chain->strings + offsets[0],
+                                 offsets[1] - offsets[0] - 1) == 1
+            || end_tweet(batch) == 1)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void free_compressed_chain(CompressedChain *compressed_chain)
+{
+    free(compressed_chain->word_offsets);
+    free(compressed_chain->strings);
+    free(compressed_chain->edge_offsets);
+    free(compressed_chain->edges);
+    free(compressed_chain->startable_words);
+    free_arena(&compressed_chain->start_arena);
+    memset(compressed_chain, 0, sizeof(CompressedChain));
+}
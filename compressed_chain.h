@@ -0,0 +1,128 @@
+#ifndef _COMPRESSED_CHAIN_H_
+#define _COMPRESSED_CHAIN_H_
+
+#include "markov_chain.h"
+#include <stdint.h>
+
+// counts are quantized to between this many bits (or kept exact with 0),
+// of which this many are the exponent
+#define MIN_COUNT_BITS 8
+#define MAX_COUNT_BITS 16
+#define COUNT_EXPONENT_BITS 5
+// nodes with more successors than this get a skip entry every this many
+// successors, so sampling decodes at most this many of them
+#define COMPRESSED_BLOCK_SIZE 32
+
+// A frozen chain in a dense read only form, for keeping several big chains
+// in memory at once. The words are back to back like in a model file, and
+// the successors of every node are one run of bytes:
+//   varint number of successors, varint total count
+//   if there are more than COMPRESSED_BLOCK_SIZE successors, a skip entry
+//     for the start of every block after the first: uint32_t byte offset
+//     (from the first successor), count and id before the block
+//   then for every successor, by id: varint id - previous id (the first one
+//     from 0) and varint count
+// where a varint is 7 bits a byte, low bits first, the high bit set on all
+// but the last byte. Sampling decodes a node on the fly: it finds the block
+// of the drawn number through the skip entries and decodes up to one block.
+// The first word of a tweet comes from an alias table over the exact start
+// counts of the chain (see MarkovNode.start_count), built when compressing,
+// or out of the words that don't end a sentence, all as likely, for a chain
+// with uniform_first_words.
+//
+// With b count bits, every count is stored as a small float: the top
+// COUNT_EXPONENT_BITS bits are an exponent, the other m = b - 5 bits a
+// mantissa, so the counts below 2^(m + 1) stay exact and the bigger ones
+// are rounded to m + 1 significant bits, off by at most d = 2^-(m + 1) of
+// themselves (the codes are then varints like the rest). The total count
+// is off by at most d of itself too, so the total variation distance
+// between the sampled and the exact distribution of any word is at most
+// d / (1 - d): 6.7% with 8 bits, 0.4% with 12, 0.025% with 16, whatever
+// the number of successors. get_compressed_chain_error measures the largest
+// one.
+
+typedef struct CompressedChain {
+    uint32_t word_count;
+    // word i is at strings + word_offsets[i], null terminated
+    uint32_t *word_offsets;
+    char *strings;
+    // the successors of node i start at edges + edge_offsets[i]
+    uint32_t *edge_offsets;
+    unsigned char *edges;
+    size_t edges_size;
+    // 0 for exact counts
+    int count_bits;
+    // the words that started sentences, as often as they did, NULL to draw
+    // the first words uniformly (in start_arena, a block of its own)
+    struct AliasTable *start_table;
+    Arena start_arena;
+    // the words that don't end a sentence, the ones a uniform first word is
+    // drawn from
+    uint32_t *startable_words;
+    uint32_t num_of_startable_words;
+} CompressedChain;
+
+/**
+ * Build the compressed form of a chain.
+ * @param compressed_chain where to build it
+ * @param markov_chain the chain (frozen or not, it's not changed)
+ * @param count_bits 0 to keep the counts exact, or how many bits to quantize
+ * them to (MIN_COUNT_BITS to MAX_COUNT_BITS)
+ * @return 0 on success, 1 for invalid count_bits, a chain too big for 32 bit
+ * offsets or in case of allocation error.
+ */
+int compress_markov_chain(CompressedChain *compressed_chain,
+                          const MarkovChain *markov_chain, int count_bits);
+
+/**
+ * @param compressed_chain the compressed chain
+ * @return the bytes it takes
+ */
+size_t get_compressed_chain_memory(const CompressedChain *compressed_chain);
+
+/**
+ * Measure how far quantizing moved the distributions.
+ * @param compressed_chain the compressed chain
+ * @param markov_chain the chain it was built from
+ * @return the largest total variation distance between the distribution
+ * of a word in compressed_chain and in markov_chain (0 with exact counts),
+ * -1 in case of allocation error
+ */
+double get_compressed_chain_error(const CompressedChain *compressed_chain,
+                                  const MarkovChain *markov_chain);
+
+/**
+ * Choose randomly the next word, depending on its (compressed) count.
+ * @param compressed_chain the compressed chain
+ * @param word_index the current word
+ * @param next_index where to store the next word
+ * @param random_state the generator to draw from
+ * @return 0 on success, 1 if the word has no successors.
+ */
+int get_next_compressed_word(const CompressedChain *compressed_chain, uint32_t word_index,
+                             uint32_t *next_index, RandomState *random_state);
+
+/**
+ * Generate num_of_tweets tweets into the batch, by the same rules as
+ * generate_tweets (the first words come from the start table in O(1), like
+ * get_first_random_node). Only reads the chain, so threads may generate from it at
+ * once.
+ * @param compressed_chain the compressed chain
+ * @param num_of_tweets how many tweets to generate
+ * @param max_length maximum length of every tweet
+ * @param batch the batch to add the tweets to
+ * @param random_state the generator to draw from
+ * @return 0 on success, 1 in case of allocation error or if no word can
+ * start a tweet.
+ */
+int generate_compressed_tweets(const CompressedChain *compressed_chain, int num_of_tweets,
+                               int max_length, TweetBatch *batch,
+                               RandomState *random_state);
+
+/**
+ * Free the compressed chain.
+ * @param compressed_chain the compressed chain to free
+ */
+void free_compressed_chain(CompressedChain *compressed_chain);
+
+#endif //_COMPRESSED_CHAIN_H_
@@ -0,0 +1,88 @@
+#include "count_min_sketch.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#define FNV64_OFFSET_BASIS 14695981039346656037ULL
+#define FNV64_PRIME 1099511628211ULL
+// the seeds of the two hashes get_columns combines
+#define FIRST_HASH_SEED 0x9E3779B97F4A7C15ULL
+#define SECOND_HASH_SEED 0xC2B2AE3D27D4EB4FULL
+
+int init_count_min_sketch(CountMinSketch *sketch, unsigned int width)
+{
+    sketch->width = 1;
+    while (sketch->width < width)
+        sketch->width *= 2;
+    sketch->counters = calloc((size_t) COUNT_MIN_SKETCH_DEPTH * sketch->width,
+                              sizeof(unsigned int));
+    return sketch->counters == NULL;
+}
+
+// 64 bit FNV-1a starting from a seeded basis, then mixed (the murmur3
+// finalizer) so that every bit depends on the seed and the whole word
+static uint64_t hash_seeded_word(const char *word, size_t length,
+                                 uint64_t seed)
+{
+    uint64_t hash = FNV64_OFFSET_BASIS ^ seed;
+    for (size_t i = 0; i < length; ++i)
+    {
+        hash ^= (unsigned char) word[i];
+        hash *= FNV64_PRIME;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// the counter of the word in every row comes from two independent 64 bit
+// hashes (double hashing), the second one made odd so the rows never all
+// collide. words that share a counter in one row only share the others
+// if both hashes agree on the low bits, not whenever one hash collides
+static void get_columns(const CountMinSketch *sketch, const char *word,
+                        size_t length, unsigned int *columns)
+{
+    uint64_t hash = hash_seeded_word(word, length, FIRST_HASH_SEED);
+    uint64_t step = hash_seeded_word(word, length, SECOND_HASH_SEED) | 1;
+    for (int row = 0; row < COUNT_MIN_SKETCH_DEPTH; ++row)
+        columns[row] = (unsigned int) ((hash + row * step)
+                                       & (sketch->width - 1));
+}
+
+void count_word(CountMinSketch *sketch, const char *word, size_t length)
+{
+    unsigned int columns[COUNT_MIN_SKETCH_DEPTH];
+    get_columns(sketch, word, length, columns);
+    for (int row = 0; row < COUNT_MIN_SKETCH_DEPTH; ++row)
+    {
+        unsigned int *counter = sketch->counters
+                                + (size_t) row * sketch->width + columns[row];
+        if (*counter < UINT_MAX)
+            (*counter)++;
+    }
+}
+
+unsigned int estimate_word_count(const CountMinSketch *sketch,
+                                 const char *word, size_t length)
+{
+    unsigned int columns[COUNT_MIN_SKETCH_DEPTH];
+    get_columns(sketch, word, length, columns);
+    unsigned int estimate = UINT_MAX;
+    for (int row = 0; row < COUNT_MIN_SKETCH_DEPTH; ++row)
+    {
+        unsigned int counter = sketch->counters[(size_t) row * sketch->width
+                                                + columns[row]];
+        if (counter < estimate)
+            estimate = counter;
+    }
+    return estimate;
+}
+
+void free_count_min_sketch(CountMinSketch *sketch)
+{
+    free(sketch->counters);
+    sketch->counters = NULL;
+}
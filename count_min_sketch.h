@@ -0,0 +1,53 @@
+#ifndef _COUNT_MIN_SKETCH_H_
+#define _COUNT_MIN_SKETCH_H_
+
+#include <stddef.h> // For size_t
+
+// rows of counters a word is counted in (every row has its own hash)
+#define COUNT_MIN_SKETCH_DEPTH 4
+
+/**
+ * Approximate word counts in a fixed amount of memory, however many
+ * distinct words are counted. A word's estimate is the smallest of its
+ * counters, one per row: never below its real count, and above it only by
+ * what other words that hash to the same counters add.
+ */
+typedef struct CountMinSketch {
+    // counters per row (a power of 2)
+    unsigned int width;
+    unsigned int *counters;
+} CountMinSketch;
+
+/**
+ * Initialize a sketch with all the counts at 0.
+ * @param sketch the sketch to initialize
+ * @param width counters per row, rounded up to a power of 2
+ * @return 0 on success, 1 in case of allocation error.
+ */
+int init_count_min_sketch(CountMinSketch *sketch, unsigned int width);
+
+/**
+ * Count one occurrence of a word.
+ * @param sketch the sketch
+ * @param word the word (does not need to be null terminated)
+ * @param length number of characters in word
+ */
+void count_word(CountMinSketch *sketch, const char *word, size_t length);
+
+/**
+ * Estimate how many times a word was counted.
+ * @param sketch the sketch
+ * @param word the word (does not need to be null terminated)
+ * @param length number of characters in word
+ * @return the estimate (at least the real count)
+ */
+unsigned int estimate_word_count(const CountMinSketch *sketch,
+                                 const char *word, size_t length);
+
+/**
+ * Free the counters of the sketch.
+ * @param sketch the sketch to free
+ */
+void free_count_min_sketch(CountMinSketch *sketch);
+
+#endif //_COUNT_MIN_SKETCH_H_
@@ -0,0 +1,1012 @@
+#include "external_build.h"
+#include "model_file.h"
+#include "word_table.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define INITIAL_ENTRIES_CAPACITY 4096
+#define INITIAL_PAIR_SLOT_CAPACITY 8192
+#define MAX_ARENA_BLOCK_SIZE (1 << 20)
+// every section of the model file is written through a buffer this big
+#define SECTION_BUFFER_SIZE (1 << 16)
+#define RUN_FILE_NAME "/markov-run-XXXXXX"
+
+/**
+ * A pair of words and how many times it was seen. A word on its own is
+ * counted as the pair of it and the empty word (count 0), so the words that
+ * nothing follows are still in the vocabulary.
+ */
+typedef struct PairEntry {
+    uint32_t count;
+    uint32_t first_length;
+    uint32_t second_length;
+    uint32_t hash;
+    // the first word and then the second one, not null terminated
+    char bytes[];
+} PairEntry;
+
+/**
+ * A record of a run file. The words point into whoever read it.
+ */
+typedef struct RunRecord {
+    const char *first;
+    uint32_t first_length;
+    const char *second;
+    uint32_t second_length;
+    uint32_t count;
+} RunRecord;
+
+/**
+ * Reads the records of a run file one by one.
+ */
+typedef struct RunReader {
+    FILE *file;
+    // the bytes of the current record
+    char *buffer;
+    size_t buffer_capacity;
+    RunRecord record;
+    int has_record;
+    int failed;
+} RunReader;
+
+/**
+ * Reads runs as one sorted run, summing the counts of equal keys.
+ */
+typedef struct RunMerger {
+    RunReader *readers;
+    int num_of_readers;
+    // indices of the readers that still have records, smallest record first
+    int *heap;
+    int heap_size;
+    // the current merged record, its bytes copied to buffer
+    RunRecord record;
+    char *buffer;
+    size_t buffer_capacity;
+    int failed;
+} RunMerger;
+
+
+// compares like memcmp, the shorter of two equal prefixes first
+static int compare_bytes(const char *first, uint32_t first_length,
+                         const char *second, uint32_t second_length)
+{
+    uint32_t length = first_length < second_length ? first_length : second_length;
+    int result = length > 0 ? memcmp(first, second, length) : 0;
+    if (result != 0)
+    {
+        return result;
+    }
+    return (first_length > second_length) - (first_length < second_length);
+}
+
+static int compare_records(const RunRecord *first, const RunRecord *second)
+{
+    int result = compare_bytes(first->first, first->first_length,
+                               second->first, second->first_length);
+    return result != 0 ? result
+                       : compare_bytes(first->second, first->second_length,
+                                       second->second, second->second_length);
+}
+
+static RunRecord entry_record(const PairEntry *entry)
+{
+    RunRecord record = {entry->bytes, entry->first_length,
+                        entry->bytes + entry->first_length, entry->second_length,
+                        entry->count};
+    return record;
+}
+
+// qsort comparator of PairEntry pointers
+static int compare_entries(const void *first, const void *second)
+{
+    RunRecord first_record = entry_record(*(PairEntry *const *) first);
+    RunRecord second_record = entry_record(*(PairEntry *const *) second);
+    return compare_records(&first_record, &second_record);
+}
+
+// grows a buffer so it holds at least needed bytes
+static int reserve_bytes(char **buffer, size_t *capacity, size_t needed)
+{
+    if (needed <= *capacity)
+    {
+        return 0;
+    }
+    size_t new_capacity = *capacity == 0 ? 64 : *capacity;
+    while (new_capacity < needed)
+    {
+        new_capacity *= 2;
+    }
+    char *new_buffer = realloc(*buffer, new_capacity);
+    if (new_buffer == NULL)
+    {
+        return 1;
+    }
+    *buffer = new_buffer;
+    *capacity = new_capacity;
+    return 0;
+}
+
+
+// ---- run files ----
+
+static int add_run(RunList *list, char *path, int owned)
+{
+    if (list->num_of_runs == list->runs_capacity)
+    {
+        int capacity = list->runs_capacity == 0 ? 16 : list->runs_capacity * 2;
+        RunFile *runs = realloc(list->runs, capacity * sizeof(RunFile));
+        if (runs == NULL)
+        {
+            return 1;
+        }
+        list->runs = runs;
+        list->runs_capacity = capacity;
+    }
+    list->runs[list->num_of_runs].path = path;
+    list->runs[list->num_of_runs].owned = owned;
+    list->num_of_runs++;
+    return 0;
+}
+
+// deletes the runs of the list the builder made, and forgets all of them
+static void remove_runs(RunFile *runs, int num_of_runs)
+{
+    for (int i = 0; i < num_of_runs; ++i)
+    {
+        if (runs[i].owned)
+        {
+            unlink(runs[i].path);
+        }
+        free(runs[i].path);
+    }
+}
+
+static void free_run_list(RunList *list)
+{
+    remove_runs(list->runs, list->num_of_runs);
+    free(list->runs);
+    list->runs = NULL;
+    list->num_of_runs = 0;
+    list->runs_capacity = 0;
+}
+
+// makes a new empty run file in the builder's directory and opens it
+static FILE *create_run_file(const ExternalBuilder *builder, char **path)
+{
+    *path = malloc(strlen(builder->temp_dir) + sizeof(RUN_FILE_NAME));
+    if (*path == NULL)
+    {
+        return NULL;
+    }
+    strcpy(*path, builder->temp_dir);
+    strcat(*path, RUN_FILE_NAME);
+    int fd = mkstemp(*path);
+    FILE *file = fd == -1 ? NULL : fdopen(fd, "wb");
+    if (file == NULL)
+    {
+        if (fd != -1)
+        {
+            close(fd);
+            unlink(*path);
+        }
+        free(*path);
+        *path = NULL;
+    }
+    return file;
+}
+
+static int write_run_header(FILE *file)
+{
+    uint32_t header[2] = {RUN_FILE_MAGIC, RUN_FILE_VERSION};
+    return fwrite(header, sizeof(header), 1, file) != 1;
+}
+
+static int write_run_record(FILE *file, const RunRecord *record)
+{
+    uint32_t header[3] = {record->first_length, record->second_length, record->count};
+    return fwrite(header, sizeof(header), 1, file) != 1
+           || fwrite(record->first, 1, record->first_length, file) != record->first_length
+           || fwrite(record->second, 1, record->second_length, file) != record->second_length;
+}
+
+// moves the reader to its next record (has_record is 0 at the end)
+static void read_run_record(RunReader *reader)
+{
+    uint32_t header[3];
+    size_t read = fread(header, sizeof(uint32_t), 3, reader->file);
+    if (read != 3)
+    {
+        reader->has_record = 0;
+        reader->failed |= read != 0 || ferror(reader->file);
+        return;
+    }
+    size_t length = (size_t) header[0] + header[1];
+    if (reserve_bytes(&reader->buffer, &reader->buffer_capacity, length + 1) == 1
+        || fread(reader->buffer, 1, length, reader->file) != length)
+    {
+        reader->has_record = 0;
+        reader->failed = 1;
+        return;
+    }
+    reader->record.first = reader->buffer;
+    reader->record.first_length = header[0];
+    reader->record.second = reader->buffer + header[0];
+    reader->record.second_length = header[1];
+    reader->record.count = header[2];
+    reader->has_record = 1;
+}
+
+static int open_run_reader(RunReader *reader, const char *path)
+{
+    memset(reader, 0, sizeof(RunReader));
+    reader->file = fopen(path, "rb");
+    if (reader->file == NULL)
+    {
+        return 1;
+    }
+    setvbuf(reader->file, NULL, _IOFBF, RUN_READ_BUFFER_SIZE);
+    uint32_t header[2];
+    if (fread(header, sizeof(header), 1, reader->file) != 1
+        || header[0] != RUN_FILE_MAGIC || header[1] != RUN_FILE_VERSION)
+    {
+        fclose(reader->file);
+        reader->file = NULL;
+        return 1;
+    }
+    read_run_record(reader);
+    return reader->failed;
+}
+
+static void close_run_reader(RunReader *reader)
+{
+    if (reader->file != NULL)
+    {
+        fclose(reader->file);
+    }
+    free(reader->buffer);
+}
+
+
+// ---- merging ----
+
+static int reader_is_smaller(const RunMerger *merger, int first, int second)
+{
+    return compare_records(&merger->readers[first].record,
+                           &merger->readers[second].record) < 0;
+}
+
+// restores the heap below position
+static void sift_down(RunMerger *merger, int position)
+{
+    for (;;)
+    {
+        int smallest = position;
+        int left = 2 * position + 1;
+        int right = left + 1;
+        if (left < merger->heap_size
+            && reader_is_smaller(merger, merger->heap[left], merger->heap[smallest]))
+        {
+            smallest = left;
+        }
+        if (right < merger->heap_size
+            && reader_is_smaller(merger, merger->heap[right], merger->heap[smallest]))
+        {
+            smallest = right;
+        }
+        if (smallest == position)
+        {
+            return;
+        }
+        int swapped = merger->heap[position];
+        merger->heap[position] = merger->heap[smallest];
+        merger->heap[smallest] = swapped;
+        position = smallest;
+    }
+}
+
+// moves the smallest reader on, and out of the heap once it's done
+static void advance_smallest(RunMerger *merger)
+{
+    RunReader *reader = &merger->readers[merger->heap[0]];
+    read_run_record(reader);
+    merger->failed |= reader->failed;
+    if (!reader->has_record)
+    {
+        merger->heap[0] = merger->heap[--merger->heap_size];
+    }
+    sift_down(merger, 0);
+}
+
+static void close_run_merger(RunMerger *merger)
+{
+    for (int i = 0; i < merger->num_of_readers; ++i)
+    {
+        close_run_reader(&merger->readers[i]);
+    }
+    free(merger->readers);
+    free(merger->heap);
+    free(merger->buffer);
+}
+
+static int open_run_merger(RunMerger *merger, const RunFile *runs, int num_of_runs)
+{
+    memset(merger, 0, sizeof(RunMerger));
+    merger->readers = calloc(num_of_runs > 0 ? num_of_runs : 1, sizeof(RunReader));
+    merger->heap = malloc((num_of_runs > 0 ? num_of_runs : 1) * sizeof(int));
+    if (merger->readers == NULL || merger->heap == NULL)
+    {
+        close_run_merger(merger);
+        return 1;
+    }
+    for (int i = 0; i < num_of_runs; ++i)
+    {
+        merger->num_of_readers++;
+        if (open_run_reader(&merger->readers[i], runs[i].path) == 1)
+        {
+            close_run_merger(merger);
+            return 1;
+        }
+        if (merger->readers[i].has_record)
+        {
+            merger->heap[merger->heap_size++] = i;
+        }
+    }
+    for (int i = merger->heap_size / 2 - 1; i >= 0; --i)
+    {
+        sift_down(merger, i);
+    }
+    return 0;
+}
+
+// moves the merger to its next record, returns 0 at the end (or on failure)
+static int next_merged_record(RunMerger *merger)
+{
+    if (merger->heap_size == 0 || merger->failed)
+    {
+        return 0;
+    }
+    const RunRecord *smallest = &merger->readers[merger->heap[0]].record;
+    size_t length = (size_t) smallest->first_length + smallest->second_length;
+    if (reserve_bytes(&merger->buffer, &merger->buffer_capacity, length + 1) == 1)
+    {
+        merger->failed = 1;
+        return 0;
+    }
+    memcpy(merger->buffer, smallest->first, smallest->first_length);
+    memcpy(merger->buffer + smallest->first_length, smallest->second,
+           smallest->second_length);
+    merger->record = *smallest;
+    merger->record.first = merger->buffer;
+    merger->record.second = merger->buffer + smallest->first_length;
+    advance_smallest(merger);
+    // the same key in other runs only adds to the count
+    while (merger->heap_size > 0
+           && compare_records(&merger->readers[merger->heap[0]].record,
+                              &merger->record) == 0)
+    {
+        merger->record.count += merger->readers[merger->heap[0]].record.count;
+        advance_smallest(merger);
+    }
+    return !merger->failed;
+}
+
+// how many runs a merge may read at once: half the budget goes to their
+// buffers, the other half to the counter
+static int merge_fan_in(const ExternalBuilder *builder)
+{
+    size_t fan_in = builder->memory_budget / 2 / RUN_READ_BUFFER_SIZE;
+    return fan_in < 2 ? 2 : fan_in > 1024 ? 1024 : (int) fan_in;
+}
+
+// merges runs into one run file (the runs themselves are left alone)
+static int merge_into_file(const RunFile *runs, int num_of_runs, FILE *file)
+{
+    RunMerger merger;
+    if (open_run_merger(&merger, runs, num_of_runs) == 1)
+    {
+        return 1;
+    }
+    int failed = write_run_header(file);
+    while (!failed && next_merged_record(&merger))
+    {
+        failed = write_run_record(file, &merger.record);
+    }
+    failed |= merger.failed;
+    close_run_merger(&merger);
+    return failed;
+}
+
+// merges the oldest runs of the list into one until a single merge can read
+// all of them
+static int reduce_runs(const ExternalBuilder *builder, RunList *list)
+{
+    int fan_in = merge_fan_in(builder);
+    while (list->num_of_runs > fan_in)
+    {
+        char *path;
+        FILE *file = create_run_file(builder, &path);
+        if (file == NULL)
+        {
+            return 1;
+        }
+        int failed = merge_into_file(list->runs, fan_in, file);
+        failed |= fclose(file) != 0;
+        if (failed || add_run(list, path, 1) == 1)
+        {
+            unlink(path);
+            free(path);
+            return 1;
+        }
+        remove_runs(list->runs, fan_in);
+        list->num_of_runs -= fan_in;
+        memmove(list->runs, list->runs + fan_in, list->num_of_runs * sizeof(RunFile));
+    }
+    return 0;
+}
+
+
+// ---- counting ----
+
+static void init_pair_counter(PairCounter *counter, size_t memory_budget)
+{
+    size_t block_size = memory_budget / 16;
+    init_arena(&counter->entries_arena,
+               block_size > MAX_ARENA_BLOCK_SIZE ? MAX_ARENA_BLOCK_SIZE : block_size);
+    counter->entries = NULL;
+    counter->num_of_entries = 0;
+    counter->entries_capacity = 0;
+    counter->slots = NULL;
+    counter->slot_capacity = 0;
+}
+
+static size_t pair_counter_bytes(const PairCounter *counter)
+{
+    return counter->entries_arena.bytes_reserved
+           + counter->entries_capacity * sizeof(PairEntry *)
+           + counter->slot_capacity * sizeof(int);
+}
+
+static void free_pair_counter(PairCounter *counter)
+{
+    free_arena(&counter->entries_arena);
+    free(counter->entries);
+    free(counter->slots);
+}
+
+// spills the counted pairs as a sorted run and empties the counter
+static int spill_counter(const ExternalBuilder *builder, PairCounter *counter,
+                         RunList *list)
+{
+    if (counter->num_of_entries == 0)
+    {
+        return 0;
+    }
+    qsort(counter->entries, counter->num_of_entries, sizeof(PairEntry *), compare_entries);
+    char *path;
+    FILE *file = create_run_file(builder, &path);
+    if (file == NULL)
+    {
+        return 1;
+    }
+    int failed = write_run_header(file);
+    for (int i = 0; i < counter->num_of_entries && !failed; ++i)
+    {
+        RunRecord record = entry_record(counter->entries[i]);
+        failed = write_run_record(file, &record);
+    }
+    failed |= fclose(file) != 0;
+    if (failed || add_run(list, path, 1) == 1)
+    {
+        unlink(path);
+        free(path);
+        return 1;
+    }
+
+    // the arrays are kept for the next run, the entries go
+    size_t block_size = counter->entries_arena.block_size;
+    free_arena(&counter->entries_arena);
+    init_arena(&counter->entries_arena, block_size);
+    counter->num_of_entries = 0;
+    memset(counter->slots, -1, counter->slot_capacity * sizeof(int));
+    return 0;
+}
+
+// the bytes the counter would hold after adding an entry of entry_size bytes
+static size_t counter_bytes_with(const PairCounter *counter, size_t entry_size)
+{
+    size_t bytes = pair_counter_bytes(counter);
+    const ArenaBlock *block = counter->entries_arena.current;
+    if (block == NULL || block->used + entry_size + _Alignof(PairEntry) > block->capacity)
+    {
+        bytes += counter->entries_arena.block_size > entry_size
+                 ? counter->entries_arena.block_size : entry_size;
+    }
+    if (counter->num_of_entries == counter->entries_capacity)
+    {
+        bytes += (counter->entries_capacity > 0 ? counter->entries_capacity
+                                                : INITIAL_ENTRIES_CAPACITY) * sizeof(PairEntry *);
+    }
+    if ((counter->num_of_entries + 1) * 2 > counter->slot_capacity)
+    {
+        bytes += (counter->slot_capacity > 0 ? counter->slot_capacity
+                                             : INITIAL_PAIR_SLOT_CAPACITY) * sizeof(int);
+    }
+    return bytes;
+}
+
+// grows the counter's arrays so they take one more entry
+static int make_room(PairCounter *counter)
+{
+    if (counter->num_of_entries == counter->entries_capacity)
+    {
+        int capacity = counter->entries_capacity > 0 ? counter->entries_capacity * 2
+                                                     : INITIAL_ENTRIES_CAPACITY;
+        PairEntry **entries = realloc(counter->entries, capacity * sizeof(PairEntry *));
+        if (entries == NULL)
+        {
+            return 1;
+        }
+        counter->entries = entries;
+        counter->entries_capacity = capacity;
+    }
+    if ((counter->num_of_entries + 1) * 2 > counter->slot_capacity)
+    {
+        int capacity = counter->slot_capacity > 0 ? counter->slot_capacity * 2
+                                                  : INITIAL_PAIR_SLOT_CAPACITY;
+        int *slots = malloc(capacity * sizeof(int));
+        if (slots == NULL)
+        {
+            return 1;
+        }
+        free(counter->slots);
+        counter->slots = slots;
+        counter->slot_capacity = capacity;
+        memset(slots, -1, capacity * sizeof(int));
+        unsigned int mask = (unsigned int) capacity - 1;
+        for (int i = 0; i < counter->num_of_entries; ++i)
+        {
+            unsigned int slot = counter->entries[i]->hash & mask;
+            while (slots[slot] != -1)
+            {
+                slot = (slot + 1) & mask;
+            }
+            slots[slot] = i;
+        }
+    }
+    return 0;
+}
+
+// counts a pair, spilling the counter to list first when the pair is new
+// and wouldn't fit in the counter's half of the budget
+static int count_pair(const ExternalBuilder *builder, PairCounter *counter, RunList *list,
+                      const char *first, uint32_t first_length,
+                      const char *second, uint32_t second_length, uint32_t count)
+{
+    unsigned int hash = hash_word(first, first_length)
+                        ^ (hash_word(second, second_length) * 2654435761u);
+    unsigned int mask = (unsigned int) counter->slot_capacity - 1;
+    if (counter->slot_capacity > 0)
+    {
+        for (unsigned int slot = hash & mask; counter->slots[slot] != -1;
+             slot = (slot + 1) & mask)
+        {
+            PairEntry *entry = counter->entries[counter->slots[slot]];
+            if (entry->hash == hash && entry->first_length == first_length
+                && entry->second_length == second_length
+                && memcmp(entry->bytes, first, first_length) == 0
+                && memcmp(entry->bytes + first_length, second, second_length) == 0)
+            {
+                entry->count += count;
+                return 0;
+            }
+        }
+    }
+
+    size_t entry_size = sizeof(PairEntry) + first_length + second_length;
+    if (counter->num_of_entries > 0
+        && counter_bytes_with(counter, entry_size) > builder->memory_budget / 2
+        && spill_counter(builder, counter, list) == 1)
+    {
+        return 1;
+    }
+    if (make_room(counter) == 1)
+    {
+        return 1;
+    }
+    PairEntry *entry = arena_alloc(&counter->entries_arena, entry_size, _Alignof(PairEntry));
+    if (entry == NULL)
+    {
+        return 1;
+    }
+    entry->count = count;
+    entry->first_length = first_length;
+    entry->second_length = second_length;
+    entry->hash = hash;
+    memcpy(entry->bytes, first, first_length);
+    memcpy(entry->bytes + first_length, second, second_length);
+    mask = (unsigned int) counter->slot_capacity - 1;
+    unsigned int slot = hash & mask;
+    while (counter->slots[slot] != -1)
+    {
+        slot = (slot + 1) & mask;
+    }
+    counter->slots[slot] = counter->num_of_entries;
+    counter->entries[counter->num_of_entries++] = entry;
+    return 0;
+}
+
+
+// ---- the builder ----
+
+int init_external_builder(ExternalBuilder *builder, size_t memory_budget,
+                          const char *temp_dir)
+{
+    if (temp_dir == NULL)
+    {
+        temp_dir = getenv("TMPDIR");
+    }
+    builder->memory_budget = memory_budget < MIN_MEMORY_BUDGET ? MIN_MEMORY_BUDGET
+                                                               : memory_budget;
+    builder->temp_dir = strdup(temp_dir != NULL && temp_dir[0] != '\0' ? temp_dir : "/tmp");
+    init_pair_counter(&builder->counter, builder->memory_budget);
+    builder->runs = (RunList) {NULL, 0, 0};
+    return builder->temp_dir == NULL;
+}
+
+int add_corpus_to_builder(ExternalBuilder *builder, Tokenizer *tokenizer,
+                          int words_to_read)
+{
+    // the token's text may be gone after the next token, so the word before
+    // is kept here
+    char *previous = NULL;
+    size_t previous_capacity = 0;
+    uint32_t previous_length = 0;
+    int has_previous = 0;
+    Token token;
+    int failed = 0;
+
+    for (int words_read = 0; !failed && words_read < words_to_read
+                             && next_token(tokenizer, &token); ++words_read)
+    {
+        uint32_t length = (uint32_t) token.length;
+        int ends_sentence = token.start[token.length - 1] == '.';
+        // the word's own record counts the sentences it starts, the way
+        // add_sentence_start does
+        uint32_t starts = (!has_previous || token.starts_line) && !ends_sentence;
+        failed = count_pair(builder, &builder->counter, &builder->runs,
+                            token.start, length, "", 0, starts);
+        // we don't add the first word of a line or of a sentence as a successor
+        if (!failed && has_previous && !token.starts_line)
+        {
+            failed = count_pair(builder, &builder->counter, &builder->runs,
+                                previous, previous_length, token.start, length, 1);
+        }
+        has_previous = !ends_sentence;
+        if (!failed && has_previous)
+        {
+            failed = reserve_bytes(&previous, &previous_capacity, length);
+            if (!failed)
+            {
+                memcpy(previous, token.start, length);
+                previous_length = length;
+            }
+        }
+    }
+    free(previous);
+    return failed || tokenizer->failed;
+}
+
+int add_run_file_to_builder(ExternalBuilder *builder, const char *path)
+{
+    RunReader reader;
+    int failed = open_run_reader(&reader, path);
+    close_run_reader(&reader);
+    char *copy = failed ? NULL : strdup(path);
+    if (copy == NULL || add_run(&builder->runs, copy, 0) == 1)
+    {
+        free(copy);
+        return 1;
+    }
+    return 0;
+}
+
+int write_builder_runs(ExternalBuilder *builder, const char *path)
+{
+    if (spill_counter(builder, &builder->counter, &builder->runs) == 1
+        || reduce_runs(builder, &builder->runs) == 1)
+    {
+        return 1;
+    }
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        return 1;
+    }
+    int failed = merge_into_file(builder->runs.runs, builder->runs.num_of_runs, file);
+    failed |= fclose(file) != 0;
+    free_run_list(&builder->runs);
+    return failed;
+}
+
+/**
+ * One section of the model file, written through its own buffer.
+ */
+typedef struct SectionWriter {
+    FILE *file;
+} SectionWriter;
+
+static int open_section(SectionWriter *section, const char *path, long offset)
+{
+    section->file = fopen(path, "r+b");
+    if (section->file == NULL)
+    {
+        return 1;
+    }
+    setvbuf(section->file, NULL, _IOFBF, SECTION_BUFFER_SIZE);
+    return fseek(section->file, offset, SEEK_SET) != 0;
+}
+
+static int write_section_u32(SectionWriter *section, uint32_t value)
+{
+    return fwrite(&value, sizeof(value), 1, section->file) != 1;
+}
+
+static int close_section(SectionWriter *section)
+{
+    return section->file != NULL && fclose(section->file) != 0;
+}
+
+// the rank of a word as a key that sorts like the number
+static void encode_rank(uint32_t rank, char *key)
+{
+    key[0] = (char) (rank >> 24);
+    key[1] = (char) (rank >> 16);
+    key[2] = (char) (rank >> 8);
+    key[3] = (char) rank;
+}
+
+static uint32_t decode_rank(const char *key)
+{
+    const unsigned char *bytes = (const unsigned char *) key;
+    return (uint32_t) bytes[0] << 24 | (uint32_t) bytes[1] << 16
+           | (uint32_t) bytes[2] << 8 | bytes[3];
+}
+
+// the sizes of the model, counted while splitting the pairs
+typedef struct ModelSizes {
+    uint32_t word_count;
+    uint32_t edge_count;
+    uint32_t strings_size;
+    uint32_t start_count;
+} ModelSizes;
+
+// first pass over the merged pairs: the sorted vocabulary goes to
+// vocabulary (the word number is the position, the count is how many
+// sentences the word starts), and every pair is counted
+// again keyed by its second word, into by_target
+static int split_pairs(ExternalBuilder *builder, FILE *vocabulary, RunList *by_target,
+                       ModelSizes *sizes)
+{
+    RunMerger merger;
+    if (open_run_merger(&merger, builder->runs.runs, builder->runs.num_of_runs) == 1)
+    {
+        return 1;
+    }
+    int failed = write_run_header(vocabulary);
+    while (!failed && next_merged_record(&merger))
+    {
+        const RunRecord *record = &merger.record;
+        // a word comes before all its pairs, the empty word sorts first
+        if (record->second_length == 0)
+        {
+            RunRecord word = {record->first, record->first_length, "", 0, record->count};
+            failed = write_run_record(vocabulary, &word);
+            sizes->word_count++;
+            sizes->strings_size += record->first_length + 1;
+            sizes->start_count += record->count > 0;
+        }
+        else
+        {
+            failed = count_pair(builder, &builder->counter, by_target,
+                                record->second, record->second_length,
+                                record->first, record->first_length, record->count);
+            sizes->edge_count++;
+        }
+    }
+    failed |= merger.failed;
+    close_run_merger(&merger);
+    return failed || spill_counter(builder, &builder->counter, by_target);
+}
+
+// second pass: the pairs keyed by second word are walked together with the
+// vocabulary to swap the second word for its number, and counted again
+// keyed by (first word, number), into by_source
+static int number_targets(ExternalBuilder *builder, const char *vocabulary_path,
+                          RunList *by_target, RunList *by_source)
+{
+    RunReader vocabulary;
+    RunMerger merger;
+    if (open_run_reader(&vocabulary, vocabulary_path) == 1)
+    {
+        close_run_reader(&vocabulary);
+        return 1;
+    }
+    if (open_run_merger(&merger, by_target->runs, by_target->num_of_runs) == 1)
+    {
+        close_run_reader(&vocabulary);
+        return 1;
+    }
+    uint32_t rank = 0;
+    int failed = 0;
+    while (!failed && next_merged_record(&merger))
+    {
+        const RunRecord *record = &merger.record;
+        while (vocabulary.has_record
+               && compare_bytes(vocabulary.record.first, vocabulary.record.first_length,
+                                record->first, record->first_length) < 0)
+        {
+            read_run_record(&vocabulary);
+            rank++;
+        }
+        // every word of a pair is in the vocabulary
+        failed = !vocabulary.has_record;
+        char key[4];
+        encode_rank(rank, key);
+        failed = failed || count_pair(builder, &builder->counter, by_source,
+                                      record->second, record->second_length,
+                                      key, sizeof(key), record->count);
+    }
+    failed |= merger.failed | vocabulary.failed;
+    close_run_merger(&merger);
+    close_run_reader(&vocabulary);
+    return failed || spill_counter(builder, &builder->counter, by_source);
+}
+
+// last pass: the vocabulary and the numbered pairs, both sorted by first
+// word, are written out as the sections of the model file
+static int write_model_sections(const char *path, const char *vocabulary_path,
+                                const RunList *by_source, const ModelSizes *sizes)
+{
+    long words_offset = sizeof(ModelFileHeader);
+    long edges_offset = words_offset + ((long) sizes->word_count + 1) * sizeof(uint32_t);
+    long targets_offset = edges_offset + ((long) sizes->word_count + 1) * sizeof(uint32_t);
+    long weights_offset = targets_offset + (long) sizes->edge_count * sizeof(uint32_t);
+    long start_words_offset = weights_offset + (long) sizes->edge_count * sizeof(uint32_t);
+    long start_weights_offset = start_words_offset
+                                + (long) sizes->start_count * sizeof(uint32_t);
+    long strings_offset = start_weights_offset
+                          + (long) sizes->start_count * sizeof(uint32_t);
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        return 1;
+    }
+    ModelFileHeader header = {MODEL_FILE_MAGIC, MODEL_FILE_VERSION, sizes->word_count,
+                              sizes->edge_count, sizes->strings_size, sizes->start_count,
+                              {0, 0}};
+    int failed = fwrite(&header, sizeof(header), 1, file) != 1;
+    failed |= fclose(file) != 0;
+
+    SectionWriter words = {NULL}, edges = {NULL}, targets = {NULL}, weights = {NULL},
+                  start_words = {NULL}, start_weights = {NULL}, strings = {NULL};
+    RunReader vocabulary;
+    RunMerger merger;
+    failed = failed || open_section(&words, path, words_offset)
+             || open_section(&edges, path, edges_offset)
+             || open_section(&targets, path, targets_offset)
+             || open_section(&weights, path, weights_offset)
+             || open_section(&start_words, path, start_words_offset)
+             || open_section(&start_weights, path, start_weights_offset)
+             || open_section(&strings, path, strings_offset);
+    int has_vocabulary = !failed && open_run_reader(&vocabulary, vocabulary_path) == 0;
+    int has_merger = has_vocabulary
+                     && open_run_merger(&merger, by_source->runs, by_source->num_of_runs) == 0;
+    failed |= !has_merger;
+
+    uint32_t word_offset = 0;
+    uint32_t edge_offset = 0;
+    uint32_t word_index = 0;
+    uint32_t accumulated_starts = 0;
+    int has_edge = has_merger && next_merged_record(&merger);
+    while (!failed && vocabulary.has_record)
+    {
+        const RunRecord *word = &vocabulary.record;
+        failed = write_section_u32(&words, word_offset)
+                 || write_section_u32(&edges, edge_offset)
+                 || fwrite(word->first, 1, word->first_length, strings.file)
+                    != word->first_length
+                 || fputc('\0', strings.file) == EOF;
+        word_offset += word->first_length + 1;
+        if (!failed && word->count > 0)
+        {
+            accumulated_starts += word->count;
+            failed = write_section_u32(&start_words, word_index)
+                     || write_section_u32(&start_weights, accumulated_starts);
+        }
+        word_index++;
+
+        // the pairs of the word, as running sums of their counts
+        uint32_t accumulated_frequency = 0;
+        while (!failed && has_edge
+               && compare_bytes(merger.record.first, merger.record.first_length,
+                                word->first, word->first_length) == 0)
+        {
+            accumulated_frequency += merger.record.count;
+            failed = write_section_u32(&targets, decode_rank(merger.record.second))
+                     || write_section_u32(&weights, accumulated_frequency);
+            edge_offset++;
+            has_edge = next_merged_record(&merger);
+        }
+        read_run_record(&vocabulary);
+    }
+    failed = failed || write_section_u32(&words, word_offset)
+             || write_section_u32(&edges, edge_offset)
+             || edge_offset != sizes->edge_count || has_edge;
+    if (has_merger)
+    {
+        failed |= merger.failed;
+        close_run_merger(&merger);
+    }
+    if (has_vocabulary)
+    {
+        failed |= vocabulary.failed;
+    }
+    close_run_reader(&vocabulary);
+    SectionWriter *sections[] = {&words, &edges, &targets, &weights, &start_words,
+                                 &start_weights, &strings};
+    for (int i = 0; i < 7; ++i)
+    {
+        failed |= close_section(sections[i]);
+    }
+    return failed;
+}
+
+int write_builder_model(ExternalBuilder *builder, const char *path)
+{
+    RunList by_target = {NULL, 0, 0};
+    RunList by_source = {NULL, 0, 0};
+    RunList vocabulary = {NULL, 0, 0};
+    ModelSizes sizes = {0, 0, 0, 0};
+    char *vocabulary_path = NULL;
+    FILE *vocabulary_file = NULL;
+
+    int failed = spill_counter(builder, &builder->counter, &builder->runs)
+                 || reduce_runs(builder, &builder->runs);
+    if (!failed)
+    {
+        vocabulary_file = create_run_file(builder, &vocabulary_path);
+        failed = vocabulary_file == NULL;
+    }
+    if (!failed)
+    {
+        failed = split_pairs(builder, vocabulary_file, &by_target, &sizes);
+        failed |= fclose(vocabulary_file) != 0;
+        failed |= add_run(&vocabulary, vocabulary_path, 1);
+        if (failed && vocabulary.num_of_runs == 0)
+        {
+            unlink(vocabulary_path);
+            free(vocabulary_path);
+        }
+    }
+    // the pairs are in by_target now
+    free_run_list(&builder->runs);
+
+    failed = failed || reduce_runs(builder, &by_target)
+             || number_targets(builder, vocabulary_path, &by_target, &by_source);
+    free_run_list(&by_target);
+    failed = failed || reduce_runs(builder, &by_source)
+             || write_model_sections(path, vocabulary_path, &by_source, &sizes);
+    free_run_list(&by_source);
+    free_run_list(&vocabulary);
+    return failed;
+}
+
+void free_external_builder(ExternalBuilder *builder)
+{
+    free_pair_counter(&builder->counter);
+    free_run_list(&builder->runs);
+    free(builder->temp_dir);
+}
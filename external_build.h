@@ -0,0 +1,121 @@
+#ifndef _EXTERNAL_BUILD_H_
+#define _EXTERNAL_BUILD_H_
+
+#include "arena.h"
+#include "tokenizer.h"
+#include <stdint.h>
+#include <stddef.h> // For size_t
+
+#define RUN_FILE_MAGIC 0x524B564Du // "MKVR"
+#define RUN_FILE_VERSION 1u
+
+// the smallest memory budget a builder works with
+#define MIN_MEMORY_BUDGET (1 << 20)
+// every run file being merged is read through a buffer this big
+#define RUN_READ_BUFFER_SIZE (1 << 16)
+
+// Builds a model file (see model_file.h) out of corpora of any size in a
+// bounded amount of memory. The pairs of words (and every word on its own)
+// are counted in memory until the budget is used up, then sorted and
+// spilled to a run file: a run file header and then records of
+//   uint32_t first_length, second_length, count, then the bytes of both
+// sorted by (first, second) with no key twice. Merging the runs sums the
+// counts of equal keys. A run file of a corpus can be kept (a shard) and
+// merged with other shards later, instead of reading the corpora again.
+//
+// The words of the model are numbered in sorted order (not in the order
+// they first appear, like save_markov_chain does), so the tweets differ
+// from those of the in memory chain, but the transitions and their counts
+// are the same.
+
+/**
+ * A run file, made by the builder (deleted when done) or given to it.
+ */
+typedef struct RunFile {
+    char *path;
+    int owned;
+} RunFile;
+
+typedef struct RunList {
+    RunFile *runs;
+    int num_of_runs;
+    int runs_capacity;
+} RunList;
+
+/**
+ * Counts pairs in memory: an arena of entries and an open addressing index
+ * over them.
+ */
+typedef struct PairCounter {
+    Arena entries_arena;
+    struct PairEntry **entries;
+    int num_of_entries;
+    int entries_capacity;
+    int *slots;
+    int slot_capacity;
+} PairCounter;
+
+typedef struct ExternalBuilder {
+    size_t memory_budget;
+    // where the run files are made
+    char *temp_dir;
+    PairCounter counter;
+    // runs of pairs (and words) read so far, not merged yet
+    RunList runs;
+} ExternalBuilder;
+
+/**
+ * Initialize a builder with nothing counted.
+ * @param builder the builder to initialize
+ * @param memory_budget bytes the builder may use (at least
+ * MIN_MEMORY_BUDGET)
+ * @param temp_dir directory for the run files, NULL for $TMPDIR or /tmp
+ * @return 0 on success, 1 in case of allocation error.
+ */
+int init_external_builder(ExternalBuilder *builder, size_t memory_budget,
+                          const char *temp_dir);
+
+/**
+ * Count the words and pairs of a corpus, by the same rules as
+ * fill_database_from_tokenizer (no pair across lines or after a word that
+ * ends a sentence).
+ * @param builder the builder
+ * @param tokenizer the tokenizer to read the words from
+ * @param words_to_read stop after this many words
+ * @return 0 on success, 1 on failure.
+ */
+int add_corpus_to_builder(ExternalBuilder *builder, Tokenizer *tokenizer,
+                          int words_to_read);
+
+/**
+ * Add the counts of a run file written by write_builder_runs (a shard).
+ * @param builder the builder
+ * @param path the run file, read when the builder writes its output
+ * @return 0 on success, 1 if it's not a run file or out of memory.
+ */
+int add_run_file_to_builder(ExternalBuilder *builder, const char *path);
+
+/**
+ * Write everything counted so far into one run file (a shard), for
+ * add_run_file_to_builder to add to another builder later.
+ * @param builder the builder, left with nothing counted
+ * @param path where to write the run file
+ * @return 0 on success, 1 on failure.
+ */
+int write_builder_runs(ExternalBuilder *builder, const char *path);
+
+/**
+ * Write everything counted so far as a model file.
+ * @param builder the builder, left with nothing counted
+ * @param path where to write the model
+ * @return 0 on success, 1 on failure.
+ */
+int write_builder_model(ExternalBuilder *builder, const char *path);
+
+/**
+ * Free the builder and delete the run files it made.
+ * @param builder the builder to free
+ */
+void free_external_builder(ExternalBuilder *builder);
+
+#endif //_EXTERNAL_BUILD_H_
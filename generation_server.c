@@ -0,0 +1,840 @@
+#define _GNU_SOURCE // For accept4()
+#include "generation_server.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define MAX_EVENTS 64
+#define LISTEN_BACKLOG 128
+#define INITIAL_BUFFER_SIZE 4096
+// a connection is not read while this much of its input waits to be parsed
+#define MAX_PENDING_INPUT (1 << 16)
+#define OUT_OF_MEMORY_RESPONSE "ERR out of memory\n"
+
+/**
+ * A client, owned by the event loop. A dropped connection whose request is
+ * still with the workers (fd -1, busy) is freed when the answer comes back.
+ */
+typedef struct ServerConnection {
+    int fd;
+    // received text not parsed yet
+    char *input;
+    size_t input_length;
+    size_t input_capacity;
+    // text to send, output_sent of it already sent
+    char *output;
+    size_t output_length;
+    size_t output_sent;
+    size_t output_capacity;
+    // the client sent everything it will
+    int input_closed;
+    // request is with the workers
+    int busy;
+    ServerRequest request;
+    // what the connection is registered for in epoll
+    uint32_t events;
+    struct ServerConnection *previous;
+    struct ServerConnection *next;
+} ServerConnection;
+
+// grows a buffer so it holds at least needed bytes
+static int reserve_buffer(char **buffer, size_t *capacity, size_t needed)
+{
+    if (needed <= *capacity)
+    {
+        return 0;
+    }
+    size_t new_capacity = *capacity == 0 ? INITIAL_BUFFER_SIZE : *capacity;
+    while (new_capacity < needed)
+    {
+        new_capacity *= 2;
+    }
+    char *new_buffer = realloc(*buffer, new_capacity);
+    if (new_buffer == NULL)
+    {
+        return 1;
+    }
+    *buffer = new_buffer;
+    *capacity = new_capacity;
+    return 0;
+}
+
+// adds text to the end of a request's response
+static int append_response(ServerRequest *request, const char *text, size_t length)
+{
+    if (reserve_buffer(&request->response, &request->response_capacity,
+                       request->response_length + length) == 1)
+    {
+        return 1;
+    }
+    memcpy(request->response + request->response_length, text, length);
+    request->response_length += length;
+    return 0;
+}
+
+// the worker side: generates the tweets of a request into its response (an
+// empty response means allocation failed)
+static void answer_request(const Markov *model, ServerRequest *request,
+                           TweetBatch *batch)
+{
+    RandomState random_state;
+    seed_random_state(&random_state, request->seed);
+    clear_tweet_batch(batch);
+    int status = request->start_length == 0
+                 ? markov_generate(model, request->num_of_tweets, request->max_length,
+                                   batch, &random_state)
+                 : markov_generate_from(model, request->start_word, request->start_length,
+                                        request->num_of_tweets, request->max_length,
+                                        batch, &random_state);
+
+    char header[64];
+    request->response_length = 0;
+    if (status != MARKOV_OK)
+    {
+        const char *message = markov_strerror(status);
+        if (append_response(request, "ERR ", 4) == 1
+            || append_response(request, message, strlen(message)) == 1
+            || append_response(request, "\n", 1) == 1)
+        {
+            request->response_length = 0;
+        }
+        return;
+    }
+    int header_length = snprintf(header, sizeof(header), "OK %d\n", batch->num_of_tweets);
+    size_t needed = (size_t) header_length + batch->text_length + batch->num_of_tweets;
+    if (reserve_buffer(&request->response, &request->response_capacity, needed) == 1)
+    {
+        return;
+    }
+    append_response(request, header, (size_t) header_length);
+    for (int i = 0; i < batch->num_of_tweets; ++i)
+    {
+        const TweetSpan *tweet = &batch->tweets[i];
+        append_response(request, batch->text + tweet->offset, tweet->length);
+        append_response(request, "\n", 1);
+    }
+}
+
+// thread body of a worker: answers batches of requests until the server stops
+static void *serve_requests(void *arg)
+{
+    GenerationServer *server = (GenerationServer *) arg;
+    TweetBatch batch;
+    int has_batch = init_tweet_batch(&batch) == 0;
+    ServerRequest *taken[SERVER_WORKER_BATCH];
+    for (;;)
+    {
+        pthread_mutex_lock(&server->lock);
+        while (server->queue_first == NULL && !server->stopping)
+        {
+            pthread_cond_wait(&server->has_requests, &server->lock);
+        }
+        if (server->stopping)
+        {
+            pthread_mutex_unlock(&server->lock);
+            break;
+        }
+        // an even share of the queue, so a burst spreads over all the workers
+        int share = server->queue_length / server->num_of_workers;
+        int num_of_taken = 0;
+        while (server->queue_first != NULL && num_of_taken < SERVER_WORKER_BATCH
+               && (num_of_taken == 0 || num_of_taken < share))
+        {
+            taken[num_of_taken++] = server->queue_first;
+            server->queue_first = server->queue_first->next;
+        }
+        if (server->queue_first == NULL)
+        {
+            server->queue_last = NULL;
+        }
+        server->queue_length -= num_of_taken;
+        pthread_mutex_unlock(&server->lock);
+
+        for (int i = 0; i < num_of_taken; ++i)
+        {
+            if (has_batch)
+            {
+                answer_request(server->model, taken[i], &batch);
+            }
+            else
+            {
+                taken[i]->response_length = 0;
+            }
+        }
+
+        pthread_mutex_lock(&server->lock);
+        for (int i = 0; i < num_of_taken; ++i)
+        {
+            taken[i]->next = server->answered;
+            server->answered = taken[i];
+        }
+        pthread_mutex_unlock(&server->lock);
+        uint64_t one = 1;
+        if (write(server->done_fd, &one, sizeof(one)) == -1)
+        {
+            // the counter can't overflow in practice, and the loop drains it
+        }
+    }
+    if (has_batch)
+    {
+        free_tweet_batch(&batch);
+    }
+    return NULL;
+}
+
+// parses "GEN <count> <seed> <max_length> [start_word]" into request,
+// returns NULL if it's valid or else what is wrong with it
+static const char *parse_request(const char *line, size_t length,
+                                 ServerRequest *request)
+{
+    char text[SERVER_MAX_REQUEST_LENGTH + 1];
+    memcpy(text, line, length);
+    text[length] = '\0';
+    char *fields[6];
+    int num_of_fields = 0;
+    char *save;
+    for (char *field = strtok_r(text, " \t", &save); field != NULL && num_of_fields < 6;
+         field = strtok_r(NULL, " \t", &save))
+    {
+        fields[num_of_fields++] = field;
+    }
+    if (num_of_fields == 0 || strcmp(fields[0], "GEN") != 0)
+    {
+        return "unknown request";
+    }
+    if (num_of_fields < 4 || num_of_fields > 5)
+    {
+        return "usage: GEN <count> <seed> <max_length> [start_word]";
+    }
+    char *end;
+    long count = strtol(fields[1], &end, 10);
+    if (*end != '\0' || count < 1 || count > SERVER_MAX_TWEETS)
+    {
+        return "invalid count";
+    }
+    errno = 0;
+    unsigned long long seed = strtoull(fields[2], &end, 10);
+    if (*end != '\0' || errno != 0)
+    {
+        return "invalid seed";
+    }
+    long max_length = strtol(fields[3], &end, 10);
+    if (*end != '\0' || max_length < 1 || max_length > SERVER_MAX_TWEET_LENGTH)
+    {
+        return "invalid max_length";
+    }
+    request->num_of_tweets = (int) count;
+    request->seed = seed;
+    request->max_length = (int) max_length;
+    request->start_length = num_of_fields == 5 ? strlen(fields[4]) : 0;
+    memcpy(request->start_word, num_of_fields == 5 ? fields[4] : "",
+           request->start_length + 1);
+    return NULL;
+}
+
+// adds text to what the connection sends next
+static int append_output(ServerConnection *connection, const char *text, size_t length)
+{
+    // drop what was already sent first, instead of growing past it
+    if (connection->output_sent > 0)
+    {
+        memmove(connection->output, connection->output + connection->output_sent,
+                connection->output_length - connection->output_sent);
+        connection->output_length -= connection->output_sent;
+        connection->output_sent = 0;
+    }
+    if (reserve_buffer(&connection->output, &connection->output_capacity,
+                       connection->output_length + length) == 1)
+    {
+        return 1;
+    }
+    memcpy(connection->output + connection->output_length, text, length);
+    connection->output_length += length;
+    return 0;
+}
+
+// sends as much of the output as the socket takes, returns 1 if the client
+// is gone
+static int flush_output(ServerConnection *connection)
+{
+    while (connection->output_sent < connection->output_length)
+    {
+        ssize_t sent = send(connection->fd, connection->output + connection->output_sent,
+                            connection->output_length - connection->output_sent,
+                            MSG_NOSIGNAL);
+        if (sent > 0)
+        {
+            connection->output_sent += (size_t) sent;
+        }
+        else if (errno == EINTR)
+        {
+            continue;
+        }
+        else
+        {
+            return errno != EAGAIN && errno != EWOULDBLOCK;
+        }
+    }
+    connection->output_sent = 0;
+    connection->output_length = 0;
+    return 0;
+}
+
+// reads everything the socket has (up to MAX_PENDING_INPUT waiting), returns
+// 1 if the connection failed
+static int read_input(ServerConnection *connection)
+{
+    while (!connection->input_closed && connection->input_length < MAX_PENDING_INPUT)
+    {
+        if (reserve_buffer(&connection->input, &connection->input_capacity,
+                           connection->input_length + INITIAL_BUFFER_SIZE) == 1)
+        {
+            return 1;
+        }
+        ssize_t received = read(connection->fd, connection->input + connection->input_length,
+                                connection->input_capacity - connection->input_length);
+        if (received > 0)
+        {
+            connection->input_length += (size_t) received;
+        }
+        else if (received == 0)
+        {
+            connection->input_closed = 1;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            break;
+        }
+        else if (errno != EINTR)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// hands the connection's next request to the workers (through requests,
+// which the loop queues all at once), answering bad requests right away.
+// returns 1 if out of memory
+static int dispatch_requests(ServerConnection *connection, ServerRequest **requests)
+{
+    while (!connection->busy
+           && connection->output_length - connection->output_sent < SERVER_MAX_PENDING_OUTPUT)
+    {
+        char *newline = memchr(connection->input, '\n', connection->input_length);
+        if (newline == NULL)
+        {
+            if (connection->input_length > SERVER_MAX_REQUEST_LENGTH)
+            {
+                // nothing sensible can follow, answer and hang up
+                connection->input_length = 0;
+                connection->input_closed = 1;
+                return append_output(connection, "ERR request too long\n", 21);
+            }
+            return 0;
+        }
+        size_t line_length = (size_t) (newline - connection->input);
+        size_t consumed = line_length + 1;
+        if (line_length > 0 && connection->input[line_length - 1] == '\r')
+        {
+            line_length--;
+        }
+        const char *problem = line_length > SERVER_MAX_REQUEST_LENGTH
+                              ? "request too long"
+                              : parse_request(connection->input, line_length,
+                                              &connection->request);
+        memmove(connection->input, connection->input + consumed,
+                connection->input_length - consumed);
+        connection->input_length -= consumed;
+
+        if (problem != NULL)
+        {
+            if (append_output(connection, "ERR ", 4) == 1
+                || append_output(connection, problem, strlen(problem)) == 1
+                || append_output(connection, "\n", 1) == 1)
+            {
+                return 1;
+            }
+            continue;
+        }
+        connection->busy = 1;
+        connection->request.next = *requests;
+        *requests = &connection->request;
+    }
+    return 0;
+}
+
+// forgets the connection: it's freed now if the workers don't have its
+// request, or else when the answer comes back
+static void drop_connection(GenerationServer *server, ServerConnection *connection,
+                            ServerConnection **dropped)
+{
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+    close(connection->fd);
+    connection->fd = -1;
+    if (connection->previous != NULL)
+    {
+        connection->previous->next = connection->next;
+    }
+    else
+    {
+        server->connections = connection->next;
+    }
+    if (connection->next != NULL)
+    {
+        connection->next->previous = connection->previous;
+    }
+    // freeing waits for the end of the round of events, which may still
+    // mention the connection
+    if (!connection->busy)
+    {
+        connection->next = *dropped;
+        *dropped = connection;
+    }
+}
+
+static void free_connection(ServerConnection *connection)
+{
+    free(connection->input);
+    free(connection->output);
+    free(connection->request.response);
+    free(connection);
+}
+
+// moves a connection on after anything happened to it: dispatches its next
+// request, sends what it can and closes it once it's done
+static void advance_connection(GenerationServer *server, ServerConnection *connection,
+                               ServerRequest **requests, ServerConnection **dropped)
+{
+    if (dispatch_requests(connection, requests) == 1 || flush_output(connection) == 1)
+    {
+        drop_connection(server, connection, dropped);
+        return;
+    }
+    int has_output = connection->output_sent < connection->output_length;
+    if (connection->input_closed && !connection->busy && !has_output
+        && memchr(connection->input, '\n', connection->input_length) == NULL)
+    {
+        drop_connection(server, connection, dropped);
+        return;
+    }
+
+    uint32_t events = (has_output ? EPOLLOUT : 0)
+                      | (!connection->input_closed
+                         && connection->input_length < MAX_PENDING_INPUT ? EPOLLIN : 0);
+    if (events != connection->events)
+    {
+        struct epoll_event event = {.events = events, .data.ptr = connection};
+        if (epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, connection->fd, &event) == -1)
+        {
+            drop_connection(server, connection, dropped);
+            return;
+        }
+        connection->events = events;
+    }
+}
+
+// accepts every waiting client
+static void accept_connections(GenerationServer *server)
+{
+    for (;;)
+    {
+        int fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            // no one else is waiting (or out of descriptors, retried when
+            // the next client knocks)
+            return;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        ServerConnection *connection = calloc(1, sizeof(ServerConnection));
+        if (connection == NULL)
+        {
+            close(fd);
+            continue;
+        }
+        connection->fd = fd;
+        connection->events = EPOLLIN;
+        connection->request.connection = connection;
+        struct epoll_event event = {.events = EPOLLIN, .data.ptr = connection};
+        if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+        {
+            close(fd);
+            free(connection);
+            continue;
+        }
+        connection->next = server->connections;
+        if (server->connections != NULL)
+        {
+            server->connections->previous = connection;
+        }
+        server->connections = connection;
+    }
+}
+
+// gives the answered requests back to their connections
+static void deliver_answers(GenerationServer *server, ServerRequest **requests,
+                            ServerConnection **dropped)
+{
+    uint64_t count;
+    if (read(server->done_fd, &count, sizeof(count)) == -1)
+    {
+        // nothing new, another round already took the answers
+    }
+    pthread_mutex_lock(&server->lock);
+    ServerRequest *answered = server->answered;
+    server->answered = NULL;
+    pthread_mutex_unlock(&server->lock);
+
+    while (answered != NULL)
+    {
+        ServerRequest *request = answered;
+        answered = answered->next;
+        ServerConnection *connection = request->connection;
+        connection->busy = 0;
+        if (connection->fd == -1)
+        {
+            connection->next = *dropped;
+            *dropped = connection;
+            continue;
+        }
+        int failed;
+        if (request->response_length == 0)
+        {
+            failed = append_output(connection, OUT_OF_MEMORY_RESPONSE,
+                                   strlen(OUT_OF_MEMORY_RESPONSE));
+        }
+        else if (connection->output_sent == connection->output_length)
+        {
+            // nothing else to send, so the response itself becomes the output
+            char *output = connection->output;
+            size_t output_capacity = connection->output_capacity;
+            connection->output = request->response;
+            connection->output_capacity = request->response_capacity;
+            connection->output_length = request->response_length;
+            connection->output_sent = 0;
+            request->response = output;
+            request->response_capacity = output_capacity;
+            failed = 0;
+        }
+        else
+        {
+            failed = append_output(connection, request->response, request->response_length);
+        }
+        if (failed)
+        {
+            drop_connection(server, connection, dropped);
+            continue;
+        }
+        advance_connection(server, connection, requests, dropped);
+    }
+}
+
+// puts the requests dispatched in a round at the end of the queue, all at once
+static void queue_requests(GenerationServer *server, ServerRequest *requests)
+{
+    if (requests == NULL)
+    {
+        return;
+    }
+    // they were collected newest first
+    ServerRequest *reversed = NULL;
+    ServerRequest *last = requests;
+    int count = 0;
+    while (requests != NULL)
+    {
+        ServerRequest *next = requests->next;
+        requests->next = reversed;
+        reversed = requests;
+        requests = next;
+        count++;
+    }
+    pthread_mutex_lock(&server->lock);
+    if (server->queue_last != NULL)
+    {
+        server->queue_last->next = reversed;
+    }
+    else
+    {
+        server->queue_first = reversed;
+    }
+    server->queue_last = last;
+    server->queue_length += count;
+    if (count == 1)
+    {
+        pthread_cond_signal(&server->has_requests);
+    }
+    else
+    {
+        pthread_cond_broadcast(&server->has_requests);
+    }
+    pthread_mutex_unlock(&server->lock);
+}
+
+// fills address with where an address string points, returns its length
+// (0 if invalid)
+static socklen_t resolve_address(const char *address, struct sockaddr_storage *storage)
+{
+    memset(storage, 0, sizeof(*storage));
+    if (address[0] != '\0' && strspn(address, "0123456789") == strlen(address))
+    {
+        long port = strtol(address, NULL, 10);
+        if (port < 1 || port > 65535)
+        {
+            errno = EINVAL;
+            return 0;
+        }
+        struct sockaddr_in *internet = (struct sockaddr_in *) storage;
+        internet->sin_family = AF_INET;
+        internet->sin_port = htons((uint16_t) port);
+        internet->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        return sizeof(struct sockaddr_in);
+    }
+    struct sockaddr_un *local = (struct sockaddr_un *) storage;
+    if (strlen(address) >= sizeof(local->sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return 0;
+    }
+    local->sun_family = AF_UNIX;
+    strcpy(local->sun_path, address);
+    return sizeof(struct sockaddr_un);
+}
+
+// registers one of the server's own descriptors in epoll, marked by its field
+static int watch_server_fd(GenerationServer *server, int *fd)
+{
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = fd};
+    return epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, *fd, &event) == -1;
+}
+
+int open_generation_server(GenerationServer *server, const Markov *model,
+                           const char *address, int num_of_workers)
+{
+    memset(server, 0, sizeof(GenerationServer));
+    server->model = model;
+    server->listen_fd = server->epoll_fd = server->done_fd = server->stop_fd = -1;
+    pthread_mutex_init(&server->lock, NULL);
+    pthread_cond_init(&server->has_requests, NULL);
+
+    struct sockaddr_storage storage;
+    socklen_t length = resolve_address(address, &storage);
+    if (length == 0)
+    {
+        close_generation_server(server);
+        return 1;
+    }
+    server->listen_fd = socket(storage.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server->listen_fd == -1)
+    {
+        close_generation_server(server);
+        return 1;
+    }
+    if (storage.ss_family == AF_UNIX)
+    {
+        unlink(address);
+        server->socket_path = strdup(address);
+    }
+    else
+    {
+        int one = 1;
+        setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    }
+    if ((storage.ss_family == AF_UNIX && server->socket_path == NULL)
+        || bind(server->listen_fd, (struct sockaddr *) &storage, length) == -1
+        || listen(server->listen_fd, LISTEN_BACKLOG) == -1)
+    {
+        close_generation_server(server);
+        return 1;
+    }
+
+    server->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    server->done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    server->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    server->workers = malloc(num_of_workers * sizeof(pthread_t));
+    if (server->epoll_fd == -1 || server->done_fd == -1 || server->stop_fd == -1
+        || server->workers == NULL
+        || watch_server_fd(server, &server->listen_fd) == 1
+        || watch_server_fd(server, &server->done_fd) == 1
+        || watch_server_fd(server, &server->stop_fd) == 1)
+    {
+        close_generation_server(server);
+        return 1;
+    }
+    // the share of a worker is counted with the number of workers asked for
+    server->num_of_workers = num_of_workers;
+    for (int i = 0; i < num_of_workers; ++i)
+    {
+        if (pthread_create(&server->workers[i], NULL, serve_requests, server) != 0)
+        {
+            server->num_of_workers = i;
+            close_generation_server(server);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int run_generation_server(GenerationServer *server)
+{
+    struct epoll_event events[MAX_EVENTS];
+    for (;;)
+    {
+        int num_of_events = epoll_wait(server->epoll_fd, events, MAX_EVENTS, -1);
+        if (num_of_events == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return 1;
+        }
+        ServerRequest *requests = NULL;
+        ServerConnection *dropped = NULL;
+        int stopped = 0;
+        for (int i = 0; i < num_of_events; ++i)
+        {
+            void *source = events[i].data.ptr;
+            if (source == &server->stop_fd)
+            {
+                stopped = 1;
+            }
+            else if (source == &server->listen_fd)
+            {
+                accept_connections(server);
+            }
+            else if (source == &server->done_fd)
+            {
+                deliver_answers(server, &requests, &dropped);
+            }
+            else
+            {
+                ServerConnection *connection = source;
+                // dropped earlier in this round
+                if (connection->fd == -1)
+                {
+                    continue;
+                }
+                // after a hang up nothing can be sent back either
+                if (((events[i].events & EPOLLIN) && read_input(connection) == 1)
+                    || (events[i].events & (EPOLLHUP | EPOLLERR)))
+                {
+                    drop_connection(server, connection, &dropped);
+                    continue;
+                }
+                advance_connection(server, connection, &requests, &dropped);
+            }
+        }
+        queue_requests(server, requests);
+        while (dropped != NULL)
+        {
+            ServerConnection *next = dropped->next;
+            free_connection(dropped);
+            dropped = next;
+        }
+        if (stopped)
+        {
+            return 0;
+        }
+    }
+}
+
+void stop_generation_server(GenerationServer *server)
+{
+    uint64_t one = 1;
+    if (write(server->stop_fd, &one, sizeof(one)) == -1)
+    {
+        // already stopping
+    }
+}
+
+void close_generation_server(GenerationServer *server)
+{
+    pthread_mutex_lock(&server->lock);
+    server->stopping = 1;
+    pthread_cond_broadcast(&server->has_requests);
+    pthread_mutex_unlock(&server->lock);
+    for (int i = 0; i < server->num_of_workers; ++i)
+    {
+        pthread_join(server->workers[i], NULL);
+    }
+
+    // the dropped connections that still had a request out are only known
+    // through their request
+    ServerRequest *lists[] = {server->queue_first, server->answered};
+    for (int i = 0; i < 2; ++i)
+    {
+        for (ServerRequest *request = lists[i]; request != NULL;)
+        {
+            ServerRequest *next = request->next;
+            if (request->connection->fd == -1)
+            {
+                free_connection(request->connection);
+            }
+            request = next;
+        }
+    }
+    while (server->connections != NULL)
+    {
+        ServerConnection *next = server->connections->next;
+        close(server->connections->fd);
+        free_connection(server->connections);
+        server->connections = next;
+    }
+
+    int fds[] = {server->listen_fd, server->epoll_fd, server->done_fd, server->stop_fd};
+    for (int i = 0; i < 4; ++i)
+    {
+        if (fds[i] != -1)
+        {
+            close(fds[i]);
+        }
+    }
+    if (server->socket_path != NULL)
+    {
+        unlink(server->socket_path);
+        free(server->socket_path);
+    }
+    free(server->workers);
+    pthread_mutex_destroy(&server->lock);
+    pthread_cond_destroy(&server->has_requests);
+    memset(server, 0, sizeof(GenerationServer));
+    server->listen_fd = server->epoll_fd = server->done_fd = server->stop_fd = -1;
+}
+
+int connect_to_generation_server(const char *address)
+{
+    struct sockaddr_storage storage;
+    socklen_t length = resolve_address(address, &storage);
+    if (length == 0)
+    {
+        return -1;
+    }
+    int fd = socket(storage.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *) &storage, length) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
@@ -0,0 +1,116 @@
+#ifndef _GENERATION_SERVER_H_
+#define _GENERATION_SERVER_H_
+
+#include "markov.h"
+#include <pthread.h>
+#include <stdint.h>
+
+// The protocol is one request per line, answered in the order it was sent:
+//   GEN <count> <seed> <max_length> [start_word]
+// is answered by "OK <count>" and then count lines of tweets, and anything
+// wrong by a single "ERR <message>" line. The tweets of a request only
+// depend on its seed (and on the model), the same as the command line's
+// tweets with one thread.
+
+// a request line (without its '\n') may be at most this long
+#define SERVER_MAX_REQUEST_LENGTH 1024
+// limits of a request
+#define SERVER_MAX_TWEETS 100000
+#define SERVER_MAX_TWEET_LENGTH 1000
+// a worker takes up to this many requests off the queue at once
+#define SERVER_WORKER_BATCH 32
+// a connection's next request waits while this much of its output is unsent
+#define SERVER_MAX_PENDING_OUTPUT (1 << 20)
+
+struct ServerConnection;
+
+/**
+ * One parsed request, and then its answer.
+ */
+typedef struct ServerRequest {
+    int num_of_tweets;
+    uint64_t seed;
+    int max_length;
+    // empty for random first words
+    char start_word[SERVER_MAX_REQUEST_LENGTH + 1];
+    size_t start_length;
+    // the answer, written by a worker
+    char *response;
+    size_t response_length;
+    size_t response_capacity;
+    struct ServerConnection *connection;
+    // next in the server's queue or list of answered requests
+    struct ServerRequest *next;
+} ServerRequest;
+
+/**
+ * Serves a model over a socket: one thread runs the epoll event loop that
+ * does all the reading and writing, and a pool of workers generates the
+ * tweets, all of them sharing the read only model. A connection has at most
+ * one request with the workers at a time, so its answers keep its order.
+ */
+typedef struct GenerationServer {
+    const Markov *model;
+    int listen_fd;
+    int epoll_fd;
+    // written by workers when they answered requests
+    int done_fd;
+    // written by stop_generation_server
+    int stop_fd;
+    pthread_t *workers;
+    int num_of_workers;
+    // requests waiting for a worker (oldest first), and answered ones
+    pthread_mutex_t lock;
+    pthread_cond_t has_requests;
+    ServerRequest *queue_first;
+    ServerRequest *queue_last;
+    int queue_length;
+    ServerRequest *answered;
+    int stopping;
+    // the open connections (only touched by the event loop)
+    struct ServerConnection *connections;
+    // the path to unlink when closing, for a unix socket
+    char *socket_path;
+} GenerationServer;
+
+/**
+ * Listen on an address and start the workers. An address made of digits
+ * only is a TCP port on 127.0.0.1, anything else the path of a unix socket
+ * (replaced if it exists).
+ * @param server the server to open
+ * @param model the frozen model to serve, must outlive the server
+ * @param address where to listen
+ * @param num_of_workers how many threads generate tweets
+ * @return 0 on success, 1 on failure (errno tells why).
+ */
+int open_generation_server(GenerationServer *server, const Markov *model,
+                           const char *address, int num_of_workers);
+
+/**
+ * Serve until stop_generation_server is called.
+ * @param server the open server
+ * @return 0 when stopped, 1 if the event loop failed.
+ */
+int run_generation_server(GenerationServer *server);
+
+/**
+ * Make run_generation_server return. Safe to call from a signal handler.
+ * @param server the server
+ */
+void stop_generation_server(GenerationServer *server);
+
+/**
+ * Stop the workers, drop the connections and stop listening.
+ * @param server the server to close
+ */
+void close_generation_server(GenerationServer *server);
+
+/**
+ * Connect to a server, for clients.
+ * @param address the address the server listens on (see
+ * open_generation_server)
+ * @return the connected (blocking) socket, -1 on failure.
+ */
+int connect_to_generation_server(const char *address);
+
+#endif //_GENERATION_SERVER_H_
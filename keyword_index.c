@@ -0,0 +1,203 @@
+#include "keyword_index.h"
+#include <string.h>
+
+// backward walks of tweets up to this long keep their nodes on the stack
+#define STACK_WALK_LENGTH 64
+
+// qsort comparator of MarkovNode pointers, by word
+static int compare_nodes(const void *first, const void *second)
+{
+    return strcmp((*(MarkovNode *const *) first)->data,
+                  (*(MarkovNode *const *) second)->data);
+}
+
+int build_keyword_index(KeywordIndex *index, const MarkovChain *markov_chain)
+{
+    int num_of_nodes = markov_chain->database->size;
+    index->num_of_nodes = num_of_nodes;
+    index->sorted_nodes = malloc((num_of_nodes + 1) * sizeof(MarkovNode *));
+    index->predecessor_offsets = calloc(num_of_nodes + 1, sizeof(unsigned int));
+    index->predecessors = NULL;
+    index->predecessor_weights = NULL;
+    if (index->sorted_nodes == NULL || index->predecessor_offsets == NULL)
+    {
+        free_keyword_index(index);
+        return 1;
+    }
+
+    // count the predecessors of every node, then turn the counts into the
+    // offsets of where they end (filling moves each one back to its start)
+    size_t num_of_edges = 0;
+    for (int i = 0; i < num_of_nodes; ++i)
+    {
+        const MarkovNode *markov_node = get_node_by_id(markov_chain, (unsigned int) i);
+        index->sorted_nodes[i] = (MarkovNode *) markov_node;
+        for (int j = 0; j < markov_node->num_of_successors; ++j)
+        {
+            index->predecessor_offsets[markov_node->successors[j]]++;
+        }
+        num_of_edges += (size_t) markov_node->num_of_successors;
+    }
+    unsigned int offset = 0;
+    for (int i = 0; i <= num_of_nodes; ++i)
+    {
+        offset += index->predecessor_offsets[i];
+        index->predecessor_offsets[i] = offset;
+    }
+    index->predecessors = malloc((num_of_edges + 1) * sizeof(unsigned int));
+    index->predecessor_weights = malloc((num_of_edges + 1) * sizeof(unsigned int));
+    if (index->predecessors == NULL || index->predecessor_weights == NULL)
+    {
+        free_keyword_index(index);
+        return 1;
+    }
+    // going over the nodes backward leaves every node's predecessors in id
+    // order
+    for (int i = num_of_nodes - 1; i >= 0; --i)
+    {
+        const MarkovNode *markov_node = index->sorted_nodes[i];
+        for (int j = 0; j < markov_node->num_of_successors; ++j)
+        {
+            unsigned int position = --index->predecessor_offsets[markov_node->successors[j]];
+            index->predecessors[position] = (unsigned int) i;
+            index->predecessor_weights[position] = markov_node->frequencies[j];
+        }
+    }
+    for (int i = 0; i < num_of_nodes; ++i)
+    {
+        unsigned int accumulated_frequency = 0;
+        for (unsigned int j = index->predecessor_offsets[i];
+             j < index->predecessor_offsets[i + 1]; ++j)
+        {
+            accumulated_frequency += index->predecessor_weights[j];
+            index->predecessor_weights[j] = accumulated_frequency;
+        }
+    }
+
+    qsort(index->sorted_nodes, num_of_nodes, sizeof(MarkovNode *), compare_nodes);
+    return 0;
+}
+
+int find_keyword_range(const KeywordIndex *index, const char *prefix, size_t length,
+                       int *first)
+{
+    // the first word not below the prefix, then the first one above it (the
+    // words in between all start with it)
+    int low = 0;
+    int high = index->num_of_nodes;
+    while (low < high)
+    {
+        int middle = low + (high - low) / 2;
+        if (strncmp(index->sorted_nodes[middle]->data, prefix, length) < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    *first = low;
+    high = index->num_of_nodes;
+    while (low < high)
+    {
+        int middle = low + (high - low) / 2;
+        if (strncmp(index->sorted_nodes[middle]->data, prefix, length) <= 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low - *first;
+}
+
+MarkovNode* get_previous_random_node(const MarkovChain *markov_chain,
+                                     const KeywordIndex *index,
+                                     const MarkovNode *markov_node,
+                                     RandomState *random_state)
+{
+    unsigned int low = index->predecessor_offsets[markov_node->id];
+    unsigned int high = index->predecessor_offsets[markov_node->id + 1];
+    if (low == high)
+    {
+        return NULL;
+    }
+
+    // the weights are running sums, so look for the first one above the
+    // random number
+    unsigned int random_number = (unsigned int) get_random_number(
+            random_state, (int) index->predecessor_weights[high - 1]);
+    while (low < high)
+    {
+        unsigned int middle = low + (high - low) / 2;
+        if (index->predecessor_weights[middle] <= random_number)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return get_node_by_id(markov_chain, index->predecessors[low]);
+}
+
+int write_tweet_containing(const MarkovChain *markov_chain, const KeywordIndex *index,
+                           MarkovNode *keyword_node, int max_length,
+                           TweetBatch *batch, RandomState *random_state)
+{
+    // the words before the keyword are found last to first, so they are
+    // kept until the walk is done
+    MarkovNode *stack_walk[STACK_WALK_LENGTH];
+    MarkovNode **walk = stack_walk;
+    int num_of_before = max_length > 1 ? get_random_number(random_state, max_length) : 0;
+    if (num_of_before > STACK_WALK_LENGTH)
+    {
+        walk = malloc(num_of_before * sizeof(MarkovNode *));
+        if (walk == NULL)
+        {
+            return 1;
+        }
+    }
+    int walked = 0;
+    for (MarkovNode *current_node = keyword_node; walked < num_of_before; ++walked)
+    {
+        current_node = get_previous_random_node(markov_chain, index, current_node,
+                                                random_state);
+        if (current_node == NULL)
+        {
+            break;
+        }
+        walk[walked] = current_node;
+    }
+
+    int result = 0;
+    for (int i = walked - 1; i >= 0 && result == 0; --i)
+    {
+        result = append_word_to_tweet(batch, walk[i]->data,
+                                      markov_chain->words.lengths[walk[i]->id]);
+    }
+    if (walk != stack_walk)
+    {
+        free(walk);
+    }
+    // the tweet goes on from the keyword like any other
+    return result == 1 ? 1 : write_tweet(markov_chain, keyword_node, max_length - walked,
+                                         batch, random_state);
+}
+
+void free_keyword_index(KeywordIndex *index)
+{
+    free(index->sorted_nodes);
+    free(index->predecessor_offsets);
+    free(index->predecessors);
+    free(index->predecessor_weights);
+    index->sorted_nodes = NULL;
+    index->predecessor_offsets = NULL;
+    index->predecessors = NULL;
+    index->predecessor_weights = NULL;
+    index->num_of_nodes = 0;
+}
@@ -0,0 +1,92 @@
+#ifndef _KEYWORD_INDEX_H_
+#define _KEYWORD_INDEX_H_
+
+#include "markov_chain.h"
+
+// Generating tweets that start with, or contain, a keyword (a hashtag, say)
+// without generating tweets at random until one does. Two indexes over a
+// frozen chain make that direct:
+// - the nodes sorted by word, so the words that start with a prefix are one
+//   range found by binary search (an exact word is a prefix too)
+// - the predecessors of every node with how many times they came before it
+//   (the transitions reversed), so a tweet that contains a word can be
+//   walked backward from it and then forward, like write_tweet does.
+// Both are built in one pass over the chain, like the alias tables of
+// freeze_markov_chain, and have to be built again after the chain changes.
+
+/**
+ * The sorted words and reversed transitions of a chain.
+ */
+typedef struct KeywordIndex {
+    // every node of the chain, sorted by word
+    MarkovNode **sorted_nodes;
+    int num_of_nodes;
+    // the predecessors of node i are at predecessor_offsets[i] up to
+    // predecessor_offsets[i + 1], the weights are running sums of how many
+    // times each one came before node i (like a model file's weights)
+    unsigned int *predecessor_offsets;
+    unsigned int *predecessors;
+    unsigned int *predecessor_weights;
+} KeywordIndex;
+
+/**
+ * Build the indexes of a chain.
+ * @param index the index to build
+ * @param markov_chain the chain, which must not change while the index is
+ * used
+ * @return 0 on success, 1 in case of allocation error.
+ */
+int build_keyword_index(KeywordIndex *index, const MarkovChain *markov_chain);
+
+/**
+ * Find the words that start with a prefix.
+ * @param index the index
+ * @param prefix the prefix (does not need to be null terminated)
+ * @param length number of characters in prefix
+ * @param first where to store the position of the first of them in
+ * sorted_nodes
+ * @return how many words start with the prefix (they follow each other in
+ * sorted_nodes)
+ */
+int find_keyword_range(const KeywordIndex *index, const char *prefix, size_t length,
+                       int *first);
+
+/**
+ * Choose randomly a node that came right before the given one, depending on
+ * how many times it did.
+ * @param markov_chain the chain of the index
+ * @param index the index
+ * @param markov_node the node
+ * @param random_state the generator to draw from
+ * @return the previous node, NULL if nothing ever came before markov_node
+ */
+MarkovNode* get_previous_random_node(const MarkovChain *markov_chain,
+                                     const KeywordIndex *index,
+                                     const MarkovNode *markov_node,
+                                     RandomState *random_state);
+
+/**
+ * Write a tweet that contains the given node: a random number of words (up
+ * to max_length - 1) is walked backward from it, and the tweet goes on
+ * forward from it like write_tweet, so the whole tweet has at most
+ * max_length words. The backward walk stops early at a word nothing came
+ * before.
+ * @param markov_chain the chain of the index
+ * @param index the index
+ * @param keyword_node the node the tweet contains
+ * @param max_length maximum length of the tweet
+ * @param batch the batch to write to
+ * @param random_state the generator to draw from
+ * @return 0 on success, 1 in case of allocation error.
+ */
+int write_tweet_containing(const MarkovChain *markov_chain, const KeywordIndex *index,
+                           MarkovNode *keyword_node, int max_length,
+                           TweetBatch *batch, RandomState *random_state);
+
+/**
+ * Free the indexes.
+ * @param index the index to free
+ */
+void free_keyword_index(KeywordIndex *index);
+
+#endif //_KEYWORD_INDEX_H_
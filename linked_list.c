@@ -1,8 +1,11 @@
 #include "linked_list.h"
+#include "arena.h"
 
 int add(LinkedList *link_list, void *data)
 {
-    Node *new_node = malloc(sizeof(Node));
+    Node *new_node = link_list->node_pool != NULL
+                     ? slab_pool_alloc(link_list->node_pool)
+                     : malloc(sizeof(Node));
     if (new_node == NULL)
     {
         return 1;
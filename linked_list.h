@@ -11,6 +11,8 @@ typedef struct LinkedList {
     Node *first;
     Node *last;
     int size;
+    // if not NULL, add takes its nodes from this pool instead of malloc
+    struct SlabPool *node_pool;
 } LinkedList;
 
 /**
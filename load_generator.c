@@ -0,0 +1,264 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "generation_server.h"
+
+// Load generator for markov_server: every connection sends its requests one
+// after the other (a new one as soon as the last one is answered), all the
+// connections at once, and the throughput and latencies are printed as a
+// JSON object:
+//   markov_load <address> [--connections n] [--requests n] [--tweets n]
+//               [--max-length n] [--start word] [--seed s]
+// request i of connection c has the seed seed + c * requests + i
+
+#define CONNECTIONS_OPTION "--connections"
+#define REQUESTS_OPTION "--requests"
+#define TWEETS_OPTION "--tweets"
+#define MAX_LENGTH_OPTION "--max-length"
+#define START_OPTION "--start"
+#define SEED_OPTION "--seed"
+
+#define DEFAULT_CONNECTIONS 8
+#define DEFAULT_REQUESTS 10000
+#define DEFAULT_TWEETS 1
+#define DEFAULT_MAX_LENGTH 20
+#define DEFAULT_SEED 1
+#define RECEIVE_BUFFER_SIZE (1 << 16)
+
+typedef struct LoadSettings {
+    const char* address;
+    int num_of_connections;
+    int num_of_requests;
+    int num_of_tweets;
+    int max_length;
+    const char* start_word;
+    unsigned long long seed;
+} LoadSettings;
+
+// one connection's requests and how long each one took
+typedef struct LoadTask {
+    const LoadSettings* settings;
+    int index;
+    long long* latencies;
+    int num_of_errors;
+    int failed;
+} LoadTask;
+
+static long long nanoseconds_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static int compare_latencies(const void* first, const void* second)
+{
+    long long a = *(const long long*) first;
+    long long b = *(const long long*) second;
+    return (a > b) - (a < b);
+}
+
+static int send_all(int fd, const char* text, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t sent = write(fd, text, length);
+        if (sent == -1 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return 1;
+        text += sent;
+        length -= (size_t) sent;
+    }
+    return 0;
+}
+
+/**
+ * Read one whole response: its first line, and then as many lines as the
+ * "OK <count>" header says.
+ * @param fd the connection
+ * @param buffer where to read to (RECEIVE_BUFFER_SIZE bytes)
+ * @param is_error where to store whether it was an "ERR" response
+ * @return 0 on success, 1 if the connection failed
+ */
+static int receive_response(int fd, char* buffer, int* is_error)
+{
+    // lines still to come, -1 until the header is in
+    long lines_left = -1;
+    size_t length = 0;
+    for (;;)
+    {
+        ssize_t received = read(fd, buffer + length, RECEIVE_BUFFER_SIZE - 1 - length);
+        if (received == -1 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return 1;
+        length += (size_t) received;
+        buffer[length] = '\0';
+
+        char* start = buffer;
+        char* newline;
+        while ((newline = memchr(start, '\n', length - (start - buffer))) != NULL)
+        {
+            if (lines_left == -1)
+            {
+                *is_error = strncmp(start, "OK ", 3) != 0;
+                lines_left = *is_error ? 0 : strtol(start + 3, NULL, 10);
+            }
+            else
+                lines_left--;
+            start = newline + 1;
+            if (lines_left == 0)
+                return 0;
+        }
+        // keep only the unfinished line, the tweets themselves don't matter
+        length -= (size_t) (start - buffer);
+        memmove(buffer, start, length);
+        if (length == RECEIVE_BUFFER_SIZE - 1)
+            length = 0;
+    }
+}
+
+// thread body of one connection
+static void* run_connection(void* arg)
+{
+    LoadTask* task = (LoadTask*) arg;
+    const LoadSettings* settings = task->settings;
+    char* buffer = malloc(RECEIVE_BUFFER_SIZE);
+    int fd = connect_to_generation_server(settings->address);
+    if (buffer == NULL || fd == -1)
+    {
+        task->failed = 1;
+        free(buffer);
+        if (fd != -1)
+            close(fd);
+        return NULL;
+    }
+    char request[SERVER_MAX_REQUEST_LENGTH + 64];
+    for (int i = 0; i < settings->num_of_requests; ++i)
+    {
+        unsigned long long seed = settings->seed
+                                  + (unsigned long long) task->index
+                                    * settings->num_of_requests + i;
+        int length = snprintf(request, sizeof(request), "GEN %d %llu %d %s\n",
+                              settings->num_of_tweets, seed, settings->max_length,
+                              settings->start_word);
+        int is_error;
+        long long before = nanoseconds_now();
+        if (send_all(fd, request, (size_t) length) == 1
+            || receive_response(fd, buffer, &is_error) == 1)
+        {
+            task->failed = 1;
+            break;
+        }
+        task->latencies[i] = nanoseconds_now() - before;
+        task->num_of_errors += is_error;
+    }
+    close(fd);
+    free(buffer);
+    return NULL;
+}
+
+static int parse_load_arguments(int argc, char* argv[], LoadSettings* settings)
+{
+    if (argc < 2 || argc % 2 != 0)
+        return 1;
+    settings->address = argv[1];
+    settings->num_of_connections = DEFAULT_CONNECTIONS;
+    settings->num_of_requests = DEFAULT_REQUESTS;
+    settings->num_of_tweets = DEFAULT_TWEETS;
+    settings->max_length = DEFAULT_MAX_LENGTH;
+    settings->start_word = "";
+    settings->seed = DEFAULT_SEED;
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], CONNECTIONS_OPTION) == 0)
+            settings->num_of_connections = (int) strtol(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], REQUESTS_OPTION) == 0)
+            settings->num_of_requests = (int) strtol(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], TWEETS_OPTION) == 0)
+            settings->num_of_tweets = (int) strtol(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], MAX_LENGTH_OPTION) == 0)
+            settings->max_length = (int) strtol(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], START_OPTION) == 0)
+            settings->start_word = argv[i + 1];
+        else if (strcmp(argv[i], SEED_OPTION) == 0)
+            settings->seed = strtoull(argv[i + 1], NULL, 10);
+        else
+            return 1;
+    }
+    return settings->num_of_connections < 1 || settings->num_of_requests < 1
+           || strlen(settings->start_word) > SERVER_MAX_REQUEST_LENGTH / 2;
+}
+
+int main(int argc, char* argv[])
+{
+    LoadSettings settings;
+    if (parse_load_arguments(argc, argv, &settings) == 1)
+    {
+        fprintf(stderr, "Usage: markov_load <address> [--connections n] "
+                        "[--requests n] [--tweets n] [--max-length n] "
+                        "[--start word] [--seed s]\n");
+        return EXIT_FAILURE;
+    }
+
+    int num_of_connections = settings.num_of_connections;
+    long long total = (long long) num_of_connections * settings.num_of_requests;
+    LoadTask* tasks = calloc(num_of_connections, sizeof(LoadTask));
+    pthread_t* threads = malloc(num_of_connections * sizeof(pthread_t));
+    long long* latencies = malloc(total * sizeof(long long));
+    if (tasks == NULL || threads == NULL || latencies == NULL)
+    {
+        fprintf(stderr, "Allocation failure\n");
+        free(tasks);
+        free(threads);
+        free(latencies);
+        return EXIT_FAILURE;
+    }
+
+    long long start = nanoseconds_now();
+    int num_of_started = 0;
+    for (; num_of_started < num_of_connections; ++num_of_started)
+    {
+        LoadTask* task = &tasks[num_of_started];
+        task->settings = &settings;
+        task->index = num_of_started;
+        task->latencies = latencies + (long long) num_of_started * settings.num_of_requests;
+        if (pthread_create(&threads[num_of_started], NULL, run_connection, task) != 0)
+            break;
+    }
+    int failed = num_of_started < num_of_connections;
+    int num_of_errors = 0;
+    for (int i = 0; i < num_of_started; ++i)
+    {
+        pthread_join(threads[i], NULL);
+        failed |= tasks[i].failed;
+        num_of_errors += tasks[i].num_of_errors;
+    }
+    double seconds = (double) (nanoseconds_now() - start) * 1e-9;
+
+    if (failed)
+        fprintf(stderr, "Some connections failed\n");
+    else
+    {
+        qsort(latencies, total, sizeof(long long), compare_latencies);
+        printf("{\"address\": \"%s\", \"connections\": %d, \"requests\": %lld, "
+               "\"tweets_per_request\": %d, \"errors\": %d, \"seconds\": %.6f, "
+               "\"requests_per_second\": %.0f, \"tweets_per_second\": %.0f, "
+               "\"latency_p50_ns\": %lld, \"latency_p99_ns\": %lld, "
+               "\"latency_p999_ns\": %lld, \"latency_max_ns\": %lld}\n",
+               settings.address, num_of_connections, total, settings.num_of_tweets,
+               num_of_errors, seconds, total / seconds,
+               (double) total * settings.num_of_tweets / seconds,
+               latencies[total / 2], latencies[total * 99 / 100],
+               latencies[total * 999 / 1000], latencies[total - 1]);
+    }
+    free(tasks);
+    free(threads);
+    free(latencies);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,693 @@
+#include "markov.h"
+#include "model_file.h"
+#include "count_min_sketch.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// where an ingest reads its words from: file, source, or text when both are
+// NULL
+typedef struct Corpus {
+    FILE *file;
+    ByteSource *source;
+    const char *text;
+    size_t length;
+} Corpus;
+
+// one chunk of the corpus and the chain built from it
+typedef struct IngestTask {
+    const char *start;
+    size_t length;
+    MarkovChain *chain;
+    int result;
+} IngestTask;
+
+// starts a tokenizer at the corpus' current position
+static int open_corpus(const Corpus *corpus, Tokenizer *tokenizer)
+{
+    if (corpus->source != NULL)
+    {
+        return init_source_tokenizer(tokenizer, corpus->source);
+    }
+    if (corpus->file == NULL)
+    {
+        init_text_tokenizer(tokenizer, corpus->text, corpus->length);
+        return 0;
+    }
+    return init_file_tokenizer(tokenizer, corpus->file);
+}
+
+// the status of a fill that returned 1: a file or source that failed to
+// read, or else an allocation that failed
+static int fill_status(const Corpus *corpus)
+{
+    return (corpus->file != NULL && ferror(corpus->file))
+           || (corpus->source != NULL && corpus->source->failed)
+           ? MARKOV_IO_ERROR : MARKOV_ALLOCATION_ERROR;
+}
+
+// fills the chain from the corpus in one pass
+static int fill_database(const Corpus *corpus, int words_to_read,
+                         MarkovChain *markov_chain)
+{
+    Tokenizer tokenizer;
+    if (open_corpus(corpus, &tokenizer) == 1)
+    {
+        return MARKOV_ALLOCATION_ERROR;
+    }
+    int result = fill_database_from_tokenizer(&tokenizer, words_to_read, markov_chain);
+    free_tokenizer(&tokenizer);
+    // a source that failed just looks like the end of the words
+    if (result == 0 && corpus->source != NULL && corpus->source->failed)
+    {
+        return MARKOV_IO_ERROR;
+    }
+    return result == 1 ? fill_status(corpus) : MARKOV_OK;
+}
+
+// fills the n-gram chain from the corpus in one pass
+static int fill_ngram(const Corpus *corpus, int words_to_read, NgramChain *ngram_chain)
+{
+    Tokenizer tokenizer;
+    if (open_corpus(corpus, &tokenizer) == 1)
+    {
+        return MARKOV_ALLOCATION_ERROR;
+    }
+    int result = fill_ngram_chain(&tokenizer, words_to_read, ngram_chain);
+    free_tokenizer(&tokenizer);
+    if (result == 0 && corpus->source != NULL && corpus->source->failed)
+    {
+        return MARKOV_IO_ERROR;
+    }
+    return result == 1 ? fill_status(corpus) : MARKOV_OK;
+}
+
+// fills the chain from the corpus in two passes: the first counts the words,
+// the second leaves out the ones seen fewer than min_word_count times
+static int fill_database_two_pass(const Corpus *corpus, int words_to_read,
+                                  int min_word_count, MarkovChain *markov_chain)
+{
+    // the second pass starts over from where the first one started
+    long start = corpus->file == NULL ? 0 : ftell(corpus->file);
+    if (start == -1)
+    {
+        return MARKOV_IO_ERROR;
+    }
+    CountMinSketch sketch;
+    Tokenizer tokenizer;
+    if (init_count_min_sketch(&sketch, MARKOV_SKETCH_WIDTH) == 1)
+    {
+        return MARKOV_ALLOCATION_ERROR;
+    }
+    if (open_corpus(corpus, &tokenizer) == 1)
+    {
+        free_count_min_sketch(&sketch);
+        return MARKOV_ALLOCATION_ERROR;
+    }
+    int result = count_words(&tokenizer, words_to_read, &sketch) == 1
+                 ? fill_status(corpus) : MARKOV_OK;
+    free_tokenizer(&tokenizer);
+
+    if (result == MARKOV_OK && corpus->file != NULL
+        && fseek(corpus->file, start, SEEK_SET) != 0)
+    {
+        result = MARKOV_IO_ERROR;
+    }
+    if (result == MARKOV_OK)
+    {
+        if (open_corpus(corpus, &tokenizer) == 1)
+        {
+            free_count_min_sketch(&sketch);
+            return MARKOV_ALLOCATION_ERROR;
+        }
+        if (fill_database_with_sketch(&tokenizer, words_to_read, markov_chain, &sketch,
+                                      (unsigned int) min_word_count) == 1)
+        {
+            result = fill_status(corpus);
+        }
+        free_tokenizer(&tokenizer);
+    }
+    free_count_min_sketch(&sketch);
+    return result;
+}
+
+// thread body: builds the chain of one chunk, straight out of the mapped file
+static void *ingest_chunk(void *arg)
+{
+    IngestTask *task = (IngestTask *) arg;
+    Tokenizer tokenizer;
+    init_text_tokenizer(&tokenizer, task->start, task->length);
+    task->result = fill_database_from_tokenizer(&tokenizer, INT_MAX, task->chain);
+    return NULL;
+}
+
+// fills the chain from the rest of a file with num_of_threads threads, each
+// building a chain out of a chunk of lines that are then merged in order.
+// the result is exactly the chain fill_database would build
+static int fill_database_parallel(FILE *file, int num_of_threads,
+                                  MarkovChain *markov_chain)
+{
+    Corpus corpus = {file, NULL, NULL, 0};
+    struct stat file_stat;
+    long position = ftell(file);
+    if (fstat(fileno(file), &file_stat) == -1 || position == -1
+        || file_stat.st_size <= position)
+    {
+        // nothing to split (an empty file, or not a regular file at all)
+        return fill_database(&corpus, INT_MAX, markov_chain);
+    }
+    size_t size = (size_t) file_stat.st_size;
+    char *mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+    if (mapped == MAP_FAILED)
+    {
+        return fill_database(&corpus, INT_MAX, markov_chain);
+    }
+    // the chunks are cut out of what is left of the file
+    char *text = mapped + position;
+    size_t length = size - (size_t) position;
+
+    IngestTask *tasks = calloc(num_of_threads, sizeof(IngestTask));
+    pthread_t *threads = malloc(num_of_threads * sizeof(pthread_t));
+    if (tasks == NULL || threads == NULL)
+    {
+        free(tasks);
+        free(threads);
+        munmap(mapped, size);
+        return MARKOV_ALLOCATION_ERROR;
+    }
+
+    // cut the text into roughly equal chunks, moving every cut to the start
+    // of the next line. the first chunk is read straight into markov_chain
+    size_t chunk_start = 0;
+    int result = 0;
+    int num_of_started = 0;
+    for (int i = 0; i < num_of_threads && chunk_start < length; ++i)
+    {
+        size_t chunk_end = i == num_of_threads - 1 ? length
+                           : length / num_of_threads * (i + 1);
+        if (chunk_end < chunk_start)
+        {
+            chunk_end = chunk_start;
+        }
+        char *newline = memchr(text + chunk_end, '\n', length - chunk_end);
+        chunk_end = newline == NULL ? length : (size_t) (newline - text) + 1;
+
+        tasks[i].start = text + chunk_start;
+        tasks[i].length = chunk_end - chunk_start;
+        tasks[i].chain = i == 0 ? markov_chain : create_markov_chain();
+        if (tasks[i].chain == NULL
+            || pthread_create(&threads[i], NULL, ingest_chunk, &tasks[i]) != 0)
+        {
+            result = 1;
+            break;
+        }
+        num_of_started++;
+        chunk_start = chunk_end;
+    }
+
+    // wait for everyone, then merge the chains in the order of the chunks
+    for (int i = 0; i < num_of_started; ++i)
+    {
+        pthread_join(threads[i], NULL);
+        result |= tasks[i].result;
+    }
+    for (int i = 1; i < num_of_started && result == 0; ++i)
+    {
+        result = merge_markov_chain(markov_chain, tasks[i].chain);
+    }
+    for (int i = 1; i < num_of_threads; ++i)
+    {
+        if (tasks[i].chain != NULL)
+        {
+            free_database(&tasks[i].chain);
+        }
+    }
+
+    free(tasks);
+    free(threads);
+    munmap(mapped, size);
+    // the file was read through the mapping, so it is now at its end
+    if (result == 0 && fseek(file, 0, SEEK_END) != 0)
+    {
+        return MARKOV_IO_ERROR;
+    }
+    return result == 1 ? MARKOV_ALLOCATION_ERROR : MARKOV_OK;
+}
+
+// every ingest goes through here
+static int ingest(Markov *model, const Corpus *corpus, int words_to_read)
+{
+    if (model->mapped_model != NULL)
+    {
+        return MARKOV_INVALID_ARGUMENT;
+    }
+    // whatever happens, the chain may have changed
+    model->frozen = 0;
+    if (model->ngram_chain != NULL)
+    {
+        return fill_ngram(corpus, words_to_read, model->ngram_chain);
+    }
+    if (model->options.min_word_count > 0)
+    {
+        // a source can't be read twice
+        if (corpus->source != NULL)
+        {
+            return MARKOV_INVALID_ARGUMENT;
+        }
+        return fill_database_two_pass(corpus, words_to_read,
+                                      model->options.min_word_count, model->chain);
+    }
+    // the chunks can't know how many words the ones before them read, so a
+    // limit on the words to read means reading the file in one go
+    if (corpus->file != NULL && model->options.num_of_threads > 1
+        && words_to_read == INT_MAX)
+    {
+        return fill_database_parallel(corpus->file, model->options.num_of_threads,
+                                      model->chain);
+    }
+    return fill_database(corpus, words_to_read, model->chain);
+}
+
+// drops the model's keyword index, if it has one
+static void free_keywords(Markov *model)
+{
+    if (model->keywords != NULL)
+    {
+        free_keyword_index(model->keywords);
+        free(model->keywords);
+        model->keywords = NULL;
+    }
+}
+
+// allocates a model with the given options and nothing in it yet
+static Markov *allocate_model(const MarkovOptions *options)
+{
+    Markov *model = malloc(sizeof(Markov));
+    if (model == NULL)
+    {
+        return NULL;
+    }
+    model->chain = NULL;
+    model->ngram_chain = NULL;
+    model->mapped_model = NULL;
+    model->options = *options;
+    if (model->options.num_of_threads == 0)
+    {
+        model->options.num_of_threads = 1;
+    }
+    model->frozen = 0;
+    model->keywords = NULL;
+    return model;
+}
+
+int markov_create(Markov **model, const MarkovOptions *options)
+{
+    MarkovOptions defaults = {1, 0, {0, 0, 0}, 0, 0, 0};
+    if (options == NULL)
+    {
+        options = &defaults;
+    }
+    if (options->num_of_threads < 0 || options->min_word_count < 0
+        || options->prune_settings.min_count < 0 || options->prune_settings.top_k < 0
+        || options->prune_settings.max_vocabulary < 0
+        || (options->prune_settings.max_vocabulary > 0
+            && options->prune_settings.max_vocabulary < 3)
+        || options->order < 0 || options->order > MAX_NGRAM_ORDER)
+    {
+        return MARKOV_INVALID_ARGUMENT;
+    }
+    // an n-gram chain has none of the chain's extras
+    if (options->order > 1
+        && (options->min_word_count > 0 || prune_settings_active(&options->prune_settings)
+            || options->keyword_index))
+    {
+        return MARKOV_INVALID_ARGUMENT;
+    }
+    Markov *new_model = allocate_model(options);
+    if (new_model == NULL)
+    {
+        return MARKOV_ALLOCATION_ERROR;
+    }
+    if (options->order > 1)
+    {
+        new_model->ngram_chain = create_ngram_chain(options->order);
+    }
+    else
+    {
+        new_model->chain = create_markov_chain();
+    }
+    if (new_model->chain == NULL && new_model->ngram_chain == NULL)
+    {
+        free(new_model);
+        return MARKOV_ALLOCATION_ERROR;
+    }
+    if (new_model->chain != NULL)
+    {
+        new_model->chain->uniform_first_words = options->uniform_first_words != 0;
+    }
+    *model = new_model;
+    return MARKOV_OK;
+}
+
+int markov_load(Markov **model, const char *path, const MarkovOptions *options)
+{
+    MarkovOptions defaults = {1, 0, {0, 0, 0}, 0, 0, 0};
+    if (options == NULL)
+    {
+        options = &defaults;
+    }
+    if (options->num_of_threads < 0 || options->min_word_count != 0
+        || prune_settings_active(&options->prune_settings) || options->keyword_index
+        || options->order > 1)
+    {
+        return MARKOV_INVALID_ARGUMENT;
+    }
+    Markov *new_model = allocate_model(options);
+    if (new_model == NULL)
+    {
+        return MARKOV_ALLOCATION_ERROR;
+    }
+    new_model->mapped_model = load_mapped_model(path);
+    if (new_model->mapped_model == NULL)
+    {
+        free(new_model);
+        return MARKOV_IO_ERROR;
+    }
+    // without its sentence starts the model draws the first word uniformly
+    new_model->mapped_model->uniform_first_words = options->uniform_first_words != 0;
+    // a model file holds a chain that was already frozen
+    new_model->frozen = 1;
+    *model = new_model;
+    return MARKOV_OK;
+}
+
+int markov_ingest_file(Markov *model, FILE *file, int words_to_read)
+{
+    Corpus corpus = {file, NULL, NULL, 0};
+    return ingest(model, &corpus, words_to_read);
+}
+
+int markov_ingest_source(Markov *model, ByteSource *source, int words_to_read)
+{
+    Corpus corpus = {NULL, source, NULL, 0};
+    return ingest(model, &corpus, words_to_read);
+}
+
+int markov_ingest_text(Markov *model, const char *text, size_t length)
+{
+    Corpus corpus = {NULL, NULL, text, length};
+    return ingest(model, &corpus, INT_MAX);
+}
+
+int markov_freeze(Markov *model, PruneReport *report)
+{
+    if (model->frozen)
+    {
+        return MARKOV_OK;
+    }
+    // an n-gram chain is ready as soon as it's filled
+    if (model->ngram_chain != NULL)
+    {
+        model->frozen = 1;
+        return MARKOV_OK;
+    }
+    const PruneSettings *settings = &model->options.prune_settings;
+    if (prune_settings_active(settings))
+    {
+        PruneReport prune_report;
+        if (prune_markov_chain(&model->chain, settings,
+                               report != NULL ? report : &prune_report) == 1)
+        {
+            return MARKOV_ALLOCATION_ERROR;
+        }
+    }
+    if (freeze_markov_chain(model->chain) == 1)
+    {
+        return MARKOV_ALLOCATION_ERROR;
+    }
+    // any change to the chain can change every part of the index, so it's
+    // built again from scratch
+    if (model->options.keyword_index)
+    {
+        free_keywords(model);
+        KeywordIndex *keywords = malloc(sizeof(KeywordIndex));
+        if (keywords == NULL || build_keyword_index(keywords, model->chain) == 1)
+        {
+            free(keywords);
+            return MARKOV_ALLOCATION_ERROR;
+        }
+        model->keywords = keywords;
+    }
+    model->frozen = 1;
+    return MARKOV_OK;
+}
+
+// whether the model has a word (or a state) to start a tweet with
+static int can_start_tweet(const Markov *model)
+{
+    if (model->ngram_chain != NULL)
+    {
+        return model->ngram_chain->num_of_states > 0;
+    }
+    if (model->mapped_model != NULL)
+    {
+        return model->mapped_model->num_of_startable_words > 0;
+    }
+    return model->chain->num_of_startable_words > 0;
+}
+
+int markov_generate(const Markov *model, int num_of_tweets, int max_length,
+                    TweetBatch *batch, RandomState *random_state)
+{
+    if (!model->frozen || !can_start_tweet(model))
+    {
+        return MARKOV_NOT_READY;
+    }
+    if (num_of_tweets <= 0)
+    {
+        return MARKOV_OK;
+    }
+    int result;
+    if (model->ngram_chain != NULL)
+    {
+        result = generate_ngram_tweets(model->ngram_chain, num_of_tweets, max_length,
+                                       batch, random_state);
+    }
+    else if (model->mapped_model != NULL)
+    {
+        result = generate_mapped_tweets(model->mapped_model, num_of_tweets, max_length,
+                                        batch, random_state);
+    }
+    else
+    {
+        result = generate_tweets(model->chain, num_of_tweets, max_length, batch,
+                                 random_state);
+    }
+    return result == 1 ? MARKOV_ALLOCATION_ERROR : MARKOV_OK;
+}
+
+int markov_generate_from(const Markov *model, const char *word, size_t length,
+                         int num_of_tweets, int max_length, TweetBatch *batch,
+                         RandomState *random_state)
+{
+    if (model->chain == NULL)
+    {
+        return MARKOV_INVALID_ARGUMENT;
+    }
+    if (!model->frozen)
+    {
+        return MARKOV_NOT_READY;
+    }
+    int word_id = find_word(&model->chain->words, word, length);
+    if (word_id == -1)
+    {
+        return MARKOV_UNKNOWN_WORD;
+    }
+    MarkovNode *first_node = get_node_by_id(model->chain, (unsigned int) word_id);
+    for (int i = 0; i < num_of_tweets; ++i)
+    {
+        if (write_tweet(model->chain, first_node, max_length, batch, random_state) == 1)
+        {
+            return MARKOV_ALLOCATION_ERROR;
+        }
+    }
+    return MARKOV_OK;
+}
+
+// generates the tweets of markov_generate_starting (contains is 0) and
+// markov_generate_containing (contains is 1)
+static int generate_with_keyword(const Markov *model, const char *prefix, size_t length,
+                                 int contains, int num_of_tweets, int max_length,
+                                 TweetBatch *batch, RandomState *random_state)
+{
+    if (!model->frozen || model->keywords == NULL)
+    {
+        return MARKOV_NOT_READY;
+    }
+    int first;
+    int num_of_matches = find_keyword_range(model->keywords, prefix, length, &first);
+    if (num_of_matches == 0)
+    {
+        return MARKOV_UNKNOWN_WORD;
+    }
+    for (int i = 0; i < num_of_tweets; ++i)
+    {
+        MarkovNode *keyword_node = model->keywords->sorted_nodes[
+                first + (num_of_matches > 1 ? get_random_number(random_state, num_of_matches) : 0)];
+        int result = contains ? write_tweet_containing(model->chain, model->keywords,
+                                                       keyword_node, max_length, batch,
+                                                       random_state)
+                              : write_tweet(model->chain, keyword_node, max_length, batch,
+                                            random_state);
+        if (result == 1)
+        {
+            return MARKOV_ALLOCATION_ERROR;
+        }
+    }
+    return MARKOV_OK;
+}
+
+int markov_generate_starting(const Markov *model, const char *prefix, size_t length,
+                             int num_of_tweets, int max_length, TweetBatch *batch,
+                             RandomState *random_state)
+{
+    return generate_with_keyword(model, prefix, length, 0, num_of_tweets, max_length,
+                                 batch, random_state);
+}
+
+int markov_generate_containing(const Markov *model, const char *prefix, size_t length,
+                               int num_of_tweets, int max_length, TweetBatch *batch,
+                               RandomState *random_state)
+{
+    return generate_with_keyword(model, prefix, length, 1, num_of_tweets, max_length,
+                                 batch, random_state);
+}
+
+int markov_init_mixture(ChainMixture *mixture, Markov *const *models,
+                        const double *weights, int num_of_models)
+{
+    if (num_of_models < 1)
+    {
+        return MARKOV_INVALID_ARGUMENT;
+    }
+    double total_weight = 0;
+    for (int i = 0; i < num_of_models; ++i)
+    {
+        if (models[i]->chain == NULL || !(weights[i] >= 0))
+        {
+            return MARKOV_INVALID_ARGUMENT;
+        }
+        if (!models[i]->frozen)
+        {
+            return MARKOV_NOT_READY;
+        }
+        // the first word comes from the models that have one to give
+        if (models[i]->chain->num_of_startable_words > 0)
+        {
+            total_weight += weights[i];
+        }
+    }
+    if (total_weight <= 0)
+    {
+        return MARKOV_NOT_READY;
+    }
+    MarkovChain **chains = malloc(num_of_models * sizeof(MarkovChain *));
+    if (chains == NULL)
+    {
+        return MARKOV_ALLOCATION_ERROR;
+    }
+    for (int i = 0; i < num_of_models; ++i)
+    {
+        chains[i] = models[i]->chain;
+    }
+    int result = init_chain_mixture(mixture, chains, weights, num_of_models);
+    free(chains);
+    return result == 1 ? MARKOV_ALLOCATION_ERROR : MARKOV_OK;
+}
+
+int markov_save(const Markov *model, const char *path)
+{
+    if (model->chain == NULL)
+    {
+        return MARKOV_INVALID_ARGUMENT;
+    }
+    return save_markov_chain(model->chain, path) == 1 ? MARKOV_IO_ERROR : MARKOV_OK;
+}
+
+int markov_word_count(const Markov *model)
+{
+    if (model->ngram_chain != NULL)
+    {
+        return model->ngram_chain->words.size;
+    }
+    if (model->mapped_model != NULL)
+    {
+        return (int) model->mapped_model->word_count;
+    }
+    return model->chain->database->size;
+}
+
+void markov_stats(const Markov *model, MarkovChainStats *stats)
+{
+    if (model->chain == NULL)
+    {
+        memset(stats, 0, sizeof(MarkovChainStats));
+        return;
+    }
+    markov_chain_stats(model->chain, stats);
+}
+
+MarkovChain *markov_take_chain(Markov **model)
+{
+    MarkovChain *markov_chain = (*model)->chain;
+    if (markov_chain == NULL)
+    {
+        return NULL;
+    }
+    free_keywords(*model);
+    free(*model);
+    *model = NULL;
+    return markov_chain;
+}
+
+void markov_destroy(Markov **model)
+{
+    if ((*model)->chain != NULL)
+    {
+        free_database(&(*model)->chain);
+    }
+    if ((*model)->ngram_chain != NULL)
+    {
+        free_ngram_chain(&(*model)->ngram_chain);
+    }
+    if ((*model)->mapped_model != NULL)
+    {
+        free_mapped_model(&(*model)->mapped_model);
+    }
+    free_keywords(*model);
+    free(*model);
+    *model = NULL;
+}
+
+const char *markov_strerror(int status)
+{
+    switch (status)
+    {
+        case MARKOV_OK:
+            return "Success";
+        case MARKOV_ALLOCATION_ERROR:
+            return ALLOCATION_ERROR_MASSAGE;
+        case MARKOV_IO_ERROR:
+            return "Error: could not read/write the corpus or the model file";
+        case MARKOV_INVALID_ARGUMENT:
+            return "Error: invalid argument";
+        case MARKOV_NOT_READY:
+            return "Error: the model has no word to start a tweet with, or was not frozen";
+        case MARKOV_UNKNOWN_WORD:
+            return "Error: the word is not in the model";
+        default:
+            return "Error: unknown error";
+    }
+}
@@ -0,0 +1,281 @@
+#ifndef _MARKOV_H_
+#define _MARKOV_H_
+
+#include "markov_chain.h"
+#include "ngram_chain.h"
+#include "model_file.h"
+#include "chain_mixture.h"
+#include "pruning.h"
+#include "markov_stats.h"
+#include "keyword_index.h"
+#include <limits.h> // For INT_MAX
+
+// words_to_read for reading the whole corpus
+#define MARKOV_ALL_WORDS INT_MAX
+
+// counters per row of the sketch min_word_count counts the words in (4 MiB
+// in all)
+#define MARKOV_SKETCH_WIDTH (1 << 18)
+
+/**
+ * What the markov_* functions return: MARKOV_OK, or why they failed. None of
+ * them print anything, markov_strerror has a message for every status.
+ */
+typedef enum MarkovStatus {
+    MARKOV_OK = 0,
+    MARKOV_ALLOCATION_ERROR,
+    // reading the corpus, or reading or writing a model file, failed
+    MARKOV_IO_ERROR,
+    // an option or argument is out of range, or the model can't do that
+    // (see order and markov_load)
+    MARKOV_INVALID_ARGUMENT,
+    // generating from a model that was not frozen since the last ingest, or
+    // that has no word a tweet can start with (no words at all, or only
+    // words that end a sentence)
+    MARKOV_NOT_READY,
+    // a start word that is not in the model
+    MARKOV_UNKNOWN_WORD
+} MarkovStatus;
+
+/**
+ * How a model is built. Zeroed options (or NULL) build the plain chain with
+ * one thread.
+ */
+typedef struct MarkovOptions {
+    // threads that read a file with no limit on the words (at least 1). the
+    // chain is the same for any number of them
+    int num_of_threads;
+    // when above 0, every ingest reads its corpus twice: once to count the
+    // words in a count-min sketch, then to build the chain with the words
+    // seen fewer than this many times as <unk> (see pruning.h)
+    int min_word_count;
+    // applied by every markov_freeze that follows an ingest
+    PruneSettings prune_settings;
+    // when not 0, every markov_freeze also builds the keyword index that
+    // markov_generate_starting and markov_generate_containing need
+    int keyword_index;
+    // when not 0, tweets start with any word that doesn't end a sentence,
+    // all as likely, instead of with the words that started sentences in
+    // the corpus, as often as they did
+    int uniform_first_words;
+    // number of words in a state: 0 or 1 for the chain of markov_chain.h,
+    // up to MAX_NGRAM_ORDER for an n-gram chain (see ngram_chain.h). an
+    // n-gram chain takes neither min_word_count, prune_settings nor
+    // keyword_index, always draws its first state uniformly, and can only be
+    // ingested, frozen and generated from
+    int order;
+} MarkovOptions;
+
+/**
+ * A model that stays resident between generations: built with
+ * markov_create and markov_ingest_*, made ready with markov_freeze (or
+ * mapped from a model file with markov_load), then generated from by any
+ * number of threads at once, each with its own RandomState.
+ */
+typedef struct Markov {
+    // exactly one of these is set: chain, or ngram_chain for an order above
+    // 1, or mapped_model for a model file
+    MarkovChain *chain;
+    NgramChain *ngram_chain;
+    MappedModel *mapped_model;
+    MarkovOptions options;
+    // whether chain was frozen since it last changed
+    int frozen;
+    // the keyword index of the frozen chain, NULL unless the options ask
+    // for it
+    KeywordIndex *keywords;
+} Markov;
+
+/**
+ * Create an empty model.
+ * @param model where to store the new model
+ * @param options how to build it, NULL for the defaults (copied)
+ * @return MARKOV_OK, MARKOV_INVALID_ARGUMENT or MARKOV_ALLOCATION_ERROR
+ */
+int markov_create(Markov **model, const MarkovOptions *options);
+
+/**
+ * Map a model file (see model_file.h) into a model that is ready to
+ * generate from. Nothing can be ingested into it, and it can't be saved,
+ * mixed or generated from with a given first word.
+ * @param model where to store the new model
+ * @param path the model file
+ * @param options NULL for the defaults (copied). only num_of_threads and
+ * uniform_first_words apply, the other options must be 0 (order may be 1)
+ * @return MARKOV_OK, MARKOV_INVALID_ARGUMENT, MARKOV_IO_ERROR (a missing or
+ * invalid file) or MARKOV_ALLOCATION_ERROR
+ */
+int markov_load(Markov **model, const char *path, const MarkovOptions *options);
+
+/**
+ * Add the words of a file to the model, from its current position.
+ * @param model the model
+ * @param file the corpus
+ * @param words_to_read how many words to read, MARKOV_ALL_WORDS for all of
+ * them (only then are the model's threads used, and never by an n-gram
+ * chain)
+ * @return MARKOV_OK, MARKOV_INVALID_ARGUMENT (a loaded model),
+ * MARKOV_IO_ERROR or MARKOV_ALLOCATION_ERROR
+ */
+int markov_ingest_file(Markov *model, FILE *file, int words_to_read);
+
+/**
+ * Add the words of a byte source (a compressed file, see byte_source.h) to
+ * the model, on one thread. Not with min_word_count, which reads the corpus
+ * twice.
+ * @param model the model
+ * @param source the corpus
+ * @param words_to_read how many words to read, MARKOV_ALL_WORDS for all of
+ * them
+ * @return MARKOV_OK, MARKOV_INVALID_ARGUMENT, MARKOV_IO_ERROR (the source
+ * failed, a corrupt or cut file included) or MARKOV_ALLOCATION_ERROR
+ */
+int markov_ingest_source(Markov *model, ByteSource *source, int words_to_read);
+
+/**
+ * Add the words of a text in memory to the model.
+ * @param model the model
+ * @param text the corpus (does not need to be null terminated)
+ * @param length number of characters in text
+ * @return MARKOV_OK, MARKOV_INVALID_ARGUMENT (a loaded model) or
+ * MARKOV_ALLOCATION_ERROR
+ */
+int markov_ingest_text(Markov *model, const char *text, size_t length);
+
+/**
+ * Prune the model if its options say so and build what generating needs.
+ * Only the words that changed since the last freeze are rebuilt, unless
+ * pruning rebuilds the whole chain.
+ * @param model the model
+ * @param report where to store what pruning did (left alone when the
+ * options don't prune), may be NULL
+ * @return MARKOV_OK or MARKOV_ALLOCATION_ERROR
+ */
+int markov_freeze(Markov *model, PruneReport *report);
+
+/**
+ * Generate tweets into a batch. Only reads the model, so threads may
+ * generate from the same model at once.
+ * @param model the frozen model
+ * @param num_of_tweets how many tweets to generate
+ * @param max_length maximum number of words in every tweet
+ * @param batch the batch to add the tweets to
+ * @param random_state the generator to draw from
+ * @return MARKOV_OK, MARKOV_NOT_READY (checked even for 0 tweets, an n-gram
+ * chain with no state is not ready either) or MARKOV_ALLOCATION_ERROR
+ */
+int markov_generate(const Markov *model, int num_of_tweets, int max_length,
+                    TweetBatch *batch, RandomState *random_state);
+
+/**
+ * Same as markov_generate, but every tweet starts with the given word.
+ * @param model the frozen model (of order 1, not loaded)
+ * @param word the first word of every tweet (does not need to be null
+ * terminated)
+ * @param length number of characters in word
+ * @param num_of_tweets how many tweets to generate
+ * @param max_length maximum number of words in every tweet
+ * @param batch the batch to add the tweets to
+ * @param random_state the generator to draw from
+ * @return MARKOV_OK, MARKOV_INVALID_ARGUMENT, MARKOV_NOT_READY,
+ * MARKOV_UNKNOWN_WORD or MARKOV_ALLOCATION_ERROR
+ */
+int markov_generate_from(const Markov *model, const char *word, size_t length,
+                         int num_of_tweets, int max_length, TweetBatch *batch,
+                         RandomState *random_state);
+
+/**
+ * Same as markov_generate, but every tweet starts with a word that starts
+ * with the given prefix (one of them at random for every tweet, each as
+ * likely). A whole word is a prefix too.
+ * @param model the frozen model, built with the keyword_index option
+ * @param prefix the prefix (does not need to be null terminated)
+ * @param length number of characters in prefix
+ * @param num_of_tweets how many tweets to generate
+ * @param max_length maximum number of words in every tweet
+ * @param batch the batch to add the tweets to
+ * @param random_state the generator to draw from
+ * @return MARKOV_OK, MARKOV_NOT_READY, MARKOV_UNKNOWN_WORD (no word starts
+ * with the prefix) or MARKOV_ALLOCATION_ERROR
+ */
+int markov_generate_starting(const Markov *model, const char *prefix, size_t length,
+                             int num_of_tweets, int max_length, TweetBatch *batch,
+                             RandomState *random_state);
+
+/**
+ * Same as markov_generate_starting, but the word that starts with the prefix
+ * can be anywhere in the tweet: the words before it are walked backward
+ * through the transitions that led to it (see write_tweet_containing).
+ * @param model the frozen model, built with the keyword_index option
+ * @param prefix the prefix (does not need to be null terminated)
+ * @param length number of characters in prefix
+ * @param num_of_tweets how many tweets to generate
+ * @param max_length maximum number of words in every tweet
+ * @param batch the batch to add the tweets to
+ * @param random_state the generator to draw from
+ * @return MARKOV_OK, MARKOV_NOT_READY, MARKOV_UNKNOWN_WORD (no word starts
+ * with the prefix) or MARKOV_ALLOCATION_ERROR
+ */
+int markov_generate_containing(const Markov *model, const char *prefix, size_t length,
+                               int num_of_tweets, int max_length, TweetBatch *batch,
+                               RandomState *random_state);
+
+/**
+ * Initialize a mixture of models (see chain_mixture.h), which must not
+ * change while the mixture is used and must outlive it.
+ * @param mixture the mixture to initialize, freed with free_chain_mixture
+ * @param models the frozen models (at least one, of order 1, not loaded)
+ * @param weights the weight of every model (not negative, they don't need
+ * to sum to 1)
+ * @param num_of_models number of models
+ * @return MARKOV_OK, MARKOV_INVALID_ARGUMENT, MARKOV_NOT_READY (a model is
+ * not frozen, or no model with some weight has a word to start a tweet
+ * with) or MARKOV_ALLOCATION_ERROR
+ */
+int markov_init_mixture(ChainMixture *mixture, Markov *const *models,
+                        const double *weights, int num_of_models);
+
+/**
+ * Write the model to a model file (see model_file.h).
+ * @param model the model (of order 1, not loaded)
+ * @param path the file to write
+ * @return MARKOV_OK, MARKOV_INVALID_ARGUMENT or MARKOV_IO_ERROR
+ */
+int markov_save(const Markov *model, const char *path);
+
+/**
+ * @param model the model
+ * @return how many different words the model has (the ones pruned away
+ * not included)
+ */
+int markov_word_count(const Markov *model);
+
+/**
+ * Fill stats with what the model is made of (see markov_stats.h).
+ * @param model the model (all 0 unless it is of order 1 and not loaded)
+ * @param stats where to store the stats
+ */
+void markov_stats(const Markov *model, MarkovChainStats *stats);
+
+/**
+ * Hand the model's chain over to the caller (to train it online, for
+ * example) and free the rest of the model.
+ * @param model the model, set to NULL (left alone if it has no chain)
+ * @return the chain, for the caller to free, NULL for an n-gram chain or a
+ * loaded model
+ */
+MarkovChain *markov_take_chain(Markov **model);
+
+/**
+ * Free the model and everything in it.
+ * @param model the model to free, set to NULL
+ */
+void markov_destroy(Markov **model);
+
+/**
+ * @param status a MarkovStatus
+ * @return a message describing status
+ */
+const char *markov_strerror(int status);
+
+#endif //_MARKOV_H_
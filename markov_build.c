@@ -0,0 +1,106 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "external_build.h"
+#include "tokenizer.h"
+
+// Builds a model file out of corpora of any size in a bounded amount of
+// memory (see external_build.h):
+//   markov_build [--budget MiB] [--temp dir] (--model | --runs) <output> <inputs...>
+// an input is either a corpus or a run file written by --runs (a shard), so
+// shards counted on their own can be merged into one model later. The model
+// is loaded with tweets_generator's --load-model
+
+#define BUDGET_OPTION "--budget"
+#define TEMP_OPTION "--temp"
+#define MODEL_OPTION "--model"
+#define RUNS_OPTION "--runs"
+#define DEFAULT_BUDGET_MIB 256
+#define USAGE "Usage: markov_build [--budget MiB] [--temp dir] " \
+              "(--model | --runs) <output> <inputs...>\n"
+
+// whether the file starts like a run file
+static int is_run_file(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return 0;
+    uint32_t magic = 0;
+    int result = fread(&magic, sizeof(magic), 1, file) == 1 && magic == RUN_FILE_MAGIC;
+    fclose(file);
+    return result;
+}
+
+static int add_input(ExternalBuilder *builder, const char *path)
+{
+    if (is_run_file(path))
+        return add_run_file_to_builder(builder, path);
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return 1;
+    Tokenizer tokenizer;
+    int failed = init_file_tokenizer(&tokenizer, file);
+    if (!failed)
+    {
+        failed = add_corpus_to_builder(builder, &tokenizer, INT32_MAX);
+        free_tokenizer(&tokenizer);
+    }
+    fclose(file);
+    return failed;
+}
+
+int main(int argc, char *argv[])
+{
+    long budget_mib = DEFAULT_BUDGET_MIB;
+    const char *temp_dir = NULL;
+    const char *output = NULL;
+    int write_runs = 0;
+    int i = 1;
+    for (; i < argc && output == NULL; i += 2)
+    {
+        if (i + 1 == argc)
+            break;
+        if (strcmp(argv[i], BUDGET_OPTION) == 0)
+            budget_mib = strtol(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], TEMP_OPTION) == 0)
+            temp_dir = argv[i + 1];
+        else if (strcmp(argv[i], MODEL_OPTION) == 0 || strcmp(argv[i], RUNS_OPTION) == 0)
+        {
+            write_runs = strcmp(argv[i], RUNS_OPTION) == 0;
+            output = argv[i + 1];
+        }
+        else
+            break;
+    }
+    if (output == NULL || i >= argc || budget_mib < 1)
+    {
+        fprintf(stderr, USAGE);
+        return EXIT_FAILURE;
+    }
+
+    ExternalBuilder builder;
+    if (init_external_builder(&builder, (size_t) budget_mib << 20, temp_dir) == 1)
+    {
+        fprintf(stderr, "Allocation failure\n");
+        return EXIT_FAILURE;
+    }
+    for (; i < argc; ++i)
+    {
+        if (add_input(&builder, argv[i]) == 1)
+        {
+            fprintf(stderr, "Error: could not read %s\n", argv[i]);
+            free_external_builder(&builder);
+            return EXIT_FAILURE;
+        }
+    }
+    int failed = write_runs ? write_builder_runs(&builder, output)
+                            : write_builder_model(&builder, output);
+    free_external_builder(&builder);
+    if (failed)
+    {
+        fprintf(stderr, "Error: could not write %s\n", output);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -1,15 +1,79 @@
 #include "markov_chain.h"
+#include "markov_stats.h"
+#include "alias_table.h"
 #include <stdio.h>
 #include <string.h>
 
 /**
- * Get random number between 0 and max_number [0, max_number).
+ * Get random number between 0 and max_number [0, max_number), with no
+ * modulo bias.
+ * @param random_state the generator to draw from
  * @param max_number
  * @return Random number
  */
-int get_random_number(int max_number)
+int get_random_number(RandomState *random_state, int max_number)
 {
-    return rand() % max_number;
+    // Lemire's method: scale 32 random bits by max_number, and only redraw
+    // in the rare case the low half lands in the biased part
+    uint32_t bound = (uint32_t) max_number;
+    uint64_t product = (next_random(random_state) >> 32) * bound;
+    if ((uint32_t) product < bound)
+    {
+        uint32_t threshold = -bound % bound;
+        while ((uint32_t) product < threshold)
+            product = (next_random(random_state) >> 32) * bound;
+    }
+    return (int) (product >> 32);
+}
+
+
+/**
+ * Allocate a new markov chain with an empty database.
+ * @return the new chain, NULL in case of allocation error.
+ */
+MarkovChain* create_markov_chain(void){
+    MarkovChain* markov_chain = (MarkovChain*) malloc(sizeof(MarkovChain));
+    if(markov_chain == NULL){
+        return NULL;
+    }
+    markov_chain->database = (LinkedList*) malloc(sizeof(LinkedList));
+    if(markov_chain->database == NULL){
+        free(markov_chain);
+        return NULL;
+    }
+    if(init_word_table(&markov_chain->words) == 1){
+        free(markov_chain->database);
+        free(markov_chain);
+        return NULL;
+    }
+    markov_chain->nodes = NULL;
+    markov_chain->nodes_capacity = 0;
+    init_slab_pool(&markov_chain->markov_nodes, sizeof(MarkovNode),
+                   SLAB_OBJECTS_PER_SLAB);
+    init_slab_pool(&markov_chain->list_nodes, sizeof(Node),
+                   SLAB_OBJECTS_PER_SLAB);
+    init_arena(&markov_chain->tables, STRING_ARENA_BLOCK_SIZE);
+    for(int i = 0; i < ALIAS_TABLE_CLASSES; ++i){
+        markov_chain->free_tables[i] = NULL;
+    }
+    markov_chain->edge_offsets = NULL;
+    markov_chain->edge_successors = NULL;
+    markov_chain->edge_frequencies = NULL;
+    markov_chain->num_of_compacted_edges = 0;
+    markov_chain->num_of_uncompacted_edges = 0;
+    markov_chain->dirty_nodes = NULL;
+    markov_chain->num_of_dirty_nodes = 0;
+    markov_chain->dirty_nodes_capacity = 0;
+    markov_chain->start_table = NULL;
+    markov_chain->num_of_new_starts = 0;
+    markov_chain->num_of_table_starts = 0;
+    markov_chain->uniform_first_words = 0;
+    markov_chain->startable_blocks = NULL;
+    markov_chain->startable_blocks_capacity = 0;
+    markov_chain->num_of_startable_words = 0;
+    *markov_chain->database = (LinkedList) {NULL, NULL, 0,
+                                            &markov_chain->list_nodes};
+    return markov_chain;
 }
 
 
@@ -22,15 +86,23 @@ int get_random_number(int max_number)
  * database.
  */
 Node* get_node_from_database(MarkovChain *markov_chain, char *data_ptr){
-    Node* currentNode = markov_chain->database->first;
-    // if the list is empty this should just skip the loop and return NULL
-    while(currentNode != NULL) {
-        if (strcmp(currentNode->data->data, data_ptr) == 0) {
-            return currentNode;
-        }
-        currentNode = currentNode->next;
+    int word_id = find_word(&markov_chain->words, data_ptr, strlen(data_ptr));
+    if(word_id == -1){
+        return NULL;
     }
-    return NULL;
+    return markov_chain->nodes[word_id];
+}
+
+
+/**
+ * Get the MarkovNode of a word by its id.
+ * @param markov_chain the chain the word belongs to
+ * @param word_id id of the word (must be in the database)
+ * @return the MarkovNode of the word
+ */
+MarkovNode* get_node_by_id(const MarkovChain *markov_chain,
+                           unsigned int word_id){
+    return markov_chain->nodes[word_id]->data;
 }
 
 
@@ -43,217 +115,705 @@ Node* get_node_from_database(MarkovChain *markov_chain, char *data_ptr){
  * returns NULL in case of memory allocation failure.
  */
 Node* add_to_database(MarkovChain *markov_chain, char *data_ptr){
-    // Check if the node already exists in the database
-    Node* existingNode = get_node_from_database(markov_chain, data_ptr);
-    if(existingNode != NULL){
-        return existingNode;
+    return add_word_to_database(markov_chain, data_ptr, strlen(data_ptr));
+}
+
+
+// makes sure the next startable word has a place in a block, returns 1 in
+// case of allocation error
+static int reserve_startable_word(MarkovChain *markov_chain){
+    int block = markov_chain->num_of_startable_words >> STARTABLE_BLOCK_BITS;
+    if(markov_chain->num_of_startable_words & (STARTABLE_BLOCK_WORDS - 1)){
+        return 0;
     }
+    if(block == markov_chain->startable_blocks_capacity){
+        int capacity = block == 0 ? 1 : block * 2;
+        unsigned int** blocks = realloc(markov_chain->startable_blocks,
+                                        capacity * sizeof(unsigned int*));
+        if(blocks == NULL){
+            return 1;
+        }
+        markov_chain->startable_blocks = blocks;
+        markov_chain->startable_blocks_capacity = capacity;
+    }
+    markov_chain->startable_blocks[block] = arena_alloc(&markov_chain->tables,
+                                                        STARTABLE_BLOCK_WORDS
+                                                        * sizeof(unsigned int),
+                                                        sizeof(unsigned int));
+    return markov_chain->startable_blocks[block] == NULL;
+}
 
-    // Allocate a new MarkovNode
-    MarkovNode* newMarkovNode = (MarkovNode*) malloc(sizeof(MarkovNode));
-    if(newMarkovNode == NULL){
-        error(ALLOCATION_ERROR_MASSAGE);
+unsigned int get_startable_word(const MarkovChain *markov_chain, int index){
+    return markov_chain->startable_blocks[index >> STARTABLE_BLOCK_BITS]
+                                         [index & (STARTABLE_BLOCK_WORDS - 1)];
+}
+
+
+/**
+ * Same as add_to_database, for a word that is not null terminated (like the
+ * words a Tokenizer hands out).
+ * @param markov_chain the chain to look in its database
+ * @param data_ptr the word to look for
+ * @param length number of characters in the word
+ * @return Node wrapping the word in given chain's database,
+ * returns NULL in case of memory allocation failure.
+ */
+Node* add_word_to_database(MarkovChain *markov_chain, const char *data_ptr,
+                           size_t length){
+    // Check if the word already exists in the database (if not, interning
+    // it gives it the next id)
+    int size = markov_chain->words.size;
+    unsigned int word_id;
+    if(intern_word(&markov_chain->words, data_ptr, length, &word_id) == 1){
+        return NULL;
+    }
+    if(markov_chain->words.size == size){
+        return markov_chain->nodes[word_id];
+    }
+
+    int startable = !word_ends_sentence(&markov_chain->words, word_id);
+    if(startable && reserve_startable_word(markov_chain) == 1){
         return NULL;
     }
 
-    // Initialize the data field
-    newMarkovNode->data = (char*) malloc(strlen(data_ptr) + 1);
-    strcpy(newMarkovNode->data, data_ptr);
-    if(newMarkovNode->data == NULL){
-        error(ALLOCATION_ERROR_MASSAGE);
-        free(newMarkovNode); // Free the allocated MarkovNode
+    // make room for the new word's Node
+    if(markov_chain->nodes_capacity == markov_chain->database->size){
+        int capacity = markov_chain->nodes_capacity == 0
+                       ? WORD_TABLE_INITIAL_CAPACITY
+                       : markov_chain->nodes_capacity * 2;
+        Node** nodes = realloc(markov_chain->nodes, capacity * sizeof(Node*));
+        if(nodes == NULL){
+            return NULL;
+        }
+        markov_chain->nodes = nodes;
+        markov_chain->nodes_capacity = capacity;
+    }
+
+    // Allocate a new MarkovNode (nothing allocated from the chain needs to
+    // be freed on failure, free_database releases it all anyway)
+    MarkovNode* newMarkovNode = slab_pool_alloc(&markov_chain->markov_nodes);
+    if(newMarkovNode == NULL){
         return NULL;
     }
 
-    // Initialize the frequency list pointers
-    newMarkovNode->frequency_list = NULL;
-    newMarkovNode->last_frequency_node = NULL;
+    // Initialize the data field
+    newMarkovNode->data = markov_chain->words.words[word_id];
+
+    // Initialize the successors (allocated with the first one)
+    newMarkovNode->successors = NULL;
+    newMarkovNode->frequencies = NULL;
+    newMarkovNode->num_of_successors = 0;
+    newMarkovNode->successors_capacity = 0;
+    newMarkovNode->successor_slots = NULL;
+    newMarkovNode->successor_slot_capacity = 0;
+    newMarkovNode->alias_table = NULL;
+    newMarkovNode->start_count = 0;
+    newMarkovNode->id = (int) word_id;
 
     // Add the new MarkovNode to the database
     if(add(markov_chain->database, newMarkovNode) == 1){
-        error(ALLOCATION_ERROR_MASSAGE);
-        free(newMarkovNode->data);
-        free(newMarkovNode); // Free the MarkovNode and its data
         return NULL;
     }
 
+    markov_chain->nodes[word_id] = markov_chain->database->last;
+    if(startable){
+        int index = markov_chain->num_of_startable_words++;
+        markov_chain->startable_blocks[index >> STARTABLE_BLOCK_BITS]
+                                      [index & (STARTABLE_BLOCK_WORDS - 1)] = word_id;
+    }
+
     // Return the newly added node
     return markov_chain->database->last;
 }
 
 
+/**
+ * Count more sentences that start with a word (the ones that end a sentence
+ * are left out). The start table takes them in the next time the chain is
+ * frozen, or once enough of them were added.
+ * @param markov_chain the chain markov_node belongs to
+ * @param markov_node the first word of the sentences
+ * @param count how many sentences
+ */
+void add_sentence_start(MarkovChain *markov_chain, MarkovNode *markov_node,
+                        unsigned int count){
+    if(count == 0 || word_ends_sentence(&markov_chain->words, markov_node->id)){
+        return;
+    }
+    markov_node->start_count += count;
+    markov_chain->num_of_new_starts += count;
+}
+
+
+/**
+ * fills the database with the words handed out by a tokenizer. A line starts
+ * a new sentence, and so does the word after one that ends with '.'. The
+ * chain does not need to be empty: the new words and transitions are added
+ * to the ones already there (and the nodes they change become dirty).
+ *
+ * @param tokenizer the tokenizer to read the words from
+ * @param words_to_read stop after this many words
+ * @param markovChain the chain to fill
+ * @return 0 on success, 1 on failure
+ */
+int fill_database_from_tokenizer(Tokenizer *tokenizer, int words_to_read,
+                                 MarkovChain* markovChain){
+    // the first word of the input has nothing before it
+    MarkovNode* current_node = NULL;
+    Token token;
+    STATS_TIMER_START(ingest_start);
+
+    // the limit is checked per word, so reading stops right at it
+    for (int words_read = 0; words_read < words_to_read
+                             && next_token(tokenizer, &token); ++words_read) {
+        STATS_TIMER_START(insert_start);
+        Node* next_node = add_word_to_database(markovChain, token.start, token.length);
+        // check if adding the new node was successful (allocation success check) (success also means it existed)
+        if(next_node == NULL){
+            return 1;
+        }
+        // we don't add the first word of a line or of a sentence as a successor,
+        // it's counted as a start instead
+        if(current_node == NULL || token.starts_line){
+            add_sentence_start(markovChain, next_node->data, 1);
+        }
+        else if(add_node_to_frequency_list(markovChain, current_node, next_node->data) == 1){
+            return 1;
+        }
+        current_node = token.start[token.length - 1] == '.' ? NULL : next_node->data;
+        STATS_TIMER_STOP(insert_ns, insert_start);
+    }
+    // whatever was not spent inserting was spent tokenizing
+    STATS_TIMER_STOP(ingest_ns, ingest_start);
+    return tokenizer->failed;
+}
+
+
+// spreads the word ids over a node's index (consecutive ids are common)
+static unsigned int hash_successor(unsigned int word_id){
+    return word_id * 2654435761u;
+}
+
+// puts the successor at position into the node's index, which has room
+static void insert_successor_slot(MarkovNode *markov_node, int position){
+    unsigned int mask = (unsigned int) markov_node->successor_slot_capacity - 1;
+    unsigned int slot = hash_successor(markov_node->successors[position]) & mask;
+    while(markov_node->successor_slots[slot] != -1)
+        slot = (slot + 1) & mask;
+    markov_node->successor_slots[slot] = position;
+}
+
+// (re)builds the node's index with at least twice as many slots as successors
+static int build_successor_index(MarkovNode *markov_node){
+    int capacity = markov_node->successor_slot_capacity > 0
+                   ? markov_node->successor_slot_capacity : 4 * SUCCESSOR_INDEX_THRESHOLD;
+    while(capacity < markov_node->num_of_successors * 2)
+        capacity *= 2;
+    int* slots = malloc(capacity * sizeof(int));
+    if(slots == NULL)
+        return 1;
+    memset(slots, -1, capacity * sizeof(int));
+    free(markov_node->successor_slots);
+    markov_node->successor_slots = slots;
+    markov_node->successor_slot_capacity = capacity;
+    for(int i = 0; i < markov_node->num_of_successors; ++i)
+        insert_successor_slot(markov_node, i);
+    return 0;
+}
+
+// doubles the node's successor arrays (or gives it its own copy of them, if
+// they are borrowed from the chain's edge arrays). both arrays share one
+// block: the successors, then the frequencies right after them
+static int grow_successors(MarkovNode *markov_node){
+    int count = markov_node->num_of_successors;
+    int capacity = count * 2;
+    if(capacity < INITIAL_SUCCESSORS_CAPACITY)
+        capacity = INITIAL_SUCCESSORS_CAPACITY;
+    unsigned int* block;
+    if(markov_node->successors_capacity > 0){
+        block = realloc(markov_node->successors,
+                        2 * capacity * sizeof(unsigned int));
+        if(block == NULL)
+            return 1;
+        // the frequencies move up to make room for the new successors
+        memmove(block + capacity, block + markov_node->successors_capacity,
+                count * sizeof(unsigned int));
+    }
+    else{
+        block = malloc(2 * capacity * sizeof(unsigned int));
+        if(block == NULL)
+            return 1;
+        if(count > 0){
+            memcpy(block, markov_node->successors, count * sizeof(unsigned int));
+            memcpy(block + capacity, markov_node->frequencies,
+                   count * sizeof(unsigned int));
+        }
+    }
+    markov_node->successors = block;
+    markov_node->frequencies = block + capacity;
+    markov_node->successors_capacity = capacity;
+    return 0;
+}
+
+
+// puts the node on the chain's dirty list
+static int mark_node_dirty(MarkovChain *markov_chain, const MarkovNode *markov_node){
+    if(markov_chain->num_of_dirty_nodes == markov_chain->dirty_nodes_capacity){
+        int capacity = markov_chain->dirty_nodes_capacity == 0
+                       ? WORD_TABLE_INITIAL_CAPACITY
+                       : markov_chain->dirty_nodes_capacity * 2;
+        unsigned int* dirty_nodes = realloc(markov_chain->dirty_nodes,
+                                            capacity * sizeof(unsigned int));
+        if(dirty_nodes == NULL)
+            return 1;
+        markov_chain->dirty_nodes = dirty_nodes;
+        markov_chain->dirty_nodes_capacity = capacity;
+    }
+    markov_chain->dirty_nodes[markov_chain->num_of_dirty_nodes++] = markov_node->id;
+    return 0;
+}
+
 
 /**
- * Add the second markov_node to the frequency list of the first markov_node.
+ * Add the second markov_node to the successors of the first markov_node.
  * If already in list, update it's occurrence frequency value.
+ * @param markov_chain the chain both nodes belong to (new list entries are
+ * allocated from it)
  * @param first_node
  * @param second_node
  * @return success/failure: 0 if the process was successful, 1 if in
  * case of allocation error.
  */
-int add_node_to_frequency_list(MarkovNode *first_node, MarkovNode *second_node){
-    // check if the frequency list is empty, if it is we just add the node directly
-    if(first_node->frequency_list == NULL){
-        first_node->frequency_list = (MarkovNodeFrequency*) malloc(sizeof (MarkovNodeFrequency));
-        if(first_node->frequency_list == NULL){
-            error(ALLOCATION_ERROR_MASSAGE);
+int add_node_to_frequency_list(MarkovChain *markov_chain, MarkovNode *first_node, MarkovNode *second_node){
+    return add_frequency_to_list(markov_chain, first_node, second_node, 1);
+}
+
+
+/**
+ * Same as add_node_to_frequency_list, but counts frequency occurrences at once
+ * (used when merging chains).
+ * @param markov_chain the chain both nodes belong to
+ * @param first_node
+ * @param second_node
+ * @param frequency how many occurrences to add
+ * @return success/failure: 0 if the process was successful, 1 if in
+ * case of allocation error.
+ */
+int add_frequency_to_list(MarkovChain *markov_chain, MarkovNode *first_node,
+                          MarkovNode *second_node, int frequency){
+    // a frozen node's table would be stale after this, so go back to the arrays
+    // (the old table stays in the chain's arena until free_database). a node
+    // that has no table and already has successors is on the dirty list
+    if(first_node->alias_table != NULL || first_node->num_of_successors == 0){
+        if(mark_node_dirty(markov_chain, first_node) == 1){
             return 1;
         }
-        first_node->frequency_list->markov_node = second_node;
-        first_node->frequency_list->frequency = 1;
-        first_node->frequency_list->next_frequency_node = NULL; // since this is the first node there is no next node
-        first_node->last_frequency_node = first_node->frequency_list; // since the list was empty the first node is = to the last node
-    }
-    // now we are left with 2 options: either it exists and needs updating or does not exist and needs to be added
-    else {
-        // since the list is not empty lets see if the second node is already in the frequency list
-        MarkovNodeFrequency *frequency_node = find_markov_node_frequency(first_node, second_node);
-
-
-        // if the second node was not found in the frequency list we need to add it to the end of the list
-        if (frequency_node == NULL) {
-            // create the new node that needs to be added
-            MarkovNodeFrequency *new_frequency_node = (MarkovNodeFrequency *) malloc(sizeof(MarkovNodeFrequency));
-            if (new_frequency_node == NULL) {
+    }
+    first_node->alias_table = NULL;
+
+    // see if the second node is already one of the successors, if so we just count it
+    int position = find_markov_node_frequency(first_node, second_node);
+    if(position != -1){
+        first_node->frequencies[position] += frequency;
+        return 0;
+    }
+
+    // otherwise it goes at the end of the arrays
+    // (a frozen node's capacity is 0, so it always gets its own arrays here)
+    if(first_node->num_of_successors >= first_node->successors_capacity){
+        if(first_node->successors_capacity == 0){
+            markov_chain->num_of_uncompacted_edges += first_node->num_of_successors;
+        }
+        if(grow_successors(first_node) == 1){
+            return 1;
+        }
+    }
+    position = first_node->num_of_successors++;
+    markov_chain->num_of_uncompacted_edges++;
+    first_node->successors[position] = second_node->id;
+    first_node->frequencies[position] = frequency;
+
+    // big nodes find their successors through the index from now on
+    if(first_node->successor_slots != NULL
+       && first_node->num_of_successors * 2 <= first_node->successor_slot_capacity){
+        insert_successor_slot(first_node, position);
+    }
+    else if(first_node->num_of_successors > SUCCESSOR_INDEX_THRESHOLD){
+        if(build_successor_index(first_node) == 1){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Check if the second node is one of the successors of the first node
+ * @param first_node
+ * @param second_node
+ * @return will return -1 if it was not found. will return its position in first_node's successors if found
+ */
+int find_markov_node_frequency(const MarkovNode *first_node, const MarkovNode *second_node){
+    unsigned int word_id = (unsigned int) second_node->id;
+    if(first_node->successor_slots != NULL){
+        unsigned int mask = (unsigned int) first_node->successor_slot_capacity - 1;
+        for(unsigned int slot = hash_successor(word_id) & mask;
+            first_node->successor_slots[slot] != -1; slot = (slot + 1) & mask){
+            if(first_node->successors[first_node->successor_slots[slot]] == word_id)
+                return first_node->successor_slots[slot];
+        }
+        return -1;
+    }
+    // small nodes just scan their (contiguous) successors
+    for(int i = 0; i < first_node->num_of_successors; ++i){
+        if(first_node->successors[i] == word_id)
+            return i;
+    }
+    // we will return -1 if it is not found and its position if it is found
+    return -1;
+}
+
+/**
+ * Add all the words and transitions of source to destination, summing the
+ * frequencies of transitions both have. Merging the chains of consecutive
+ * parts of a text gives exactly the chain of the whole text (same database
+ * order, same successors order).
+ * @param destination the chain to merge into
+ * @param source the chain to merge, left unchanged
+ * @return 0 on success, 1 in case of allocation error.
+ */
+int merge_markov_chain(MarkovChain *destination, MarkovChain *source){
+    // source's ids are dense, so translating them to destination's ids
+    // is one array lookup per transition
+    unsigned int* translated = malloc(source->database->size * sizeof(unsigned int));
+    if(translated == NULL && source->database->size > 0){
+        return 1;
+    }
+
+    // the words first, in source's order
+    for(Node* current_node = source->database->first; current_node != NULL;
+        current_node = current_node->next){
+        MarkovNode* markov_node = current_node->data;
+        Node* merged_node = add_word_to_database(destination, markov_node->data,
+                                                 source->words.lengths[markov_node->id]);
+        if(merged_node == NULL){
+            free(translated);
+            return 1;
+        }
+        translated[markov_node->id] = merged_node->data->id;
+        add_sentence_start(destination, merged_node->data, markov_node->start_count);
+    }
+
+    // then the successors of every node, in their own order
+    for(Node* current_node = source->database->first; current_node != NULL;
+        current_node = current_node->next){
+        MarkovNode* markov_node = current_node->data;
+        MarkovNode* first_node = get_node_by_id(destination,
+                                                translated[markov_node->id]);
+        for(int i = 0; i < markov_node->num_of_successors; ++i){
+            if(add_frequency_to_list(destination, first_node,
+                                     get_node_by_id(destination,
+                                                    translated[markov_node->successors[i]]),
+                                     (int) markov_node->frequencies[i]) == 1){
+                free(translated);
                 return 1;
             }
-
-            // the last node needs to point to this new node
-            first_node->last_frequency_node->next_frequency_node = new_frequency_node;
-            // update the last node to be this new node
-            first_node->last_frequency_node = new_frequency_node;
-
-            // update this new node
-            new_frequency_node->next_frequency_node = NULL;
-            new_frequency_node->markov_node = second_node;
-            new_frequency_node->frequency = 1;
-        } else {
-            frequency_node->frequency++;
         }
     }
+    free(translated);
     return 0;
 }
 
-// this is a helper function to see if a frequency node is in the frequency list of a markov node
-// IMPORTANT: this assumes the list is not empty (added that check in the add_node_to_frequency_list function)
-MarkovNodeFrequency* find_markov_node_frequency(MarkovNode *first_node, MarkovNode *second_node){
-    MarkovNodeFrequency* frequency_node_iterator = first_node->frequency_list;
 
-    while(frequency_node_iterator != NULL && frequency_node_iterator->markov_node != second_node) {
-        frequency_node_iterator = frequency_node_iterator->next_frequency_node;
+/**
+ * Move the successors of every node into new edge arrays of the chain (in
+ * database order, exactly as big as needed), dropping the nodes' own arrays
+ * and indexes. freeze_markov_chain does this when it's worth it.
+ * @param markov_chain the chain to compact
+ * @return 0 on success, 1 in case of allocation error.
+ */
+int compact_markov_chain(MarkovChain *markov_chain){
+    size_t num_of_edges = 0;
+    for(Node* current_node = markov_chain->database->first; current_node != NULL;
+        current_node = current_node->next){
+        num_of_edges += current_node->data->num_of_successors;
+    }
+    unsigned int* offsets = malloc((markov_chain->database->size + 1)
+                                   * sizeof(unsigned int));
+    // (one extra edge so an empty chain doesn't make a 0 byte allocation)
+    unsigned int* successors = malloc((num_of_edges + 1) * sizeof(unsigned int));
+    unsigned int* frequencies = malloc((num_of_edges + 1) * sizeof(unsigned int));
+    if(offsets == NULL || successors == NULL || frequencies == NULL){
+        free(offsets);
+        free(successors);
+        free(frequencies);
+        return 1;
+    }
+
+    unsigned int offset = 0;
+    for(Node* current_node = markov_chain->database->first; current_node != NULL;
+        current_node = current_node->next){
+        MarkovNode* markov_node = current_node->data;
+        size_t count = markov_node->num_of_successors;
+        offsets[markov_node->id] = offset;
+        if(count > 0){
+            memcpy(successors + offset, markov_node->successors,
+                   count * sizeof(unsigned int));
+            memcpy(frequencies + offset, markov_node->frequencies,
+                   count * sizeof(unsigned int));
+        }
+        if(markov_node->successors_capacity > 0){
+            free(markov_node->successors);
+        }
+        free(markov_node->successor_slots);
+        markov_node->successors = successors + offset;
+        markov_node->frequencies = frequencies + offset;
+        markov_node->successors_capacity = 0;
+        markov_node->successor_slots = NULL;
+        markov_node->successor_slot_capacity = 0;
+        offset += (unsigned int) count;
     }
-    // we will return NULL if it is not found and the frequency node that matches if it is found
-    return frequency_node_iterator;
+    offsets[markov_chain->database->size] = offset;
+
+    free(markov_chain->edge_offsets);
+    free(markov_chain->edge_successors);
+    free(markov_chain->edge_frequencies);
+    markov_chain->edge_offsets = offsets;
+    markov_chain->edge_successors = successors;
+    markov_chain->edge_frequencies = frequencies;
+    markov_chain->num_of_compacted_edges = num_of_edges;
+    markov_chain->num_of_uncompacted_edges = 0;
+    return 0;
 }
 
 
+// builds a new start table out of the start counts (the old one stays in
+// the tables arena, like the old tables of dirty nodes, unless the online
+// chain recycles it)
+static int build_start_table(MarkovChain *markov_chain){
+    int num_of_starts = 0;
+    for(Node* current_node = markov_chain->database->first; current_node != NULL;
+        current_node = current_node->next){
+        num_of_starts += current_node->data->start_count > 0;
+    }
+    markov_chain->start_table = NULL;
+    if(num_of_starts == 0){
+        return 0;
+    }
+    unsigned int* words = malloc(num_of_starts * sizeof(unsigned int));
+    unsigned int* counts = malloc(num_of_starts * sizeof(unsigned int));
+    if(words == NULL || counts == NULL){
+        free(words);
+        free(counts);
+        return 1;
+    }
+    int i = 0;
+    for(Node* current_node = markov_chain->database->first; current_node != NULL;
+        current_node = current_node->next){
+        if(current_node->data->start_count > 0){
+            words[i] = (unsigned int) current_node->data->id;
+            counts[i++] = current_node->data->start_count;
+        }
+    }
+    markov_chain->start_table = create_alias_table(&markov_chain->tables,
+                                                   markov_chain->free_tables, words,
+                                                   counts, num_of_starts);
+    free(words);
+    free(counts);
+    return markov_chain->start_table == NULL;
+}
+
 /**
- * Free markov_chain and all of it's content from memory
- * @param markov_chain markov_chain to free
+ * Switch the chain to sampling mode: build an alias table for every node with
+ * successors, so get_next_random_node samples in O(1), and compact the
+ * successors of all the nodes into the chain's edge arrays.
+ * Adding a successor afterwards drops that node's table again and makes it
+ * dirty. Freezing again only builds tables for the dirty nodes, and only
+ * compacts again once enough successors were added outside the edge arrays.
+ * The start table is built the first time there are sentence starts, then
+ * again once enough were added since (see MarkovChain.num_of_new_starts),
+ * and never with uniform_first_words.
+ * @param markov_chain the (filled) chain to freeze
+ * @return 0 on success, 1 in case of allocation error.
  */
-void free_database(MarkovChain ** ptr_chain){
-    // first let's grab hold of the linked list
-    LinkedList* linkedList = (*ptr_chain)->database;
-    // next we grab the first node
-    Node* currentNode = linkedList->first;
-    while(currentNode != NULL){
-        // free the markov node
-        free_markov_node(currentNode->data);
-        // save this node for removal
-        Node* node_to_remove = currentNode;
-        // point to the next node
-        currentNode = currentNode->next;
-        // remove the current node (the one we saved)
-        free(node_to_remove);
-    }
-    // free the linked list
-    free(linkedList);
-    // free the markov chain
-    free(*ptr_chain);
+int freeze_markov_chain(MarkovChain *markov_chain){
+    // compacting moves the successors of every node, so after the first
+    // time it's only worth it once the nodes' own arrays hold as many
+    // successors as the edge arrays
+    if(markov_chain->edge_offsets == NULL
+       || markov_chain->num_of_uncompacted_edges > markov_chain->num_of_compacted_edges){
+        if(compact_markov_chain(markov_chain) == 1){
+            return 1;
+        }
+    }
+    // only the dirty nodes need a (new) table
+    for(int i = 0; i < markov_chain->num_of_dirty_nodes; ++i){
+        MarkovNode* markov_node = get_node_by_id(markov_chain,
+                                                 markov_chain->dirty_nodes[i]);
+        // a failed add may have left a node without successors, and a node
+        // that is on the list twice already got its table
+        if(markov_node->num_of_successors == 0 || markov_node->alias_table != NULL)
+            continue;
+        markov_node->alias_table = create_alias_table(&markov_chain->tables,
+                                                       markov_chain->free_tables,
+                                                       markov_node->successors,
+                                                       markov_node->frequencies,
+                                                       markov_node->num_of_successors);
+        if(markov_node->alias_table == NULL){
+            return 1;
+        }
+    }
+    markov_chain->num_of_dirty_nodes = 0;
+    // a uniform chain never samples the start table, so it doesn't need one.
+    // (the starts are only counted for words that don't end a sentence, so
+    // with new starts there is a table to build)
+    if(markov_chain->num_of_new_starts > 0 && !markov_chain->uniform_first_words
+       && (markov_chain->start_table == NULL
+           || markov_chain->num_of_new_starts * START_TABLE_SLACK
+              > markov_chain->num_of_table_starts)){
+        if(build_start_table(markov_chain) == 1){
+            return 1;
+        }
+        markov_chain->num_of_table_starts += markov_chain->num_of_new_starts;
+        markov_chain->num_of_new_starts = 0;
+    }
+    return 0;
 }
 
-// helper function for the free database
-void free_markov_node(MarkovNode* markov_node){
-    // free the frequency list first
-    free_frequency_list(markov_node->frequency_list);
-    // free the data
-    free(markov_node->data);
-    // free the node itself (in theory at this point we freed all the pointer the markov node has).
-    free(markov_node);
+
+/**
+ * Count the bytes the chain takes: its words, nodes, successors, tables and
+ * indexes (allocator headers not included).
+ * @param markov_chain the chain
+ * @return number of bytes
+ */
+size_t get_markov_chain_memory(const MarkovChain *markov_chain){
+    const WordTable* words = &markov_chain->words;
+    size_t bytes = sizeof(MarkovChain) + sizeof(LinkedList)
+                   + words->strings.bytes_reserved
+                   + words->capacity * (sizeof(char*) + 2 * sizeof(unsigned int) + 1)
+                   + words->slot_capacity * sizeof(int)
+                   + markov_chain->nodes_capacity * sizeof(Node*)
+                   + markov_chain->markov_nodes.arena.bytes_reserved
+                   + markov_chain->list_nodes.arena.bytes_reserved
+                   + markov_chain->tables.bytes_reserved
+                   + markov_chain->dirty_nodes_capacity * sizeof(unsigned int)
+                   + markov_chain->startable_blocks_capacity * sizeof(unsigned int*);
+    if(markov_chain->edge_offsets != NULL){
+        bytes += (markov_chain->database->size + 1) * sizeof(unsigned int)
+                 + markov_chain->num_of_compacted_edges * 2 * sizeof(unsigned int);
+    }
+    for(Node* current_node = markov_chain->database->first; current_node != NULL;
+        current_node = current_node->next){
+        const MarkovNode* markov_node = current_node->data;
+        bytes += markov_node->successors_capacity * 2 * sizeof(unsigned int)
+                 + markov_node->successor_slot_capacity * sizeof(int);
+    }
+    return bytes;
 }
 
-// helper function for the free database (called by free_markov_node function)
-void free_frequency_list(MarkovNodeFrequency* frequency_list){
-    // point to the first frequency node
-    MarkovNodeFrequency* frequency_list_iterator = frequency_list;
-    while (frequency_list_iterator != NULL){
-        // put aside the current one to remove
-        MarkovNodeFrequency* frequency_to_remove = frequency_list_iterator;
-        // make sure im pointing to the next item
-        frequency_list_iterator = frequency_list_iterator->next_frequency_node;
-        // remove the current one (the one we saved)
-        free(frequency_to_remove);
+
+/**
+ * Free markov_chain and all of it's content from memory
+ * @param markov_chain markov_chain to free
+ */
+void free_database(MarkovChain ** ptr_chain){
+    MarkovChain* markov_chain = *ptr_chain;
+    // only the successors of nodes that were not frozen (or changed since)
+    // live outside the chain's arenas and edge arrays
+    for(Node* current_node = markov_chain->database->first; current_node != NULL;
+        current_node = current_node->next){
+        MarkovNode* markov_node = current_node->data;
+        if(markov_node->successors_capacity > 0){
+            free(markov_node->successors);
+        }
+        free(markov_node->successor_slots);
     }
+    // every node, word and table lives in one of the chain's arenas
+    free_slab_pool(&markov_chain->list_nodes);
+    free_slab_pool(&markov_chain->markov_nodes);
+    free_arena(&markov_chain->tables);
+    free(markov_chain->edge_offsets);
+    free(markov_chain->edge_successors);
+    free(markov_chain->edge_frequencies);
+    free(markov_chain->dirty_nodes);
+    free(markov_chain->startable_blocks);
+    // free the linked list, the words and the index over them
+    free(markov_chain->database);
+    free(markov_chain->nodes);
+    free_word_table(&markov_chain->words);
+    // free the markov chain
+    free(markov_chain);
+    *ptr_chain = NULL;
 }
 
 
 /**
- * Get one random MarkovNode from the given markov_chain's database.
+ * Get a random MarkovNode to start a tweet with: one of the words that
+ * started sentences, as often as they did, in O(1) through the start table.
+ * With uniform_first_words set (or no start table), any word of the
+ * database that doesn't end a sentence, all as likely, in one draw too.
  * @param markov_chain
- * @return the random MarkovNode
+ * @param random_state the generator to draw from
+ * @return the random MarkovNode, NULL if every word ends a sentence (or
+ * there are none)
  */
 // TODO we need to test that we are not meeting a NULL node at any point
-MarkovNode* get_first_random_node(MarkovChain *markov_chain){
-    // grab a random number between 1 and linked list size (including)
-    int element_number = get_random_number(markov_chain->database->size) + 1;
-    // point at the first node
-    Node* current_node = markov_chain->database->first;
-    // traverse random number of nodes
-    for (int i = 1; i < element_number; ++i, current_node = current_node->next);
-    // return the markovNode inside the markov_chain
-    char* current_word = current_node->data->data;
-
-    // if the first node we found ends with a dot we need to find a new one
-    while (current_word[strlen(current_word) - 1] == '.'){
-        element_number = get_random_number(markov_chain->database->size) + 1;
-        current_node = markov_chain->database->first;
-        for (int i = 1; i < element_number; ++i, current_node = current_node->next);
-        current_word = current_node->data->data;
-    }
-    return current_node->data;
+MarkovNode* get_first_random_node(MarkovChain *markov_chain,
+                                  RandomState *random_state){
+    // no word in the start table ends a sentence, so one draw is enough
+    if(!markov_chain->uniform_first_words && markov_chain->start_table != NULL){
+        STATS_ADD(first_node_draws, 1);
+        return get_node_by_id(markov_chain, sample_alias_table(markov_chain->start_table,
+                                                               random_state));
+    }
+
+    // a tweet can't start with a word that ends with a dot, so the draw is
+    // among the others only
+    if(markov_chain->num_of_startable_words == 0){
+        return NULL;
+    }
+    STATS_ADD(first_node_draws, 1);
+    int index = get_random_number(random_state, markov_chain->num_of_startable_words);
+    return get_node_by_id(markov_chain, get_startable_word(markov_chain, index));
 }
 
 /**
  * Choose randomly the next MarkovNode, depend on it's occurrence frequency.
+ * @param markov_chain the chain cur_markov_node belongs to
  * @param cur_markov_node current MarkovNode
- * @return the next random MarkovNode
+ * @param random_state the generator to draw from
+ * @return the next random MarkovNode, NULL if cur_markov_node has no
+ * successors
  */
-MarkovNode* get_next_random_node(MarkovNode *cur_markov_node){
-    MarkovNodeFrequency* current_frequency = cur_markov_node->frequency_list;
-
+MarkovNode* get_next_random_node(const MarkovChain *markov_chain,
+                                 MarkovNode *cur_markov_node,
+                                 RandomState *random_state){
     // TODO not sure I need this I think I land out at NULL anyway in which case remove the comment in the bottom
-    if(current_frequency == NULL)
+    if(cur_markov_node->num_of_successors == 0)
         return NULL;
 
+    // frozen nodes sample from their alias table in O(1)
+    if(cur_markov_node->alias_table != NULL)
+        return get_node_by_id(markov_chain,
+                              sample_alias_table(cur_markov_node->alias_table,
+                                                 random_state));
+
     int accumulated_frequency = 0;
 
     // let's find out the range of numbers from which to choose the random number
-    while(current_frequency != NULL){
-        accumulated_frequency += current_frequency->frequency;
-        current_frequency = current_frequency->next_frequency_node;
+    for(int i = 0; i < cur_markov_node->num_of_successors; ++i){
+        accumulated_frequency += (int) cur_markov_node->frequencies[i];
     }
 
     // let's grab a random number from the range we made;
-    int random_number = get_random_number(accumulated_frequency);
+    int random_number = get_random_number(random_state, accumulated_frequency);
 
     // grab and return the node with the accumulation of the random number
     accumulated_frequency = 0;
-    current_frequency = cur_markov_node->frequency_list;
-    while(current_frequency != NULL){
-        accumulated_frequency += current_frequency->frequency;
+    for(int i = 0; i < cur_markov_node->num_of_successors; ++i){
+        accumulated_frequency += (int) cur_markov_node->frequencies[i];
         if(random_number < accumulated_frequency)
-            return current_frequency->markov_node;
-        current_frequency = current_frequency->next_frequency_node;
+            return get_node_by_id(markov_chain, cur_markov_node->successors[i]);
     }
 
     // CODE SHOULD NEVER REACH THIS POINT!!!
@@ -263,27 +823,87 @@ MarkovNode* get_next_random_node(MarkovNode *cur_markov_node){
 /**
  * Receive first node of markov_chain, generate and print random sentence out of it. The
  * sentence must have at least 2 words in it. {this means that we must call get_first_random_node and pass the return of that to this function}
+ * @param markov_chain the chain first_node belongs to
  * @param first_node markov_node to start with
  * @param  max_length maximum length of chain to generate
+ * @param random_state the generator to draw from
+ * @return 0 on success, 1 in case of allocation error.
+ */
+int generate_tweet(const MarkovChain *markov_chain, MarkovNode *first_node,
+                   int max_length, RandomState *random_state){
+    TweetBatch batch;
+    if(init_tweet_batch(&batch) == 1){
+        return 1;
+    }
+    int result = write_tweet(markov_chain, first_node, max_length, &batch,
+                             random_state);
+    if(result == 0){
+        printf("%.*s\n", (int) batch.text_length, batch.text);
+    }
+    free_tweet_batch(&batch);
+    return result;
+}
+
+/**
+ * Same as generate_tweet, but writes the sentence as a new tweet of the batch
+ * instead of printing it.
+ * @param markov_chain the chain first_node belongs to
+ * @param first_node markov_node to start with
+ * @param max_length maximum length of chain to generate
+ * @param batch the batch to write to
+ * @param random_state the generator to draw from
+ * @return 0 on success, 1 in case of allocation error.
  */
-void generate_tweet(MarkovNode *first_node, int max_length){
-     MarkovNode* current_node = first_node;
-     // In theory, I don't need to check if you get_next_random_node returns NULL
-     // since the only case that will happen is if a word has a . at the end and that will be caught in the loop
-     for (int i = 0; i < max_length-1; ++i, current_node = get_next_random_node(current_node)) {
-         if(current_node->data[strlen(current_node->data)-1] == '.'){
-             printf("%s\n", current_node->data);
-             return;
-         }
-         else{
-             printf("%s", current_node->data);
-             printf(" ");
-         }
-     }
-    printf("%s\n", current_node->data);
+int write_tweet(const MarkovChain *markov_chain, MarkovNode *first_node,
+                int max_length, TweetBatch *batch, RandomState *random_state){
+    const WordTable* words = &markov_chain->words;
+    MarkovNode* current_node = first_node;
+    for (int i = 1; i < max_length; ++i) {
+        if(word_ends_sentence(words, current_node->id)){
+            break;
+        }
+        // a word that only ever ended a line has nowhere to go either
+        MarkovNode* next_node = get_next_random_node(markov_chain, current_node,
+                                                     random_state);
+        if(next_node == NULL){
+            break;
+        }
+        if(append_word_to_tweet(batch, current_node->data,
+                                words->lengths[current_node->id]) == 1){
+            return 1;
+        }
+        current_node = next_node;
+    }
+    if(append_word_to_tweet(batch, current_node->data,
+                            words->lengths[current_node->id]) == 1){
+        return 1;
+    }
+    return end_tweet(batch);
 }
 
-int error(char error_message[]){
-    printf("%s", error_message);
-    return EXIT_FAILURE;
+/**
+ * Generate num_of_tweets tweets into the batch, each one starting from
+ * get_first_random_node. Nothing is printed.
+ * @param markov_chain the chain to generate from
+ * @param num_of_tweets how many tweets to generate
+ * @param max_length maximum length of every tweet
+ * @param batch the batch to add the tweets to
+ * @param random_state the generator to draw from
+ * @return 0 on success, 1 in case of allocation error or if no word can
+ * start a tweet.
+ */
+int generate_tweets(MarkovChain *markov_chain, int num_of_tweets,
+                    int max_length, TweetBatch *batch,
+                    RandomState *random_state){
+    STATS_TIMER_START(generate_start);
+    for (int i = 0; i < num_of_tweets; ++i) {
+        MarkovNode* first_node = get_first_random_node(markov_chain, random_state);
+        if(first_node == NULL || write_tweet(markov_chain, first_node, max_length, batch,
+                                             random_state) == 1){
+            return 1;
+        }
+    }
+    STATS_ADD(tweets_generated, num_of_tweets);
+    STATS_TIMER_STOP(generate_ns, generate_start);
+    return 0;
 }
\ No newline at end of file
@@ -2,6 +2,11 @@
 #define _MARKOV_CHAIN_H_
 
 #include "linked_list.h"
+#include "word_table.h"
+#include "arena.h"
+#include "tweet_batch.h"
+#include "random_state.h"
+#include "tokenizer.h"
 #include <stdio.h>  // For printf(), sscanf()
 #include <stdlib.h> // For malloc()
 #include <stdbool.h> // for bool
@@ -10,25 +15,110 @@
 #define ALLOCATION_ERROR_MASSAGE "Allocation failure: Failed to allocate"\
             "new memory\n"
 
+// room for this many successors is made when a node gets its first one
+#define INITIAL_SUCCESSORS_CAPACITY 2
+// nodes with more successors than this find them through a hash index
+// instead of scanning the whole array
+#define SUCCESSOR_INDEX_THRESHOLD 8
+// size classes of the chain's free lists of alias tables: the tables of
+// class c have room for at least 2^c columns
+#define ALIAS_TABLE_CLASSES 32
+// freeze_markov_chain builds the start table again once the sentence starts
+// added since it was built are more than 1/START_TABLE_SLACK of the ones it
+// was built with
+#define START_TABLE_SLACK 32
+// ids in a block of the chain's startable words
+#define STARTABLE_BLOCK_BITS 10
+#define STARTABLE_BLOCK_WORDS (1 << STARTABLE_BLOCK_BITS)
+
 
 typedef struct MarkovChain{
     LinkedList *database;
+    // interns the words of database: a word's id is its position in database
+    WordTable words;
+    // the Node of every word in database, by word id
+    Node **nodes;
+    int nodes_capacity;
+    // everything else the chain allocates comes from these, and free_database
+    // releases each of them in bulk instead of freeing object by object
+    SlabPool markov_nodes;
+    SlabPool list_nodes;
+    Arena tables;
+    // tables handed back with recycle_alias_table (only the online chain
+    // does, once no snapshot can reach them), taken before the arena grows
+    struct AliasTable* free_tables[ALIAS_TABLE_CLASSES];
+    // freeze_markov_chain moves the successors of every node here, back to
+    // back in database order (node i's are at edge_offsets[i] up to
+    // edge_offsets[i + 1]). NULL while the chain was never frozen
+    unsigned int *edge_offsets;
+    unsigned int *edge_successors;
+    unsigned int *edge_frequencies;
+    size_t num_of_compacted_edges;
+    // successors added to nodes that kept their own arrays since then
+    size_t num_of_uncompacted_edges;
+    // ids of the nodes that have successors but no alias table (the ones
+    // freeze_markov_chain has to build a table for), each one listed once
+    unsigned int *dirty_nodes;
+    int num_of_dirty_nodes;
+    int dirty_nodes_capacity;
+    // the words that started sentences, as often as they did (see
+    // MarkovNode.start_count), built by freeze_markov_chain. NULL before
+    // that, with uniform_first_words, or when no sentence started with a
+    // word that doesn't end one
+    struct AliasTable* start_table;
+    // sentence starts counted since start_table was built, and the ones it
+    // was built with. building it goes over the whole database, so a chain
+    // trained in many small rounds only builds it again once the new starts
+    // are more than 1/START_TABLE_SLACK of those; in between, the first
+    // words come from counts at most that far behind (and a word that only
+    // started sentences since is not drawn yet)
+    unsigned long long num_of_new_starts;
+    unsigned long long num_of_table_starts;
+    // get_first_random_node draws any word that doesn't end a sentence, all
+    // as likely, instead of drawing from start_table
+    int uniform_first_words;
+    // the ids of the words that don't end a sentence (the ones a tweet can
+    // start with), in database order, STARTABLE_BLOCK_WORDS to a block (see
+    // get_startable_word). the blocks are in the tables arena and never
+    // move, and ids are only ever added after the last one, so a snapshot
+    // can share them. 0 of them means no tweet can be generated
+    unsigned int **startable_blocks;
+    int startable_blocks_capacity;
+    int num_of_startable_words;
 } MarkovChain;
 
 typedef struct MarkovNode{
+    // the interned word (owned by the chain's WordTable)
     char *data;
-    struct MarkovNodeFrequency* frequency_list;
-    // any other field you need
-    struct MarkovNodeFrequency* last_frequency_node;
+    // id of the word, which is also the position of the node in the database
+    int id;
+    // the ids of the words that followed this one and how many times each
+    // did, in the order they first did (resolved with get_node_by_id). both
+    // arrays are one allocation, the frequencies right after the successors
+    unsigned int* successors;
+    unsigned int* frequencies;
+    int num_of_successors;
+    // 0 when the arrays are borrowed from the chain's edge arrays (a frozen
+    // node), which are copied out the next time a successor is added
+    int successors_capacity;
+    // open addressing index over successors (positions, -1 for an empty
+    // slot), only for nodes with more than SUCCESSOR_INDEX_THRESHOLD of them
+    int* successor_slots;
+    int successor_slot_capacity;
+    // how many sentences started with the word (always 0 for a word that
+    // ends a sentence, no tweet starts with one of those)
+    unsigned int start_count;
+    // sampling table over the successors, built by freeze_markov_chain
+    // (NULL while the chain is still being filled)
+    struct AliasTable* alias_table;
 } MarkovNode;
 
-typedef struct MarkovNodeFrequency{
-    struct MarkovNode* markov_node;
-    int frequency;
-    // any other field you need
-    struct MarkovNodeFrequency* next_frequency_node;
-} MarkovNodeFrequency;
 
+/**
+ * Allocate a new markov chain with an empty database.
+ * @return the new chain, NULL in case of allocation error.
+ */
+MarkovChain* create_markov_chain(void);
 
 /**
 * Check if data_ptr is in database. If so, return the Node wrapping it in
@@ -40,6 +130,15 @@ typedef struct MarkovNodeFrequency{
  */
 Node* get_node_from_database(MarkovChain *markov_chain, char *data_ptr);
 
+/**
+ * Get the MarkovNode of a word by its id.
+ * @param markov_chain the chain the word belongs to
+ * @param word_id id of the word (must be in the database)
+ * @return the MarkovNode of the word
+ */
+MarkovNode* get_node_by_id(const MarkovChain *markov_chain,
+                           unsigned int word_id);
+
 /**
 * If data_ptr in markov_chain, return it's node. Otherwise, create new
  * node, add to end of markov_chain's database and return it.
@@ -50,83 +149,209 @@ Node* get_node_from_database(MarkovChain *markov_chain, char *data_ptr);
  */
 Node* add_to_database(MarkovChain *markov_chain, char *data_ptr);
 
+/**
+ * fills the database with the words handed out by a tokenizer. A line starts
+ * a new sentence, and so does the word after one that ends with '.'. The
+ * chain does not need to be empty: the new words and transitions are added
+ * to the ones already there (and the nodes they change become dirty).
+ *
+ * @param tokenizer the tokenizer to read the words from
+ * @param words_to_read stop after this many words
+ * @param markovChain the chain to fill
+ * @return 0 on success, 1 on failure
+ */
+int fill_database_from_tokenizer(Tokenizer *tokenizer, int words_to_read,
+                                 MarkovChain* markovChain);
+
+/**
+ * Same as add_to_database, for a word that is not null terminated (like the
+ * words a Tokenizer hands out).
+ * @param markov_chain the chain to look in its database
+ * @param data_ptr the word to look for
+ * @param length number of characters in the word
+ * @return Node wrapping the word in given chain's database,
+ * returns NULL in case of memory allocation failure.
+ */
+Node* add_word_to_database(MarkovChain *markov_chain, const char *data_ptr,
+                           size_t length);
+
 
 /**
- * Add the second markov_node to the frequency list of the first markov_node.
+ * Add the second markov_node to the successors of the first markov_node.
  * If already in list, update it's occurrence frequency value.
+ * @param markov_chain the chain both nodes belong to (new list entries are
+ * allocated from it)
  * @param first_node
  * @param second_node
  * @return success/failure: 0 if the process was successful, 1 if in
  * case of allocation error.
  */
-int add_node_to_frequency_list(MarkovNode *first_node
+int add_node_to_frequency_list(MarkovChain *markov_chain, MarkovNode *first_node
                                , MarkovNode *second_node);
 
+/**
+ * Same as add_node_to_frequency_list, but counts frequency occurrences at once
+ * (used when merging chains).
+ * @param markov_chain the chain both nodes belong to
+ * @param first_node
+ * @param second_node
+ * @param frequency how many occurrences to add
+ * @return success/failure: 0 if the process was successful, 1 if in
+ * case of allocation error.
+ */
+int add_frequency_to_list(MarkovChain *markov_chain, MarkovNode *first_node,
+                          MarkovNode *second_node, int frequency);
+
 // new helper function I added
 /**
- * Check if the second node is in the frequency list of the first node
+ * Check if the second node is one of the successors of the first node
  * @param first_node
  * @param second_node
- * @return will return NULL if it was not found. will return a pointer to the frequency node if found
+ * @return will return -1 if it was not found. will return its position in first_node's successors if found
  */
-MarkovNodeFrequency* find_markov_node_frequency(MarkovNode *first_node, MarkovNode *second_node);
+int find_markov_node_frequency(const MarkovNode *first_node, const MarkovNode *second_node);
 
 
+/**
+ * Add all the words and transitions of source to destination, summing the
+ * frequencies of transitions both have. Merging the chains of consecutive
+ * parts of a text gives exactly the chain of the whole text (same database
+ * order, same successors order).
+ * @param destination the chain to merge into
+ * @param source the chain to merge, left unchanged
+ * @return 0 on success, 1 in case of allocation error.
+ */
+int merge_markov_chain(MarkovChain *destination, MarkovChain *source);
+
+/**
+ * Switch the chain to sampling mode: build an alias table for every node with
+ * successors, so get_next_random_node samples in O(1), and compact the
+ * successors of all the nodes into the chain's edge arrays.
+ * Adding a successor afterwards drops that node's table again and makes it
+ * dirty. Freezing again only builds tables for the dirty nodes, and only
+ * compacts again once enough successors were added outside the edge arrays.
+ * The start table is built the first time there are sentence starts, then
+ * again once enough were added since (see MarkovChain.num_of_new_starts),
+ * and never with uniform_first_words.
+ * @param markov_chain the (filled) chain to freeze
+ * @return 0 on success, 1 in case of allocation error.
+ */
+int freeze_markov_chain(MarkovChain *markov_chain);
+
+/**
+ * Move the successors of every node into new edge arrays of the chain (in
+ * database order, exactly as big as needed), dropping the nodes' own arrays
+ * and indexes. freeze_markov_chain does this when it's worth it.
+ * @param markov_chain the chain to compact
+ * @return 0 on success, 1 in case of allocation error.
+ */
+int compact_markov_chain(MarkovChain *markov_chain);
+
+/**
+ * Count the bytes the chain takes: its words, nodes, successors, tables and
+ * indexes (allocator headers not included).
+ * @param markov_chain the chain
+ * @return number of bytes
+ */
+size_t get_markov_chain_memory(const MarkovChain *markov_chain);
+
 /**
  * Free markov_chain and all of it's content from memory
  * @param markov_chain markov_chain to free
  */
 void free_database(MarkovChain ** ptr_chain);
 
-// 2 new helper functions for the free database function
 /**
- * knows how to free the memory of a markov node
- * @param markov_node
+ * Count more sentences that start with a word (the ones that end a sentence
+ * are left out). The start table takes them in the next time the chain is
+ * frozen, or once enough of them were added.
+ * @param markov_chain the chain markov_node belongs to
+ * @param markov_node the first word of the sentences
+ * @param count how many sentences
  */
-void free_markov_node(MarkovNode* markov_node);
+void add_sentence_start(MarkovChain *markov_chain, MarkovNode *markov_node,
+                        unsigned int count);
 
 /**
- * knows how to free the memory of a frequency list
- * @param frequency_list
+ * Get the index-th of the words that don't end a sentence.
+ * @param markov_chain the chain
+ * @param index position of the word, below num_of_startable_words
+ * @return the id of the word
  */
-void free_frequency_list(MarkovNodeFrequency* frequency_list);
-
+unsigned int get_startable_word(const MarkovChain *markov_chain, int index);
 
 /**
- * Get one random MarkovNode from the given markov_chain's database.
+ * Get a random MarkovNode to start a tweet with: one of the words that
+ * started sentences, as often as they did, in O(1) through the start table.
+ * With uniform_first_words set (or no start table), any word of the
+ * database that doesn't end a sentence, all as likely, in one draw too.
  * @param markov_chain
- * @return the random MarkovNode
+ * @param random_state the generator to draw from
+ * @return the random MarkovNode, NULL if every word ends a sentence (or
+ * there are none)
  */
-MarkovNode* get_first_random_node(MarkovChain *markov_chain);
+MarkovNode* get_first_random_node(MarkovChain *markov_chain,
+                                  RandomState *random_state);
 
 /**
  * Choose randomly the next MarkovNode, depend on it's occurrence frequency.
+ * @param markov_chain the chain cur_markov_node belongs to
  * @param cur_markov_node current MarkovNode
- * @return the next random MarkovNode
+ * @param random_state the generator to draw from
+ * @return the next random MarkovNode, NULL if cur_markov_node has no
+ * successors
  */
-MarkovNode* get_next_random_node(MarkovNode *cur_markov_node);
+MarkovNode* get_next_random_node(const MarkovChain *markov_chain,
+                                 MarkovNode *cur_markov_node,
+                                 RandomState *random_state);
 
 /**
  * Receive markov_chain, generate and print random sentence out of it. The
  * sentence must have at least 2 words in it.
+ * @param markov_chain the chain first_node belongs to
  * @param first_node markov_node to start with
  * @param  max_length maximum length of chain to generate
+ * @param random_state the generator to draw from
+ * @return 0 on success, 1 in case of allocation error.
  */
-void generate_tweet(MarkovNode *first_node, int max_length);
+int generate_tweet(const MarkovChain *markov_chain, MarkovNode *first_node,
+                   int max_length, RandomState *random_state);
 
 /**
- * Get random number between 0 and max_number [0, max_number).
- * @param max_number
- * @return Random number
+ * Same as generate_tweet, but writes the sentence as a new tweet of the batch
+ * instead of printing it.
+ * @param markov_chain the chain first_node belongs to
+ * @param first_node markov_node to start with
+ * @param max_length maximum length of chain to generate
+ * @param batch the batch to write to
+ * @param random_state the generator to draw from
+ * @return 0 on success, 1 in case of allocation error.
  */
-int get_random_number(int max_number);
+int write_tweet(const MarkovChain *markov_chain, MarkovNode *first_node,
+                int max_length, TweetBatch *batch, RandomState *random_state);
 
+/**
+ * Generate num_of_tweets tweets into the batch, each one starting from
+ * get_first_random_node. Nothing is printed.
+ * @param markov_chain the chain to generate from
+ * @param num_of_tweets how many tweets to generate
+ * @param max_length maximum length of every tweet
+ * @param batch the batch to add the tweets to
+ * @param random_state the generator to draw from
+ * @return 0 on success, 1 in case of allocation error or if no word can
+ * start a tweet.
+ */
+int generate_tweets(MarkovChain *markov_chain, int num_of_tweets,
+                    int max_length, TweetBatch *batch,
+                    RandomState *random_state);
 
 /**
- * this function is just cause I'm lazy and I didn't want to type printf every time
- *
- * @param error_message
- * @return
+ * Get random number between 0 and max_number [0, max_number), with no
+ * modulo bias.
+ * @param random_state the generator to draw from
+ * @param max_number
+ * @return Random number
  */
-int error(char error_message[]);
+int get_random_number(RandomState *random_state, int max_number);
+
 #endif /* _MARKOV_CHAIN_H_ */
@@ -0,0 +1,88 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include "markov.h"
+#include "generation_server.h"
+
+// Builds a chain out of a corpus once, then serves tweets out of it until
+// interrupted (see generation_server.h for the protocol):
+//   markov_server <corpus path> <address> [--workers n]
+// the address is a TCP port on 127.0.0.1 or the path of a unix socket.
+// markov_load is the matching load generator
+
+#define WORKERS_OPTION "--workers"
+#define USAGE "Usage: markov_server <corpus path> <address> [--workers n]\n"
+
+// the server the signal handler stops
+static GenerationServer server;
+
+static void handle_stop_signal(int signal_number)
+{
+    (void) signal_number;
+    stop_generation_server(&server);
+}
+
+int main(int argc, char *argv[])
+{
+    long num_of_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_of_workers < 1)
+        num_of_workers = 1;
+    if (argc == 5 && strcmp(argv[3], WORKERS_OPTION) == 0)
+        num_of_workers = strtol(argv[4], NULL, 10);
+    else if (argc != 3)
+    {
+        fprintf(stderr, USAGE);
+        return EXIT_FAILURE;
+    }
+    if (num_of_workers < 1)
+    {
+        fprintf(stderr, USAGE);
+        return EXIT_FAILURE;
+    }
+
+    FILE *file = fopen(argv[1], "r");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Error: incorrect file path\n");
+        return EXIT_FAILURE;
+    }
+    // the workers have nothing to do yet, so they read the corpus
+    MarkovOptions options = {(int) num_of_workers, 0, {0, 0, 0}, 0, 0, 0};
+    Markov *model;
+    int status = markov_create(&model, &options);
+    if (status == MARKOV_OK)
+    {
+        status = markov_ingest_file(model, file, MARKOV_ALL_WORDS);
+        if (status == MARKOV_OK)
+            status = markov_freeze(model, NULL);
+        if (status != MARKOV_OK)
+            markov_destroy(&model);
+    }
+    fclose(file);
+    if (status != MARKOV_OK)
+    {
+        fprintf(stderr, "%s\n", markov_strerror(status));
+        return EXIT_FAILURE;
+    }
+
+    if (open_generation_server(&server, model, argv[2], (int) num_of_workers) == 1)
+    {
+        perror("Error: could not listen");
+        markov_destroy(&model);
+        return EXIT_FAILURE;
+    }
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_stop_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    fprintf(stderr, "Serving %d words on %s with %ld workers\n",
+            markov_word_count(model), argv[2], num_of_workers);
+
+    int result = run_generation_server(&server);
+    close_generation_server(&server);
+    markov_destroy(&model);
+    return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
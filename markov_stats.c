@@ -0,0 +1,146 @@
+#include "markov_stats.h"
+#include "markov_chain.h"
+#include <string.h>
+#include <time.h>
+
+#ifdef MARKOV_STATS
+
+MarkovStatsCounters markov_stats_counters;
+
+unsigned long long markov_stats_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long) now.tv_sec * 1000000000ull
+           + (unsigned long long) now.tv_nsec;
+}
+
+// copies the shared counters into stats
+static void read_counters(MarkovChainStats *stats)
+{
+    MarkovStatsCounters *counters = &markov_stats_counters;
+    stats->instrumented = 1;
+    stats->word_lookups = atomic_load(&counters->word_lookups);
+    stats->word_probes = atomic_load(&counters->word_probes);
+    stats->first_node_draws = atomic_load(&counters->first_node_draws);
+    stats->ingest_ns = atomic_load(&counters->ingest_ns);
+    stats->insert_ns = atomic_load(&counters->insert_ns);
+    stats->generate_ns = atomic_load(&counters->generate_ns);
+    stats->tweets_generated = atomic_load(&counters->tweets_generated);
+}
+
+#else
+
+// nothing was counted, so the counters stay 0
+static void read_counters(MarkovChainStats *stats)
+{
+    (void) stats;
+}
+
+#endif
+
+// the histogram bucket of a node with out_degree successors
+static int out_degree_bucket(int out_degree)
+{
+    int bucket = 0;
+    while (out_degree > 0 && bucket < OUT_DEGREE_BUCKETS - 1)
+    {
+        out_degree >>= 1;
+        ++bucket;
+    }
+    return bucket;
+}
+
+void markov_chain_stats(const MarkovChain *markov_chain, MarkovChainStats *stats)
+{
+    memset(stats, 0, sizeof(MarkovChainStats));
+    const WordTable *words = &markov_chain->words;
+    stats->vocabulary_size = markov_chain->database->size;
+
+    // the same parts get_markov_chain_memory adds up, kept apart
+    stats->word_bytes = words->strings.bytes_reserved
+                        + words->capacity * (sizeof(char *) + 2 * sizeof(unsigned int) + 1)
+                        + words->slot_capacity * sizeof(int);
+    stats->node_bytes = markov_chain->markov_nodes.arena.bytes_reserved
+                        + markov_chain->list_nodes.arena.bytes_reserved
+                        + markov_chain->nodes_capacity * sizeof(Node *);
+    stats->alias_table_bytes = markov_chain->tables.bytes_reserved;
+    stats->other_bytes = sizeof(MarkovChain) + sizeof(LinkedList)
+                         + markov_chain->dirty_nodes_capacity * sizeof(unsigned int);
+    if (markov_chain->edge_offsets != NULL)
+    {
+        stats->successor_bytes = (markov_chain->database->size + 1) * sizeof(unsigned int)
+                                 + markov_chain->num_of_compacted_edges * 2 * sizeof(unsigned int);
+    }
+
+    for (Node *current_node = markov_chain->database->first; current_node != NULL;
+         current_node = current_node->next)
+    {
+        const MarkovNode *markov_node = current_node->data;
+        int out_degree = markov_node->num_of_successors;
+        stats->num_of_edges += out_degree;
+        if (out_degree > stats->max_out_degree)
+        {
+            stats->max_out_degree = out_degree;
+        }
+        stats->out_degree_histogram[out_degree_bucket(out_degree)]++;
+        stats->successor_bytes += markov_node->successors_capacity * 2 * sizeof(unsigned int);
+        stats->successor_index_bytes += markov_node->successor_slot_capacity * sizeof(int);
+    }
+    read_counters(stats);
+}
+
+// ns as seconds, for the report
+static double seconds(unsigned long long ns)
+{
+    return (double) ns / 1e9;
+}
+
+void print_markov_chain_stats(FILE *out, const MarkovChainStats *stats)
+{
+    fprintf(out, "vocabulary: %d words\n", stats->vocabulary_size);
+    fprintf(out, "edges: %zu (max out degree %d, average %.2f)\n",
+            stats->num_of_edges, stats->max_out_degree,
+            stats->vocabulary_size > 0
+            ? (double) stats->num_of_edges / stats->vocabulary_size : 0.0);
+    fprintf(out, "out degree:\n");
+    for (int bucket = 0; bucket < OUT_DEGREE_BUCKETS; ++bucket)
+    {
+        if (stats->out_degree_histogram[bucket] == 0)
+        {
+            continue;
+        }
+        if (bucket <= 1)
+        {
+            fprintf(out, "  %d: %d\n", bucket, stats->out_degree_histogram[bucket]);
+        }
+        else if (bucket == OUT_DEGREE_BUCKETS - 1)
+        {
+            fprintf(out, "  %lu+: %d\n", 1ul << (bucket - 1),
+                    stats->out_degree_histogram[bucket]);
+        }
+        else
+        {
+            fprintf(out, "  %lu-%lu: %d\n", 1ul << (bucket - 1), (1ul << bucket) - 1,
+                    stats->out_degree_histogram[bucket]);
+        }
+    }
+    fprintf(out, "bytes: words %zu, nodes %zu, successors %zu, "
+                 "successor indexes %zu, alias tables %zu, other %zu\n",
+            stats->word_bytes, stats->node_bytes, stats->successor_bytes,
+            stats->successor_index_bytes, stats->alias_table_bytes, stats->other_bytes);
+
+    if (!stats->instrumented)
+    {
+        fprintf(out, "(probe, draw and time counters need a build with MARKOV_STATS)\n");
+        return;
+    }
+    fprintf(out, "word lookups: %llu, average probe length %.3f\n",
+            stats->word_lookups, stats->word_lookups > 0
+            ? (double) stats->word_probes / stats->word_lookups : 0.0);
+    fprintf(out, "first word draws: %llu\n", stats->first_node_draws);
+    fprintf(out, "time: tokenizing %.3fs, inserting %.3fs, generating %.3fs "
+                 "(%llu tweets)\n",
+            seconds(stats->ingest_ns - stats->insert_ns), seconds(stats->insert_ns),
+            seconds(stats->generate_ns), stats->tweets_generated);
+}
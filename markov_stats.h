@@ -0,0 +1,95 @@
+#ifndef _MARKOV_STATS_H_
+#define _MARKOV_STATS_H_
+
+#include <stdio.h>  // For FILE
+#include <stddef.h> // For size_t
+
+// nodes are counted by out degree in buckets of powers of 2: bucket 0 holds
+// the nodes with no successors, bucket i the ones with 2^(i-1) up to
+// 2^i - 1 of them (the last bucket also holds everything above)
+#define OUT_DEGREE_BUCKETS 24
+
+struct MarkovChain;
+
+/**
+ * What a chain is made of and, when built with MARKOV_STATS, where the time
+ * of building it and generating from it went.
+ */
+typedef struct MarkovChainStats {
+    int vocabulary_size;
+    size_t num_of_edges;
+    int max_out_degree;
+    int out_degree_histogram[OUT_DEGREE_BUCKETS];
+    // bytes by what they hold
+    size_t word_bytes;          // the WordTable: strings, arrays and index
+    size_t node_bytes;          // MarkovNodes and their database Nodes
+    size_t successor_bytes;     // successor and frequency arrays
+    size_t successor_index_bytes;
+    size_t alias_table_bytes;
+    size_t other_bytes;         // the chain itself and its bookkeeping
+    // the counters below are only kept in builds with MARKOV_STATS (they are
+    // all 0 otherwise). they add up since the program started
+    int instrumented;
+    unsigned long long word_lookups;
+    unsigned long long word_probes;
+    unsigned long long first_node_draws;
+    unsigned long long ingest_ns;   // filling, tokenizing included
+    unsigned long long insert_ns;   // the part of it spent adding to the chain
+    unsigned long long generate_ns; // summed over the generating threads
+    unsigned long long tweets_generated;
+} MarkovChainStats;
+
+#ifdef MARKOV_STATS
+
+#include <stdatomic.h>
+
+typedef struct MarkovStatsCounters {
+    atomic_ullong word_lookups;
+    atomic_ullong word_probes;
+    atomic_ullong first_node_draws;
+    atomic_ullong ingest_ns;
+    atomic_ullong insert_ns;
+    atomic_ullong generate_ns;
+    atomic_ullong tweets_generated;
+} MarkovStatsCounters;
+
+extern MarkovStatsCounters markov_stats_counters;
+
+/**
+ * @return a monotonic clock reading, in nanoseconds
+ */
+unsigned long long markov_stats_now(void);
+
+#define STATS_ADD(counter, amount) \
+    atomic_fetch_add_explicit(&markov_stats_counters.counter, \
+                              (unsigned long long) (amount), memory_order_relaxed)
+#define STATS_TIMER_START(timer) unsigned long long timer = markov_stats_now()
+#define STATS_TIMER_STOP(counter, timer) \
+    STATS_ADD(counter, markov_stats_now() - (timer))
+
+#else
+
+// compiled out: no counters, no clock reads
+#define STATS_ADD(counter, amount) ((void) 0)
+#define STATS_TIMER_START(timer) ((void) 0)
+#define STATS_TIMER_STOP(counter, timer) ((void) 0)
+
+#endif
+
+/**
+ * Fill stats with the shape and memory of a chain and the counters so far.
+ * Walks every node, so it takes time linear in the size of the chain.
+ * @param markov_chain the chain
+ * @param stats where to store the stats
+ */
+void markov_chain_stats(const struct MarkovChain *markov_chain,
+                        MarkovChainStats *stats);
+
+/**
+ * Print stats as a human readable report.
+ * @param out where to print
+ * @param stats the stats to print
+ */
+void print_markov_chain_stats(FILE *out, const MarkovChainStats *stats);
+
+#endif //_MARKOV_STATS_H_
@@ -0,0 +1,354 @@
+#include "model_file.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// writes one uint32_t, returns 1 on failure like the rest of the module
+static int write_u32(FILE *file, uint32_t value)
+{
+    return fwrite(&value, sizeof(value), 1, file) != 1;
+}
+
+int save_markov_chain(MarkovChain *markov_chain, const char *path)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+        return 1;
+
+    ModelFileHeader header = {MODEL_FILE_MAGIC, MODEL_FILE_VERSION, 0, 0, 0, 0,
+                              {0, 0}};
+    header.word_count = (uint32_t) markov_chain->database->size;
+    for (Node *node = markov_chain->database->first; node != NULL;
+         node = node->next)
+    {
+        header.strings_size += markov_chain->words.lengths[node->data->id] + 1;
+        header.edge_count += (uint32_t) node->data->num_of_successors;
+        if (node->data->start_count > 0)
+            ++header.start_count;
+    }
+    int failed = fwrite(&header, sizeof(header), 1, file) != 1;
+
+    // word offsets
+    uint32_t offset = 0;
+    for (Node *node = markov_chain->database->first; node != NULL;
+         node = node->next)
+    {
+        failed |= write_u32(file, offset);
+        offset += markov_chain->words.lengths[node->data->id] + 1;
+    }
+    failed |= write_u32(file, offset);
+
+    // edge offsets
+    offset = 0;
+    for (Node *node = markov_chain->database->first; node != NULL;
+         node = node->next)
+    {
+        failed |= write_u32(file, offset);
+        offset += (uint32_t) node->data->num_of_successors;
+    }
+    failed |= write_u32(file, offset);
+
+    // targets, then the running sums of the weights
+    for (Node *node = markov_chain->database->first; node != NULL;
+         node = node->next)
+    {
+        MarkovNode *markov_node = node->data;
+        for (int i = 0; i < markov_node->num_of_successors; ++i)
+            failed |= write_u32(file, markov_node->successors[i]);
+    }
+    for (Node *node = markov_chain->database->first; node != NULL;
+         node = node->next)
+    {
+        MarkovNode *markov_node = node->data;
+        uint32_t accumulated_frequency = 0;
+        for (int i = 0; i < markov_node->num_of_successors; ++i)
+        {
+            accumulated_frequency += markov_node->frequencies[i];
+            failed |= write_u32(file, accumulated_frequency);
+        }
+    }
+
+    // the sentence starts, and the running sums of their counts
+    uint32_t word_index = 0;
+    for (Node *node = markov_chain->database->first; node != NULL;
+         node = node->next, ++word_index)
+    {
+        if (node->data->start_count > 0)
+            failed |= write_u32(file, word_index);
+    }
+    uint32_t accumulated_starts = 0;
+    for (Node *node = markov_chain->database->first; node != NULL;
+         node = node->next)
+    {
+        if (node->data->start_count > 0)
+        {
+            accumulated_starts += node->data->start_count;
+            failed |= write_u32(file, accumulated_starts);
+        }
+    }
+
+    // the string blob
+    for (Node *node = markov_chain->database->first; node != NULL;
+         node = node->next)
+    {
+        failed |= fwrite(node->data->data,
+                         markov_chain->words.lengths[node->data->id] + 1, 1,
+                         file) != 1;
+    }
+
+    failed |= fclose(file) != 0;
+    return failed ? 1 : 0;
+}
+
+// checks that running sums from low to high never go down and end above 0
+// and within the range get_random_number draws from
+static int is_valid_running_sum(const uint32_t *weights, uint32_t low,
+                                uint32_t high)
+{
+    for (uint32_t i = low + 1; i < high; ++i)
+    {
+        if (weights[i] < weights[i - 1])
+            return 0;
+    }
+    return weights[high - 1] > 0 && weights[high - 1] <= INT_MAX;
+}
+
+// checks everything the sampling functions index with, once, so they can
+// trust the file afterwards. returns 1 if the model is not valid
+static int check_mapped_model(const MappedModel *model, uint32_t edge_count,
+                              uint32_t strings_size)
+{
+    // every word is at least one char and its null terminator, inside the
+    // blob
+    if (model->word_offsets[0] != 0
+        || model->word_offsets[model->word_count] != strings_size)
+        return 1;
+    for (uint32_t i = 0; i < model->word_count; ++i)
+    {
+        if (model->word_offsets[i + 1] < (uint64_t) model->word_offsets[i] + 2
+            || model->word_offsets[i + 1] > strings_size
+            || model->strings[model->word_offsets[i + 1] - 1] != '\0')
+            return 1;
+    }
+
+    if (model->edge_offsets[0] != 0
+        || model->edge_offsets[model->word_count] != edge_count)
+        return 1;
+    for (uint32_t i = 0; i < model->word_count; ++i)
+    {
+        uint32_t low = model->edge_offsets[i];
+        uint32_t high = model->edge_offsets[i + 1];
+        if (high < low || high > edge_count)
+            return 1;
+        if (low < high && !is_valid_running_sum(model->weights, low, high))
+            return 1;
+    }
+    for (uint32_t i = 0; i < edge_count; ++i)
+    {
+        if (model->targets[i] >= model->word_count)
+            return 1;
+    }
+
+    for (uint32_t i = 0; i < model->start_count; ++i)
+    {
+        if (model->start_words[i] >= model->word_count)
+            return 1;
+    }
+    if (model->start_count > 0
+        && !is_valid_running_sum(model->start_weights, 0, model->start_count))
+        return 1;
+    return 0;
+}
+
+// the offsets include the null terminator, so the last char is 2 back
+static int ends_sentence(const MappedModel *model, uint32_t word_index)
+{
+    return model->strings[model->word_offsets[word_index + 1] - 2] == '.';
+}
+
+// fills the model's startable words, returns 1 in case of allocation error
+static int list_startable_words(MappedModel *model)
+{
+    // (at least one entry, so a model with none doesn't allocate 0 bytes)
+    model->startable_words = malloc((model->word_count + 1) * sizeof(uint32_t));
+    if (model->startable_words == NULL)
+        return 1;
+    for (uint32_t i = 0; i < model->word_count; ++i)
+    {
+        if (!ends_sentence(model, i))
+            model->startable_words[model->num_of_startable_words++] = i;
+    }
+    return 0;
+}
+
+MappedModel* load_mapped_model(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return NULL;
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == -1
+        || (size_t) file_stat.st_size < sizeof(ModelFileHeader))
+    {
+        close(fd);
+        return NULL;
+    }
+    size_t size = (size_t) file_stat.st_size;
+    // the mapping keeps the file alive, so the descriptor can go right away
+    void *base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    const ModelFileHeader *header = base;
+    size_t expected_size = sizeof(ModelFileHeader)
+                           + 2 * ((size_t) header->word_count + 1)
+                             * sizeof(uint32_t)
+                           + 2 * (size_t) header->edge_count * sizeof(uint32_t)
+                           + 2 * (size_t) header->start_count * sizeof(uint32_t)
+                           + header->strings_size;
+    MappedModel *model = malloc(sizeof(MappedModel));
+    if (header->magic != MODEL_FILE_MAGIC
+        || header->version != MODEL_FILE_VERSION
+        || header->start_count > header->word_count
+        || expected_size != size || model == NULL)
+    {
+        free(model);
+        munmap(base, size);
+        return NULL;
+    }
+
+    model->base = base;
+    model->size = size;
+    model->word_count = header->word_count;
+    model->word_offsets = (const uint32_t*) (header + 1);
+    model->edge_offsets = model->word_offsets + header->word_count + 1;
+    model->targets = model->edge_offsets + header->word_count + 1;
+    model->weights = model->targets + header->edge_count;
+    model->start_count = header->start_count;
+    model->start_words = model->weights + header->edge_count;
+    model->start_weights = model->start_words + header->start_count;
+    model->strings = (const char*) (model->start_weights + header->start_count);
+    model->startable_words = NULL;
+    model->num_of_startable_words = 0;
+    model->uniform_first_words = 0;
+    if (check_mapped_model(model, header->edge_count, header->strings_size)
+        || list_startable_words(model) == 1)
+    {
+        free(model->startable_words);
+        free(model);
+        munmap(base, size);
+        return NULL;
+    }
+    return model;
+}
+
+void free_mapped_model(MappedModel **ptr_model)
+{
+    free((*ptr_model)->startable_words);
+    munmap((*ptr_model)->base, (*ptr_model)->size);
+    free(*ptr_model);
+    *ptr_model = NULL;
+}
+
+const char* get_mapped_word(const MappedModel *model, uint32_t word_index)
+{
+    return model->strings + model->word_offsets[word_index];
+}
+
+// the index of the first running sum above a random number below the last
+// one, between low and high
+static uint32_t find_running_sum(const uint32_t *weights, uint32_t low,
+                                 uint32_t high, RandomState *random_state)
+{
+    uint32_t random_number = (uint32_t) get_random_number(
+            random_state, (int) weights[high - 1]);
+    while (low < high)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        if (weights[middle] <= random_number)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+uint32_t get_first_random_word(const MappedModel *model,
+                               RandomState *random_state)
+{
+    if (model->start_count > 0 && !model->uniform_first_words)
+        return model->start_words[find_running_sum(
+                model->start_weights, 0, model->start_count, random_state)];
+
+    // same as get_first_random_node: a tweet can't start with a word
+    // that ends a sentence
+    return model->startable_words[get_random_number(
+            random_state, (int) model->num_of_startable_words)];
+}
+
+int get_next_random_word(const MappedModel *model, uint32_t word_index,
+                         uint32_t *next_index, RandomState *random_state)
+{
+    uint32_t low = model->edge_offsets[word_index];
+    uint32_t high = model->edge_offsets[word_index + 1];
+    if (low == high)
+        return 1;
+
+    // the weights are running sums, so look for the first one above the
+    // random number
+    *next_index = model->targets[find_running_sum(model->weights, low, high,
+                                                  random_state)];
+    return 0;
+}
+
+// the length of a word, without its null terminator
+static size_t get_mapped_word_length(const MappedModel *model,
+                                     uint32_t word_index)
+{
+    return model->word_offsets[word_index + 1]
+           - model->word_offsets[word_index] - 1;
+}
+
+int write_mapped_tweet(const MappedModel *model, uint32_t first_word,
+                       int max_length, TweetBatch *batch,
+                       RandomState *random_state)
+{
+    uint32_t current_word = first_word;
+    for (int i = 1; i < max_length && !ends_sentence(model, current_word); ++i)
+    {
+        uint32_t next_word;
+        // a word that only ever ended a line has nowhere to go either
+        if (get_next_random_word(model, current_word, &next_word,
+                                 random_state) == 1)
+            break;
+        if (append_word_to_tweet(batch, get_mapped_word(model, current_word),
+                                 get_mapped_word_length(model, current_word))
+            == 1)
+            return 1;
+        current_word = next_word;
+    }
+    if (append_word_to_tweet(batch, get_mapped_word(model, current_word),
+                             get_mapped_word_length(model, current_word)) == 1)
+        return 1;
+    return end_tweet(batch);
+}
+
+int generate_mapped_tweets(const MappedModel *model, int num_of_tweets,
+                           int max_length, TweetBatch *batch,
+                           RandomState *random_state)
+{
+    if (num_of_tweets > 0 && model->num_of_startable_words == 0)
+        return 1;
+    for (int i = 0; i < num_of_tweets; ++i)
+    {
+        uint32_t first_word = get_first_random_word(model, random_state);
+        if (write_mapped_tweet(model, first_word, max_length, batch,
+                               random_state) == 1)
+            return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,146 @@
+#ifndef _MODEL_FILE_H_
+#define _MODEL_FILE_H_
+
+#include "markov_chain.h"
+#include "tweet_batch.h"
+#include <stdint.h>
+
+#define MODEL_FILE_MAGIC 0x4D4B564Du // "MKVM"
+#define MODEL_FILE_VERSION 1u
+
+/**
+ * Header at the start of a model file. The sections follow it in this order,
+ * all of them made of native endian uint32_t except for the last one:
+ *   word_offsets[word_count + 1]  offset of every word in the string blob
+ *   edge_offsets[word_count + 1]  first transition of every word
+ *   targets[edge_count]           word index of every transition
+ *   weights[edge_count]           running sum of the frequencies of a word's
+ *                                 transitions, so sampling is a binary search
+ *   start_words[start_count]      word index of every word that starts a
+ *                                 sentence
+ *   start_weights[start_count]    running sum of how many sentences they start
+ *   strings[strings_size]         all the words, null terminated, back to back
+ * Files without sentence starts (start_count 0, as in older files) draw the
+ * first word of a tweet uniformly.
+ */
+typedef struct ModelFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t word_count;
+    uint32_t edge_count;
+    uint32_t strings_size;
+    uint32_t start_count;
+    uint32_t reserved[2];
+} ModelFileHeader;
+
+/**
+ * A model file mapped into memory. All the pointers but startable_words
+ * point into the mapping: loading only checks the file and lists the words
+ * a tweet can start with, nothing else is parsed or copied.
+ */
+typedef struct MappedModel {
+    void *base;
+    size_t size;
+    uint32_t word_count;
+    const uint32_t *word_offsets;
+    const uint32_t *edge_offsets;
+    const uint32_t *targets;
+    const uint32_t *weights;
+    // 0 to draw the first word uniformly
+    uint32_t start_count;
+    const uint32_t *start_words;
+    const uint32_t *start_weights;
+    const char *strings;
+    // the words that don't end a sentence, the ones a uniform first word is
+    // drawn from (allocated when loading)
+    uint32_t *startable_words;
+    uint32_t num_of_startable_words;
+    // when not 0, the sentence starts are left out and the first word is
+    // drawn uniformly (0 when loaded)
+    int uniform_first_words;
+} MappedModel;
+
+/**
+ * Write the chain to a model file (words are numbered by their id).
+ * @param markov_chain the chain to save
+ * @param path where to write the model
+ * @return 0 on success, 1 if the file could not be written.
+ */
+int save_markov_chain(MarkovChain *markov_chain, const char *path);
+
+/**
+ * Map a model file written by save_markov_chain into memory. The offsets,
+ * word ids and running sums are all checked here, once, so a damaged file
+ * is rejected instead of read out of bounds while sampling.
+ * @param path the model file
+ * @return the mapped model, NULL if the file is missing or not a valid model.
+ */
+MappedModel* load_mapped_model(const char *path);
+
+/**
+ * Unmap the model and free it.
+ * @param ptr_model the model to free, set to NULL afterwards
+ */
+void free_mapped_model(MappedModel **ptr_model);
+
+/**
+ * Get the word with the given index.
+ * @param model the model
+ * @param word_index index of the word
+ * @return the (null terminated) word inside the mapping
+ */
+const char* get_mapped_word(const MappedModel *model, uint32_t word_index);
+
+/**
+ * Get a random word to start a tweet with: a word that started a sentence,
+ * as often as it did, or if the model has no sentence starts (or is set to
+ * uniform_first_words), any word that does not end a sentence (in one draw,
+ * there must be one).
+ * @param model the model to sample from
+ * @param random_state the generator to draw from
+ * @return index of the word
+ */
+uint32_t get_first_random_word(const MappedModel *model,
+                               RandomState *random_state);
+
+/**
+ * Choose randomly the next word, depending on the transition weights.
+ * @param model the model to sample from
+ * @param word_index the current word
+ * @param next_index where to store the next word
+ * @param random_state the generator to draw from
+ * @return 0 on success, 1 if the word has no transitions.
+ */
+int get_next_random_word(const MappedModel *model, uint32_t word_index,
+                         uint32_t *next_index, RandomState *random_state);
+
+/**
+ * Generate a random sentence out of the model into a new tweet of the batch,
+ * the same way write_tweet does for a MarkovChain.
+ * @param model the model to sample from
+ * @param first_word index of the word to start with
+ * @param max_length maximum length of chain to generate
+ * @param batch the batch to write to
+ * @param random_state the generator to draw from
+ * @return 0 on success, 1 in case of allocation error.
+ */
+int write_mapped_tweet(const MappedModel *model, uint32_t first_word,
+                       int max_length, TweetBatch *batch,
+                       RandomState *random_state);
+
+/**
+ * Generate num_of_tweets tweets into the batch, each one starting from
+ * get_first_random_word.
+ * @param model the model to sample from
+ * @param num_of_tweets how many tweets to generate
+ * @param max_length maximum length of every tweet
+ * @param batch the batch to add the tweets to
+ * @param random_state the generator to draw from
+ * @return 0 on success, 1 in case of allocation error or if no word can
+ * start a tweet.
+ */
+int generate_mapped_tweets(const MappedModel *model, int num_of_tweets,
+                           int max_length, TweetBatch *batch,
+                           RandomState *random_state);
+
+#endif //_MODEL_FILE_H_
@@ -0,0 +1,342 @@
+#include "ngram_chain.h"
+#include <string.h>
+
+#define NGRAM_INITIAL_STATES 1024
+#define NGRAM_INITIAL_TRANSITIONS 2
+
+NgramChain* create_ngram_chain(int order)
+{
+    NgramChain *ngram_chain = calloc(1, sizeof(NgramChain));
+    if (ngram_chain == NULL)
+        return NULL;
+    ngram_chain->order = order;
+    int words_failed = init_word_table(&ngram_chain->words);
+    ngram_chain->state_words = malloc(NGRAM_INITIAL_STATES * order
+                                      * sizeof(unsigned int));
+    ngram_chain->state_hashes = malloc(NGRAM_INITIAL_STATES
+                                       * sizeof(unsigned int));
+    ngram_chain->transitions = malloc(NGRAM_INITIAL_STATES
+                                      * sizeof(NgramTransitions));
+    ngram_chain->slots = malloc(NGRAM_INDEX_INITIAL_CAPACITY * sizeof(int));
+    ngram_chain->state_capacity = NGRAM_INITIAL_STATES;
+    ngram_chain->slot_capacity = NGRAM_INDEX_INITIAL_CAPACITY;
+    if (words_failed || ngram_chain->state_words == NULL
+        || ngram_chain->state_hashes == NULL
+        || ngram_chain->transitions == NULL || ngram_chain->slots == NULL)
+    {
+        free_ngram_chain(&ngram_chain);
+        return NULL;
+    }
+    memset(ngram_chain->slots, -1, NGRAM_INDEX_INITIAL_CAPACITY * sizeof(int));
+    return ngram_chain;
+}
+
+int add_ngram_word(NgramChain *ngram_chain, const char *word, size_t length,
+                   unsigned int *word_id)
+{
+    return intern_word(&ngram_chain->words, word, length, word_id);
+}
+
+static unsigned int hash_state(const NgramChain *ngram_chain,
+                               const unsigned int *state_words)
+{
+    return hash_word((const char*) state_words,
+                     ngram_chain->order * sizeof(unsigned int));
+}
+
+// first slot of the state's probe sequence that holds it or is empty
+static int find_state_slot(const NgramChain *ngram_chain,
+                           const unsigned int *state_words, unsigned int hash)
+{
+    unsigned int mask = (unsigned int) ngram_chain->slot_capacity - 1;
+    size_t state_size = ngram_chain->order * sizeof(unsigned int);
+    unsigned int slot = hash & mask;
+    for (; ngram_chain->slots[slot] != -1; slot = (slot + 1) & mask)
+    {
+        int state = ngram_chain->slots[slot];
+        if (ngram_chain->state_hashes[state] == hash
+            && memcmp(ngram_chain->state_words + (size_t) state
+                                                 * ngram_chain->order,
+                      state_words, state_size) == 0)
+            break;
+    }
+    return (int) slot;
+}
+
+int find_ngram_state(const NgramChain *ngram_chain,
+                     const unsigned int *state_words)
+{
+    int slot = find_state_slot(ngram_chain, state_words,
+                               hash_state(ngram_chain, state_words));
+    return ngram_chain->slots[slot];
+}
+
+// doubles the slots, placing every state again by its cached hash
+static int grow_state_index(NgramChain *ngram_chain)
+{
+    int new_capacity = ngram_chain->slot_capacity * 2;
+    int *new_slots = malloc(new_capacity * sizeof(int));
+    if (new_slots == NULL)
+        return 1;
+    memset(new_slots, -1, new_capacity * sizeof(int));
+    unsigned int mask = (unsigned int) new_capacity - 1;
+    for (int state = 0; state < ngram_chain->num_of_states; ++state)
+    {
+        unsigned int slot = ngram_chain->state_hashes[state] & mask;
+        while (new_slots[slot] != -1)
+            slot = (slot + 1) & mask;
+        new_slots[slot] = state;
+    }
+    free(ngram_chain->slots);
+    ngram_chain->slots = new_slots;
+    ngram_chain->slot_capacity = new_capacity;
+    return 0;
+}
+
+// doubles the per state arrays
+static int grow_states(NgramChain *ngram_chain)
+{
+    size_t new_capacity = (size_t) ngram_chain->state_capacity * 2;
+    unsigned int *state_words = realloc(ngram_chain->state_words,
+                                        new_capacity * ngram_chain->order
+                                        * sizeof(unsigned int));
+    if (state_words == NULL)
+        return 1;
+    ngram_chain->state_words = state_words;
+    unsigned int *state_hashes = realloc(ngram_chain->state_hashes,
+                                         new_capacity * sizeof(unsigned int));
+    if (state_hashes == NULL)
+        return 1;
+    ngram_chain->state_hashes = state_hashes;
+    NgramTransitions *transitions = realloc(ngram_chain->transitions,
+                                            new_capacity
+                                            * sizeof(NgramTransitions));
+    if (transitions == NULL)
+        return 1;
+    ngram_chain->transitions = transitions;
+    ngram_chain->state_capacity = (int) new_capacity;
+    return 0;
+}
+
+// returns the index of the state, adding it if needed (-1 on failure)
+static int add_ngram_state(NgramChain *ngram_chain,
+                           const unsigned int *state_words)
+{
+    unsigned int hash = hash_state(ngram_chain, state_words);
+    int slot = find_state_slot(ngram_chain, state_words, hash);
+    if (ngram_chain->slots[slot] != -1)
+        return ngram_chain->slots[slot];
+
+    if (ngram_chain->num_of_states == ngram_chain->state_capacity
+        && grow_states(ngram_chain) == 1)
+        return -1;
+    int state = ngram_chain->num_of_states++;
+    memcpy(ngram_chain->state_words + (size_t) state * ngram_chain->order,
+           state_words, ngram_chain->order * sizeof(unsigned int));
+    ngram_chain->state_hashes[state] = hash;
+    ngram_chain->transitions[state] = (NgramTransitions) {NULL, NULL, 0, 0};
+
+    // keep the load factor at most 1/2
+    if (ngram_chain->num_of_states * 2 > ngram_chain->slot_capacity)
+    {
+        if (grow_state_index(ngram_chain) == 1)
+        {
+            ngram_chain->num_of_states--;
+            return -1;
+        }
+    }
+    else
+    {
+        ngram_chain->slots[slot] = state;
+    }
+    return state;
+}
+
+int add_ngram_transition(NgramChain *ngram_chain,
+                         const unsigned int *state_words,
+                         unsigned int next_word)
+{
+    int state = add_ngram_state(ngram_chain, state_words);
+    if (state == -1)
+        return 1;
+    NgramTransitions *transitions = &ngram_chain->transitions[state];
+    for (int i = 0; i < transitions->size; ++i)
+    {
+        if (transitions->word_ids[i] == next_word)
+        {
+            transitions->counts[i]++;
+            return 0;
+        }
+    }
+
+    if (transitions->size == transitions->capacity)
+    {
+        int new_capacity = transitions->capacity == 0
+                           ? NGRAM_INITIAL_TRANSITIONS
+                           : transitions->capacity * 2;
+        unsigned int *word_ids = realloc(transitions->word_ids,
+                                         new_capacity * sizeof(unsigned int));
+        if (word_ids == NULL)
+            return 1;
+        transitions->word_ids = word_ids;
+        unsigned int *counts = realloc(transitions->counts,
+                                       new_capacity * sizeof(unsigned int));
+        if (counts == NULL)
+            return 1;
+        transitions->counts = counts;
+        transitions->capacity = new_capacity;
+    }
+    transitions->word_ids[transitions->size] = next_word;
+    transitions->counts[transitions->size] = 1;
+    transitions->size++;
+    return 0;
+}
+
+int fill_ngram_chain(Tokenizer *tokenizer, int words_to_read,
+                     NgramChain *ngram_chain)
+{
+    unsigned int window[MAX_NGRAM_ORDER];
+    int order = ngram_chain->order;
+    // how many words of the current sentence are in the window
+    int window_size = 0;
+    Token token;
+
+    for (int words_read = 0; words_read < words_to_read
+                             && next_token(tokenizer, &token); ++words_read)
+    {
+        unsigned int word_id;
+        if (add_ngram_word(ngram_chain, token.start, token.length, &word_id) == 1)
+            return 1;
+        if (token.starts_line)
+            window_size = 0;
+        // a full window is a state, and this word follows it
+        if (window_size == order
+            && add_ngram_transition(ngram_chain, window, word_id) == 1)
+            return 1;
+        if (window_size == order)
+        {
+            memmove(window, window + 1, (order - 1) * sizeof(unsigned int));
+            window_size--;
+        }
+        window[window_size++] = word_id;
+        if (token.start[token.length - 1] == '.')
+            window_size = 0;
+    }
+    return tokenizer->failed;
+}
+
+int get_first_random_state(const NgramChain *ngram_chain,
+                           RandomState *random_state)
+{
+    // sentence ends reset the window, so no state holds a word ending with
+    // '.' and every state has at least one transition
+    return get_random_number(random_state, ngram_chain->num_of_states);
+}
+
+unsigned int get_next_random_word_id(const NgramChain *ngram_chain, int state,
+                                     RandomState *random_state)
+{
+    const NgramTransitions *transitions = &ngram_chain->transitions[state];
+    int accumulated_count = 0;
+    for (int i = 0; i < transitions->size; ++i)
+        accumulated_count += (int) transitions->counts[i];
+
+    int random_number = get_random_number(random_state, accumulated_count);
+    accumulated_count = 0;
+    for (int i = 0; i < transitions->size - 1; ++i)
+    {
+        accumulated_count += (int) transitions->counts[i];
+        if (random_number < accumulated_count)
+            return transitions->word_ids[i];
+    }
+    return transitions->word_ids[transitions->size - 1];
+}
+
+// adds a word of the vocabulary to the tweet being written
+static int append_ngram_word(const NgramChain *ngram_chain,
+                             unsigned int word_id, TweetBatch *batch)
+{
+    return append_word_to_tweet(batch, ngram_chain->words.words[word_id],
+                                ngram_chain->words.lengths[word_id]);
+}
+
+int write_ngram_tweet(const NgramChain *ngram_chain, int first_state,
+                      int max_length, TweetBatch *batch,
+                      RandomState *random_state)
+{
+    int order = ngram_chain->order;
+    unsigned int window[MAX_NGRAM_ORDER];
+    memcpy(window, ngram_chain->state_words + (size_t) first_state * order,
+           order * sizeof(unsigned int));
+    for (int i = 0; i < order - 1; ++i)
+    {
+        if (append_ngram_word(ngram_chain, window[i], batch) == 1)
+            return 1;
+    }
+
+    // window[order - 1] is the newest word, it's written once we know
+    // whether the tweet goes on after it
+    int state = first_state;
+    for (int length = order; length < max_length && state != -1; ++length)
+    {
+        if (word_ends_sentence(&ngram_chain->words, window[order - 1]))
+            break;
+        if (append_ngram_word(ngram_chain, window[order - 1], batch) == 1)
+            return 1;
+        memmove(window, window + 1, (order - 1) * sizeof(unsigned int));
+        window[order - 1] = get_next_random_word_id(ngram_chain, state,
+                                                    random_state);
+        // the new window was only ever the end of a line if it isn't a state
+        state = find_ngram_state(ngram_chain, window);
+    }
+    if (append_ngram_word(ngram_chain, window[order - 1], batch) == 1)
+        return 1;
+    return end_tweet(batch);
+}
+
+int generate_ngram_tweets(const NgramChain *ngram_chain, int num_of_tweets,
+                          int max_length, TweetBatch *batch,
+                          RandomState *random_state)
+{
+    for (int i = 0; i < num_of_tweets; ++i)
+    {
+        int first_state = get_first_random_state(ngram_chain, random_state);
+        if (write_ngram_tweet(ngram_chain, first_state, max_length, batch,
+                              random_state) == 1)
+            return 1;
+    }
+    return 0;
+}
+
+size_t get_ngram_chain_memory(const NgramChain *ngram_chain)
+{
+    size_t bytes = sizeof(NgramChain)
+                   + (size_t) ngram_chain->state_capacity
+                     * (ngram_chain->order * sizeof(unsigned int)
+                        + sizeof(unsigned int) + sizeof(NgramTransitions))
+                   + ngram_chain->slot_capacity * sizeof(int);
+    for (int state = 0; state < ngram_chain->num_of_states; ++state)
+        bytes += ngram_chain->transitions[state].capacity
+                 * 2 * sizeof(unsigned int);
+    return bytes;
+}
+
+void free_ngram_chain(NgramChain **ptr_chain)
+{
+    NgramChain *ngram_chain = *ptr_chain;
+    if (ngram_chain->transitions != NULL)
+    {
+        for (int state = 0; state < ngram_chain->num_of_states; ++state)
+        {
+            free(ngram_chain->transitions[state].word_ids);
+            free(ngram_chain->transitions[state].counts);
+        }
+    }
+    free_word_table(&ngram_chain->words);
+    free(ngram_chain->state_words);
+    free(ngram_chain->state_hashes);
+    free(ngram_chain->transitions);
+    free(ngram_chain->slots);
+    free(ngram_chain);
+    *ptr_chain = NULL;
+}
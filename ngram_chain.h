@@ -0,0 +1,153 @@
+#ifndef _NGRAM_CHAIN_H_
+#define _NGRAM_CHAIN_H_
+
+#include "markov_chain.h"
+
+// the longest state --order accepts
+#define MAX_NGRAM_ORDER 8
+// the state index starts with this many slots and doubles when half full
+#define NGRAM_INDEX_INITIAL_CAPACITY 1024
+
+/**
+ * The words that followed one state, and how many times each did.
+ */
+typedef struct NgramTransitions {
+    unsigned int *word_ids;
+    unsigned int *counts;
+    int size;
+    int capacity;
+} NgramTransitions;
+
+/**
+ * Markov chain of order k: a state is the last k words, stored as k packed
+ * word ids (the ids of the words in the chain's WordTable) instead of
+ * concatenated strings.
+ */
+typedef struct NgramChain {
+    int order;
+    // the vocabulary
+    WordTable words;
+    // order word ids per state, back to back
+    unsigned int *state_words;
+    unsigned int *state_hashes;
+    NgramTransitions *transitions;
+    int num_of_states;
+    int state_capacity;
+    // open addressing index over the states (-1 for an empty slot)
+    int *slots;
+    int slot_capacity;
+} NgramChain;
+
+/**
+ * Allocate an empty chain.
+ * @param order number of words in a state (1 to MAX_NGRAM_ORDER)
+ * @return the new chain, NULL in case of allocation error.
+ */
+NgramChain* create_ngram_chain(int order);
+
+/**
+ * Add a word to the vocabulary (if it is not there yet).
+ * @param ngram_chain the chain
+ * @param word the word (does not need to be null terminated)
+ * @param length number of characters in word
+ * @param word_id where to store the id of the word
+ * @return 0 on success, 1 in case of allocation error.
+ */
+int add_ngram_word(NgramChain *ngram_chain, const char *word, size_t length,
+                   unsigned int *word_id);
+
+/**
+ * Look for a state.
+ * @param ngram_chain the chain
+ * @param state_words the order word ids of the state
+ * @return index of the state, -1 if it is not in the chain.
+ */
+int find_ngram_state(const NgramChain *ngram_chain,
+                     const unsigned int *state_words);
+
+/**
+ * Count one occurrence of next_word right after the given state (adding the
+ * state if it's new).
+ * @param ngram_chain the chain
+ * @param state_words the order word ids of the state
+ * @param next_word id of the word that followed the state
+ * @return 0 on success, 1 in case of allocation error.
+ */
+int add_ngram_transition(NgramChain *ngram_chain,
+                         const unsigned int *state_words,
+                         unsigned int next_word);
+
+/**
+ * Fill the chain with the words handed out by a tokenizer, following the
+ * sentence rules of fill_database_from_tokenizer: the window of the last
+ * words starts over at every line and after every word that ends with '.'.
+ * @param tokenizer the tokenizer to read the words from
+ * @param words_to_read stop after this many words
+ * @param ngram_chain the chain to fill
+ * @return 0 on success, 1 on failure (allocation, or the tokenizer failed).
+ */
+int fill_ngram_chain(Tokenizer *tokenizer, int words_to_read,
+                     NgramChain *ngram_chain);
+
+/**
+ * Get a random state to start a tweet with.
+ * @param ngram_chain the (non empty) chain
+ * @param random_state the generator to draw from
+ * @return index of the state
+ */
+int get_first_random_state(const NgramChain *ngram_chain,
+                           RandomState *random_state);
+
+/**
+ * Choose randomly the word that follows a state, depending on the counts.
+ * @param ngram_chain the chain
+ * @param state index of the current state
+ * @param random_state the generator to draw from
+ * @return id of the next word
+ */
+unsigned int get_next_random_word_id(const NgramChain *ngram_chain, int state,
+                                     RandomState *random_state);
+
+/**
+ * Generate a random sentence into a new tweet of the batch, starting with the
+ * words of a state and sliding a window of order words over it.
+ * @param ngram_chain the chain
+ * @param first_state the state to start with
+ * @param max_length maximum number of words to generate
+ * @param batch the batch to write to
+ * @param random_state the generator to draw from
+ * @return 0 on success, 1 in case of allocation error.
+ */
+int write_ngram_tweet(const NgramChain *ngram_chain, int first_state,
+                      int max_length, TweetBatch *batch,
+                      RandomState *random_state);
+
+/**
+ * Generate num_of_tweets tweets into the batch, each one starting from
+ * get_first_random_state.
+ * @param ngram_chain the (non empty) chain
+ * @param num_of_tweets how many tweets to generate
+ * @param max_length maximum length of every tweet
+ * @param batch the batch to add the tweets to
+ * @param random_state the generator to draw from
+ * @return 0 on success, 1 in case of allocation error.
+ */
+int generate_ngram_tweets(const NgramChain *ngram_chain, int num_of_tweets,
+                          int max_length, TweetBatch *batch,
+                          RandomState *random_state);
+
+/**
+ * Count the bytes the states and transitions of the chain take (the
+ * vocabulary not included).
+ * @param ngram_chain the chain
+ * @return number of bytes
+ */
+size_t get_ngram_chain_memory(const NgramChain *ngram_chain);
+
+/**
+ * Free the chain and all of it's content from memory.
+ * @param ptr_chain the chain to free, set to NULL afterwards
+ */
+void free_ngram_chain(NgramChain **ptr_chain);
+
+#endif //_NGRAM_CHAIN_H_
@@ -0,0 +1,411 @@
+#include "online_chain.h"
+#include "markov.h"
+#include <string.h>
+
+// how many chunks num_of_words words take
+static int get_num_of_chunks(int num_of_words)
+{
+    return (num_of_words + SNAPSHOT_CHUNK_WORDS - 1) >> SNAPSHOT_CHUNK_BITS;
+}
+
+// the chunk of the snapshot a word is in
+static const SnapshotChunk* get_word_chunk(const ChainSnapshot *snapshot,
+                                           unsigned int word)
+{
+    return snapshot->chunks[word >> SNAPSHOT_CHUNK_BITS];
+}
+
+// the place of a word in its chunk
+static int get_chunk_index(unsigned int word)
+{
+    return (int) (word & (SNAPSHOT_CHUNK_WORDS - 1));
+}
+
+static void free_retired_tables(RetiredTables *retired)
+{
+    while (retired != NULL)
+    {
+        RetiredTables *next = retired->next;
+        free(retired);
+        retired = next;
+    }
+}
+
+// puts the batches of more in front of the ones of list
+static void add_retired_tables(RetiredTables **list, RetiredTables *more)
+{
+    if (more == NULL)
+        return;
+    RetiredTables *last = more;
+    while (last->next != NULL)
+        last = last->next;
+    last->next = *list;
+    *list = more;
+}
+
+// lets go of the chunks of the snapshot and frees it, with the retired
+// tables it still holds (the tables themselves belong to the chain)
+static void free_snapshot(ChainSnapshot *snapshot)
+{
+    if (snapshot == NULL)
+        return;
+    if (snapshot->chunks != NULL)
+    {
+        for (int c = 0; c < get_num_of_chunks(snapshot->num_of_words); ++c)
+        {
+            SnapshotChunk *chunk = snapshot->chunks[c];
+            if (chunk != NULL && atomic_fetch_sub(&chunk->holders, 1) == 1)
+                free(chunk);
+        }
+    }
+    free(snapshot->chunks);
+    free(snapshot->startable_blocks);
+    free_retired_tables(snapshot->retired);
+    free(snapshot);
+}
+
+// the chunk of the snapshot to change a word of chunk number chunk_number
+// in: a chunk shared with the previous snapshot is copied first, and a
+// missing one is made (with none of its words set)
+static SnapshotChunk* get_own_chunk(ChainSnapshot *snapshot,
+                                    const ChainSnapshot *previous,
+                                    int chunk_number)
+{
+    SnapshotChunk *chunk = snapshot->chunks[chunk_number];
+    int shared = chunk != NULL && previous != NULL
+                 && chunk_number < get_num_of_chunks(previous->num_of_words)
+                 && chunk == previous->chunks[chunk_number];
+    if (chunk != NULL && !shared)
+        return chunk;
+    SnapshotChunk *copy = malloc(sizeof(SnapshotChunk));
+    if (copy == NULL)
+        return NULL;
+    if (chunk != NULL)
+    {
+        memcpy(copy, chunk, sizeof(SnapshotChunk));
+        // the previous snapshot still holds it
+        atomic_fetch_sub(&chunk->holders, 1);
+    }
+    atomic_init(&copy->holders, 1);
+    snapshot->chunks[chunk_number] = copy;
+    return copy;
+}
+
+// adds the table to the ones the snapshot's round replaced, unless it's the
+// one the snapshot has now
+static void retire_table(RetiredTables *retired, AliasTable *old_table,
+                         const AliasTable *new_table)
+{
+    if (old_table != NULL && old_table != new_table)
+        retired->tables[retired->size++] = old_table;
+}
+
+// takes a snapshot of the (frozen) chain. when the previous snapshot is
+// reused, its chunks are shared and only the ones with the given dirty
+// nodes or new words are copied, otherwise every chunk is made anew. the
+// tables of the previous snapshot the chain no longer has are retired
+static ChainSnapshot* take_snapshot(const MarkovChain *markov_chain,
+                                    const ChainSnapshot *previous,
+                                    int reuse_previous,
+                                    const unsigned int *dirty_nodes,
+                                    int num_of_dirty_nodes)
+{
+    ChainSnapshot *snapshot = calloc(1, sizeof(ChainSnapshot));
+    if (snapshot == NULL)
+        return NULL;
+    const WordTable *words = &markov_chain->words;
+    int num_of_chunks = get_num_of_chunks(words->size);
+    reuse_previous = reuse_previous && previous != NULL;
+    snapshot->epoch = previous == NULL ? 0 : previous->epoch + 1;
+    snapshot->num_of_words = words->size;
+    // (at least one entry, so an empty chain doesn't allocate 0 bytes)
+    snapshot->chunks = calloc(num_of_chunks > 0 ? num_of_chunks : 1,
+                              sizeof(SnapshotChunk*));
+    // the blocks never change where the snapshot looks, so only the
+    // pointers to them are copied
+    int num_of_blocks = (markov_chain->num_of_startable_words + STARTABLE_BLOCK_WORDS - 1)
+                        >> STARTABLE_BLOCK_BITS;
+    snapshot->num_of_startable_words = markov_chain->num_of_startable_words;
+    snapshot->startable_blocks = malloc((num_of_blocks > 0 ? num_of_blocks : 1)
+                                        * sizeof(unsigned int*));
+    // a word looked at replaces one table at most, and so does the start
+    // table
+    int most_retired = (reuse_previous ? num_of_dirty_nodes : words->size) + 1;
+    snapshot->retired = malloc(sizeof(RetiredTables)
+                               + most_retired * sizeof(AliasTable*));
+    if (snapshot->chunks == NULL || snapshot->startable_blocks == NULL
+        || snapshot->retired == NULL)
+    {
+        free_snapshot(snapshot);
+        return NULL;
+    }
+    memcpy(snapshot->startable_blocks, markov_chain->startable_blocks,
+           num_of_blocks * sizeof(unsigned int*));
+    RetiredTables *retired = snapshot->retired;
+    retired->next = NULL;
+    retired->size = 0;
+
+    int first_new_word = 0;
+    if (reuse_previous)
+    {
+        for (int c = 0; c < get_num_of_chunks(previous->num_of_words); ++c)
+        {
+            snapshot->chunks[c] = previous->chunks[c];
+            atomic_fetch_add(&snapshot->chunks[c]->holders, 1);
+        }
+        first_new_word = previous->num_of_words;
+        // the new words among them are set below
+        for (int i = 0; i < num_of_dirty_nodes; ++i)
+        {
+            unsigned int id = dirty_nodes[i];
+            AliasTable *table = get_node_by_id(markov_chain, (int) id)->alias_table;
+            // a node listed twice was set the first time
+            if (id >= (unsigned int) first_new_word
+                || get_word_chunk(snapshot, id)->tables[get_chunk_index(id)] == table)
+                continue;
+            SnapshotChunk *chunk = get_own_chunk(snapshot, previous,
+                                                 (int) (id >> SNAPSHOT_CHUNK_BITS));
+            if (chunk == NULL)
+            {
+                free_snapshot(snapshot);
+                return NULL;
+            }
+            retire_table(retired, chunk->tables[get_chunk_index(id)], table);
+            chunk->tables[get_chunk_index(id)] = table;
+        }
+    }
+    for (int id = first_new_word; id < words->size; ++id)
+    {
+        SnapshotChunk *chunk = get_own_chunk(snapshot, previous,
+                                             id >> SNAPSHOT_CHUNK_BITS);
+        if (chunk == NULL)
+        {
+            free_snapshot(snapshot);
+            return NULL;
+        }
+        int index = get_chunk_index((unsigned int) id);
+        chunk->words[index] = words->words[id];
+        chunk->lengths[index] = words->lengths[id];
+        chunk->flags[index] = words->flags[id];
+        chunk->tables[index] = get_node_by_id(markov_chain, id)->alias_table;
+        if (previous != NULL && id < previous->num_of_words)
+            retire_table(retired, get_word_chunk(previous, (unsigned int) id)->tables[index],
+                         chunk->tables[index]);
+    }
+    snapshot->start_table = markov_chain->start_table;
+    if (previous != NULL)
+        retire_table(retired, previous->start_table, snapshot->start_table);
+    if (retired->size == 0)
+    {
+        free(retired);
+        snapshot->retired = NULL;
+    }
+    return snapshot;
+}
+
+// takes an outdated snapshot nobody uses out of the list of snapshots in
+// use. the tables it retired wait for the snapshots older than it along
+// with the ones of the next snapshot, and the ones the oldest snapshot
+// retired can't be reached any more. called with snapshot_lock held
+static void unlink_snapshot(OnlineChain *online_chain, ChainSnapshot *snapshot)
+{
+    ChainSnapshot **link = &online_chain->oldest;
+    while (*link != snapshot)
+        link = &(*link)->newer;
+    *link = snapshot->newer;
+    // an outdated snapshot always has a newer one
+    add_retired_tables(&snapshot->newer->retired, snapshot->retired);
+    snapshot->retired = NULL;
+    add_retired_tables(&online_chain->reclaimable, online_chain->oldest->retired);
+    online_chain->oldest->retired = NULL;
+}
+
+// makes snapshot the current one, freeing the old one if nobody uses it
+static void publish_snapshot(OnlineChain *online_chain, ChainSnapshot *snapshot)
+{
+    pthread_mutex_lock(&online_chain->snapshot_lock);
+    ChainSnapshot *previous = online_chain->current;
+    previous->newer = snapshot;
+    online_chain->current = snapshot;
+    if (previous->readers > 0)
+        previous = NULL;
+    else
+        unlink_snapshot(online_chain, previous);
+    pthread_mutex_unlock(&online_chain->snapshot_lock);
+    free_snapshot(previous);
+}
+
+// hands the tables no snapshot can reach any more to the chain's free
+// lists, for the tables of this round (called with train_lock held)
+static void recycle_reclaimable_tables(OnlineChain *online_chain)
+{
+    pthread_mutex_lock(&online_chain->snapshot_lock);
+    RetiredTables *reclaimable = online_chain->reclaimable;
+    online_chain->reclaimable = NULL;
+    pthread_mutex_unlock(&online_chain->snapshot_lock);
+    for (RetiredTables *retired = reclaimable; retired != NULL;
+         retired = retired->next)
+    {
+        for (int i = 0; i < retired->size; ++i)
+            recycle_alias_table(online_chain->chain->free_tables,
+                                retired->tables[i]);
+    }
+    free_retired_tables(reclaimable);
+}
+
+OnlineChain* create_online_chain(MarkovChain *markov_chain)
+{
+    OnlineChain *online_chain = malloc(sizeof(OnlineChain));
+    if (online_chain == NULL)
+        return NULL;
+    if (freeze_markov_chain(markov_chain) == 1)
+    {
+        free(online_chain);
+        return NULL;
+    }
+    online_chain->chain = markov_chain;
+    online_chain->current = take_snapshot(markov_chain, NULL, 0, NULL, 0);
+    online_chain->oldest = online_chain->current;
+    online_chain->reclaimable = NULL;
+    online_chain->snapshot_is_stale = 0;
+    if (online_chain->current == NULL)
+    {
+        free(online_chain);
+        return NULL;
+    }
+    pthread_mutex_init(&online_chain->train_lock, NULL);
+    pthread_mutex_init(&online_chain->snapshot_lock, NULL);
+    return online_chain;
+}
+
+int train_online_chain(OnlineChain *online_chain, Tokenizer *tokenizer,
+                       int words_to_read)
+{
+    MarkovChain *markov_chain = online_chain->chain;
+    pthread_mutex_lock(&online_chain->train_lock);
+    recycle_reclaimable_tables(online_chain);
+    int result = fill_database_from_tokenizer(tokenizer, words_to_read,
+                                              markov_chain);
+
+    // freezing empties the dirty list, and the snapshot needs it afterwards
+    unsigned int *dirty_nodes = NULL;
+    int num_of_dirty_nodes = markov_chain->num_of_dirty_nodes;
+    if (result == 0 && num_of_dirty_nodes > 0)
+    {
+        dirty_nodes = malloc(num_of_dirty_nodes * sizeof(unsigned int));
+        if (dirty_nodes == NULL)
+            result = 1;
+        else
+            memcpy(dirty_nodes, markov_chain->dirty_nodes,
+                   num_of_dirty_nodes * sizeof(unsigned int));
+    }
+    if (result == 0)
+        result = freeze_markov_chain(markov_chain);
+
+    // only this thread ever changes current, so it can be read unlocked
+    ChainSnapshot *snapshot = NULL;
+    if (result == 0)
+    {
+        snapshot = take_snapshot(markov_chain, online_chain->current,
+                                 !online_chain->snapshot_is_stale,
+                                 dirty_nodes, num_of_dirty_nodes);
+        result = snapshot == NULL;
+        // the dirty list is gone, so the next round has to look at every node
+        online_chain->snapshot_is_stale = result;
+    }
+    if (result == 0)
+        publish_snapshot(online_chain, snapshot);
+    free(dirty_nodes);
+    pthread_mutex_unlock(&online_chain->train_lock);
+    return result;
+}
+
+ChainSnapshot* acquire_snapshot(OnlineChain *online_chain)
+{
+    pthread_mutex_lock(&online_chain->snapshot_lock);
+    ChainSnapshot *snapshot = online_chain->current;
+    snapshot->readers++;
+    pthread_mutex_unlock(&online_chain->snapshot_lock);
+    return snapshot;
+}
+
+void release_snapshot(OnlineChain *online_chain, ChainSnapshot *snapshot)
+{
+    pthread_mutex_lock(&online_chain->snapshot_lock);
+    int outdated = --snapshot->readers == 0
+                   && snapshot != online_chain->current;
+    if (outdated)
+        unlink_snapshot(online_chain, snapshot);
+    pthread_mutex_unlock(&online_chain->snapshot_lock);
+    if (outdated)
+        free_snapshot(snapshot);
+}
+
+// same as write_tweet, on the words and tables of a snapshot
+static int write_snapshot_tweet(const ChainSnapshot *snapshot,
+                                unsigned int first_word, int max_length,
+                                TweetBatch *batch, RandomState *random_state)
+{
+    unsigned int word = first_word;
+    const SnapshotChunk *chunk = get_word_chunk(snapshot, word);
+    int index = get_chunk_index(word);
+    for (int i = 1; i < max_length; ++i)
+    {
+        if (chunk->flags[index] & WORD_ENDS_SENTENCE)
+            break;
+        // a word that only ever ended a line has nowhere to go either
+        if (chunk->tables[index] == NULL)
+            break;
+        unsigned int next_word = sample_alias_table(chunk->tables[index],
+                                                    random_state);
+        if (append_word_to_tweet(batch, chunk->words[index],
+                                 chunk->lengths[index]) == 1)
+            return 1;
+        word = next_word;
+        chunk = get_word_chunk(snapshot, word);
+        index = get_chunk_index(word);
+    }
+    if (append_word_to_tweet(batch, chunk->words[index],
+                             chunk->lengths[index]) == 1)
+        return 1;
+    return end_tweet(batch);
+}
+
+int generate_snapshot_tweets(const ChainSnapshot *snapshot, int num_of_tweets,
+                             int max_length, TweetBatch *batch,
+                             RandomState *random_state)
+{
+    // no word to start a tweet with (an empty chain has none either)
+    if (num_of_tweets > 0 && snapshot->num_of_startable_words == 0)
+        return MARKOV_NOT_READY;
+    for (int i = 0; i < num_of_tweets; ++i)
+    {
+        // same draws as get_first_random_node
+        unsigned int first_word;
+        if (snapshot->start_table != NULL)
+            first_word = sample_alias_table(snapshot->start_table, random_state);
+        else
+        {
+            int index = get_random_number(random_state,
+                                          snapshot->num_of_startable_words);
+            first_word = snapshot->startable_blocks[index >> STARTABLE_BLOCK_BITS]
+                                                   [index & (STARTABLE_BLOCK_WORDS - 1)];
+        }
+        if (write_snapshot_tweet(snapshot, first_word, max_length, batch,
+                                 random_state) == 1)
+            return MARKOV_ALLOCATION_ERROR;
+    }
+    return MARKOV_OK;
+}
+
+void free_online_chain(OnlineChain **ptr_chain)
+{
+    OnlineChain *online_chain = *ptr_chain;
+    free_retired_tables(online_chain->reclaimable);
+    free_snapshot(online_chain->current);
+    free_database(&online_chain->chain);
+    pthread_mutex_destroy(&online_chain->train_lock);
+    pthread_mutex_destroy(&online_chain->snapshot_lock);
+    free(online_chain);
+    *ptr_chain = NULL;
+}
@@ -0,0 +1,162 @@
+#ifndef _ONLINE_CHAIN_H_
+#define _ONLINE_CHAIN_H_
+
+#include "markov_chain.h"
+#include "alias_table.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+// words in a chunk of a snapshot, a chunk is copied as a whole
+#define SNAPSHOT_CHUNK_BITS 10
+#define SNAPSHOT_CHUNK_WORDS (1 << SNAPSHOT_CHUNK_BITS)
+
+/**
+ * SNAPSHOT_CHUNK_WORDS words of a snapshot, in id order. A new snapshot
+ * copies the chunks that have a dirty node or a new word, and shares the
+ * others with the snapshot before it, so a training round costs the chunks
+ * it touched and not the whole vocabulary.
+ */
+typedef struct SnapshotChunk {
+    // the snapshots holding the chunk, the last one to let go frees it
+    atomic_int holders;
+    // copies of the chain's per word arrays (the strings themselves are
+    // shared, the chain never moves or frees them)
+    char *words[SNAPSHOT_CHUNK_WORDS];
+    unsigned int lengths[SNAPSHOT_CHUNK_WORDS];
+    unsigned char flags[SNAPSHOT_CHUNK_WORDS];
+    // the alias table of every word, NULL for a word with no successors.
+    // shared with the chain: a table never changes, a dirty node gets a
+    // new one
+    AliasTable *tables[SNAPSHOT_CHUNK_WORDS];
+} SnapshotChunk;
+
+/**
+ * The tables a training round replaced. The snapshots before that round
+ * may still sample from them, so they go back to the chain's free lists
+ * once none of those snapshots is left.
+ */
+typedef struct RetiredTables {
+    struct RetiredTables *next;
+    int size;
+    AliasTable *tables[];
+} RetiredTables;
+
+/**
+ * Everything generation needs out of a frozen chain, as the chain was when
+ * the snapshot was published. A snapshot never changes, so any number of
+ * threads can generate from it while the chain goes on learning.
+ */
+typedef struct ChainSnapshot {
+    // the training round that published it (0 for the first snapshot)
+    unsigned long epoch;
+    int num_of_words;
+    // the word with id i is in chunks[i / SNAPSHOT_CHUNK_WORDS]
+    SnapshotChunk **chunks;
+    // the chain's start table, shared like the other tables (NULL to draw
+    // the first words uniformly, like get_first_random_node)
+    AliasTable *start_table;
+    // the words a uniform first word is drawn from: the chain's blocks of
+    // them (see MarkovChain.startable_blocks), shared, the first
+    // num_of_startable_words ids only
+    unsigned int **startable_blocks;
+    int num_of_startable_words;
+    // the tables replaced since the snapshot before, and those of the
+    // snapshots freed before their time (waiting for the older ones)
+    RetiredTables *retired;
+    // the next newer snapshot in use, NULL for the current one
+    struct ChainSnapshot *newer;
+    // threads generating from it. an outdated snapshot is freed by the
+    // last one to release it
+    int readers;
+} ChainSnapshot;
+
+/**
+ * A chain that keeps learning from new text while tweets are generated out
+ * of it. Training adds to the chain, rebuilds the tables of the nodes it
+ * made dirty, and swaps in a new snapshot; generation runs on whichever
+ * snapshot it acquired (RCU style, old snapshots go away once released).
+ * The tables a round replaces are reused by later rounds once no snapshot
+ * can reach them, so a chain trained forever only grows with what it
+ * learns.
+ */
+typedef struct OnlineChain {
+    MarkovChain *chain;
+    ChainSnapshot *current;
+    // the oldest snapshot in use, the others follow it through newer
+    ChainSnapshot *oldest;
+    // tables no snapshot can reach any more, handed back to the chain's
+    // free lists at the start of the next round
+    RetiredTables *reclaimable;
+    // one training round at a time
+    pthread_mutex_t train_lock;
+    // guards current, the list of snapshots in use, reclaimable and the
+    // readers counts (only held to swap or pin a snapshot, never while
+    // generating)
+    pthread_mutex_t snapshot_lock;
+    // a round froze the chain but could not publish, so the next snapshot
+    // can't trust the tables of the current one
+    int snapshot_is_stale;
+} OnlineChain;
+
+/**
+ * Wrap a filled chain: freeze it and publish its first snapshot.
+ * @param markov_chain the chain, owned by the online chain from now on
+ * @return the new online chain, NULL in case of allocation error (the
+ * chain is not freed then).
+ */
+OnlineChain* create_online_chain(MarkovChain *markov_chain);
+
+/**
+ * Add more text to the chain (following the rules of
+ * fill_database_from_tokenizer) and publish a snapshot that includes it.
+ * Only the nodes the text changed get new tables, and only the chunks of
+ * the snapshot they (and the new words) are in get copied. Safe to call
+ * while other threads generate, and from several threads (they train one
+ * at a time).
+ * @param online_chain the chain to train
+ * @param tokenizer the tokenizer to read the words from
+ * @param words_to_read stop after this many words
+ * @return 0 on success, 1 on failure (whatever was read before the failure
+ * stays in the chain, but no snapshot is published).
+ */
+int train_online_chain(OnlineChain *online_chain, Tokenizer *tokenizer,
+                       int words_to_read);
+
+/**
+ * Pin the latest snapshot, to generate from it.
+ * @param online_chain the chain
+ * @return the snapshot, valid until it is released
+ */
+ChainSnapshot* acquire_snapshot(OnlineChain *online_chain);
+
+/**
+ * Unpin a snapshot acquired with acquire_snapshot.
+ * @param online_chain the chain the snapshot came from
+ * @param snapshot the snapshot
+ */
+void release_snapshot(OnlineChain *online_chain, ChainSnapshot *snapshot);
+
+/**
+ * Generate num_of_tweets tweets out of a snapshot into the batch. With the
+ * same random numbers, the tweets are the ones generate_tweets makes out of
+ * the frozen chain the snapshot was taken of.
+ * @param snapshot the snapshot to generate from
+ * @param num_of_tweets how many tweets to generate
+ * @param max_length maximum length of every tweet
+ * @param batch the batch to add the tweets to
+ * @param random_state the generator to draw from
+ * @return MARKOV_OK, MARKOV_NOT_READY (the snapshot has no word a tweet can
+ * start with) or MARKOV_ALLOCATION_ERROR
+ */
+int generate_snapshot_tweets(const ChainSnapshot *snapshot, int num_of_tweets,
+                             int max_length, TweetBatch *batch,
+                             RandomState *random_state);
+
+/**
+ * Free the online chain, its chain and its snapshot. No snapshot may still
+ * be acquired.
+ * @param ptr_chain the chain to free, set to NULL afterwards
+ */
+void free_online_chain(OnlineChain **ptr_chain);
+
+#endif //_ONLINE_CHAIN_H_
@@ -0,0 +1,255 @@
+#include "pruning.h"
+#include <string.h>
+
+// a word and how many times it followed another one
+typedef struct WordRank {
+    unsigned int count;
+    unsigned int id;
+} WordRank;
+
+// most frequent first, then in database order (qsort comparator). also
+// orders the successors of a node for top_k, with positions for ids
+static int compare_ranks(const void *first, const void *second)
+{
+    const WordRank *a = first;
+    const WordRank *b = second;
+    if (a->count != b->count)
+        return a->count > b->count ? -1 : 1;
+    return a->id < b->id ? -1 : a->id > b->id;
+}
+
+static size_t count_transitions(const MarkovChain *markov_chain)
+{
+    size_t transitions = 0;
+    for (Node *node = markov_chain->database->first; node != NULL;
+         node = node->next)
+        transitions += node->data->num_of_successors;
+    return transitions;
+}
+
+// marks the words that stay in the vocabulary
+static int choose_vocabulary(const MarkovChain *markov_chain,
+                             int max_vocabulary, char *kept)
+{
+    int size = markov_chain->database->size;
+    if (max_vocabulary <= 0 || size <= max_vocabulary)
+    {
+        memset(kept, 1, size);
+        return 0;
+    }
+    WordRank *ranks = malloc(size * sizeof(WordRank));
+    if (ranks == NULL)
+        return 1;
+    for (int id = 0; id < size; ++id)
+        ranks[id] = (WordRank) {0, (unsigned int) id};
+    for (Node *node = markov_chain->database->first; node != NULL;
+         node = node->next)
+    {
+        const MarkovNode *markov_node = node->data;
+        for (int i = 0; i < markov_node->num_of_successors; ++i)
+            ranks[markov_node->successors[i]].count
+                += markov_node->frequencies[i];
+    }
+    qsort(ranks, size, sizeof(WordRank), compare_ranks);
+    // the two unknown buckets take the last places
+    memset(kept, 0, size);
+    for (int i = 0; i < max_vocabulary - 2; ++i)
+        kept[ranks[i].id] = 1;
+    free(ranks);
+    return 0;
+}
+
+// drops the successors of a node the settings don't keep, in place and in
+// order. buffer has room for all of them
+static void prune_successors(MarkovNode *markov_node,
+                             const PruneSettings *settings, WordRank *buffer)
+{
+    int size = 0;
+    for (int i = 0; i < markov_node->num_of_successors; ++i)
+    {
+        if ((int) markov_node->frequencies[i] < settings->min_count)
+            continue;
+        markov_node->successors[size] = markov_node->successors[i];
+        markov_node->frequencies[size] = markov_node->frequencies[i];
+        size++;
+    }
+
+    if (settings->top_k > 0 && size > settings->top_k)
+    {
+        for (int i = 0; i < size; ++i)
+            buffer[i] = (WordRank) {markov_node->frequencies[i],
+                                    (unsigned int) i};
+        qsort(buffer, size, sizeof(WordRank), compare_ranks);
+        // the cut is the last kept rank: keep what sorts before it
+        WordRank last = buffer[settings->top_k - 1];
+        int kept = 0;
+        for (int i = 0; i < size; ++i)
+        {
+            WordRank rank = {markov_node->frequencies[i], (unsigned int) i};
+            if (compare_ranks(&rank, &last) > 0)
+                continue;
+            markov_node->successors[kept] = markov_node->successors[i];
+            markov_node->frequencies[kept] = markov_node->frequencies[i];
+            kept++;
+        }
+        size = kept;
+    }
+
+    // the positions changed, the index is rebuilt if the node grows again
+    if (size != markov_node->num_of_successors)
+    {
+        free(markov_node->successor_slots);
+        markov_node->successor_slots = NULL;
+        markov_node->successor_slot_capacity = 0;
+        markov_node->num_of_successors = size;
+    }
+}
+
+// copies the words of source into destination (the dropped ones as
+// unknown buckets) and stores every word's new id in translated
+static int copy_vocabulary(const MarkovChain *source, MarkovChain *destination,
+                           const char *kept, unsigned int *translated)
+{
+    for (Node *node = source->database->first; node != NULL; node = node->next)
+    {
+        const MarkovNode *markov_node = node->data;
+        unsigned int id = (unsigned int) markov_node->id;
+        Node *copy;
+        if (kept[id])
+            copy = add_word_to_database(destination, markov_node->data,
+                                        source->words.lengths[id]);
+        else
+            copy = add_to_database(destination,
+                                   word_ends_sentence(&source->words, id)
+                                   ? UNKNOWN_SENTENCE_END : UNKNOWN_WORD);
+        if (copy == NULL)
+            return 1;
+        translated[id] = (unsigned int) copy->data->id;
+        // the starts of dropped words add up in their bucket
+        add_sentence_start(destination, copy->data, markov_node->start_count);
+    }
+    return 0;
+}
+
+int prune_settings_active(const PruneSettings *settings)
+{
+    return settings->min_count > 1 || settings->top_k > 0
+           || settings->max_vocabulary > 0;
+}
+
+int prune_markov_chain(MarkovChain **ptr_chain, const PruneSettings *settings,
+                       PruneReport *report)
+{
+    MarkovChain *markov_chain = *ptr_chain;
+    int size = markov_chain->database->size;
+    report->bytes_before = get_markov_chain_memory(markov_chain);
+    report->words_before = size;
+    report->transitions_before = count_transitions(markov_chain);
+
+    // (at least one entry, so an empty chain doesn't allocate 0 bytes)
+    char *kept = malloc(size + 1);
+    unsigned int *translated = malloc((size + 1) * sizeof(unsigned int));
+    MarkovChain *pruned = create_markov_chain();
+    if (pruned != NULL)
+        pruned->uniform_first_words = markov_chain->uniform_first_words;
+    int result = kept == NULL || translated == NULL || pruned == NULL
+                 || choose_vocabulary(markov_chain, settings->max_vocabulary,
+                                      kept) == 1
+                 || copy_vocabulary(markov_chain, pruned, kept,
+                                    translated) == 1;
+
+    // the transitions, summed into the unknown buckets where needed
+    int most_successors = 0;
+    for (Node *node = markov_chain->database->first;
+         node != NULL && result == 0; node = node->next)
+    {
+        const MarkovNode *markov_node = node->data;
+        MarkovNode *first_node = get_node_by_id(pruned,
+                                                translated[markov_node->id]);
+        for (int i = 0; i < markov_node->num_of_successors && result == 0; ++i)
+        {
+            MarkovNode *second_node = get_node_by_id(
+                    pruned, translated[markov_node->successors[i]]);
+            result = add_frequency_to_list(pruned, first_node, second_node,
+                                           (int) markov_node->frequencies[i]);
+        }
+        if (first_node->num_of_successors > most_successors)
+            most_successors = first_node->num_of_successors;
+    }
+    free(kept);
+    free(translated);
+
+    // then whatever the counts and top_k drop, and the new arrays are
+    // compacted to exactly the transitions that are left
+    WordRank *buffer = NULL;
+    if (result == 0)
+    {
+        buffer = malloc((most_successors + 1) * sizeof(WordRank));
+        result = buffer == NULL;
+    }
+    for (Node *node = result == 0 ? pruned->database->first : NULL;
+         node != NULL; node = node->next)
+        prune_successors(node->data, settings, buffer);
+    free(buffer);
+    if (result == 0)
+        result = compact_markov_chain(pruned);
+
+    if (result != 0)
+    {
+        if (pruned != NULL)
+            free_database(&pruned);
+        return 1;
+    }
+    free_database(ptr_chain);
+    *ptr_chain = pruned;
+    report->bytes_after = get_markov_chain_memory(pruned);
+    report->words_after = pruned->database->size;
+    report->transitions_after = count_transitions(pruned);
+    return 0;
+}
+
+int count_words(Tokenizer *tokenizer, int words_to_read,
+                CountMinSketch *sketch)
+{
+    Token token;
+    for (int words_read = 0; words_read < words_to_read
+                             && next_token(tokenizer, &token); ++words_read)
+        count_word(sketch, token.start, token.length);
+    return tokenizer->failed;
+}
+
+int fill_database_with_sketch(Tokenizer *tokenizer, int words_to_read,
+                              MarkovChain *markov_chain,
+                              const CountMinSketch *sketch,
+                              unsigned int min_word_count)
+{
+    // the first word of the input has nothing before it
+    MarkovNode *current_node = NULL;
+    Token token;
+
+    for (int words_read = 0; words_read < words_to_read
+                             && next_token(tokenizer, &token); ++words_read)
+    {
+        int ends_sentence = token.start[token.length - 1] == '.';
+        Node *next_node;
+        if (estimate_word_count(sketch, token.start, token.length)
+            >= min_word_count)
+            next_node = add_word_to_database(markov_chain, token.start,
+                                             token.length);
+        else
+            next_node = add_to_database(markov_chain,
+                                        ends_sentence ? UNKNOWN_SENTENCE_END
+                                                      : UNKNOWN_WORD);
+        if (next_node == NULL)
+            return 1;
+        // the first word of a line or of a sentence follows nothing, it's
+        // counted as a start instead
+        if (current_node == NULL || token.starts_line)
+            add_sentence_start(markov_chain, next_node->data, 1);
+        else if (add_node_to_frequency_list(markov_chain, current_node,
+                                            next_node->data) == 1)
+            return 1;
+        current_node = ends_sentence ? NULL : next_node->data;
+    }
+    return tokenizer->failed;
+}
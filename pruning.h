@@ -0,0 +1,87 @@
+#ifndef _PRUNING_H_
+#define _PRUNING_H_
+
+#include "markov_chain.h"
+#include "count_min_sketch.h"
+
+// the buckets words dropped from the vocabulary are mapped to (the second
+// one for words that end a sentence, so sentences still end there)
+#define UNKNOWN_WORD "<unk>"
+#define UNKNOWN_SENTENCE_END "<unk>."
+
+/**
+ * What prune_markov_chain drops. 0 turns an option off.
+ */
+typedef struct PruneSettings {
+    // transitions seen fewer times than this
+    int min_count;
+    // all but the top_k most frequent successors of every node
+    int top_k;
+    // all but the most frequent words, so the vocabulary (the unknown
+    // buckets included) is at most this big (at least 3 when on)
+    int max_vocabulary;
+} PruneSettings;
+
+/**
+ * Check if the settings drop anything (a min_count of 1 drops nothing).
+ * @param settings the settings
+ * @return 1 if prune_markov_chain would change a chain with them, 0 if not
+ */
+int prune_settings_active(const PruneSettings *settings);
+
+/**
+ * What pruning did to a chain.
+ */
+typedef struct PruneReport {
+    size_t bytes_before;
+    size_t bytes_after;
+    int words_before;
+    int words_after;
+    size_t transitions_before;
+    size_t transitions_after;
+} PruneReport;
+
+/**
+ * Compaction pass over a filled chain: rebuild it without the words and
+ * transitions the settings drop. Words beyond the vocabulary limit become
+ * one of the unknown buckets, whose transitions are the sums of theirs,
+ * then the transitions under min_count and beyond top_k are dropped. The
+ * remaining counts are kept as they are, so sampling stays proportional to
+ * them. The new chain is compacted (not frozen).
+ * @param ptr_chain the chain to prune, replaced by the pruned one
+ * @param settings what to drop
+ * @param report where to store the sizes before and after
+ * @return 0 on success, 1 in case of allocation error (the chain is left
+ * unchanged then).
+ */
+int prune_markov_chain(MarkovChain **ptr_chain, const PruneSettings *settings,
+                       PruneReport *report);
+
+/**
+ * Count every word handed out by a tokenizer in a sketch (the first pass of
+ * fill_database_with_sketch).
+ * @param tokenizer the tokenizer to read the words from
+ * @param words_to_read stop after this many words
+ * @param sketch the sketch to count the words in
+ * @return 0 on success, 1 on failure
+ */
+int count_words(Tokenizer *tokenizer, int words_to_read,
+                CountMinSketch *sketch);
+
+/**
+ * Same as fill_database_from_tokenizer, but words the sketch estimates were
+ * seen fewer than min_word_count times are added as one of the unknown
+ * buckets, so rare words never take memory in the chain.
+ * @param tokenizer the tokenizer to read the words from
+ * @param words_to_read stop after this many words
+ * @param markov_chain the chain to fill
+ * @param sketch the counts of the words, from count_words
+ * @param min_word_count words seen fewer times are unknown
+ * @return 0 on success, 1 on failure
+ */
+int fill_database_with_sketch(Tokenizer *tokenizer, int words_to_read,
+                              MarkovChain *markov_chain,
+                              const CountMinSketch *sketch,
+                              unsigned int min_word_count);
+
+#endif //_PRUNING_H_
@@ -0,0 +1,52 @@
+#include "random_state.h"
+
+static uint64_t rotate_left(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+void seed_random_state(RandomState *random_state, uint64_t seed)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        uint64_t z = (seed += 0x9E3779B97F4A7C15u);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9u;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBu;
+        random_state->s[i] = z ^ (z >> 31);
+    }
+}
+
+uint64_t next_random(RandomState *random_state)
+{
+    uint64_t *s = random_state->s;
+    uint64_t result = rotate_left(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotate_left(s[3], 45);
+    return result;
+}
+
+void jump_random_state(RandomState *random_state)
+{
+    static const uint64_t jump[] = {0x180EC6D33CFD0ABAu, 0xD5A61266F0C9392Cu,
+                                    0xA9582618E03FC9AAu, 0x39ABDC4529B1661Cu};
+    uint64_t s[4] = {0, 0, 0, 0};
+    for (int i = 0; i < 4; ++i)
+    {
+        for (int bit = 0; bit < 64; ++bit)
+        {
+            if (jump[i] & ((uint64_t) 1 << bit))
+            {
+                for (int j = 0; j < 4; ++j)
+                    s[j] ^= random_state->s[j];
+            }
+            next_random(random_state);
+        }
+    }
+    for (int j = 0; j < 4; ++j)
+        random_state->s[j] = s[j];
+}
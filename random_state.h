@@ -0,0 +1,35 @@
+#ifndef _RANDOM_STATE_H_
+#define _RANDOM_STATE_H_
+
+#include <stdint.h>
+
+/**
+ * State of a xoshiro256** generator. Every thread that generates tweets keeps
+ * its own, so nothing is shared between them (unlike rand()).
+ */
+typedef struct RandomState {
+    uint64_t s[4];
+} RandomState;
+
+/**
+ * Seed the generator (the seed is spread over the state with splitmix64).
+ * @param random_state the state to seed
+ * @param seed any number, 0 included
+ */
+void seed_random_state(RandomState *random_state, uint64_t seed);
+
+/**
+ * Get the next 64 random bits.
+ * @param random_state the generator
+ * @return the random bits
+ */
+uint64_t next_random(RandomState *random_state);
+
+/**
+ * Advance the generator by 2^128 steps. Jumping copies of one seeded state
+ * 0, 1, 2... times gives streams that never overlap in practice.
+ * @param random_state the generator
+ */
+void jump_random_state(RandomState *random_state);
+
+#endif //_RANDOM_STATE_H_
@@ -0,0 +1,141 @@
+#include "tokenizer.h"
+#include <stdlib.h>
+#include <string.h>
+
+// byte classes, looked up in one table instead of comparing against every
+// delimiter for every byte
+#define WORD_CHAR 0
+#define SPACE_CHAR 1
+#define NEWLINE_CHAR 2
+
+static const unsigned char byte_class[256] = {
+        [' '] = SPACE_CHAR,
+        ['\t'] = SPACE_CHAR,
+        ['\r'] = SPACE_CHAR,
+        ['\n'] = NEWLINE_CHAR,
+};
+
+int init_file_tokenizer(Tokenizer *tokenizer, FILE *file)
+{
+    tokenizer->buffer = malloc(TOKENIZER_BLOCK_SIZE);
+    if (tokenizer->buffer == NULL)
+        return 1;
+    tokenizer->file = file;
+    tokenizer->source = NULL;
+    tokenizer->capacity = TOKENIZER_BLOCK_SIZE;
+    tokenizer->text = tokenizer->buffer;
+    tokenizer->length = 0;
+    tokenizer->position = 0;
+    tokenizer->at_line_start = 1;
+    tokenizer->failed = 0;
+    return 0;
+}
+
+int init_source_tokenizer(Tokenizer *tokenizer, ByteSource *source)
+{
+    if (init_file_tokenizer(tokenizer, NULL) == 1)
+        return 1;
+    tokenizer->source = source;
+    return 0;
+}
+
+void init_text_tokenizer(Tokenizer *tokenizer, const char *text, size_t length)
+{
+    tokenizer->file = NULL;
+    tokenizer->source = NULL;
+    tokenizer->buffer = NULL;
+    tokenizer->capacity = 0;
+    tokenizer->text = text;
+    tokenizer->length = length;
+    tokenizer->position = 0;
+    tokenizer->at_line_start = 1;
+    tokenizer->failed = 0;
+}
+
+// moves what is left from keep_from to the start of the buffer and reads
+// another block after it. returns 0 if nothing more could be read
+static int refill_buffer(Tokenizer *tokenizer, size_t keep_from)
+{
+    if (tokenizer->file == NULL && tokenizer->source == NULL)
+        return 0;
+
+    size_t kept = tokenizer->length - keep_from;
+    memmove(tokenizer->buffer, tokenizer->buffer + keep_from, kept);
+    // a word as long as the whole buffer needs a bigger one
+    if (kept == tokenizer->capacity)
+    {
+        char *bigger = realloc(tokenizer->buffer, tokenizer->capacity * 2);
+        if (bigger == NULL)
+        {
+            tokenizer->failed = 1;
+            return 0;
+        }
+        tokenizer->buffer = bigger;
+        tokenizer->capacity *= 2;
+    }
+    tokenizer->text = tokenizer->buffer;
+    tokenizer->position -= keep_from;
+    char *end = tokenizer->buffer + kept;
+    size_t room = tokenizer->capacity - kept;
+    tokenizer->length = kept + (tokenizer->source != NULL
+                                ? read_byte_source(tokenizer->source, end, room)
+                                : fread(end, 1, room, tokenizer->file));
+    return tokenizer->length > kept;
+}
+
+int next_token(Tokenizer *tokenizer, Token *token)
+{
+    // skip the delimiters, remembering if a line ended on the way
+    for (;;)
+    {
+        while (tokenizer->position < tokenizer->length)
+        {
+            unsigned char class = byte_class[(unsigned char)
+                    tokenizer->text[tokenizer->position]];
+            if (class == WORD_CHAR)
+                break;
+            if (class == NEWLINE_CHAR)
+                tokenizer->at_line_start = 1;
+            tokenizer->position++;
+        }
+        if (tokenizer->position < tokenizer->length)
+            break;
+        if (!refill_buffer(tokenizer, tokenizer->length))
+            return 0;
+    }
+
+    // the word goes on until the next delimiter, which may be in a block
+    // that wasn't read yet
+    size_t start = tokenizer->position;
+    for (;;)
+    {
+        while (tokenizer->position < tokenizer->length
+               && byte_class[(unsigned char)
+                       tokenizer->text[tokenizer->position]] == WORD_CHAR)
+            tokenizer->position++;
+        if (tokenizer->position < tokenizer->length)
+            break;
+        size_t kept_length = tokenizer->position - start;
+        if (!refill_buffer(tokenizer, start))
+        {
+            if (tokenizer->failed)
+                return 0;
+            // end of the input, the word is whatever was left
+            start = tokenizer->position - kept_length;
+            break;
+        }
+        start = 0;
+    }
+
+    token->start = tokenizer->text + start;
+    token->length = tokenizer->position - start;
+    token->starts_line = tokenizer->at_line_start;
+    tokenizer->at_line_start = 0;
+    return 1;
+}
+
+void free_tokenizer(Tokenizer *tokenizer)
+{
+    free(tokenizer->buffer);
+    tokenizer->buffer = NULL;
+}
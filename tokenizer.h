@@ -0,0 +1,81 @@
+#ifndef _TOKENIZER_H_
+#define _TOKENIZER_H_
+
+#include <stdio.h>  // For FILE
+#include <stddef.h> // For size_t
+#include "byte_source.h"
+
+// how much of the file is read at a time (the buffer grows past this only
+// for a single word that doesn't fit in it)
+#define TOKENIZER_BLOCK_SIZE (1 << 16)
+
+/**
+ * A word of the input. start points into the tokenizer's buffer (or the text
+ * it tokenizes) and stays valid until the next call to next_token. The word
+ * is not null terminated.
+ */
+typedef struct Token {
+    const char *start;
+    size_t length;
+    // the word is the first one of its line
+    int starts_line;
+} Token;
+
+/**
+ * Splits text into words, separated by spaces, tabs and line breaks. Reads
+ * either a FILE or a ByteSource in big blocks, or a text already in memory,
+ * and never copies the words out.
+ */
+typedef struct Tokenizer {
+    FILE *file; // NULL when tokenizing a text in memory or a source
+    ByteSource *source; // NULL unless tokenizing a source
+    char *buffer;
+    size_t capacity;
+    const char *text;
+    size_t length;
+    size_t position;
+    int at_line_start;
+    int failed;
+} Tokenizer;
+
+/**
+ * Start tokenizing a file.
+ * @param tokenizer the tokenizer to initialize
+ * @param file the file to read
+ * @return 0 on success, 1 in case of allocation error.
+ */
+int init_file_tokenizer(Tokenizer *tokenizer, FILE *file);
+
+/**
+ * Start tokenizing a byte source (a compressed file, say).
+ * @param tokenizer the tokenizer to initialize
+ * @param source the source to read
+ * @return 0 on success, 1 in case of allocation error.
+ */
+int init_source_tokenizer(Tokenizer *tokenizer, ByteSource *source);
+
+/**
+ * Start tokenizing a text in memory (the text is not copied).
+ * @param tokenizer the tokenizer to initialize
+ * @param text the text to tokenize
+ * @param length number of characters in text
+ */
+void init_text_tokenizer(Tokenizer *tokenizer, const char *text, size_t length);
+
+/**
+ * Get the next word.
+ * @param tokenizer the tokenizer to read from
+ * @param token where to store the word
+ * @return 1 if a word was found, 0 at the end of the input or on failure
+ * (in which case tokenizer->failed is set).
+ */
+int next_token(Tokenizer *tokenizer, Token *token);
+
+/**
+ * Free the tokenizer's buffer (the file, source or text itself is left
+ * alone).
+ * @param tokenizer the tokenizer to free
+ */
+void free_tokenizer(Tokenizer *tokenizer);
+
+#endif //_TOKENIZER_H_
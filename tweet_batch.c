@@ -0,0 +1,82 @@
+#include "tweet_batch.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TWEET_BATCH_INITIAL_TEXT 4096
+#define TWEET_BATCH_INITIAL_TWEETS 64
+
+int init_tweet_batch(TweetBatch *batch)
+{
+    batch->text = malloc(TWEET_BATCH_INITIAL_TEXT);
+    batch->tweets = malloc(TWEET_BATCH_INITIAL_TWEETS * sizeof(TweetSpan));
+    if (batch->text == NULL || batch->tweets == NULL)
+    {
+        free(batch->text);
+        free(batch->tweets);
+        return 1;
+    }
+    batch->text_capacity = TWEET_BATCH_INITIAL_TEXT;
+    batch->tweets_capacity = TWEET_BATCH_INITIAL_TWEETS;
+    clear_tweet_batch(batch);
+    return 0;
+}
+
+void clear_tweet_batch(TweetBatch *batch)
+{
+    batch->text_length = 0;
+    batch->num_of_tweets = 0;
+    batch->tweet_is_empty = 1;
+}
+
+int append_word_to_tweet(TweetBatch *batch, const char *word, size_t length)
+{
+    // the word, and a space before it unless it's the first of its tweet
+    size_t needed = batch->text_length + length + 1;
+    if (needed > batch->text_capacity)
+    {
+        size_t new_capacity = batch->text_capacity * 2;
+        while (new_capacity < needed)
+            new_capacity *= 2;
+        char *bigger = realloc(batch->text, new_capacity);
+        if (bigger == NULL)
+            return 1;
+        batch->text = bigger;
+        batch->text_capacity = new_capacity;
+    }
+    if (!batch->tweet_is_empty)
+        batch->text[batch->text_length++] = ' ';
+    memcpy(batch->text + batch->text_length, word, length);
+    batch->text_length += length;
+    batch->tweet_is_empty = 0;
+    return 0;
+}
+
+int end_tweet(TweetBatch *batch)
+{
+    if (batch->num_of_tweets == batch->tweets_capacity)
+    {
+        TweetSpan *bigger = realloc(batch->tweets, 2 * batch->tweets_capacity
+                                                   * sizeof(TweetSpan));
+        if (bigger == NULL)
+            return 1;
+        batch->tweets = bigger;
+        batch->tweets_capacity *= 2;
+    }
+    // the tweet started right where the previous one ended
+    size_t offset = batch->num_of_tweets == 0
+                    ? 0
+                    : batch->tweets[batch->num_of_tweets - 1].offset
+                      + batch->tweets[batch->num_of_tweets - 1].length;
+    batch->tweets[batch->num_of_tweets++] =
+            (TweetSpan) {offset, batch->text_length - offset};
+    batch->tweet_is_empty = 1;
+    return 0;
+}
+
+void free_tweet_batch(TweetBatch *batch)
+{
+    free(batch->text);
+    free(batch->tweets);
+    batch->text = NULL;
+    batch->tweets = NULL;
+}
@@ -0,0 +1,65 @@
+#ifndef _TWEET_BATCH_H_
+#define _TWEET_BATCH_H_
+
+#include <stddef.h> // For size_t
+
+/**
+ * Where one tweet is in the text of a batch.
+ */
+typedef struct TweetSpan {
+    size_t offset;
+    size_t length;
+} TweetSpan;
+
+/**
+ * Tweets generated into memory: the words of all the tweets back to back in
+ * one growing text (separated by single spaces inside a tweet, with nothing
+ * between tweets), and a span per tweet.
+ */
+typedef struct TweetBatch {
+    char *text;
+    size_t text_length;
+    size_t text_capacity;
+    TweetSpan *tweets;
+    int num_of_tweets;
+    int tweets_capacity;
+    // the tweet being written has no words yet
+    int tweet_is_empty;
+} TweetBatch;
+
+/**
+ * Initialize an empty batch.
+ * @param batch the batch to initialize
+ * @return 0 on success, 1 in case of allocation error.
+ */
+int init_tweet_batch(TweetBatch *batch);
+
+/**
+ * Drop all the tweets of the batch, keeping its memory for the next ones.
+ * @param batch the batch to clear
+ */
+void clear_tweet_batch(TweetBatch *batch);
+
+/**
+ * Add a word to the end of the tweet being written.
+ * @param batch the batch to write to
+ * @param word the word (does not need to be null terminated)
+ * @param length number of characters in word
+ * @return 0 on success, 1 in case of allocation error.
+ */
+int append_word_to_tweet(TweetBatch *batch, const char *word, size_t length);
+
+/**
+ * Finish the tweet being written (the next word starts a new tweet).
+ * @param batch the batch to write to
+ * @return 0 on success, 1 in case of allocation error.
+ */
+int end_tweet(TweetBatch *batch);
+
+/**
+ * Free the memory of the batch.
+ * @param batch the batch to free
+ */
+void free_tweet_batch(TweetBatch *batch);
+
+#endif //_TWEET_BATCH_H_
@@ -0,0 +1,168 @@
+#include "tweet_filter.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define FNV64_OFFSET_BASIS 14695981039346656037ULL
+#define FNV64_PRIME 1099511628211ULL
+#define INITIAL_HASHES_CAPACITY 1024
+
+// FNV-1a, with the bits mixed at the end (the Bloom filter uses all of them)
+static uint64_t hash_tweet(const char *tweet, size_t length)
+{
+    uint64_t hash = FNV64_OFFSET_BASIS;
+    for (size_t i = 0; i < length; ++i)
+    {
+        hash ^= (unsigned char) tweet[i];
+        hash *= FNV64_PRIME;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+int init_tweet_filter(TweetFilter *filter, int expected_tweets, int exact)
+{
+    memset(filter, 0, sizeof(TweetFilter));
+    if (exact)
+    {
+        filter->hashes_capacity = INITIAL_HASHES_CAPACITY;
+        filter->hashes = calloc(filter->hashes_capacity, sizeof(uint64_t));
+        return filter->hashes == NULL;
+    }
+    // a power of two number of bits, so a hash picks one with a mask
+    uint64_t num_of_bits = 64;
+    while (num_of_bits < (uint64_t) expected_tweets * BLOOM_BITS_PER_TWEET)
+    {
+        num_of_bits *= 2;
+    }
+    filter->bit_mask = num_of_bits - 1;
+    filter->bits = calloc(num_of_bits / 64, sizeof(uint64_t));
+    return filter->bits == NULL;
+}
+
+// doubles the exact set
+static int grow_hashes(TweetFilter *filter)
+{
+    size_t capacity = filter->hashes_capacity * 2;
+    uint64_t *hashes = calloc(capacity, sizeof(uint64_t));
+    if (hashes == NULL)
+    {
+        return 1;
+    }
+    for (size_t i = 0; i < filter->hashes_capacity; ++i)
+    {
+        uint64_t hash = filter->hashes[i];
+        if (hash == 0)
+        {
+            continue;
+        }
+        size_t slot = hash & (capacity - 1);
+        while (hashes[slot] != 0)
+        {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        hashes[slot] = hash;
+    }
+    free(filter->hashes);
+    filter->hashes = hashes;
+    filter->hashes_capacity = capacity;
+    return 0;
+}
+
+// adds a hash to the exact set, returns 1 if it was there already
+static int add_exact_hash(TweetFilter *filter, uint64_t hash)
+{
+    // 0 marks an empty slot
+    hash = hash == 0 ? 1 : hash;
+    size_t mask = filter->hashes_capacity - 1;
+    size_t slot = hash & mask;
+    while (filter->hashes[slot] != 0)
+    {
+        if (filter->hashes[slot] == hash)
+        {
+            return 1;
+        }
+        slot = (slot + 1) & mask;
+    }
+    filter->hashes[slot] = hash;
+    filter->hashes_size++;
+    return 0;
+}
+
+// sets the bits of a hash in the Bloom filter, returns 1 if they all were
+// set already
+static int add_bloom_hash(TweetFilter *filter, uint64_t hash)
+{
+    // the bits are h1 + i * h2 for i < BLOOM_HASHES (h2 odd, so they differ)
+    uint64_t first = hash & 0xFFFFFFFFULL;
+    uint64_t step = (hash >> 32) | 1;
+    int seen = 1;
+    for (int i = 0; i < BLOOM_HASHES; ++i)
+    {
+        uint64_t bit = (first + i * step) & filter->bit_mask;
+        uint64_t word_mask = 1ULL << (bit % 64);
+        if (!(filter->bits[bit / 64] & word_mask))
+        {
+            seen = 0;
+            filter->bits[bit / 64] |= word_mask;
+        }
+    }
+    return seen;
+}
+
+int add_tweet_to_filter(TweetFilter *filter, const char *tweet, size_t length)
+{
+    uint64_t hash = hash_tweet(tweet, length);
+    int seen;
+    if (filter->bits != NULL)
+    {
+        seen = add_bloom_hash(filter, hash);
+    }
+    else
+    {
+        // kept at most half full
+        if (2 * (filter->hashes_size + 1) > filter->hashes_capacity && grow_hashes(filter) == 1)
+        {
+            return -1;
+        }
+        seen = add_exact_hash(filter, hash);
+    }
+    filter->tweets_checked++;
+    filter->duplicates += seen;
+    return seen;
+}
+
+int remove_duplicate_tweets(TweetFilter *filter, TweetBatch *batch)
+{
+    // the kept tweets are moved down over the dropped ones
+    size_t text_length = 0;
+    int num_of_tweets = 0;
+    for (int i = 0; i < batch->num_of_tweets; ++i)
+    {
+        TweetSpan tweet = batch->tweets[i];
+        int seen = add_tweet_to_filter(filter, batch->text + tweet.offset, tweet.length);
+        if (seen == -1)
+        {
+            return 1;
+        }
+        if (seen)
+        {
+            continue;
+        }
+        memmove(batch->text + text_length, batch->text + tweet.offset, tweet.length);
+        batch->tweets[num_of_tweets++] = (TweetSpan) {text_length, tweet.length};
+        text_length += tweet.length;
+    }
+    batch->text_length = text_length;
+    batch->num_of_tweets = num_of_tweets;
+    return 0;
+}
+
+void free_tweet_filter(TweetFilter *filter)
+{
+    free(filter->bits);
+    free(filter->hashes);
+    filter->bits = NULL;
+    filter->hashes = NULL;
+}
@@ -0,0 +1,68 @@
+#ifndef _TWEET_FILTER_H_
+#define _TWEET_FILTER_H_
+
+#include "tweet_batch.h"
+#include <stdint.h>
+
+// bits of the Bloom filter per expected tweet, and hashes per tweet: a
+// false positive (a new tweet taken for a duplicate) about once in 1300
+// tweets when the filter is full, less before
+#define BLOOM_BITS_PER_TWEET 15
+#define BLOOM_HASHES 10
+
+// Remembers the tweets generated so far, to drop the ones that come out
+// again. By default it's a Bloom filter sized for the expected number of
+// tweets, which never lets a duplicate through but now and then drops a new
+// tweet (one more to generate). The exact filter keeps the 64 bit hash of
+// every tweet instead (8 bytes a tweet, with a collision among a million
+// tweets about once in 30 million runs).
+
+typedef struct TweetFilter {
+    // the Bloom filter, NULL for the exact filter
+    uint64_t *bits;
+    uint64_t bit_mask;
+    // the exact filter: an open addressing set of hashes, 0 for an empty slot
+    uint64_t *hashes;
+    size_t hashes_capacity;
+    size_t hashes_size;
+    // tweets looked at and how many of them were dropped
+    long long tweets_checked;
+    long long duplicates;
+} TweetFilter;
+
+/**
+ * Initialize an empty filter.
+ * @param filter the filter to initialize
+ * @param expected_tweets how many different tweets it will hold (the Bloom
+ * filter is sized for it, the exact one grows as needed)
+ * @param exact 1 for the exact filter, 0 for the Bloom filter
+ * @return 0 on success, 1 in case of allocation error.
+ */
+int init_tweet_filter(TweetFilter *filter, int expected_tweets, int exact);
+
+/**
+ * Add a tweet to the filter, unless it's there already.
+ * @param filter the filter
+ * @param tweet the text of the tweet (does not need to be null terminated)
+ * @param length number of characters in tweet
+ * @return 0 if the tweet is new, 1 if it was seen before, -1 in case of
+ * allocation error.
+ */
+int add_tweet_to_filter(TweetFilter *filter, const char *tweet, size_t length);
+
+/**
+ * Drop the tweets of the batch that were seen before (in the batch or
+ * earlier), adding the others to the filter. The kept tweets stay in order.
+ * @param filter the filter
+ * @param batch the batch to filter
+ * @return 0 on success, 1 in case of allocation error.
+ */
+int remove_duplicate_tweets(TweetFilter *filter, TweetBatch *batch);
+
+/**
+ * Free the memory of the filter.
+ * @param filter the filter to free
+ */
+void free_tweet_filter(TweetFilter *filter);
+
+#endif //_TWEET_FILTER_H_
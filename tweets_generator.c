@@ -2,131 +2,817 @@
 #include <stdio.h>
 #include <limits.h>
 #include <string.h>
-#include "markov_chain.h"
+#include <pthread.h>
+#include "markov.h"
+#include "tokenizer.h"
+#include "online_chain.h"
+#include "chain_mixture.h"
+#include "tweet_filter.h"
 
 // error messages
 #define FILE_PATH_ERROR "Error: incorrect file path"
 #define NUM_ARGS_ERROR "Usage: invalid number of arguments"
+#define MODEL_FILE_ERROR "Error: could not read/write the model file"
+#define COMPRESSION_ERROR "Error: this build can't read compressed corpora of that kind"
+
+// the corpus path that reads stdin
+#define STDIN_PATH "-"
+
+// the corpus, and the files of --append and --mix, can be gzip or zstd
+// compressed (in builds with zlib or libzstd, see byte_source.h), then it's
+// decompressed on a thread of its own while the chain is built, and so is
+// stdin ("-") when it's a pipe. such a corpus
+// is read by one thread whatever --threads says, and not with
+// --min-word-count, which reads it twice
+//
+// options, they can come anywhere after the program name:
+// --save-model <path> writes the chain built from the corpus to a model file
+// --load-model <path> generates from a model file instead of a corpus (then
+// only the seed and the number of tweets are passed)
+// --threads <n> reads the corpus and generates the tweets with n threads
+// (the tweets depend on the seed and on the number of threads)
+// --order <k> uses the last k words as the state instead of the last one
+// (model files only hold first order chains)
+// --append <path> trains the chain built from the corpus on a second file
+// through the online training API, and generates from the resulting snapshot
+// --min-count <n> drops the transitions seen fewer than n times
+// --top-k <k> keeps only the k most frequent successors of every word
+// --max-vocabulary <n> keeps only the n - 2 most frequent words, the others
+// become <unk> (or <unk>. if they end a sentence)
+// --min-word-count <n> reads the corpus twice: once to count the words in a
+// count-min sketch, then to build the chain with the words seen fewer than
+// n times as <unk> (the chain never holds the rare words)
+// (the first three print the memory of the chain before and after pruning
+// to stderr. none of them work with --order or --load-model)
+// --stats prints what the chain is made of to stderr after generating, and
+// in builds with MARKOV_STATS where the time went (not with --order,
+// --load-model or --append)
+// --starts-with <prefix> makes every tweet start with a word that starts
+// with prefix, --contains <prefix> makes every tweet contain one (through
+// the keyword index, see keyword_index.h. not with --order, --load-model or
+// --append)
+// --mix <path> builds a second chain out of another corpus (the same way as
+// the first) and generates from a blend of both, --mix-weight <w> is the
+// weight of the second one (0.5 by default, see chain_mixture.h. not with
+// --order, --load-model, --append, --starts-with or --contains)
+// --unique drops the tweets that came out before (through a Bloom filter,
+// or an exact set of hashes with --exact-unique, see tweet_filter.h) and
+// generates others instead, until more than --retry-budget <n> tweets were
+// dropped (4 per tweet asked for by default, checked after every round of
+// TWEETS_PER_BATCH tweets a thread), then prints the duplicate rate to
+// stderr. works with every other option
+// --uniform-start starts the tweets with any word that doesn't end a
+// sentence, all of them as likely, instead of the words that started
+// sentences in the corpus as often as they did (--order chains always start
+// uniformly). works with every other option
+#define SAVE_MODEL_OPTION "--save-model"
+#define LOAD_MODEL_OPTION "--load-model"
+#define THREADS_OPTION "--threads"
+#define ORDER_OPTION "--order"
+#define APPEND_OPTION "--append"
+#define MIN_COUNT_OPTION "--min-count"
+#define TOP_K_OPTION "--top-k"
+#define MAX_VOCABULARY_OPTION "--max-vocabulary"
+#define MIN_WORD_COUNT_OPTION "--min-word-count"
+#define STATS_OPTION "--stats"
+#define STARTS_WITH_OPTION "--starts-with"
+#define CONTAINS_OPTION "--contains"
+#define MIX_OPTION "--mix"
+#define MIX_WEIGHT_OPTION "--mix-weight"
+#define UNIQUE_OPTION "--unique"
+#define EXACT_UNIQUE_OPTION "--exact-unique"
+#define RETRY_BUDGET_OPTION "--retry-budget"
+#define UNIFORM_START_OPTION "--uniform-start"
+#define MAX_POSITIONAL_ARGS 4
 
 #define MAX_TWEET_LEN 20
 
-#define DELIMITERS " \n\t\r"
+// how --unique tells duplicates apart
+#define UNIQUE_OFF 0
+#define UNIQUE_BLOOM 1
+#define UNIQUE_EXACT 2
+// duplicates --unique drops per tweet asked for before giving up, without
+// --retry-budget
+#define DEFAULT_RETRIES_PER_TWEET 4
+
+// tweets are generated this many at a time, and printed through a buffer
+// of this size
+#define TWEETS_PER_BATCH 4096
+#define OUTPUT_BUFFER_SIZE (1 << 16)
 
 
 
 /**
- * fills the database (the markovChain) with words from a given file
+ * this function is just cause I'm lazy and I didn't want to type printf every time
  *
- * @param fp A pointer to the FILE that contains the words
- * @param words_to_read
- * @param markovChain
+ * @param error_message
  * @return
  */
-int fill_database(FILE *fp, int words_to_read, MarkovChain* markovChain);
+int error(const char error_message[]);
+
+// generates count tweets out of some source (a chain, a model file...) into
+// a batch, returns 0 on success and 1 in case of allocation error
+typedef int (*TweetGenerator)(const void* source, int count, TweetBatch* batch,
+                              RandomState* random_state);
+
+// how many tweets to generate and how, whatever the source is
+typedef struct GenerationSettings {
+    int num_of_tweets;
+    uint64_t seed;
+    int num_of_threads;
+    // UNIQUE_OFF, UNIQUE_BLOOM or UNIQUE_EXACT, and how many duplicates to
+    // drop before giving up
+    int unique;
+    long long retry_budget;
+} GenerationSettings;
+
+// the share of the tweets one generation thread makes, with its own stream
+// of random numbers and its own batch
+typedef struct GenerateTask {
+    TweetGenerator generator;
+    const void* source;
+    int count;
+    TweetBatch batch;
+    RandomState random_state;
+    int result;
+} GenerateTask;
+
+/**
+ * Generate and print the tweets, TWEETS_PER_BATCH per thread at a time.
+ * Thread i draws from the seed's stream jumped i times and always makes the
+ * same share of every round, so the output only depends on the seed and on
+ * the number of threads. With --unique the duplicates are dropped from the
+ * shares in thread order, and the next rounds make up for them.
+ * @param generator generates the tweets
+ * @param source what to generate them out of (shared, read only)
+ * @param settings how many tweets, the seed and the number of threads
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int print_tweets(TweetGenerator generator, const void* source,
+                 const GenerationSettings* settings);
+
+/**
+ * Write the tweets of a batch as "Tweet <number>: <tweet>" lines, in big
+ * fwrite calls.
+ * @param out where to write
+ * @param batch the tweets to write
+ * @param first_tweet_number the number of the first tweet of the batch
+ * @return 0 on success, 1 if writing failed
+ */
+int write_tweet_batch(FILE* out, const TweetBatch* batch, int first_tweet_number);
+
+// the command line, split into the positional arguments and the options
+typedef struct Arguments {
+    char* positional[MAX_POSITIONAL_ARGS];
+    int num_of_positional;
+    char* save_model_path;
+    char* load_model_path;
+    int num_of_threads;
+    int order;
+    char* append_path;
+    PruneSettings prune_settings;
+    int min_word_count;
+    int print_stats;
+    // the prefix of --starts-with or --contains, NULL without them
+    char* keyword;
+    int keyword_anywhere;
+    // the corpus of --mix, NULL without it, and its weight
+    char* mix_path;
+    double mix_weight;
+    // UNIQUE_OFF without --unique, and the --retry-budget (-1 without it)
+    int unique;
+    long long retry_budget;
+    int uniform_start;
+} Arguments;
+
+// a model and the keyword its tweets start with or contain
+typedef struct KeywordSource {
+    const Markov* model;
+    const char* keyword;
+    int anywhere;
+} KeywordSource;
+
+/**
+ * Split the command line into positional arguments and options.
+ * @param argc
+ * @param argv
+ * @param arguments where to store the result
+ * @return 0 on success, 1 if the command line is invalid
+ */
+int parse_arguments(int argc, char *argv[], Arguments* arguments);
+
+/**
+ * Print tweets generated from a model file (the --load-model mode).
+ * @param model_path the model file
+ * @param uniform_start start the tweets with any word, like --uniform-start
+ * @param settings how to generate the tweets
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int generate_from_model(char* model_path, int uniform_start,
+                        const GenerationSettings* settings);
+
+/**
+ * Print tweets generated from a chain after training it on more text (the
+ * --append mode).
+ * @param markovChain the filled chain, freed by this function
+ * @param append_path the file with the text to add
+ * @param settings how to generate the tweets
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int generate_after_training(MarkovChain* markovChain, char* append_path,
+                            const GenerationSettings* settings);
+
+/**
+ * Print tweets generated from a blend of a model and a model built out of
+ * another corpus (the --mix mode).
+ * @param model the frozen model of the first corpus
+ * @param options the options to build the second model with
+ * @param mix_path the second corpus
+ * @param mix_weight the weight of the second model (in [0, 1])
+ * @param settings how to generate the tweets
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int generate_from_mixture(Markov* model, const MarkovOptions* options, char* mix_path,
+                          double mix_weight, const GenerationSettings* settings);
+
+
+// closes the corpus and the source it's read through (if any), stdin is
+// left open
+static void close_corpus(FILE* file, ByteSource* source){
+    if(source != NULL){
+        close_byte_source(source);
+    }
+    if(file != stdin){
+        fclose(file);
+    }
+}
+
+// opens a corpus ("-" for stdin): a plain file that can be read again from
+// the start is read as it is (in parallel with --threads), anything else
+// through reader, which source then points to (NULL for a plain file).
+// returns NULL on success, the message to print otherwise
+static const char* open_corpus(const char* path, FILE** file, ByteSource* reader,
+                               ByteSource** source){
+    *file = strcmp(path, STDIN_PATH) == 0 ? stdin : fopen(path, "r");
+    *source = NULL;
+    if(*file == NULL){
+        return FILE_PATH_ERROR;
+    }
+    ByteSource decoder;
+    long start = ftell(*file);
+    int opened = open_compressed_source(&decoder, *file);
+    if(opened != 0){
+        close_corpus(*file, NULL);
+        return opened == 2 ? COMPRESSION_ERROR : markov_strerror(MARKOV_IO_ERROR);
+    }
+    if(decoder.compression == BYTE_SOURCE_PLAIN && start != -1
+       && fseek(*file, start, SEEK_SET) == 0){
+        close_byte_source(&decoder);
+    }
+    else if(open_threaded_source(reader, &decoder) == 0){
+        *source = reader;
+    }
+    else{
+        close_byte_source(&decoder);
+        close_corpus(*file, NULL);
+        return ALLOCATION_ERROR_MASSAGE;
+    }
+    return NULL;
+}
+
+// the TweetGenerator of every kind of source
+static int generate_from_chain(const void* source, int count, TweetBatch* batch,
+                               RandomState* random_state){
+    return markov_generate(source, count, MAX_TWEET_LEN, batch, random_state)
+           != MARKOV_OK;
+}
+
+static int generate_from_keyword(const void* source, int count, TweetBatch* batch,
+                                 RandomState* random_state){
+    const KeywordSource* keyword_source = source;
+    const char* keyword = keyword_source->keyword;
+    int status = keyword_source->anywhere
+                 ? markov_generate_containing(keyword_source->model, keyword, strlen(keyword),
+                                              count, MAX_TWEET_LEN, batch, random_state)
+                 : markov_generate_starting(keyword_source->model, keyword, strlen(keyword),
+                                            count, MAX_TWEET_LEN, batch, random_state);
+    return status != MARKOV_OK;
+}
+
+static int generate_from_mixture_source(const void* source, int count,
+                                        TweetBatch* batch, RandomState* random_state){
+    // the mixture caches its tables as it goes, which is safe across threads
+    return generate_mixture_tweets((ChainMixture*) source, count, MAX_TWEET_LEN, batch,
+                                   random_state);
+}
+
+static int generate_from_snapshot(const void* source, int count, TweetBatch* batch,
+                                  RandomState* random_state){
+    return generate_snapshot_tweets(source, count, MAX_TWEET_LEN, batch, random_state)
+           != MARKOV_OK;
+}
 
 
 int main(int argc, char *argv[]){
-    if(argc < 4 || argc > 5){
+    Arguments arguments;
+    if(parse_arguments(argc, argv, &arguments) == 1){
         return error(NUM_ARGS_ERROR);
     }
+    char** args = arguments.positional;
 
     // convert the seed into a number. no need to check if valid (assumed)
     char* endptr;
-    unsigned int seed = (unsigned int) strtol(argv[1], &endptr, 10);
-    srand(seed);
+    GenerationSettings settings;
+    settings.seed = strtoull(args[0], &endptr, 10);
+    settings.num_of_threads = arguments.num_of_threads;
+    settings.unique = arguments.unique;
 
     // convert the number of strings into a number. no need to check if valid (assumed)
-    int num_of_tweets = (int) strtol(argv[2], &endptr, 10);
+    settings.num_of_tweets = (int) strtol(args[1], &endptr, 10);
+    settings.retry_budget = arguments.retry_budget >= 0
+                            ? arguments.retry_budget
+                            : (long long) DEFAULT_RETRIES_PER_TWEET * settings.num_of_tweets;
+
+    // a saved model replaces the whole corpus parsing
+    if(arguments.load_model_path != NULL){
+        return generate_from_model(arguments.load_model_path, arguments.uniform_start,
+                                   &settings);
+    }
 
     // get the filePath and make sure it's valid
-    char* file_path = argv[3];
-    FILE *file = fopen(file_path, "r");
-    if (file == NULL) {
-        return error(FILE_PATH_ERROR);
+    FILE *file;
+    ByteSource reader;
+    ByteSource* corpus_source;
+    const char* open_error = open_corpus(args[2], &file, &reader, &corpus_source);
+    if(open_error != NULL){
+        return error(open_error);
     }
 
     // default will be the max unless argument says otherwise
     int num_of_words_to_read = INT_MAX;
-    if(argc == 5) {
+    if(arguments.num_of_positional == 4) {
         // convert the number of strings into a number. no need to check if valid (assumed)
-        num_of_words_to_read = (int) strtol(argv[4], &endptr, 10);
+        num_of_words_to_read = (int) strtol(args[3], &endptr, 10);
     }
 
     // let's get those words from the file and fill the database
-    MarkovChain * markovChain = (MarkovChain*) malloc(sizeof(MarkovChain));
-    if (markovChain == NULL) {
-        return EXIT_FAILURE;
+    MarkovOptions options = {arguments.num_of_threads, arguments.min_word_count,
+                             arguments.prune_settings, arguments.keyword != NULL,
+                             arguments.uniform_start, arguments.order};
+    Markov* model;
+    int status = markov_create(&model, &options);
+    if (status != MARKOV_OK) {
+        close_corpus(file, corpus_source);
+        return error(markov_strerror(status));
     }
-    markovChain->database = (LinkedList*) malloc(sizeof(LinkedList));
-    if (markovChain->database == NULL) {
-        free(markovChain);
-        return EXIT_FAILURE;
+
+    // pruning (if any) happens when freezing, so the model file gets the
+    // pruned chain too
+    PruneReport report;
+    status = corpus_source != NULL
+             ? markov_ingest_source(model, corpus_source, num_of_words_to_read)
+             : markov_ingest_file(model, file, num_of_words_to_read);
+    if(status == MARKOV_OK){
+        status = markov_freeze(model, &report);
+    }
+    if(status != MARKOV_OK){
+        markov_destroy(&model);
+        close_corpus(file, corpus_source);
+        return error(markov_strerror(status)); // TODO ask teacher if this is what im supposed to return
+    }
+    const PruneSettings* prune = &arguments.prune_settings;
+    if(prune_settings_active(prune)){
+        fprintf(stderr, "Pruning: %d -> %d words, %zu -> %zu transitions, "
+                        "%zu -> %zu bytes\n",
+                report.words_before, report.words_after, report.transitions_before,
+                report.transitions_after, report.bytes_before, report.bytes_after);
     }
-    markovChain->database->first = NULL;
-    markovChain->database->last = NULL;
-    markovChain->database->size = 0;
 
+    if(arguments.save_model_path != NULL
+       && markov_save(model, arguments.save_model_path) != MARKOV_OK){
+        markov_destroy(&model);
+        close_corpus(file, corpus_source);
+        return error(MODEL_FILE_ERROR);
+    }
 
-    if(fill_database(file, num_of_words_to_read, markovChain) == 1){
-        free_database(&markovChain);
-        return EXIT_FAILURE; // TODO ask teacher if this is what im supposed to return
+    // an empty corpus (or one where every word ends a sentence) has no word
+    // to start a tweet with
+    status = markov_generate(model, 0, MAX_TWEET_LEN, NULL, NULL);
+    if(settings.num_of_tweets > 0 && status != MARKOV_OK){
+        markov_destroy(&model);
+        close_corpus(file, corpus_source);
+        return error(markov_strerror(status));
+    }
+
+    if(arguments.append_path != NULL){
+        close_corpus(file, corpus_source);
+        return generate_after_training(markov_take_chain(&model),
+                                       arguments.append_path, &settings);
     }
 
     // Print out the tweets
-    for (int i = 0; i < num_of_tweets; ++i) {
-        MarkovNode * first_markov_node_in_new_tweet = get_first_random_node(markovChain);
-        printf("Tweet %d: ", i + 1);
-        generate_tweet(first_markov_node_in_new_tweet, MAX_TWEET_LEN);
+    int result;
+    if(arguments.keyword != NULL){
+        // no tweet can be made when no word matches, so that's checked once
+        KeywordSource source = {model, arguments.keyword, arguments.keyword_anywhere};
+        status = markov_generate_starting(model, arguments.keyword,
+                                          strlen(arguments.keyword), 0, MAX_TWEET_LEN,
+                                          NULL, NULL);
+        result = status == MARKOV_OK ? print_tweets(generate_from_keyword, &source, &settings)
+                                     : error(markov_strerror(status));
+    }
+    else if(arguments.mix_path != NULL){
+        result = generate_from_mixture(model, &options, arguments.mix_path,
+                                       arguments.mix_weight, &settings);
+    }
+    else{
+        result = print_tweets(generate_from_chain, model, &settings);
+    }
+    if(arguments.print_stats){
+        MarkovChainStats stats;
+        markov_stats(model, &stats);
+        print_markov_chain_stats(stderr, &stats);
     }
 
     // Hopefully this deals with all the allocated memory all in one go
-    free_database(&markovChain);
+    markov_destroy(&model);
 
     // close the file
-    fclose(file);
+    close_corpus(file, corpus_source);
 
-    return EXIT_SUCCESS;
+    return result;
 }
 
 
+// thread body: makes one thread's share of a round
+static void* generate_share(void* arg){
+    GenerateTask* task = (GenerateTask*) arg;
+    clear_tweet_batch(&task->batch);
+    task->result = task->generator(task->source, task->count, &task->batch,
+                                   &task->random_state);
+    return NULL;
+}
 
 
-int fill_database(FILE *fp, int words_to_read, MarkovChain* markovChain){
-    int words_read = 0;
-    // buffer to store each line (the size is 1000 since we assume the line will not be more than that)
-    char buffer[1000];
+int print_tweets(TweetGenerator generator, const void* source,
+                 const GenerationSettings* settings){
+    int num_of_threads = settings->num_of_threads;
+    GenerateTask* tasks = calloc(num_of_threads, sizeof(GenerateTask));
+    pthread_t* threads = malloc(num_of_threads * sizeof(pthread_t));
+    if(tasks == NULL || threads == NULL){
+        free(tasks);
+        free(threads);
+        return error(ALLOCATION_ERROR_MASSAGE);
+    }
+    int num_of_batches = 0;
+    for (; num_of_batches < num_of_threads; ++num_of_batches) {
+        if(init_tweet_batch(&tasks[num_of_batches].batch) == 1){
+            break;
+        }
+        tasks[num_of_batches].generator = generator;
+        tasks[num_of_batches].source = source;
+        if(num_of_batches == 0){
+            seed_random_state(&tasks[0].random_state, settings->seed);
+        }
+        else{
+            tasks[num_of_batches].random_state = tasks[num_of_batches - 1].random_state;
+            jump_random_state(&tasks[num_of_batches].random_state);
+        }
+    }
 
+    int result = num_of_batches == num_of_threads ? EXIT_SUCCESS
+                 : error(ALLOCATION_ERROR_MASSAGE);
+    TweetFilter filter;
+    int filtering = settings->unique != UNIQUE_OFF && result == EXIT_SUCCESS;
+    if(filtering && init_tweet_filter(&filter, settings->num_of_tweets,
+                                      settings->unique == UNIQUE_EXACT) == 1){
+        filtering = 0;
+        result = error(ALLOCATION_ERROR_MASSAGE);
+    }
+    int per_round = TWEETS_PER_BATCH * num_of_threads;
+    int done = 0;
+    while (done < settings->num_of_tweets && result == EXIT_SUCCESS) {
+        int round = settings->num_of_tweets - done < per_round
+                    ? settings->num_of_tweets - done : per_round;
+        // the first thread is this one, the others are started for the round
+        int num_of_started = 1;
+        for (int i = 0; i < num_of_threads; ++i) {
+            tasks[i].count = round / num_of_threads + (i < round % num_of_threads);
+            if(i > 0 && pthread_create(&threads[i], NULL, generate_share, &tasks[i]) != 0){
+                result = EXIT_FAILURE;
+                break;
+            }
+            num_of_started += i > 0;
+        }
+        if(result == EXIT_SUCCESS){
+            generate_share(&tasks[0]);
+        }
+        for (int i = 1; i < num_of_started; ++i) {
+            pthread_join(threads[i], NULL);
+        }
 
-    // line reading loop
-    while(fgets(buffer, sizeof(buffer), fp) != NULL && words_read <= words_to_read){
-        // we don't need to add the first word to any frequency list
-        int skip_frequency_list_stage = 1;
+        // print the shares in thread order, numbering the tweets on
+        int tweet_number = done + 1;
+        for (int i = 0; i < num_of_started && result == EXIT_SUCCESS; ++i) {
+            if(tasks[i].result == 1
+               || (filtering && remove_duplicate_tweets(&filter, &tasks[i].batch) == 1)){
+                result = error(ALLOCATION_ERROR_MASSAGE);
+            }
+            else if(write_tweet_batch(stdout, &tasks[i].batch, tweet_number) == 1){
+                result = EXIT_FAILURE;
+            }
+            tweet_number += tasks[i].batch.num_of_tweets;
+        }
+        done = tweet_number - 1;
+        // a small corpus may not have that many different tweets in it
+        if(filtering && filter.duplicates > settings->retry_budget){
+            break;
+        }
+    }
 
-        Node* current_node;
-        Node* next_node;
+    if(filtering){
+        fprintf(stderr, "Unique: %d tweets, %lld duplicates dropped (%.2f%% of %lld "
+                        "generated)\n", done, filter.duplicates,
+                filter.tweets_checked > 0 ? 100.0 * filter.duplicates / filter.tweets_checked : 0.0,
+                filter.tweets_checked);
+        if(done < settings->num_of_tweets && result == EXIT_SUCCESS){
+            fprintf(stderr, "Unique: gave up after the retry budget of %lld duplicates, "
+                            "%d tweets short\n", settings->retry_budget,
+                    settings->num_of_tweets - done);
+        }
+        free_tweet_filter(&filter);
+    }
 
-        // loop will exit as soon as the line runs out
-        char* token = strtok(buffer, DELIMITERS);
-        while(token != NULL && words_read < words_to_read){
-            next_node = add_to_database(markovChain, token);
-            // check if adding the new node was successful (allocation success check) (success also means it existed)
-            if(next_node == NULL){
+    for (int i = 0; i < num_of_batches; ++i) {
+        free_tweet_batch(&tasks[i].batch);
+    }
+    free(tasks);
+    free(threads);
+    return result;
+}
+
+
+int write_tweet_batch(FILE* out, const TweetBatch* batch, int first_tweet_number){
+    static char buffer[OUTPUT_BUFFER_SIZE];
+    size_t used = 0;
+    // room for the "Tweet <number>: " prefix
+    const size_t max_prefix = 32;
+
+    for (int i = 0; i < batch->num_of_tweets; ++i) {
+        const TweetSpan* tweet = &batch->tweets[i];
+        if(used + max_prefix + tweet->length + 1 > OUTPUT_BUFFER_SIZE){
+            if(fwrite(buffer, 1, used, out) != used){
+                return 1;
+            }
+            used = 0;
+        }
+        used += (size_t) sprintf(buffer + used, "Tweet %d: ", first_tweet_number + i);
+        // a tweet too long for the buffer (only with huge words) goes out alone
+        if(used + tweet->length + 1 > OUTPUT_BUFFER_SIZE){
+            if(fwrite(buffer, 1, used, out) != used
+               || fwrite(batch->text + tweet->offset, 1, tweet->length, out) != tweet->length){
+                return 1;
+            }
+            used = 0;
+        }
+        else{
+            memcpy(buffer + used, batch->text + tweet->offset, tweet->length);
+            used += tweet->length;
+        }
+        buffer[used++] = '\n';
+    }
+    return fwrite(buffer, 1, used, out) != used;
+}
+
+
+int parse_arguments(int argc, char *argv[], Arguments* arguments){
+    arguments->num_of_positional = 0;
+    arguments->save_model_path = NULL;
+    arguments->load_model_path = NULL;
+    arguments->num_of_threads = 1;
+    arguments->order = 1;
+    arguments->append_path = NULL;
+    arguments->prune_settings = (PruneSettings) {0, 0, 0};
+    arguments->min_word_count = 0;
+    arguments->print_stats = 0;
+    arguments->keyword = NULL;
+    arguments->keyword_anywhere = 0;
+    arguments->mix_path = NULL;
+    arguments->mix_weight = 0.5;
+    arguments->unique = UNIQUE_OFF;
+    arguments->retry_budget = -1;
+    arguments->uniform_start = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], SAVE_MODEL_OPTION) == 0 && i + 1 < argc){
+            arguments->save_model_path = argv[++i];
+        }
+        else if(strcmp(argv[i], LOAD_MODEL_OPTION) == 0 && i + 1 < argc){
+            arguments->load_model_path = argv[++i];
+        }
+        else if(strcmp(argv[i], THREADS_OPTION) == 0 && i + 1 < argc){
+            arguments->num_of_threads = (int) strtol(argv[++i], NULL, 10);
+            if(arguments->num_of_threads < 1){
+                return 1;
+            }
+        }
+        else if(strcmp(argv[i], ORDER_OPTION) == 0 && i + 1 < argc){
+            arguments->order = (int) strtol(argv[++i], NULL, 10);
+            if(arguments->order < 1 || arguments->order > MAX_NGRAM_ORDER){
+                return 1;
+            }
+        }
+        else if(strcmp(argv[i], APPEND_OPTION) == 0 && i + 1 < argc){
+            arguments->append_path = argv[++i];
+        }
+        else if(strcmp(argv[i], MIN_COUNT_OPTION) == 0 && i + 1 < argc){
+            arguments->prune_settings.min_count = (int) strtol(argv[++i], NULL, 10);
+        }
+        else if(strcmp(argv[i], TOP_K_OPTION) == 0 && i + 1 < argc){
+            arguments->prune_settings.top_k = (int) strtol(argv[++i], NULL, 10);
+            if(arguments->prune_settings.top_k < 1){
+                return 1;
+            }
+        }
+        else if(strcmp(argv[i], MAX_VOCABULARY_OPTION) == 0 && i + 1 < argc){
+            arguments->prune_settings.max_vocabulary = (int) strtol(argv[++i], NULL, 10);
+            if(arguments->prune_settings.max_vocabulary < 3){
                 return 1;
             }
-            if(skip_frequency_list_stage)
-                skip_frequency_list_stage = 0;
-            // TODO really this should be just else without the condition but clion was worried. need to decide if I leave this
-            else if(current_node != NULL)
-                add_node_to_frequency_list(current_node->data, next_node->data);
-            current_node = next_node;
-            if(token[strlen(token) - 1] == '.'){
-                skip_frequency_list_stage = 1;
+        }
+        else if(strcmp(argv[i], MIN_WORD_COUNT_OPTION) == 0 && i + 1 < argc){
+            arguments->min_word_count = (int) strtol(argv[++i], NULL, 10);
+        }
+        else if(strcmp(argv[i], STATS_OPTION) == 0){
+            arguments->print_stats = 1;
+        }
+        else if((strcmp(argv[i], STARTS_WITH_OPTION) == 0
+                 || strcmp(argv[i], CONTAINS_OPTION) == 0) && i + 1 < argc){
+            arguments->keyword_anywhere = strcmp(argv[i], CONTAINS_OPTION) == 0;
+            arguments->keyword = argv[++i];
+        }
+        else if(strcmp(argv[i], MIX_OPTION) == 0 && i + 1 < argc){
+            arguments->mix_path = argv[++i];
+        }
+        else if(strcmp(argv[i], MIX_WEIGHT_OPTION) == 0 && i + 1 < argc){
+            arguments->mix_weight = strtod(argv[++i], NULL);
+            if(!(arguments->mix_weight >= 0 && arguments->mix_weight <= 1)){
+                return 1;
+            }
+        }
+        else if(strcmp(argv[i], UNIQUE_OPTION) == 0){
+            arguments->unique = UNIQUE_BLOOM;
+        }
+        else if(strcmp(argv[i], EXACT_UNIQUE_OPTION) == 0){
+            arguments->unique = UNIQUE_EXACT;
+        }
+        else if(strcmp(argv[i], RETRY_BUDGET_OPTION) == 0 && i + 1 < argc){
+            arguments->retry_budget = strtoll(argv[++i], NULL, 10);
+            if(arguments->retry_budget < 0){
+                return 1;
             }
-            words_read++;
-            token = strtok(NULL, DELIMITERS);
         }
+        else if(strcmp(argv[i], UNIFORM_START_OPTION) == 0){
+            arguments->uniform_start = 1;
+        }
+        else if(arguments->num_of_positional < MAX_POSITIONAL_ARGS){
+            arguments->positional[arguments->num_of_positional++] = argv[i];
+        }
+        else{
+            return 1;
+        }
+    }
+
+    // a loaded model only needs the seed and the number of tweets, a corpus
+    // also needs its path and optionally the number of words to read
+    const PruneSettings* prune = &arguments->prune_settings;
+    int prunes = prune_settings_active(prune) || arguments->min_word_count > 0;
+    if(arguments->load_model_path != NULL){
+        return arguments->num_of_positional != 2
+               || arguments->save_model_path != NULL || arguments->order > 1
+               || arguments->append_path != NULL || prunes || arguments->print_stats
+               || arguments->keyword != NULL || arguments->mix_path != NULL;
+    }
+    if(arguments->order > 1 && (arguments->save_model_path != NULL
+                                || arguments->append_path != NULL || prunes)){
+        return 1;
+    }
+    if((arguments->print_stats || arguments->keyword != NULL || arguments->mix_path != NULL)
+       && (arguments->order > 1 || arguments->append_path != NULL)){
+        return 1;
+    }
+    if(arguments->mix_path != NULL && arguments->keyword != NULL){
+        return 1;
+    }
+    return arguments->num_of_positional < 3;
+}
+
+
+int generate_from_model(char* model_path, int uniform_start,
+                        const GenerationSettings* settings){
+    MarkovOptions options = {settings->num_of_threads, 0, {0, 0, 0}, 0, uniform_start, 1};
+    Markov* model;
+    int status = markov_load(&model, model_path, &options);
+    if(status != MARKOV_OK){
+        return error(status == MARKOV_IO_ERROR ? MODEL_FILE_ERROR : markov_strerror(status));
+    }
+    // like an empty corpus, a model with no word that doesn't end a
+    // sentence has no word to start with
+    status = markov_generate(model, 0, MAX_TWEET_LEN, NULL, NULL);
+    if(settings->num_of_tweets > 0 && status != MARKOV_OK){
+        markov_destroy(&model);
+        return error(markov_strerror(status));
+    }
+
+    int result = print_tweets(generate_from_chain, model, settings);
+
+    markov_destroy(&model);
+    return result;
+}
+
+
+int generate_after_training(MarkovChain* markovChain, char* append_path,
+                            const GenerationSettings* settings){
+    OnlineChain* online_chain = create_online_chain(markovChain);
+    if(online_chain == NULL){
+        free_database(&markovChain);
+        return error(ALLOCATION_ERROR_MASSAGE);
+    }
+    FILE* file;
+    ByteSource reader;
+    ByteSource* source;
+    const char* open_error = open_corpus(append_path, &file, &reader, &source);
+    if(open_error != NULL){
+        free_online_chain(&online_chain);
+        return error(open_error);
+    }
+    Tokenizer tokenizer;
+    int result = (source != NULL ? init_source_tokenizer(&tokenizer, source)
+                                 : init_file_tokenizer(&tokenizer, file)) == 1
+                 || train_online_chain(online_chain, &tokenizer, INT_MAX) == 1
+                 ? error(ALLOCATION_ERROR_MASSAGE) : EXIT_SUCCESS;
+    // a source that failed half way trained the chain on part of the text
+    if(result == EXIT_SUCCESS && source != NULL && source->failed){
+        result = error(markov_strerror(MARKOV_IO_ERROR));
+    }
+    free_tokenizer(&tokenizer);
+    close_corpus(file, source);
+
+    if(result == EXIT_SUCCESS){
+        ChainSnapshot* snapshot = acquire_snapshot(online_chain);
+        result = print_tweets(generate_from_snapshot, snapshot, settings);
+        release_snapshot(online_chain, snapshot);
+    }
+    free_online_chain(&online_chain);
+    return result;
+}
+
+
+int generate_from_mixture(Markov* model, const MarkovOptions* options, char* mix_path,
+                          double mix_weight, const GenerationSettings* settings){
+    FILE* file;
+    ByteSource reader;
+    ByteSource* source;
+    const char* open_error = open_corpus(mix_path, &file, &reader, &source);
+    if(open_error != NULL){
+        return error(open_error);
+    }
+    Markov* mix_model;
+    int status = markov_create(&mix_model, options);
+    if(status == MARKOV_OK){
+        status = source != NULL
+                 ? markov_ingest_source(mix_model, source, MARKOV_ALL_WORDS)
+                 : markov_ingest_file(mix_model, file, MARKOV_ALL_WORDS);
+        if(status == MARKOV_OK){
+            status = markov_freeze(mix_model, NULL);
+        }
+        if(status != MARKOV_OK){
+            markov_destroy(&mix_model);
+        }
+    }
+    close_corpus(file, source);
+    if(status != MARKOV_OK){
+        return error(markov_strerror(status));
     }
-    return 0;
+
+    Markov* models[2] = {model, mix_model};
+    double weights[2] = {1 - mix_weight, mix_weight};
+    ChainMixture mixture;
+    int result;
+    status = markov_init_mixture(&mixture, models, weights, 2);
+    if(status != MARKOV_OK){
+        result = error(markov_strerror(status));
+    }
+    else{
+        result = print_tweets(generate_from_mixture_source, &mixture, settings);
+        free_chain_mixture(&mixture);
+    }
+    markov_destroy(&mix_model);
+    return result;
 }
 
 
+int error(const char error_message[]){
+    printf("%s", error_message);
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,179 @@
+#include "word_table.h"
+#include "markov_stats.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+
+unsigned int hash_word(const char *word, size_t length)
+{
+    unsigned int hash = FNV_OFFSET_BASIS;
+    for (size_t i = 0; i < length; ++i)
+    {
+        hash ^= (unsigned char) word[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+int init_word_table(WordTable *word_table)
+{
+    int capacity = WORD_TABLE_INITIAL_CAPACITY;
+    init_arena(&word_table->strings, STRING_ARENA_BLOCK_SIZE);
+    word_table->words = malloc(capacity * sizeof(char*));
+    word_table->lengths = malloc(capacity * sizeof(unsigned int));
+    word_table->hashes = malloc(capacity * sizeof(unsigned int));
+    word_table->flags = malloc(capacity);
+    word_table->slots = malloc(2 * capacity * sizeof(int));
+    word_table->size = 0;
+    word_table->capacity = capacity;
+    word_table->slot_capacity = 2 * capacity;
+    if (word_table->words == NULL || word_table->lengths == NULL
+        || word_table->hashes == NULL || word_table->flags == NULL
+        || word_table->slots == NULL)
+    {
+        free_word_table(word_table);
+        return 1;
+    }
+    memset(word_table->slots, -1, word_table->slot_capacity * sizeof(int));
+    return 0;
+}
+
+// first slot of the word's probe sequence that holds it or is empty
+static unsigned int find_slot(const WordTable *word_table, const char *word,
+                              size_t length, unsigned int hash)
+{
+    unsigned int mask = (unsigned int) word_table->slot_capacity - 1;
+    unsigned int slot = hash & mask;
+    STATS_ADD(word_lookups, 1);
+    STATS_ADD(word_probes, 1);
+    for (; word_table->slots[slot] != -1; slot = (slot + 1) & mask)
+    {
+        // only words with the same cached hash and length are worth comparing
+        int id = word_table->slots[slot];
+        if (word_table->hashes[id] == hash && word_table->lengths[id] == length
+            && memcmp(word_table->words[id], word, length) == 0)
+            break;
+        STATS_ADD(word_probes, 1);
+    }
+    return slot;
+}
+
+int find_word(const WordTable *word_table, const char *word, size_t length)
+{
+    unsigned int slot = find_slot(word_table, word, length,
+                                  hash_word(word, length));
+    return word_table->slots[slot];
+}
+
+// doubles the per word arrays
+static int grow_words(WordTable *word_table)
+{
+    size_t capacity = (size_t) word_table->capacity * 2;
+    char **words = realloc(word_table->words, capacity * sizeof(char*));
+    if (words == NULL)
+        return 1;
+    word_table->words = words;
+    unsigned int *lengths = realloc(word_table->lengths,
+                                    capacity * sizeof(unsigned int));
+    if (lengths == NULL)
+        return 1;
+    word_table->lengths = lengths;
+    unsigned int *hashes = realloc(word_table->hashes,
+                                   capacity * sizeof(unsigned int));
+    if (hashes == NULL)
+        return 1;
+    word_table->hashes = hashes;
+    unsigned char *flags = realloc(word_table->flags, capacity);
+    if (flags == NULL)
+        return 1;
+    word_table->flags = flags;
+    word_table->capacity = (int) capacity;
+    return 0;
+}
+
+// doubles the index, placing every word again by its cached hash
+static int grow_slots(WordTable *word_table)
+{
+    int capacity = word_table->slot_capacity * 2;
+    int *slots = malloc(capacity * sizeof(int));
+    if (slots == NULL)
+        return 1;
+    memset(slots, -1, capacity * sizeof(int));
+    unsigned int mask = (unsigned int) capacity - 1;
+    for (int id = 0; id < word_table->size; ++id)
+    {
+        unsigned int slot = word_table->hashes[id] & mask;
+        while (slots[slot] != -1)
+            slot = (slot + 1) & mask;
+        slots[slot] = id;
+    }
+    free(word_table->slots);
+    word_table->slots = slots;
+    word_table->slot_capacity = capacity;
+    return 0;
+}
+
+int intern_word(WordTable *word_table, const char *word, size_t length,
+                unsigned int *word_id)
+{
+    // hash the word once, both the lookup and the insertion use it
+    unsigned int hash = hash_word(word, length);
+    unsigned int slot = find_slot(word_table, word, length, hash);
+    if (word_table->slots[slot] != -1)
+    {
+        *word_id = (unsigned int) word_table->slots[slot];
+        return 0;
+    }
+
+    if (word_table->size == word_table->capacity && grow_words(word_table) == 1)
+        return 1;
+    char *copy = arena_copy_string(&word_table->strings, word, length);
+    if (copy == NULL)
+        return 1;
+    int id = word_table->size;
+    word_table->words[id] = copy;
+    word_table->lengths[id] = (unsigned int) length;
+    word_table->hashes[id] = hash;
+    word_table->flags[id] = length > 0 && word[length - 1] == '.'
+                            ? WORD_ENDS_SENTENCE : 0;
+    word_table->size++;
+
+    // keep the load factor at most 1/2 (growing places the new word too)
+    if (word_table->size * 2 > word_table->slot_capacity)
+    {
+        if (grow_slots(word_table) == 1)
+        {
+            word_table->size--;
+            return 1;
+        }
+    }
+    else
+    {
+        word_table->slots[slot] = id;
+    }
+    *word_id = (unsigned int) id;
+    return 0;
+}
+
+int word_ends_sentence(const WordTable *word_table, unsigned int word_id)
+{
+    return word_table->flags[word_id] & WORD_ENDS_SENTENCE;
+}
+
+void free_word_table(WordTable *word_table)
+{
+    free_arena(&word_table->strings);
+    free(word_table->words);
+    free(word_table->lengths);
+    free(word_table->hashes);
+    free(word_table->flags);
+    free(word_table->slots);
+    word_table->words = NULL;
+    word_table->lengths = NULL;
+    word_table->hashes = NULL;
+    word_table->flags = NULL;
+    word_table->slots = NULL;
+    word_table->size = 0;
+}
@@ -0,0 +1,82 @@
+#ifndef _WORD_TABLE_H_
+#define _WORD_TABLE_H_
+
+#include "arena.h"
+#include <stddef.h> // For size_t
+
+// the table starts with room for this many words, and its index with twice
+// as many slots (both double when needed, the index whenever half full)
+#define WORD_TABLE_INITIAL_CAPACITY 1024
+
+// bits of WordTable::flags
+#define WORD_ENDS_SENTENCE 1
+
+/**
+ * Interns words: every distinct word gets a dense id (0 for the first one)
+ * and is stored once, together with its length, its hash and its flags.
+ * An open addressing (linear probing) index maps words back to their ids.
+ */
+typedef struct WordTable {
+    Arena strings;
+    char **words;
+    unsigned int *lengths;
+    unsigned int *hashes;
+    unsigned char *flags;
+    int size;
+    int capacity;
+    // id of the word in every slot, -1 for an empty slot
+    int *slots;
+    int slot_capacity;
+} WordTable;
+
+/**
+ * Hash the first length characters of word (FNV-1a).
+ * @param word the word to hash
+ * @param length number of characters in word
+ * @return the hash of the word
+ */
+unsigned int hash_word(const char *word, size_t length);
+
+/**
+ * Initialize an empty table.
+ * @param word_table the table to initialize
+ * @return 0 on success, 1 in case of allocation error.
+ */
+int init_word_table(WordTable *word_table);
+
+/**
+ * Look for a word.
+ * @param word_table the table to look in
+ * @param word the word (does not need to be null terminated)
+ * @param length number of characters in word
+ * @return the id of the word, -1 if it is not in the table.
+ */
+int find_word(const WordTable *word_table, const char *word, size_t length);
+
+/**
+ * Get the id of a word, adding the word to the table if it's new (new words
+ * always get the id word_table->size).
+ * @param word_table the table
+ * @param word the word (does not need to be null terminated)
+ * @param length number of characters in word
+ * @param word_id where to store the id
+ * @return 0 on success, 1 in case of allocation error.
+ */
+int intern_word(WordTable *word_table, const char *word, size_t length,
+                unsigned int *word_id);
+
+/**
+ * Check if a word ends a sentence (ends with '.').
+ * @param word_table the table
+ * @param word_id id of the word
+ * @return non zero if it does, 0 otherwise
+ */
+int word_ends_sentence(const WordTable *word_table, unsigned int word_id);
+
+/**
+ * Free the table and all of its words.
+ * @param word_table the table to free
+ */
+void free_word_table(WordTable *word_table);
+
+#endif //_WORD_TABLE_H_